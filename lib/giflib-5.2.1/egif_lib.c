@@ -10,6 +10,7 @@ SPDX-License-Identifier: MIT
 
 *****************************************************************************/
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -27,6 +28,9 @@ SPDX-License-Identifier: MIT
 #include "gif_lib.h"
 #include "gif_lib_private.h"
 
+/* Most near matches the lossy mode tries in all for one string. */
+#define LOSSY_BRANCHES 16
+
 /* Masks given codes to BitsPerPixel, to make sure all codes are in range: */
 /*@+charint@*/
 static const GifPixelType CodeMask[] = {
@@ -34,6 +38,7 @@ static const GifPixelType CodeMask[] = {
 };
 /*@-charint@*/
 
+static int EGifFlushOutput(GifFileType * GifFile);
 static int EGifPutWord(int Word, GifFileType * GifFile);
 static int EGifSetupCompress(GifFileType * GifFile);
 static int EGifCompressLine(GifFileType * GifFile, GifPixelType * Line,
@@ -113,13 +118,22 @@ EGifOpenFileHandle(const int FileHandle, int *Error)
         return NULL;
     }
     /*@i1@*/memset(Private, '\0', sizeof(GifFilePrivateType));
-    if ((Private->HashTable = _InitHashTable()) == NULL) {
+    if ((Private->CodeTable = (GifCodeTableType *)calloc(1, sizeof(GifCodeTableType))) == NULL) {
+        free(GifFile);
+        free(Private);
+        if (Error != NULL)
+	    *Error = E_GIF_ERR_NOT_ENOUGH_MEM;
+        return NULL;
+    }
+    if ((Private->OutBuf = (GifByteType *)malloc(OUTPUT_BUFFER_SIZE)) == NULL) {
+        free(Private->CodeTable);
         free(GifFile);
         free(Private);
         if (Error != NULL)
 	    *Error = E_GIF_ERR_NOT_ENOUGH_MEM;
         return NULL;
     }
+    Private->OutBufSize = OUTPUT_BUFFER_SIZE;
 
 #ifdef _WIN32
     _setmode(FileHandle, O_BINARY);    /* Make sure it is in binary mode. */
@@ -170,14 +184,25 @@ EGifOpen(void *userData, OutputFunc writeFunc, int *Error)
 
     memset(Private, '\0', sizeof(GifFilePrivateType));
 
-    Private->HashTable = _InitHashTable();
-    if (Private->HashTable == NULL) {
+    Private->CodeTable = (GifCodeTableType *)calloc(1, sizeof(GifCodeTableType));
+    if (Private->CodeTable == NULL) {
+        free (GifFile);
+        free (Private);
+        if (Error != NULL)
+	    *Error = E_GIF_ERR_NOT_ENOUGH_MEM;
+        return NULL;
+    }
+
+    Private->OutBuf = (GifByteType *)malloc(OUTPUT_BUFFER_SIZE);
+    if (Private->OutBuf == NULL) {
+        free (Private->CodeTable);
         free (GifFile);
         free (Private);
         if (Error != NULL)
 	    *Error = E_GIF_ERR_NOT_ENOUGH_MEM;
         return NULL;
     }
+    Private->OutBufSize = OUTPUT_BUFFER_SIZE;
 
     GifFile->Private = (void *)Private;
     Private->FileHandle = 0;
@@ -194,6 +219,69 @@ EGifOpen(void *userData, OutputFunc writeFunc, int *Error)
     return GifFile;
 }
 
+/******************************************************************************
+ Output constructor that writes to memory. *GifData and *GifSize are the
+ output so far at any time; the buffer is grown with realloc() as needed
+ and may be bigger than *GifSize. After EGifCloseFile() the caller owns
+ *GifData and must free() it, even if something failed.
+******************************************************************************/
+GifFileType *
+EGifOpenMemory(GifByteType **GifData, size_t *GifSize, int *Error)
+{
+    GifFileType *GifFile;
+    GifFilePrivateType *Private;
+
+    GifFile = EGifOpen(NULL, NULL, Error);
+    if (GifFile == NULL)
+        return NULL;
+
+    Private = (GifFilePrivateType *) GifFile->Private;
+    Private->MemoryData = GifData;
+    Private->MemorySize = GifSize;
+    *GifData = Private->OutBuf;
+    *GifSize = 0;
+
+    return GifFile;
+}
+
+/******************************************************************************
+ Set the size of the buffer output is gathered in before it is written to
+ the file or the user write routine, which then sees few large writes
+ instead of one for each data sub-block. What is already buffered is
+ written first. 0 writes everything as it is put. A memory GIF grows as it
+ needs, this does nothing for it.
+******************************************************************************/
+int
+EGifSetOutputBuffer(GifFileType *GifFile, const size_t Size)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+    GifByteType *OutBuf;
+
+    if (Private->MemoryData != NULL)
+        return GIF_OK;
+
+    if (EGifFlushOutput(GifFile) == GIF_ERROR) {
+        GifFile->Error = E_GIF_ERR_WRITE_FAILED;
+        return GIF_ERROR;
+    }
+    if (Size == 0) {
+        free(Private->OutBuf);
+        Private->OutBuf = NULL;
+        Private->OutBufSize = 0;
+        return GIF_OK;
+    }
+    /* The user write routine takes an int count. */
+    OutBuf = (GifByteType *)realloc(Private->OutBuf,
+                                    Size < INT_MAX ? Size : INT_MAX);
+    if (OutBuf == NULL) {
+        GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
+        return GIF_ERROR;
+    }
+    Private->OutBuf = OutBuf;
+    Private->OutBufSize = Size < INT_MAX ? Size : INT_MAX;
+    return GIF_OK;
+}
+
 /******************************************************************************
  Routine to compute the GIF version that will be written on output.
 ******************************************************************************/
@@ -252,9 +340,24 @@ void EGifSetGifVersion(GifFileType *GifFile, const bool gif89)
 }
 
 /******************************************************************************
- All writes to the GIF should go through this.
+ Set lossy compression for the images put after this. While a string of
+ pixels is extended, a pixel may be taken for another color whose RGB
+ distance from it is at most Error, if that makes the string longer; 0
+ turns it off. TransparentColor, or -1, is never mixed up with a color.
 ******************************************************************************/
-static int InternalWrite(GifFileType *GifFileOut, 
+void EGifSetLossy(GifFileType *GifFile, const int Error,
+                  const int TransparentColor)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+
+    Private->Lossy = Error > 0 ? Error : 0;
+    Private->LossyTransparent = TransparentColor;
+}
+
+/******************************************************************************
+ Write straight to the file or the user write routine.
+******************************************************************************/
+static int DirectWrite(GifFileType *GifFileOut, 
 		   const unsigned char *buf, size_t len)
 {
     GifFilePrivateType *Private = (GifFilePrivateType*)GifFileOut->Private;
@@ -264,6 +367,64 @@ static int InternalWrite(GifFileType *GifFileOut,
 	return fwrite(buf, 1, len, Private->File);
 }
 
+/******************************************************************************
+ Write out what is in the output buffer, unless it is the memory GIF.
+******************************************************************************/
+static int
+EGifFlushOutput(GifFileType *GifFile)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
+    size_t Len = Private->OutBufLen;
+
+    if (Private->MemoryData != NULL || Len == 0)
+        return GIF_OK;
+
+    Private->OutBufLen = 0;
+    if (DirectWrite(GifFile, Private->OutBuf, Len) != (int)Len)
+        return GIF_ERROR;
+    return GIF_OK;
+}
+
+/******************************************************************************
+ All writes to the GIF should go through this. They are gathered in the
+ output buffer and written when it is full, so a failed write may show up
+ as a later call failing, at the latest in EGifCloseFile().
+******************************************************************************/
+static int InternalWrite(GifFileType *GifFileOut, 
+		   const unsigned char *buf, size_t len)
+{
+    GifFilePrivateType *Private = (GifFilePrivateType*)GifFileOut->Private;
+
+    if (Private->OutBuf == NULL)
+        return DirectWrite(GifFileOut, buf, len);
+    if (len > Private->OutBufSize - Private->OutBufLen) {
+        if (Private->MemoryData != NULL) {
+            /* Grow the memory GIF, at least doubling it. */
+            size_t Size = Private->OutBufSize * 2;
+            GifByteType *OutBuf;
+
+            if (Size < Private->OutBufLen + len)
+                Size = Private->OutBufLen + len;
+            OutBuf = (GifByteType *)realloc(Private->OutBuf, Size);
+            if (OutBuf == NULL)
+                return 0;
+            Private->OutBuf = OutBuf;
+            Private->OutBufSize = Size;
+            *Private->MemoryData = OutBuf;
+        } else {
+            if (EGifFlushOutput(GifFileOut) == GIF_ERROR)
+                return 0;
+            if (len > Private->OutBufSize)
+                return DirectWrite(GifFileOut, buf, len);
+        }
+    }
+    memcpy(Private->OutBuf + Private->OutBufLen, buf, len);
+    Private->OutBufLen += len;
+    if (Private->MemoryData != NULL)
+        *Private->MemorySize = Private->OutBufLen;
+    return len;
+}
+
 /******************************************************************************
  This routine should be called before any other EGif calls, immediately
  following the GIF file opening.
@@ -773,6 +934,7 @@ EGifCloseFile(GifFileType *GifFile, int *ErrorCode)
     GifByteType Buf;
     GifFilePrivateType *Private;
     FILE *File;
+    bool WriteFailed = false;
 
     if (GifFile == NULL)
         return GIF_ERROR;
@@ -791,7 +953,9 @@ EGifCloseFile(GifFileType *GifFile, int *ErrorCode)
 	File = Private->File;
 
 	Buf = TERMINATOR_INTRODUCER;
-	InternalWrite(GifFile, &Buf, 1);
+	if (InternalWrite(GifFile, &Buf, 1) != 1
+	    || EGifFlushOutput(GifFile) == GIF_ERROR)
+	    WriteFailed = true;
 
 	if (GifFile->Image.ColorMap) {
 	    GifFreeMapObject(GifFile->Image.ColorMap);
@@ -802,8 +966,12 @@ EGifCloseFile(GifFileType *GifFile, int *ErrorCode)
 	    GifFile->SColorMap = NULL;
 	}
 	if (Private) {
-	    if (Private->HashTable) {
-		free((char *) Private->HashTable);
+	    if (Private->CodeTable) {
+		free((char *) Private->CodeTable);
+	    }
+	    /* The memory GIF is the caller's now. */
+	    if (Private->MemoryData == NULL) {
+		free((char *) Private->OutBuf);
 	    }
 	    free((char *) Private);
 	}
@@ -814,6 +982,12 @@ EGifCloseFile(GifFileType *GifFile, int *ErrorCode)
 	    free(GifFile);
 	    return GIF_ERROR;
 	}
+	if (WriteFailed) {
+	    if (ErrorCode != NULL)
+		*ErrorCode = E_GIF_ERR_WRITE_FAILED;
+	    free(GifFile);
+	    return GIF_ERROR;
+	}
 
 	free(GifFile);
 	if (ErrorCode != NULL)
@@ -846,17 +1020,21 @@ EGifSetupCompress(GifFileType *GifFile)
 {
     int BitsPerPixel;
     GifByteType Buf;
+    const ColorMapObject *ColorMap;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
 
     /* Test and see what color map to use, and from it # bits per pixel: */
     if (GifFile->Image.ColorMap)
-        BitsPerPixel = GifFile->Image.ColorMap->BitsPerPixel;
+        ColorMap = GifFile->Image.ColorMap;
     else if (GifFile->SColorMap)
-        BitsPerPixel = GifFile->SColorMap->BitsPerPixel;
+        ColorMap = GifFile->SColorMap;
     else {
         GifFile->Error = E_GIF_ERR_NO_COLOR_MAP;
         return GIF_ERROR;
     }
+    BitsPerPixel = ColorMap->BitsPerPixel;
+    Private->LossyColors = ColorMap->Colors;
+    Private->LossyColorCount = ColorMap->ColorCount;
 
     Buf = BitsPerPixel = (BitsPerPixel < 2 ? 2 : BitsPerPixel);
     InternalWrite(GifFile, &Buf, 1);    /* Write the Code size to file. */
@@ -872,9 +1050,11 @@ EGifSetupCompress(GifFileType *GifFile)
     Private->CrntShiftState = 0;    /* No information in CrntShiftDWord. */
     Private->CrntShiftDWord = 0;
 
-   /* Clear hash table and send Clear to make sure the decoder do the same. */
-    _ClearHashTable(Private->HashTable);
-
+    /* Send Clear to make sure the decoder starts with an empty table too;
+     * ours is empty as RunningCode was reset. */
+    if (Private->Lossy > 0)
+        memset(Private->CodeTable->FirstChild, 0,
+               Private->ClearCode * sizeof(Private->CodeTable->FirstChild[0]));
     if (EGifCompressOutput(GifFile, Private->ClearCode) == GIF_ERROR) {
         GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
         return GIF_ERROR;
@@ -882,6 +1062,89 @@ EGifSetupCompress(GifFileType *GifFile)
     return GIF_OK;
 }
 
+/******************************************************************************
+ Lossy mode: whether a string ending with the pixel Suffix may stand for one
+ ending with Pixel, that is if they are the same or both opaque colors within
+ the error budget.
+******************************************************************************/
+static bool
+EGifLossyNear(const GifFilePrivateType *Private, const int Suffix,
+              const int Pixel)
+{
+    const GifColorType *A, *B;
+    long Distance;
+
+    if (Suffix == Pixel)
+        return true;
+    if (Suffix >= Private->LossyColorCount || Pixel >= Private->LossyColorCount
+            || Suffix == Private->LossyTransparent
+            || Pixel == Private->LossyTransparent)
+        return false;
+    A = &Private->LossyColors[Suffix];
+    B = &Private->LossyColors[Pixel];
+    Distance = (long)(A->Red - B->Red) * (A->Red - B->Red)
+        + (long)(A->Green - B->Green) * (A->Green - B->Green)
+        + (long)(A->Blue - B->Blue) * (A->Blue - B->Blue);
+    return Distance <= (long)Private->Lossy * Private->Lossy;
+}
+
+/******************************************************************************
+ Lossy mode: follows the codes that extend *Code through the pixels of Line
+ as far as near matches go and returns how many pixels that takes, with the
+ code reached in *Code. Where several codes match, each is tried, at most
+ *Branches times in all, and the one that goes furthest is taken; else the
+ exact one if it is there, or the first near one.
+******************************************************************************/
+static int
+EGifLossyMatch(const GifFilePrivateType *Private, int *Code,
+               const GifPixelType *Line, const int LineLen, int *Branches)
+{
+    const GifCodeTableType *CodeTable = Private->CodeTable;
+    int Length = 0;
+
+    while (Length < LineLen) {
+        const int Pixel = Line[Length];
+        int Child, Near = 0, Matches = 0;
+
+        for (Child = CodeTable->FirstChild[*Code]; Child != 0;
+             Child = CodeTable->NextSibling[Child]) {
+            if (EGifLossyNear(Private, Private->Suffix[Child], Pixel)) {
+                /* the exact code, or else the first near one */
+                if (Near == 0 || Private->Suffix[Child] == Pixel)
+                    Near = Child;
+                Matches++;
+            }
+        }
+        if (Matches == 0)
+            break;
+        if (Matches > 1 && *Branches > 0) {
+            int BestLength = -1, BestCode = Near;
+
+            for (Child = CodeTable->FirstChild[*Code]; Child != 0;
+                 Child = CodeTable->NextSibling[Child]) {
+                int End = Child, ChildLength;
+
+                if (*Branches <= 0 && BestLength >= 0)
+                    break;
+                if (!EGifLossyNear(Private, Private->Suffix[Child], Pixel))
+                    continue;
+                (*Branches)--;
+                ChildLength = EGifLossyMatch(Private, &End, Line + Length + 1,
+                                             LineLen - Length - 1, Branches);
+                if (ChildLength > BestLength) {
+                    BestLength = ChildLength;
+                    BestCode = End;
+                }
+            }
+            *Code = BestCode;
+            return Length + 1 + BestLength;
+        }
+        *Code = Near;
+        Length++;
+    }
+    return Length;
+}
+
 /******************************************************************************
  The LZ compression routine:
  This version compresses the given buffer Line of length LineLen.
@@ -894,10 +1157,10 @@ EGifCompressLine(GifFileType *GifFile,
                  const int LineLen)
 {
     int i = 0, CrntCode;
-    GifHashTableType *HashTable;
+    GifCodeTableType *CodeTable;
     GifFilePrivateType *Private = (GifFilePrivateType *) GifFile->Private;
 
-    HashTable = Private->HashTable;
+    CodeTable = Private->CodeTable;
 
     if (Private->CrntCode == FIRST_CODE)    /* Its first time! */
         CrntCode = Line[i++];
@@ -905,29 +1168,56 @@ EGifCompressLine(GifFileType *GifFile,
         CrntCode = Private->CrntCode;    /* Get last code in compression. */
 
     while (i < LineLen) {   /* Decode LineLen items. */
-	GifPixelType Pixel = Line[i++];  /* Get next pixel from stream. */
-        /* Form a new unique key to search hash table for the code combines 
-         * CrntCode as Prefix string with Pixel as postfix char.
-         */
-	int NewCode;
-	unsigned long NewKey = (((uint32_t) CrntCode) << 8) + Pixel;
-        if ((NewCode = _ExistsHashTable(HashTable, NewKey)) >= 0) {
-            /* This Key is already there, or the string is old one, so
-             * simple take new code as our CrntCode:
+	GifPixelType Pixel;
+	int NewCode = 0;
+        if (Private->Lossy > 0) {
+            /* Take as many pixels as near matches allow; the one after
+             * them starts a new string.
+             */
+            int Branches = LOSSY_BRANCHES;
+            i += EGifLossyMatch(Private, &CrntCode, Line + i, LineLen - i,
+                                &Branches);
+            if (i == LineLen)
+                break;
+            Pixel = Line[i++];
+        } else {
+            Pixel = Line[i++];  /* Get next pixel from stream. */
+            /* Look up the string of CrntCode as prefix followed by Pixel.
+             * The entry may be from before the last clear, see
+             * GifCodeTableType.
+             */
+            if (CrntCode < Private->ClearCode) {
+                NewCode = CodeTable->Root[CrntCode][Pixel];
+                if (NewCode <= Private->EOFCode
+                        || NewCode >= Private->RunningCode
+                        || Private->Prefix[NewCode] != (GifPrefixType) CrntCode
+                        || Private->Suffix[NewCode] != Pixel)
+                    NewCode = 0;
+            } else {
+                NewCode = CodeTable->FirstChild[CrntCode];
+                while (NewCode != 0 && Private->Suffix[NewCode] != Pixel)
+                    NewCode = CodeTable->NextSibling[NewCode];
+            }
+        }
+        if (NewCode != 0) {
+            /* This string is already there, so simple take its code as
+             * our CrntCode:
              */
             CrntCode = NewCode;
         } else {
-            /* Put it in hash table, output the prefix code, and make our
-             * CrntCode equal to Pixel.
+            /* Put it in the code table, output the prefix code, and make
+             * our CrntCode equal to Pixel.
              */
+            int PrefixCode = CrntCode;
+
             if (EGifCompressOutput(GifFile, CrntCode) == GIF_ERROR) {
                 GifFile->Error = E_GIF_ERR_DISK_IS_FULL;
                 return GIF_ERROR;
             }
             CrntCode = Pixel;
 
-            /* If however the HashTable if full, we send a clear first and
-             * Clear the hash table.
+            /* If however the code table is full, we send a clear first and
+             * start the table over.
              */
             if (Private->RunningCode >= LZ_MAX_CODE) {
                 /* Time to do some clearance: */
@@ -939,10 +1229,21 @@ EGifCompressLine(GifFileType *GifFile,
                 Private->RunningCode = Private->EOFCode + 1;
                 Private->RunningBits = Private->BitsPerPixel + 1;
                 Private->MaxCode1 = 1 << Private->RunningBits;
-                _ClearHashTable(HashTable);
+                if (Private->Lossy > 0)
+                    memset(CodeTable->FirstChild, 0,
+                           Private->ClearCode * sizeof(CodeTable->FirstChild[0]));
             } else {
-                /* Put this unique key with its relative Code in hash table: */
-                _InsertHashTable(HashTable, NewKey, Private->RunningCode++);
+                /* Put this new string with its Code in the code table: */
+                NewCode = Private->RunningCode++;
+                if (PrefixCode < Private->ClearCode)
+                    CodeTable->Root[PrefixCode][Pixel] = NewCode;
+                if (PrefixCode >= Private->ClearCode || Private->Lossy > 0) {
+                    CodeTable->NextSibling[NewCode] = CodeTable->FirstChild[PrefixCode];
+                    CodeTable->FirstChild[PrefixCode] = NewCode;
+                }
+                CodeTable->FirstChild[NewCode] = 0;
+                Private->Prefix[NewCode] = PrefixCode;
+                Private->Suffix[NewCode] = Pixel;
             }
         }
 
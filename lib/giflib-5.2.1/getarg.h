@@ -43,6 +43,21 @@ int GifQuantizeBuffer(unsigned int Width, unsigned int Height,
                    GifByteType * OutputBuffer,
                    GifColorType * OutputColorMap);
 
+/* Interleaved RGBA input, and the steps to split it across threads */
+#define GIF_QUANTIZE_HISTOGRAM_SIZE 32768
+int GifQuantizeRGBA(const GifByteType *Pixels, size_t PixelCount,
+                    int TransparentIndex, int *ColorMapSize,
+                    GifByteType *OutputBuffer,
+                    GifColorType *OutputColorMap);
+void GifQuantizeHistogramRGBA(const GifByteType *Pixels, size_t PixelCount,
+                              unsigned long *Histogram);
+int GifQuantizeHistogram(const unsigned long *Histogram, int *ColorMapSize,
+                         GifColorType *OutputColorMap,
+                         GifByteType *ColorTable);
+void GifQuantizeMapRGBA(const GifByteType *Pixels, size_t PixelCount,
+                        const GifByteType *ColorTable, int TransparentIndex,
+                        GifByteType *OutputBuffer);
+
 /* These used to live in the library header */
 #define GIF_MESSAGE(Msg) fprintf(stderr, "\n%s: %s\n", PROGRAM_NAME, Msg)
 #define GIF_EXIT(Msg)    { GIF_MESSAGE(Msg); exit(-3); }
@@ -129,6 +129,9 @@ GifFileType *EGifOpenFileName(const char *GifFileName,
                               const bool GifTestExistence, int *Error);
 GifFileType *EGifOpenFileHandle(const int GifFileHandle, int *Error);
 GifFileType *EGifOpen(void *userPtr, OutputFunc writeFunc, int *Error);
+GifFileType *EGifOpenMemory(GifByteType **GifData, size_t *GifSize,
+                            int *Error);
+int EGifSetOutputBuffer(GifFileType *GifFile, const size_t Size);
 int EGifSpew(GifFileType * GifFile);
 const char *EGifGetGifVersion(GifFileType *GifFile); /* new in 5.x */
 int EGifCloseFile(GifFileType *GifFile, int *ErrorCode);
@@ -157,6 +160,8 @@ int EGifPutImageDesc(GifFileType *GifFile,
 		     const bool GifInterlace,
                      const ColorMapObject *GifColorMap);
 void EGifSetGifVersion(GifFileType *GifFile, const bool gif89);
+void EGifSetLossy(GifFileType *GifFile, const int Error,
+                  const int TransparentColor);
 int EGifPutLine(GifFileType *GifFile, GifPixelType *GifLine,
                 int GifLineLen);
 int EGifPutPixel(GifFileType *GifFile, const GifPixelType GifPixel);
@@ -9,8 +9,9 @@ SPDX-License-Identifier: MIT
 #ifndef _GIF_LIB_PRIVATE_H
 #define _GIF_LIB_PRIVATE_H
 
+#include <stdint.h>
+
 #include "gif_lib.h"
-#include "gif_hash.h"
 
 #ifndef SIZE_MAX
     #define SIZE_MAX     UINTPTR_MAX
@@ -27,6 +28,24 @@ SPDX-License-Identifier: MIT
 #define FIRST_CODE          4097    /* Impossible code, to signal first. */
 #define NO_SUCH_CODE        4098    /* Impossible code, to signal empty. */
 
+/*
+ * The LZW encoder dictionary. The codes that follow a pixel code are looked
+ * up directly by pixel in Root, where an entry is trusted only if its code
+ * was handed out since the last clear and that code's Prefix and Suffix are
+ * the same pixel code and pixel. Longer strings are few per prefix, so each
+ * code keeps the codes that follow it in a list, by FirstChild and
+ * NextSibling, which a new code starts empty. A clear then costs nothing:
+ * it only resets RunningCode. In lossy mode the pixel codes keep such a
+ * list as well, emptied at each clear, to look for a near match in.
+ */
+typedef struct GifCodeTableType {
+    uint16_t Root[256][256];
+    uint16_t FirstChild[LZ_MAX_CODE + 1];
+    uint16_t NextSibling[LZ_MAX_CODE + 1];
+} GifCodeTableType;
+
+#define OUTPUT_BUFFER_SIZE  65536   /* Default EGifSetOutputBuffer() size. */
+
 #define FILE_STATE_WRITE    0x01
 #define FILE_STATE_SCREEN   0x02
 #define FILE_STATE_IMAGE    0x04
@@ -56,7 +75,16 @@ typedef struct GifFilePrivateType {
     GifByteType Stack[LZ_MAX_CODE]; /* Decoded pixels are stacked here. */
     GifByteType Suffix[LZ_MAX_CODE + 1];    /* So we can trace the codes. */
     GifPrefixType Prefix[LZ_MAX_CODE + 1];
-    GifHashTableType *HashTable;
+    GifCodeTableType *CodeTable;   /* Encoder dictionary, see above. */
+    int Lossy,          /* Color error a pixel may take to extend a string. */
+      LossyTransparent, /* The pixel that only matches itself, or -1. */
+      LossyColorCount;  /* Colors of the image, set up with the encoder. */
+    const GifColorType *LossyColors;
+    GifByteType *OutBuf;    /* Output is gathered here before it is written. */
+    size_t OutBufLen,       /* Bytes in OutBuf. */
+      OutBufSize;           /* Its size, 0 if output is not buffered. */
+    GifByteType **MemoryData;   /* EGifOpenMemory(): OutBuf is the output. */
+    size_t *MemorySize;
     bool gif89;
 } GifFilePrivateType;
 
@@ -9,41 +9,50 @@
  and was removed in 4.2.  Then it turned out some client apps were
  actually using it, so it was restored in 5.0.
 
+ All state lives in the call, so the routines here may run on several
+ threads at once.  GifQuantizeBuffer takes separate red, green and blue
+ planes; the GifQuantize*RGBA routines take interleaved RGBA pixels and
+ can be split so the histogram and the mapping of a big image are done in
+ pieces, on as many threads as the caller likes.
+
 SPDX-License-Identifier: MIT
 
 ******************************************************************************/
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "gif_lib.h"
 #include "gif_lib_private.h"
-
-#define ABS(x)    ((x) > 0 ? (x) : (-(x)))
+#include "getarg.h"
 
 #define COLOR_ARRAY_SIZE 32768
 #define BITS_PER_PRIM_COLOR 5
 #define MAX_PRIM_COLOR      0x1f
 
-static int SortRGBAxis;
-
-typedef struct QuantizedColorType {
-    GifByteType RGB[3];
-    GifByteType NewColorIndex;
-    long Count;
-    struct QuantizedColorType *Pnext;
-} QuantizedColorType;
+/* Index of a color in the histogram, 5 bits per primary: */
+#define COLOR_INDEX(Red, Green, Blue) \
+    ((((Red) & 0xf8) << 7) | (((Green) & 0xf8) << 2) | ((Blue) >> 3))
+/* and the primaries of an index, 0 red, 1 green, 2 blue: */
+#define COLOR_PRIM(Index, Axis) \
+    (((Index) >> ((2 - (Axis)) * BITS_PER_PRIM_COLOR)) & MAX_PRIM_COLOR)
 
 typedef struct NewColorMapType {
     GifByteType RGBMin[3], RGBWidth[3];
-    unsigned int NumEntries; /* # of QuantizedColorType in linked list below */
+    unsigned int First;      /* of its colors in the sorted color array */
+    unsigned int NumEntries; /* # of colors from First on */
     unsigned long Count; /* Total number of pixels in all the entries */
-    QuantizedColorType *QuantizedColors;
 } NewColorMapType;
 
-static int SubdivColorMap(NewColorMapType * NewColorSubdiv,
-                          unsigned int ColorMapSize,
-                          unsigned int *NewColorMapSize);
-static int SortCmpRtn(const void *Entry1, const void *Entry2);
+static void SubdivColorMap(NewColorMapType * NewColorSubdiv,
+                           unsigned short *Colors,
+                           unsigned short *Scratch,
+                           const unsigned long *Histogram,
+                           unsigned int ColorMapSize,
+                           unsigned int *NewColorMapSize);
 
 /******************************************************************************
  Quantize high resolution image into lower one. Input image consists of a
@@ -67,41 +76,141 @@ GifQuantizeBuffer(unsigned int Width,
                GifByteType * OutputBuffer,
                GifColorType * OutputColorMap) {
 
-    unsigned int Index, NumOfEntries;
-    int i, j, MaxRGBError[3];
-    unsigned int NewColorMapSize;
-    long Red, Green, Blue;
-    NewColorMapType NewColorSubdiv[256];
-    QuantizedColorType *ColorArrayEntries, *QuantizedColor;
+    size_t i = 0, PixelCount = (size_t)Width * Height;
+    unsigned long *Histogram;
+    GifByteType *ColorTable;
 
-    ColorArrayEntries = (QuantizedColorType *)malloc(
-                           sizeof(QuantizedColorType) * COLOR_ARRAY_SIZE);
-    if (ColorArrayEntries == NULL) {
+    Histogram = (unsigned long *)calloc(COLOR_ARRAY_SIZE,
+                    sizeof(unsigned long) + sizeof(GifByteType));
+    if (Histogram == NULL) {
         return GIF_ERROR;
     }
+    ColorTable = (GifByteType *)(Histogram + COLOR_ARRAY_SIZE);
 
-    for (i = 0; i < COLOR_ARRAY_SIZE; i++) {
-        ColorArrayEntries[i].RGB[0] = i >> (2 * BITS_PER_PRIM_COLOR);
-        ColorArrayEntries[i].RGB[1] = (i >> BITS_PER_PRIM_COLOR) &
-           MAX_PRIM_COLOR;
-        ColorArrayEntries[i].RGB[2] = i & MAX_PRIM_COLOR;
-        ColorArrayEntries[i].Count = 0;
+    /* Sample the colors and their distribution: */
+#if defined(__SSE2__)
+    {
+        const __m128i Zero = _mm_setzero_si128();
+        const __m128i High5 = _mm_set1_epi16(0xf8);
+        unsigned short Index[16];
+        int j;
+
+        for (; i + 16 <= PixelCount; i += 16) {
+            __m128i R = _mm_loadu_si128((const __m128i *)(RedInput + i));
+            __m128i G = _mm_loadu_si128((const __m128i *)(GreenInput + i));
+            __m128i B = _mm_loadu_si128((const __m128i *)(BlueInput + i));
+            __m128i Lo = _mm_or_si128(_mm_or_si128(
+                _mm_slli_epi16(_mm_and_si128(_mm_unpacklo_epi8(R, Zero), High5), 7),
+                _mm_slli_epi16(_mm_and_si128(_mm_unpacklo_epi8(G, Zero), High5), 2)),
+                _mm_srli_epi16(_mm_unpacklo_epi8(B, Zero), 3));
+            __m128i Hi = _mm_or_si128(_mm_or_si128(
+                _mm_slli_epi16(_mm_and_si128(_mm_unpackhi_epi8(R, Zero), High5), 7),
+                _mm_slli_epi16(_mm_and_si128(_mm_unpackhi_epi8(G, Zero), High5), 2)),
+                _mm_srli_epi16(_mm_unpackhi_epi8(B, Zero), 3));
+            _mm_storeu_si128((__m128i *)Index, Lo);
+            _mm_storeu_si128((__m128i *)(Index + 8), Hi);
+            for (j = 0; j < 16; j++)
+                Histogram[Index[j]]++;
+        }
     }
+#endif
+    for (; i < PixelCount; i++)
+        Histogram[COLOR_INDEX(RedInput[i], GreenInput[i], BlueInput[i])]++;
 
-    /* Sample the colors and their distribution: */
-    for (i = 0; i < (int)(Width * Height); i++) {
-        Index = ((RedInput[i] >> (8 - BITS_PER_PRIM_COLOR)) <<
-                  (2 * BITS_PER_PRIM_COLOR)) +
-                ((GreenInput[i] >> (8 - BITS_PER_PRIM_COLOR)) <<
-                  BITS_PER_PRIM_COLOR) +
-                (BlueInput[i] >> (8 - BITS_PER_PRIM_COLOR));
-        ColorArrayEntries[Index].Count++;
+    if (GifQuantizeHistogram(Histogram, ColorMapSize, OutputColorMap,
+                             ColorTable) != GIF_OK) {
+        free((char *)Histogram);
+        return GIF_ERROR;
+    }
+
+    /* Finally scan the input buffer again and put the mapped index in the
+     * output buffer.  */
+    for (i = 0; i < PixelCount; i++)
+        OutputBuffer[i] = ColorTable[COLOR_INDEX(RedInput[i], GreenInput[i],
+                                                 BlueInput[i])];
+
+    free((char *)Histogram);
+
+    return GIF_OK;
+}
+
+/******************************************************************************
+ Add the colors of PixelCount RGBA pixels to Histogram, which has
+ GIF_QUANTIZE_HISTOGRAM_SIZE entries.  Pixels with alpha below 128 are not
+ counted.  Histograms of parts of an image can be added up.
+******************************************************************************/
+void
+GifQuantizeHistogramRGBA(const GifByteType *Pixels,
+                         size_t PixelCount,
+                         unsigned long *Histogram) {
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* The index of 4 pixels at a time, alpha >= 128 is the sign bit: */
+    const __m128i RedMask = _mm_set1_epi32(0xf8);
+    const __m128i GreenMask = _mm_set1_epi32(0xf800);
+    const __m128i BlueMask = _mm_set1_epi32(0xf80000);
+    unsigned int Index[4];
+
+    for (; i + 4 <= PixelCount; i += 4) {
+        __m128i P = _mm_loadu_si128((const __m128i *)(Pixels + i * 4));
+        int Opaque = _mm_movemask_ps(_mm_castsi128_ps(P));
+        if (Opaque == 0)
+            continue;
+        _mm_storeu_si128((__m128i *)Index, _mm_or_si128(_mm_or_si128(
+            _mm_slli_epi32(_mm_and_si128(P, RedMask), 7),
+            _mm_srli_epi32(_mm_and_si128(P, GreenMask), 6)),
+            _mm_srli_epi32(_mm_and_si128(P, BlueMask), 19)));
+        if (Opaque == 0xf) {
+            Histogram[Index[0]]++;
+            Histogram[Index[1]]++;
+            Histogram[Index[2]]++;
+            Histogram[Index[3]]++;
+        } else {
+            int j;
+            for (j = 0; j < 4; j++)
+                if (Opaque & (1 << j))
+                    Histogram[Index[j]]++;
+        }
+    }
+#endif
+    for (; i < PixelCount; i++) {
+        const GifByteType *P = Pixels + i * 4;
+        if (P[3] >= 128)
+            Histogram[COLOR_INDEX(P[0], P[1], P[2])]++;
+    }
+}
+
+/******************************************************************************
+ Median cut the colors of Histogram into at most *ColorMapSize colors,
+ which go to OutputColorMap; *ColorMapSize is updated to the number made.
+ ColorTable, of GIF_QUANTIZE_HISTOGRAM_SIZE entries, gets the index of the
+ output color of each histogram entry that has pixels.
+******************************************************************************/
+int
+GifQuantizeHistogram(const unsigned long *Histogram,
+                     int *ColorMapSize,
+                     GifColorType *OutputColorMap,
+                     GifByteType *ColorTable) {
+
+    unsigned int i, j, k, NumOfEntries = 0, NewColorMapSize;
+    unsigned long Count = 0;
+    long Red, Green, Blue;
+    NewColorMapType NewColorSubdiv[256];
+    unsigned short *Colors;
+
+    /* The sorted colors and the scratch space to radix sort them: */
+    Colors = (unsigned short *)malloc(sizeof(unsigned short) *
+                                      COLOR_ARRAY_SIZE * 2);
+    if (Colors == NULL) {
+        return GIF_ERROR;
     }
 
     /* Put all the colors in the first entry of the color map, and call the
-     * recursive subdivision process.  */
+     * subdivision process.  */
     for (i = 0; i < 256; i++) {
-        NewColorSubdiv[i].QuantizedColors = NULL;
+        NewColorSubdiv[i].First = 0;
         NewColorSubdiv[i].Count = NewColorSubdiv[i].NumEntries = 0;
         for (j = 0; j < 3; j++) {
             NewColorSubdiv[i].RGBMin[j] = 0;
@@ -109,31 +218,22 @@ GifQuantizeBuffer(unsigned int Width,
         }
     }
 
-    /* Find the non empty entries in the color table and chain them: */
+    /* Find the non empty entries in the color table: */
     for (i = 0; i < COLOR_ARRAY_SIZE; i++)
-        if (ColorArrayEntries[i].Count > 0)
-            break;
-    QuantizedColor = NewColorSubdiv[0].QuantizedColors = &ColorArrayEntries[i];
-    NumOfEntries = 1;
-    while (++i < COLOR_ARRAY_SIZE)
-        if (ColorArrayEntries[i].Count > 0) {
-            QuantizedColor->Pnext = &ColorArrayEntries[i];
-            QuantizedColor = &ColorArrayEntries[i];
-            NumOfEntries++;
+        if (Histogram[i] > 0) {
+            Colors[NumOfEntries++] = i;
+            Count += Histogram[i];
         }
-    QuantizedColor->Pnext = NULL;
 
     NewColorSubdiv[0].NumEntries = NumOfEntries; /* Different sampled colors */
-    NewColorSubdiv[0].Count = ((long)Width) * Height; /* Pixels */
-    NewColorMapSize = 1;
-    if (SubdivColorMap(NewColorSubdiv, *ColorMapSize, &NewColorMapSize) !=
-       GIF_OK) {
-        free((char *)ColorArrayEntries);
-        return GIF_ERROR;
-    }
-    if (NewColorMapSize < *ColorMapSize) {
+    NewColorSubdiv[0].Count = Count; /* Pixels */
+    NewColorMapSize = NumOfEntries > 0 ? 1 : 0;
+    if (NumOfEntries > 0)
+        SubdivColorMap(NewColorSubdiv, Colors, Colors + COLOR_ARRAY_SIZE,
+                       Histogram, *ColorMapSize, &NewColorMapSize);
+    if (NewColorMapSize < (unsigned int)*ColorMapSize) {
         /* And clear rest of color map: */
-        for (i = NewColorMapSize; i < *ColorMapSize; i++)
+        for (i = NewColorMapSize; i < (unsigned int)*ColorMapSize; i++)
             OutputColorMap[i].Red = OutputColorMap[i].Green =
                 OutputColorMap[i].Blue = 0;
     }
@@ -142,14 +242,14 @@ GifQuantizeBuffer(unsigned int Width,
      * output color map, and plug it into the output color map itself. */
     for (i = 0; i < NewColorMapSize; i++) {
         if ((j = NewColorSubdiv[i].NumEntries) > 0) {
-            QuantizedColor = NewColorSubdiv[i].QuantizedColors;
             Red = Green = Blue = 0;
-            while (QuantizedColor) {
-                QuantizedColor->NewColorIndex = i;
-                Red += QuantizedColor->RGB[0];
-                Green += QuantizedColor->RGB[1];
-                Blue += QuantizedColor->RGB[2];
-                QuantizedColor = QuantizedColor->Pnext;
+            for (k = NewColorSubdiv[i].First;
+                 k < NewColorSubdiv[i].First + j; k++) {
+                unsigned int Index = Colors[k];
+                ColorTable[Index] = i;
+                Red += COLOR_PRIM(Index, 0);
+                Green += COLOR_PRIM(Index, 1);
+                Blue += COLOR_PRIM(Index, 2);
             }
             OutputColorMap[i].Red = (Red << (8 - BITS_PER_PRIM_COLOR)) / j;
             OutputColorMap[i].Green = (Green << (8 - BITS_PER_PRIM_COLOR)) / j;
@@ -157,57 +257,156 @@ GifQuantizeBuffer(unsigned int Width,
         }
     }
 
-    /* Finally scan the input buffer again and put the mapped index in the
-     * output buffer.  */
-    MaxRGBError[0] = MaxRGBError[1] = MaxRGBError[2] = 0;
-    for (i = 0; i < (int)(Width * Height); i++) {
-        Index = ((RedInput[i] >> (8 - BITS_PER_PRIM_COLOR)) <<
-                 (2 * BITS_PER_PRIM_COLOR)) +
-                ((GreenInput[i] >> (8 - BITS_PER_PRIM_COLOR)) <<
-                 BITS_PER_PRIM_COLOR) +
-                (BlueInput[i] >> (8 - BITS_PER_PRIM_COLOR));
-        Index = ColorArrayEntries[Index].NewColorIndex;
-        OutputBuffer[i] = Index;
-        if (MaxRGBError[0] < ABS(OutputColorMap[Index].Red - RedInput[i]))
-            MaxRGBError[0] = ABS(OutputColorMap[Index].Red - RedInput[i]);
-        if (MaxRGBError[1] < ABS(OutputColorMap[Index].Green - GreenInput[i]))
-            MaxRGBError[1] = ABS(OutputColorMap[Index].Green - GreenInput[i]);
-        if (MaxRGBError[2] < ABS(OutputColorMap[Index].Blue - BlueInput[i]))
-            MaxRGBError[2] = ABS(OutputColorMap[Index].Blue - BlueInput[i]);
+    free((char *)Colors);
+
+    *ColorMapSize = NewColorMapSize;
+
+    return GIF_OK;
+}
+
+/******************************************************************************
+ Map PixelCount RGBA pixels through the ColorTable of GifQuantizeHistogram
+ to OutputBuffer.  Pixels with alpha below 128 get TransparentIndex, or if
+ that is negative are mapped as the others.  The colors of the mapped
+ pixels must have been counted in the histogram.
+******************************************************************************/
+void
+GifQuantizeMapRGBA(const GifByteType *Pixels,
+                   size_t PixelCount,
+                   const GifByteType *ColorTable,
+                   int TransparentIndex,
+                   GifByteType *OutputBuffer) {
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i RedMask = _mm_set1_epi32(0xf8);
+    const __m128i GreenMask = _mm_set1_epi32(0xf800);
+    const __m128i BlueMask = _mm_set1_epi32(0xf80000);
+    unsigned int Index[4];
+    int Masked = TransparentIndex >= 0 ? 0xf : 0;
+
+    for (; i + 4 <= PixelCount; i += 4) {
+        __m128i P = _mm_loadu_si128((const __m128i *)(Pixels + i * 4));
+        int Transparent = ~_mm_movemask_ps(_mm_castsi128_ps(P)) & Masked;
+        int j;
+        _mm_storeu_si128((__m128i *)Index, _mm_or_si128(_mm_or_si128(
+            _mm_slli_epi32(_mm_and_si128(P, RedMask), 7),
+            _mm_srli_epi32(_mm_and_si128(P, GreenMask), 6)),
+            _mm_srli_epi32(_mm_and_si128(P, BlueMask), 19)));
+        for (j = 0; j < 4; j++)
+            OutputBuffer[i + j] = (Transparent & (1 << j)) ?
+                (GifByteType)TransparentIndex : ColorTable[Index[j]];
     }
+#endif
+    for (; i < PixelCount; i++) {
+        const GifByteType *P = Pixels + i * 4;
+        if (P[3] < 128 && TransparentIndex >= 0)
+            OutputBuffer[i] = (GifByteType)TransparentIndex;
+        else
+            OutputBuffer[i] = ColorTable[COLOR_INDEX(P[0], P[1], P[2])];
+    }
+}
 
-#ifdef DEBUG
-    fprintf(stderr,
-            "Quantization L(0) errors: Red = %d, Green = %d, Blue = %d.\n",
-            MaxRGBError[0], MaxRGBError[1], MaxRGBError[2]);
-#endif /* DEBUG */
+/******************************************************************************
+ GifQuantizeBuffer for PixelCount interleaved RGBA pixels.  Pixels with
+ alpha below 128 are left out of the color map and get TransparentIndex,
+ or 0 if that is negative; *ColorMapSize on return is the usual choice,
+ ask for 255 colors to leave room for it.
+******************************************************************************/
+int
+GifQuantizeRGBA(const GifByteType *Pixels,
+                size_t PixelCount,
+                int TransparentIndex,
+                int *ColorMapSize,
+                GifByteType *OutputBuffer,
+                GifColorType *OutputColorMap) {
+
+    unsigned long *Histogram;
+    GifByteType *ColorTable;
+
+    Histogram = (unsigned long *)calloc(COLOR_ARRAY_SIZE,
+                    sizeof(unsigned long) + sizeof(GifByteType));
+    if (Histogram == NULL) {
+        return GIF_ERROR;
+    }
+    ColorTable = (GifByteType *)(Histogram + COLOR_ARRAY_SIZE);
 
-    free((char *)ColorArrayEntries);
+    GifQuantizeHistogramRGBA(Pixels, PixelCount, Histogram);
+    if (GifQuantizeHistogram(Histogram, ColorMapSize, OutputColorMap,
+                             ColorTable) != GIF_OK) {
+        free((char *)Histogram);
+        return GIF_ERROR;
+    }
+    GifQuantizeMapRGBA(Pixels, PixelCount, ColorTable,
+                       TransparentIndex < 0 ? 0 : TransparentIndex,
+                       OutputBuffer);
 
-    *ColorMapSize = NewColorMapSize;
+    free((char *)Histogram);
 
     return GIF_OK;
 }
 
+/******************************************************************************
+ Sort NumEntries colors along Axis, then the two axes after it, by three
+ passes of a counting sort on the 5 bit primaries, least significant first.
+ The sort key is unique for each color, so the order is the one the qsort
+ of older versions made.
+******************************************************************************/
+static void
+SortColors(unsigned short *Colors,
+           unsigned short *Scratch,
+           unsigned int NumEntries,
+           int Axis) {
+
+    unsigned int Bucket[MAX_PRIM_COLOR + 1];
+    unsigned short *From = Colors, *To = Scratch, *Swap;
+    unsigned int i, Sum;
+    int Pass;
+
+    for (Pass = 2; Pass >= 0; Pass--) {
+        const int Prim = (Axis + Pass) % 3;
+        memset(Bucket, 0, sizeof(Bucket));
+        for (i = 0; i < NumEntries; i++)
+            Bucket[COLOR_PRIM(From[i], Prim)]++;
+        for (i = 0, Sum = 0; i <= MAX_PRIM_COLOR; i++) {
+            unsigned int n = Bucket[i];
+            Bucket[i] = Sum;
+            Sum += n;
+        }
+        for (i = 0; i < NumEntries; i++)
+            To[Bucket[COLOR_PRIM(From[i], Prim)]++] = From[i];
+        Swap = From;
+        From = To;
+        To = Swap;
+    }
+    /* an odd number of passes leaves them in Scratch */
+    memcpy(Colors, Scratch, sizeof(unsigned short) * NumEntries);
+}
+
 /******************************************************************************
  Routine to subdivide the RGB space recursively using median cut in each
  axes alternatingly until ColorMapSize different cubes exists.
  The biggest cube in one dimension is subdivide unless it has only one entry.
- Returns GIF_ERROR if failed, otherwise GIF_OK.
+ The colors of each cube are a range of Colors.
 *******************************************************************************/
-static int
+static void
 SubdivColorMap(NewColorMapType * NewColorSubdiv,
+               unsigned short *Colors,
+               unsigned short *Scratch,
+               const unsigned long *Histogram,
                unsigned int ColorMapSize,
                unsigned int *NewColorMapSize) {
 
     unsigned int i, j, Index = 0;
-    QuantizedColorType *QuantizedColor, **SortArray;
+    int SortRGBAxis = 0;
 
     while (ColorMapSize > *NewColorMapSize) {
         /* Find candidate for subdivision: */
 	long Sum, Count;
         int MaxSize = -1;
-	unsigned int NumEntries, MinColor, MaxColor;
+	unsigned int NumEntries, MinColor, MaxColor, First, Last;
+        unsigned short *Entries;
         for (i = 0; i < *NewColorMapSize; i++) {
             for (j = 0; j < 3; j++) {
                 if ((((int)NewColorSubdiv[i].RGBWidth[j]) > MaxSize) &&
@@ -220,69 +419,42 @@ SubdivColorMap(NewColorMapType * NewColorSubdiv,
         }
 
         if (MaxSize == -1)
-            return GIF_OK;
+            return;
 
         /* Split the entry Index into two along the axis SortRGBAxis: */
 
         /* Sort all elements in that entry along the given axis and split at
          * the median.  */
-        SortArray = (QuantizedColorType **)malloc(
-                      sizeof(QuantizedColorType *) * 
-                      NewColorSubdiv[Index].NumEntries);
-        if (SortArray == NULL)
-            return GIF_ERROR;
-        for (j = 0, QuantizedColor = NewColorSubdiv[Index].QuantizedColors;
-             j < NewColorSubdiv[Index].NumEntries && QuantizedColor != NULL;
-             j++, QuantizedColor = QuantizedColor->Pnext)
-            SortArray[j] = QuantizedColor;
-
-	/*
-	 * Because qsort isn't stable, this can produce differing 
-	 * results for the order of tuples depending on platform
-	 * details of how qsort() is implemented.
-	 *
-	 * We mitigate this problem by sorting on all three axes rather
-	 * than only the one specied by SortRGBAxis; that way the instability
-	 * can only become an issue if there are multiple color indices
-	 * referring to identical RGB tuples.  Older versions of this 
-	 * sorted on only the one axis.
-	 */
-        qsort(SortArray, NewColorSubdiv[Index].NumEntries,
-              sizeof(QuantizedColorType *), SortCmpRtn);
-
-        /* Relink the sorted list into one: */
-        for (j = 0; j < NewColorSubdiv[Index].NumEntries - 1; j++)
-            SortArray[j]->Pnext = SortArray[j + 1];
-        SortArray[NewColorSubdiv[Index].NumEntries - 1]->Pnext = NULL;
-        NewColorSubdiv[Index].QuantizedColors = QuantizedColor = SortArray[0];
-        free((char *)SortArray);
+        Entries = Colors + NewColorSubdiv[Index].First;
+        Last = NewColorSubdiv[Index].NumEntries - 1;
+        SortColors(Entries, Scratch, NewColorSubdiv[Index].NumEntries,
+                   SortRGBAxis);
 
         /* Now simply add the Counts until we have half of the Count: */
-        Sum = NewColorSubdiv[Index].Count / 2 - QuantizedColor->Count;
+        First = 0;
+        Sum = NewColorSubdiv[Index].Count / 2 - Histogram[Entries[0]];
         NumEntries = 1;
-        Count = QuantizedColor->Count;
-        while (QuantizedColor->Pnext != NULL &&
-	       (Sum -= QuantizedColor->Pnext->Count) >= 0 &&
-               QuantizedColor->Pnext->Pnext != NULL) {
-            QuantizedColor = QuantizedColor->Pnext;
+        Count = Histogram[Entries[0]];
+        while (First < Last &&
+	       (Sum -= Histogram[Entries[First + 1]]) >= 0 &&
+               First + 1 < Last) {
+            First++;
             NumEntries++;
-            Count += QuantizedColor->Count;
+            Count += Histogram[Entries[First]];
         }
         /* Save the values of the last color of the first half, and first
          * of the second half so we can update the Bounding Boxes later.
          * Also as the colors are quantized and the BBoxes are full 0..255,
          * they need to be rescaled.
          */
-        MaxColor = QuantizedColor->RGB[SortRGBAxis]; /* Max. of first half */
-	/* coverity[var_deref_op] */
-        MinColor = QuantizedColor->Pnext->RGB[SortRGBAxis]; /* of second */
+        MaxColor = COLOR_PRIM(Entries[First], SortRGBAxis); /* Max. of first half */
+        MinColor = COLOR_PRIM(Entries[First + 1], SortRGBAxis); /* of second */
         MaxColor <<= (8 - BITS_PER_PRIM_COLOR);
         MinColor <<= (8 - BITS_PER_PRIM_COLOR);
 
         /* Partition right here: */
-        NewColorSubdiv[*NewColorMapSize].QuantizedColors =
-           QuantizedColor->Pnext;
-        QuantizedColor->Pnext = NULL;
+        NewColorSubdiv[*NewColorMapSize].First =
+           NewColorSubdiv[Index].First + NumEntries;
         NewColorSubdiv[*NewColorMapSize].Count = Count;
         NewColorSubdiv[Index].Count -= Count;
         NewColorSubdiv[*NewColorMapSize].NumEntries =
@@ -304,29 +476,6 @@ SubdivColorMap(NewColorMapType * NewColorSubdiv,
 
         (*NewColorMapSize)++;
     }
-
-    return GIF_OK;
-}
-
-/****************************************************************************
- Routine called by qsort to compare two entries.
-*****************************************************************************/
-
-static int
-SortCmpRtn(const void *Entry1,
-           const void *Entry2) {
-	   QuantizedColorType *entry1 = (*((QuantizedColorType **) Entry1));
-	   QuantizedColorType *entry2 = (*((QuantizedColorType **) Entry2));
-
-	   /* sort on all axes of the color space! */
-	   int hash1 = entry1->RGB[SortRGBAxis] * 256 * 256
-	   			+ entry1->RGB[(SortRGBAxis+1) % 3] * 256
-				+ entry1->RGB[(SortRGBAxis+2) % 3];
-	   int hash2 = entry2->RGB[SortRGBAxis] * 256 * 256
-	   			+ entry2->RGB[(SortRGBAxis+1) % 3] * 256
-				+ entry2->RGB[(SortRGBAxis+2) % 3];
-
-    return hash1 - hash2;
 }
 
 /* end */
@@ -239,6 +239,11 @@ vl_filter[] =
    { "avg",    PNG_FILTER_AVG    },
    { "paeth",  PNG_FILTER_PAETH  }
 },
+vl_filter_selection[] =
+{
+   { "sad",     PNG_FILTER_SELECTION_SAD     },
+   { "entropy", PNG_FILTER_SELECTION_ENTROPY }
+},
 #endif /* WRITE_FILTER */
 #ifdef PNG_PNGCP_TIMING_SUPPORTED
 #  define PNGCP_TIME_READ  1
@@ -353,6 +358,9 @@ static const option options[] =
    VLC(memLevel)
    VLO("IDAT-size", IDAT_size, 0)
    VLO("log-depth", log_depth, 0)
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   VLO("filter-selection", filter_selection, 0)
+#endif /* WRITE_FILTER */
 
 #  undef VLO
 
@@ -2054,6 +2062,9 @@ write_png(struct display *dp, const char *destname)
 
          if (get_option(dp, "filter", &val))
             png_set_filter(dp->write_pp, PNG_FILTER_TYPE_BASE, val);
+
+         if (get_option(dp, "filter-selection", &val))
+            png_set_filter_selection(dp->write_pp, val);
       }
 #  endif /* WRITE_FILTER */
 
@@ -0,0 +1,118 @@
+/* crc32_intrinsics.c - PCLMULQDQ optimized CRC-32
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_CRC32_OPTIMIZATIONS
+
+#if PNG_INTEL_PCLMUL_OPT > 0
+
+#include <immintrin.h>
+
+/* The buffer is folded 64 bytes at a time into four 128-bit accumulators by
+ * carry-less multiplication with x^(512+64) and x^512 modulo the (bit
+ * reflected) CRC-32 polynomial, then the accumulators are folded into one,
+ * further 16 byte blocks are folded in, and the result is reduced to 32 bits
+ * with a Barrett reduction.  This is the method of Gopal et al., "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel,
+ * 2009); the constants are the ones for the reflected polynomial 0x104C11DB7.
+ */
+static const png_uint_32 crc_k1k2[4] = /* x^(4*128+32), x^(4*128-32) */
+{
+   0x54442bd4U, 0x00000001U, 0xc6e41596U, 0x00000001U
+};
+static const png_uint_32 crc_k3k4[4] = /* x^(128+32), x^(128-32) */
+{
+   0x751997d0U, 0x00000001U, 0xccaa009eU, 0x00000000U
+};
+static const png_uint_32 crc_k5[4] = /* x^64 */
+{
+   0x63cd6124U, 0x00000001U, 0x00000000U, 0x00000000U
+};
+static const png_uint_32 crc_poly[4] = /* P(x) and floor(x^64 / P(x)) */
+{
+   0xdb710641U, 0x00000001U, 0xf7011641U, 0x00000001U
+};
+
+#define LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+
+/* One folding step: a * k (both halves) xor'ed into b */
+#define FOLD(a, k, b) _mm_xor_si128(_mm_xor_si128(\
+      _mm_clmulepi64_si128(a, k, 0x00), _mm_clmulepi64_si128(a, k, 0x11)), b)
+
+size_t PNG_TARGET_PCLMUL
+png_crc32_pclmul(png_uint_32p crc, png_const_bytep ptr, size_t length)
+{
+   __m128i x0, x1, x2, x3, x4, mask;
+   size_t done;
+
+   if (length < 64 || png_intel_have_pclmul() == 0)
+      return 0;
+
+   length &= ~(size_t)15;
+   done = length;
+
+   x1 = LOAD(ptr);
+   x2 = LOAD(ptr + 16);
+   x3 = LOAD(ptr + 32);
+   x4 = LOAD(ptr + 48);
+   x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)(*crc ^ 0xffffffffU)));
+   ptr += 64;
+   length -= 64;
+
+   x0 = LOAD(crc_k1k2);
+   while (length >= 64)
+   {
+      x1 = FOLD(x1, x0, LOAD(ptr));
+      x2 = FOLD(x2, x0, LOAD(ptr + 16));
+      x3 = FOLD(x3, x0, LOAD(ptr + 32));
+      x4 = FOLD(x4, x0, LOAD(ptr + 48));
+      ptr += 64;
+      length -= 64;
+   }
+
+   /* Four accumulators to one, then the remaining 16 byte blocks */
+   x0 = LOAD(crc_k3k4);
+   x1 = FOLD(x1, x0, x2);
+   x1 = FOLD(x1, x0, x3);
+   x1 = FOLD(x1, x0, x4);
+
+   while (length >= 16)
+   {
+      x1 = FOLD(x1, x0, LOAD(ptr));
+      ptr += 16;
+      length -= 16;
+   }
+
+   /* 128 bits to 64 */
+   mask = _mm_setr_epi32(-1, 0, -1, 0);
+   x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+   x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+   x0 = LOAD(crc_k5);
+   x2 = _mm_srli_si128(x1, 4);
+   x1 = _mm_and_si128(x1, mask);
+   x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x00), x2);
+
+   /* Barrett reduction to 32 bits */
+   x0 = LOAD(crc_poly);
+   x2 = _mm_and_si128(x1, mask);
+   x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+   x2 = _mm_and_si128(x2, mask);
+   x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+   x1 = _mm_xor_si128(x1, x2);
+
+   *crc = (png_uint_32)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)) ^ 0xffffffffU;
+
+   return done;
+}
+
+#undef FOLD
+#undef LOAD
+
+#endif /* PNG_INTEL_PCLMUL_OPT > 0 */
+#endif /* PNG_CRC32_OPTIMIZATIONS */
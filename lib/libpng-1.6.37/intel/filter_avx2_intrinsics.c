@@ -0,0 +1,288 @@
+/* filter_avx2_intrinsics.c - AVX2 optimized filter functions
+ *
+ * Derived from intel/filter_sse2_intrinsics.c
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_READ_SUPPORTED
+
+#if PNG_INTEL_AVX2_OPT > 0
+
+#include <immintrin.h>
+
+/* The pixels are named as in filter_sse2_intrinsics.c:
+ *    prev:  c b
+ *    row:   a d
+ *
+ * Up has no dependency between bytes and is done 32 bytes at a time.
+ *
+ * Sub is a running sum with a stride of bpp bytes, which is done as a prefix
+ * sum inside each 16 byte lane (adding the lane shifted by bpp, 2*bpp, 4*bpp
+ * and 8*bpp bytes) followed by adding, to every byte, the last reconstructed
+ * byte of the same channel before the lane.  That byte is picked out of the
+ * previous lane with a shuffle so this works for any bpp from 1 to 8.
+ *
+ * Avg and Paeth depend on the reconstructed pixel to the left, so they are
+ * done a pixel at a time as in the SSE2 code, here for the 5 to 8 byte pixels
+ * (16 bit RGB and RGBA) that the SSE2 code does not handle.  1 and 2 byte
+ * pixels are left to the generic code, which is as fast as a vector register
+ * holding a single pixel.
+ */
+
+/* Byte i of the shuffle picks byte 16-bpp+(i%bpp) of the previous lane, the
+ * last byte of the same channel.
+ */
+static const png_byte sub_carry[9][16] =
+{
+   { 0 },
+   { 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15 },
+   { 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15 },
+   { 13, 14, 15, 13, 14, 15, 13, 14, 15, 13, 14, 15, 13, 14, 15, 13 },
+   { 12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15 },
+   { 11, 12, 13, 14, 15, 11, 12, 13, 14, 15, 11, 12, 13, 14, 15, 11 },
+   { 10, 11, 12, 13, 14, 15, 10, 11, 12, 13, 14, 15, 10, 11, 12, 13 },
+   {  9, 10, 11, 12, 13, 14, 15,  9, 10, 11, 12, 13, 14, 15,  9, 10 },
+   {  8,  9, 10, 11, 12, 13, 14, 15,  8,  9, 10, 11, 12, 13, 14, 15 }
+};
+
+/* Pixels of up to 8 bytes are held in the low half of an XMM register.  As
+ * with load4 in the SSE2 code a pixel is loaded with a single 8 byte load,
+ * reading into the next pixel, while at least 8 bytes are left in the row;
+ * only the last pixel is put together from 32 bit pieces.  Stores always write
+ * just the pixel.
+ */
+static PNG_TARGET_AVX2 __m128i
+load_pixel(png_const_bytep p, unsigned int bpp, size_t rb)
+{
+   png_uint_32 lo = 0, hi = 0;
+
+   if (rb >= 8)
+      return _mm_loadl_epi64((const __m128i*)p);
+
+   memcpy(&lo, p, bpp < 4 ? bpp : 4);
+   if (bpp > 4)
+      memcpy(&hi, p + 4, bpp - 4);
+
+   return _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)lo),
+       _mm_cvtsi32_si128((int)hi));
+}
+
+static PNG_TARGET_AVX2 void
+store_pixel(png_bytep p, __m128i v, unsigned int bpp)
+{
+   png_uint_32 lo = (png_uint_32)_mm_cvtsi128_si32(v);
+
+   memcpy(p, &lo, bpp < 4 ? bpp : 4);
+   if (bpp > 4)
+   {
+      png_uint_32 hi = (png_uint_32)_mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+
+      memcpy(p + 4, &hi, bpp - 4);
+   }
+}
+
+void PNG_TARGET_AVX2
+png_read_filter_row_up_avx2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   size_t rb = row_info->rowbytes;
+
+   png_debug(1, "in png_read_filter_row_up_avx2");
+
+   while (rb >= 32)
+   {
+      __m256i d = _mm256_loadu_si256((const __m256i*)row);
+      __m256i b = _mm256_loadu_si256((const __m256i*)prev);
+
+      _mm256_storeu_si256((__m256i*)row, _mm256_add_epi8(d, b));
+      row += 32;
+      prev += 32;
+      rb -= 32;
+   }
+
+   while (rb > 0)
+   {
+      *row = (png_byte)(*row + *prev++);
+      row++;
+      rb--;
+   }
+}
+
+/* The prefix sum needs immediate shift counts, so the loop is expanded for
+ * each pixel size; shifts of 16 bytes or more are skipped.
+ */
+#define SUB_LANES(x, bpp) \
+   do { \
+      x = _mm256_add_epi8(x, _mm256_slli_si256(x, (bpp))); \
+      if (2*(bpp) < 16) \
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, (2*(bpp)) & 15)); \
+      if (4*(bpp) < 16) \
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, (4*(bpp)) & 15)); \
+      if (8*(bpp) < 16) \
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, (8*(bpp)) & 15)); \
+   } while (0)
+
+#define SUB_ROW(bpp) \
+   case bpp: \
+      while (rb >= 32) \
+      { \
+         __m256i x = _mm256_loadu_si256((const __m256i*)row); \
+         __m128i lo, hi; \
+         SUB_LANES(x, bpp); \
+         lo = _mm_add_epi8(_mm256_castsi256_si128(x), \
+             _mm_shuffle_epi8(last, carry)); \
+         hi = _mm_add_epi8(_mm256_extracti128_si256(x, 1), \
+             _mm_shuffle_epi8(lo, carry)); \
+         _mm_storeu_si128((__m128i*)row, lo); \
+         _mm_storeu_si128((__m128i*)(row + 16), hi); \
+         last = hi; \
+         row += 32; \
+         rb -= 32; \
+      } \
+      break
+
+void PNG_TARGET_AVX2
+png_read_filter_row_sub_avx2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   unsigned int bpp = (row_info->pixel_depth + 7) >> 3;
+   size_t rb = row_info->rowbytes;
+   __m128i carry = _mm_loadu_si128((const __m128i*)sub_carry[bpp]);
+   __m128i last = _mm_setzero_si128(); /* nothing to the left of the row */
+
+   png_debug(1, "in png_read_filter_row_sub_avx2");
+   PNG_UNUSED(prev)
+
+   switch (bpp)
+   {
+      SUB_ROW(1);
+      SUB_ROW(2);
+      SUB_ROW(3);
+      SUB_ROW(4);
+      SUB_ROW(5);
+      SUB_ROW(6);
+      SUB_ROW(7);
+      SUB_ROW(8);
+      default:
+         break;
+   }
+
+   /* The tail: the first bpp bytes of the row are left as they are */
+   if (rb > 0)
+   {
+      size_t done = row_info->rowbytes - rb;
+      size_t i = done < bpp ? bpp - done : 0;
+
+      for (; i < rb; ++i)
+         row[i] = (png_byte)(row[i] + row[i - bpp]);
+   }
+}
+
+#undef SUB_ROW
+#undef SUB_LANES
+
+static PNG_TARGET_AVX2 void
+avg_pixels(png_bytep row, png_const_bytep prev, size_t rb, unsigned int bpp)
+{
+   /* (a+b)/2 rounded down is the rounded up average less the low bit of a^b */
+   const __m128i one = _mm_set1_epi8(1);
+   __m128i a = _mm_setzero_si128();
+
+   while (rb >= bpp)
+   {
+      __m128i b = load_pixel(prev, bpp, rb);
+      __m128i d = load_pixel(row, bpp, rb);
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+          _mm_and_si128(_mm_xor_si128(a, b), one));
+
+      a = _mm_add_epi8(d, avg);
+      store_pixel(row, a, bpp);
+      row += bpp;
+      prev += bpp;
+      rb -= bpp;
+   }
+}
+
+void PNG_TARGET_AVX2
+png_read_filter_row_avg_avx2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   unsigned int bpp = (row_info->pixel_depth + 7) >> 3;
+   size_t rb = row_info->rowbytes;
+
+   png_debug(1, "in png_read_filter_row_avg_avx2");
+
+   /* A constant bpp lets the pixel loads and stores be inlined */
+   switch (bpp)
+   {
+      case 5: avg_pixels(row, prev, rb, 5); break;
+      case 6: avg_pixels(row, prev, rb, 6); break;
+      case 7: avg_pixels(row, prev, rb, 7); break;
+      case 8: avg_pixels(row, prev, rb, 8); break;
+      default: break;
+   }
+}
+
+static PNG_TARGET_AVX2 void
+paeth_pixels(png_bytep row, png_const_bytep prev, size_t rb, unsigned int bpp)
+{
+   /* Paeth is worked out in 16 bits as in the SSE2 code, with
+    *    pa = |b-c|, pb = |a-c|, pc = |a+b-2c|
+    * and a picked if pa is smallest, else b if pb is, else c.
+    */
+   const __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero; /* 16 bit lanes */
+
+   while (rb >= bpp)
+   {
+      __m128i b = _mm_unpacklo_epi8(load_pixel(prev, bpp, rb), zero);
+      __m128i d = load_pixel(row, bpp, rb);
+      __m128i pa, pb, pc, smallest, nearest;
+
+      pa = _mm_sub_epi16(b, c);
+      pb = _mm_sub_epi16(a, c);
+      pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+      pa = _mm_abs_epi16(pa);
+      pb = _mm_abs_epi16(pb);
+
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+      nearest = _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(smallest, pb));
+      nearest = _mm_blendv_epi8(nearest, a, _mm_cmpeq_epi16(smallest, pa));
+
+      d = _mm_add_epi8(d, _mm_packus_epi16(nearest, nearest));
+      store_pixel(row, d, bpp);
+
+      a = _mm_unpacklo_epi8(d, zero);
+      c = b;
+      row += bpp;
+      prev += bpp;
+      rb -= bpp;
+   }
+}
+
+void PNG_TARGET_AVX2
+png_read_filter_row_paeth_avx2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   unsigned int bpp = (row_info->pixel_depth + 7) >> 3;
+   size_t rb = row_info->rowbytes;
+
+   png_debug(1, "in png_read_filter_row_paeth_avx2");
+
+   switch (bpp)
+   {
+      case 5: paeth_pixels(row, prev, rb, 5); break;
+      case 6: paeth_pixels(row, prev, rb, 6); break;
+      case 7: paeth_pixels(row, prev, rb, 7); break;
+      case 8: paeth_pixels(row, prev, rb, 8); break;
+      default: break;
+   }
+}
+
+#endif /* PNG_INTEL_AVX2_OPT > 0 */
+#endif /* READ */
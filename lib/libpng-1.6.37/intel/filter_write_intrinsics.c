@@ -0,0 +1,530 @@
+
+/* filter_write_intrinsics.c - SSE2 and AVX2 optimized write filter functions
+ *
+ * Derived from intel/filter_sse2_intrinsics.c
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+
+#include <immintrin.h>
+
+/* The pixels are named as in filter_sse2_intrinsics.c:
+ *    prev:  c b
+ *    row:   a d
+ * When writing a, b and c are all unfiltered input bytes, so unlike the read
+ * side each output byte depends only on the input and a vector of output can
+ * be produced at once for any pixel size.  The first 'bpp' bytes have no 'a'
+ * or 'c' (they are zero) and are done one byte at a time, as is the tail of
+ * the row that does not fill a vector.
+ *
+ * Each function also returns the sum of absolute differences of the filtered
+ * bytes, treating bytes >= 128 as negative, which is what png_write_find_filter
+ * uses to pick the filter.  The sum is checked against 'lmins' every
+ * PNG_SAD_CHECK vectors and the function returns as soon as it is exceeded;
+ * the returned value then only needs to be greater than 'lmins'.
+ */
+#define PNG_SAD_CHECK 8
+#define PNG_SAD_BYTE(v) ((v) < 128 ? (size_t)(v) : (size_t)(256 - (v)))
+
+static __m128i
+sad_sse2(__m128i v)
+{
+   /* min(v, -v) is the distance from zero when bytes >= 128 are negative */
+   const __m128i zero = _mm_setzero_si128();
+
+   return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+static size_t
+sad_total_sse2(__m128i acc)
+{
+   acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)
+   return (size_t)_mm_cvtsi128_si64(acc);
+#else
+   return (size_t)_mm_cvtsi128_si32(acc);
+#endif
+}
+
+static __m128i
+if_then_else_sse2(__m128i c, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+}
+
+static __m128i
+abs_epi16_sse2(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/* Paeth predictor for eight 16-bit lanes */
+static __m128i
+paeth_sse2(__m128i a, __m128i b, __m128i c)
+{
+   __m128i p, pa, pb, pc, smallest;
+
+   p = _mm_sub_epi16(b, c);
+   pc = _mm_sub_epi16(a, c);
+
+   pa = abs_epi16_sse2(p);
+   pb = abs_epi16_sse2(pc);
+   pc = abs_epi16_sse2(_mm_add_epi16(p, pc));
+
+   smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+   /* Ties go to a, then b, then c, exactly as in the generic code */
+   return if_then_else_sse2(_mm_cmpeq_epi16(pa, smallest), a,
+       if_then_else_sse2(_mm_cmpeq_epi16(pb, smallest), b, c));
+}
+
+size_t
+png_write_filter_row_none_sse2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i, sum;
+
+   PNG_UNUSED(bpp)
+   PNG_UNUSED(prev_row)
+   PNG_UNUSED(out)
+   PNG_UNUSED(lmins)
+
+   for (i = 0; i + 16 <= row_bytes; i += 16)
+      acc = _mm_add_epi64(acc,
+          sad_sse2(_mm_loadu_si128((const __m128i*)(row + i))));
+
+   sum = sad_total_sse2(acc);
+
+   for (; i < row_bytes; i++)
+      sum += PNG_SAD_BYTE(row[i]);
+
+   return sum;
+}
+
+size_t
+png_write_filter_row_sub_sse2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   PNG_UNUSED(prev_row)
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      out[i] = row[i];
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(row + i)),
+          _mm_loadu_si128((const __m128i*)(row + i - bpp)));
+
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, sad_sse2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sum + sad_total_sse2(acc) > lmins)
+         return sum + sad_total_sse2(acc);
+   }
+
+   sum += sad_total_sse2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - row[i - bpp]);
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+size_t
+png_write_filter_row_up_sse2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   __m128i acc = _mm_setzero_si128();
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   PNG_UNUSED(bpp)
+
+   for (i = 0; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(row + i)),
+          _mm_loadu_si128((const __m128i*)(prev_row + i)));
+
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, sad_sse2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sad_total_sse2(acc) > lmins)
+         return sad_total_sse2(acc);
+   }
+
+   sum = sad_total_sse2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - prev_row[i]);
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+size_t
+png_write_filter_row_avg_sse2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   const __m128i ones = _mm_set1_epi8(1);
+   __m128i acc = _mm_setzero_si128();
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - (prev_row[i] >> 1));
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev_row + i));
+      __m128i d;
+
+      /* _mm_avg_epu8 rounds up, the filter rounds down */
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+          _mm_and_si128(_mm_xor_si128(a, b), ones));
+
+      d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(row + i)), avg);
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, sad_sse2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sum + sad_total_sse2(acc) > lmins)
+         return sum + sad_total_sse2(acc);
+   }
+
+   sum += sad_total_sse2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - ((row[i - bpp] + prev_row[i]) >> 1));
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+/* The same predictor as paeth_sse2 for the bytes that do not fill a vector */
+static png_byte
+paeth_byte(int a, int b, int c)
+{
+   int p = b - c;
+   int pc = a - c;
+   int pa = p < 0 ? -p : p;
+   int pb = pc < 0 ? -pc : pc;
+
+   pc = (p + pc) < 0 ? -(p + pc) : p + pc;
+
+   return (png_byte)((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+}
+
+size_t
+png_write_filter_row_paeth_sse2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i acc = zero;
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - prev_row[i]);
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev_row + i));
+      __m128i c = _mm_loadu_si128((const __m128i*)(prev_row + i - bpp));
+      __m128i lo, hi, d;
+
+      lo = paeth_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+          _mm_unpacklo_epi8(c, zero));
+      hi = paeth_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+          _mm_unpackhi_epi8(c, zero));
+
+      d = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(row + i)),
+          _mm_packus_epi16(lo, hi));
+      _mm_storeu_si128((__m128i*)(out + i), d);
+      acc = _mm_add_epi64(acc, sad_sse2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sum + sad_total_sse2(acc) > lmins)
+         return sum + sad_total_sse2(acc);
+   }
+
+   sum += sad_total_sse2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] -
+          paeth_byte(row[i - bpp], prev_row[i], prev_row[i - bpp]));
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+#if PNG_INTEL_AVX2_OPT > 0
+/* The AVX2 versions are the same algorithm 32 bytes at a time.  The 256-bit
+ * unpack and pack instructions work within each 128-bit lane, so unpacking to
+ * 16 bits and packing back keeps the bytes in order.
+ */
+static PNG_TARGET_AVX2 __m256i
+sad_avx2(__m256i v)
+{
+   const __m256i zero = _mm256_setzero_si256();
+
+   return _mm256_sad_epu8(_mm256_min_epu8(v, _mm256_sub_epi8(zero, v)), zero);
+}
+
+static PNG_TARGET_AVX2 size_t
+sad_total_avx2(__m256i acc)
+{
+   return sad_total_sse2(_mm_add_epi64(_mm256_castsi256_si128(acc),
+       _mm256_extracti128_si256(acc, 1)));
+}
+
+static PNG_TARGET_AVX2 __m256i
+paeth_avx2(__m256i a, __m256i b, __m256i c)
+{
+   __m256i p, pa, pb, pc, smallest;
+
+   p = _mm256_sub_epi16(b, c);
+   pc = _mm256_sub_epi16(a, c);
+
+   pa = _mm256_abs_epi16(p);
+   pb = _mm256_abs_epi16(pc);
+   pc = _mm256_abs_epi16(_mm256_add_epi16(p, pc));
+
+   smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+
+   return _mm256_blendv_epi8(
+       _mm256_blendv_epi8(c, b, _mm256_cmpeq_epi16(pb, smallest)),
+       a, _mm256_cmpeq_epi16(pa, smallest));
+}
+
+PNG_TARGET_AVX2 size_t
+png_write_filter_row_none_avx2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i, sum;
+
+   PNG_UNUSED(bpp)
+   PNG_UNUSED(prev_row)
+   PNG_UNUSED(out)
+   PNG_UNUSED(lmins)
+
+   for (i = 0; i + 32 <= row_bytes; i += 32)
+      acc = _mm256_add_epi64(acc,
+          sad_avx2(_mm256_loadu_si256((const __m256i*)(row + i))));
+
+   sum = sad_total_avx2(acc);
+
+   for (; i < row_bytes; i++)
+      sum += PNG_SAD_BYTE(row[i]);
+
+   return sum;
+}
+
+PNG_TARGET_AVX2 size_t
+png_write_filter_row_sub_avx2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   PNG_UNUSED(prev_row)
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      out[i] = row[i];
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i d = _mm256_sub_epi8(
+          _mm256_loadu_si256((const __m256i*)(row + i)),
+          _mm256_loadu_si256((const __m256i*)(row + i - bpp)));
+
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, sad_avx2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sum + sad_total_avx2(acc) > lmins)
+         return sum + sad_total_avx2(acc);
+   }
+
+   sum += sad_total_avx2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - row[i - bpp]);
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+PNG_TARGET_AVX2 size_t
+png_write_filter_row_up_avx2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   __m256i acc = _mm256_setzero_si256();
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   PNG_UNUSED(bpp)
+
+   for (i = 0; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i d = _mm256_sub_epi8(
+          _mm256_loadu_si256((const __m256i*)(row + i)),
+          _mm256_loadu_si256((const __m256i*)(prev_row + i)));
+
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, sad_avx2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sad_total_avx2(acc) > lmins)
+         return sad_total_avx2(acc);
+   }
+
+   sum = sad_total_avx2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - prev_row[i]);
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+PNG_TARGET_AVX2 size_t
+png_write_filter_row_avg_avx2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   const __m256i ones = _mm256_set1_epi8(1);
+   __m256i acc = _mm256_setzero_si256();
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - (prev_row[i] >> 1));
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(row + i - bpp));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(prev_row + i));
+      __m256i avg = _mm256_sub_epi8(_mm256_avg_epu8(a, b),
+          _mm256_and_si256(_mm256_xor_si256(a, b), ones));
+      __m256i d = _mm256_sub_epi8(
+          _mm256_loadu_si256((const __m256i*)(row + i)), avg);
+
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, sad_avx2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sum + sad_total_avx2(acc) > lmins)
+         return sum + sad_total_avx2(acc);
+   }
+
+   sum += sad_total_avx2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - ((row[i - bpp] + prev_row[i]) >> 1));
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+
+PNG_TARGET_AVX2 size_t
+png_write_filter_row_paeth_avx2(size_t row_bytes, unsigned int bpp,
+    png_const_bytep row, png_const_bytep prev_row, png_bytep out,
+    size_t lmins)
+{
+   const __m256i zero = _mm256_setzero_si256();
+   __m256i acc = zero;
+   size_t i, sum = 0;
+   unsigned int n = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] - prev_row[i]);
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   for (; i + 32 <= row_bytes; i += 32)
+   {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(row + i - bpp));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(prev_row + i));
+      __m256i c = _mm256_loadu_si256((const __m256i*)(prev_row + i - bpp));
+      __m256i lo, hi, d;
+
+      lo = paeth_avx2(_mm256_unpacklo_epi8(a, zero),
+          _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(c, zero));
+      hi = paeth_avx2(_mm256_unpackhi_epi8(a, zero),
+          _mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(c, zero));
+
+      d = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(row + i)),
+          _mm256_packus_epi16(lo, hi));
+      _mm256_storeu_si256((__m256i*)(out + i), d);
+      acc = _mm256_add_epi64(acc, sad_avx2(d));
+
+      if (++n % PNG_SAD_CHECK == 0 && sum + sad_total_avx2(acc) > lmins)
+         return sum + sad_total_avx2(acc);
+   }
+
+   sum += sad_total_avx2(acc);
+
+   for (; i < row_bytes; i++)
+   {
+      out[i] = (png_byte)(row[i] -
+          paeth_byte(row[i - bpp], prev_row[i], prev_row[i - bpp]));
+      sum += PNG_SAD_BYTE(out[i]);
+   }
+
+   return sum;
+}
+#endif /* PNG_INTEL_AVX2_OPT > 0 */
+
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
+#endif /* PNG_WRITE_FILTER_SUPPORTED */
@@ -1,5 +1,5 @@
 
-/* intel_init.c - SSE2 optimized filter functions
+/* intel_init.c - SSE2 and AVX2 optimized filter functions
  *
  * Copyright (c) 2018 Cosmin Truta
  * Copyright (c) 2016-2017 Glenn Randers-Pehrson
@@ -13,9 +13,90 @@
 
 #include "../pngpriv.h"
 
-#ifdef PNG_READ_SUPPORTED
 #if PNG_INTEL_SSE_IMPLEMENTATION > 0
 
+#include <signal.h> /* for sig_atomic_t */
+
+#if (PNG_INTEL_AVX2_OPT > 0 || PNG_INTEL_PCLMUL_OPT > 0) && \
+    defined(_MSC_VER) && !defined(__clang__)
+#  include <intrin.h>
+#  include <immintrin.h>
+#endif
+
+int
+png_intel_have_avx2(void)
+{
+   /* The CPUID bit alone is not enough, the OS must also save the YMM state;
+    * both compilers' checks below cover that.  The answer cannot change while
+    * the program runs so it is only worked out once.
+    */
+   static volatile sig_atomic_t have_avx2 = -1; /* not checked */
+
+   if (have_avx2 < 0)
+   {
+#if PNG_INTEL_AVX2_OPT > 0
+#  if defined(__GNUC__) || defined(__clang__)
+      __builtin_cpu_init();
+      have_avx2 = __builtin_cpu_supports("avx2") != 0;
+#  elif defined(_MSC_VER)
+      int info[4];
+
+      have_avx2 = 0;
+      __cpuid(info, 0);
+
+      if (info[0] >= 7)
+      {
+         __cpuid(info, 1);
+
+         /* OSXSAVE and AVX, then the OS must have enabled XMM and YMM */
+         if ((info[2] & 0x18000000) == 0x18000000 &&
+             (_xgetbv(0) & 6) == 6)
+         {
+            __cpuidex(info, 7, 0);
+            have_avx2 = (info[1] & 0x20) != 0;
+         }
+      }
+#  else
+      have_avx2 = 0;
+#  endif
+#else
+      have_avx2 = 0;
+#endif
+   }
+
+   return have_avx2;
+}
+
+#if PNG_INTEL_PCLMUL_OPT > 0
+int
+png_intel_have_pclmul(void)
+{
+   /* PCLMULQDQ works on XMM registers, which every OS that runs SSE2 code
+    * saves, so only the CPUID bit matters.
+    */
+   static volatile sig_atomic_t have_pclmul = -1; /* not checked */
+
+   if (have_pclmul < 0)
+   {
+#  if defined(__GNUC__) || defined(__clang__)
+      __builtin_cpu_init();
+      have_pclmul = __builtin_cpu_supports("pclmul") != 0;
+#  elif defined(_MSC_VER)
+      int info[4];
+
+      __cpuid(info, 1);
+      have_pclmul = (info[2] & 0x2) != 0;
+#  else
+      have_pclmul = 0;
+#  endif
+   }
+
+   return have_pclmul;
+}
+#endif /* PNG_INTEL_PCLMUL_OPT > 0 */
+
+#ifdef PNG_READ_SUPPORTED
+
 void
 png_init_filter_functions_sse2(png_structp pp, unsigned int bpp)
 {
@@ -46,7 +127,59 @@ png_init_filter_functions_sse2(png_structp pp, unsigned int bpp)
    /* No need optimize PNG_FILTER_VALUE_UP.  The compiler should
     * autovectorize.
     */
+
+#if PNG_INTEL_AVX2_OPT > 0
+   /* With AVX2 up and sub are done 32 bytes at a time for any pixel size,
+    * avg and paeth a pixel at a time for the 16 bit formats.
+    */
+   if (png_intel_have_avx2() != 0 && bpp <= 8)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_UP-1] = png_read_filter_row_up_avx2;
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub_avx2;
+
+      if (bpp >= 5)
+      {
+         pp->read_filter[PNG_FILTER_VALUE_AVG-1] =
+            png_read_filter_row_avg_avx2;
+         pp->read_filter[PNG_FILTER_VALUE_PAETH-1] =
+            png_read_filter_row_paeth_avx2;
+      }
+   }
+#endif
 }
 
-#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
 #endif /* PNG_READ_SUPPORTED */
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+void
+png_init_write_filter_functions_sse2(png_structp pp, unsigned int bpp)
+{
+   /* On the write side every filter only looks at the unfiltered input, so
+    * there is no dependency between neighbouring pixels and the whole row can
+    * be processed a vector at a time whatever the pixel size.  The sum of
+    * absolute differences used to pick the filter is computed alongside.
+    */
+   png_debug(1, "in png_init_write_filter_functions_sse2");
+   PNG_UNUSED(bpp)
+
+#if PNG_INTEL_AVX2_OPT > 0
+   if (png_intel_have_avx2() != 0)
+   {
+      pp->write_filter[PNG_FILTER_VALUE_NONE] = png_write_filter_row_none_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_SUB] = png_write_filter_row_sub_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_UP] = png_write_filter_row_up_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_AVG] = png_write_filter_row_avg_avx2;
+      pp->write_filter[PNG_FILTER_VALUE_PAETH] =
+         png_write_filter_row_paeth_avx2;
+      return;
+   }
+#endif
+
+   pp->write_filter[PNG_FILTER_VALUE_NONE] = png_write_filter_row_none_sse2;
+   pp->write_filter[PNG_FILTER_VALUE_SUB] = png_write_filter_row_sub_sse2;
+   pp->write_filter[PNG_FILTER_VALUE_UP] = png_write_filter_row_up_sse2;
+   pp->write_filter[PNG_FILTER_VALUE_AVG] = png_write_filter_row_avg_sse2;
+   pp->write_filter[PNG_FILTER_VALUE_PAETH] = png_write_filter_row_paeth_sse2;
+}
+#endif /* PNG_WRITE_FILTER_SUPPORTED */
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
@@ -0,0 +1,339 @@
+/* interlace_intrinsics.c - SSE2 and AVX2 optimized Adam7 deinterlacing
+ *
+ * Derived from intel/transform_intrinsics.c
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_READ_INTERLACING_SUPPORTED
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+
+#if PNG_INTEL_AVX2_OPT > 0
+#  include <immintrin.h>
+#else
+#  include <emmintrin.h>
+#endif
+
+/* Pixels of an interlace pass land on every inc'th pixel of the final row,
+ * inc being 8, 4 or 2.  png_do_read_interlace_intel replicates each pixel inc
+ * times, in place from the end of the row back, for the 'blocky' display and
+ * the progressive reader.  png_combine_row_pass_intel puts the pixels of the
+ * pass in their places in the application's row and leaves the pixels in
+ * between as they are; it only does inc 2, the passes that have most of the
+ * pixels, as a wider spacing leaves nothing to gain over a store per pixel.
+ *
+ * 1, 2 and 4 byte pixels are spread with the SSE2 unpack instructions.
+ * 3 byte pixels need PSHUFB, so those are only done when png_intel_have_avx2()
+ * says so.  Like the functions in transform_intrinsics.c these return how many
+ * pixels of the pass they did; the C code does the rest.
+ */
+
+#define LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define STORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+
+/* Write v over the bytes of dp that are zero in 'keep' */
+#define MERGE(dp, v, keep) \
+   STORE(dp, _mm_or_si128(v, _mm_and_si128(LOAD(dp), keep)))
+
+#if PNG_INTEL_AVX2_OPT > 0
+/* Eight 3 byte pixels replicated twice are 48 bytes, built from loads at
+ * 0, 6 and 8 bytes into the 24 input bytes.  Four pixels replicated four or
+ * eight times are 48 or 96 bytes from a single load.
+ */
+static const png_byte rgb_inc2[3][16] =
+{
+   {  0,  1,  2,  0,  1,  2,  3,  4,  5,  3,  4,  5,  6,  7,  8,  6 },
+   {  1,  2,  3,  4,  5,  3,  4,  5,  6,  7,  8,  6,  7,  8,  9, 10 },
+   {  9,  7,  8,  9, 10, 11, 12, 10, 11, 12, 13, 14, 15, 13, 14, 15 }
+};
+
+static const png_byte rgb_inc4[3][16] =
+{
+   {  0,  1,  2,  0,  1,  2,  0,  1,  2,  0,  1,  2,  3,  4,  5,  3 },
+   {  4,  5,  3,  4,  5,  3,  4,  5,  6,  7,  8,  6,  7,  8,  6,  7 },
+   {  8,  6,  7,  8,  9, 10, 11,  9, 10, 11,  9, 10, 11,  9, 10, 11 }
+};
+
+static const png_byte rgb_inc8[6][16] =
+{
+   {  0,  1,  2,  0,  1,  2,  0,  1,  2,  0,  1,  2,  0,  1,  2,  0 },
+   {  1,  2,  0,  1,  2,  0,  1,  2,  3,  4,  5,  3,  4,  5,  3,  4 },
+   {  5,  3,  4,  5,  3,  4,  5,  3,  4,  5,  3,  4,  5,  3,  4,  5 },
+   {  6,  7,  8,  6,  7,  8,  6,  7,  8,  6,  7,  8,  6,  7,  8,  6 },
+   {  7,  8,  6,  7,  8,  6,  7,  8,  9, 10, 11,  9, 10, 11,  9, 10 },
+   { 11,  9, 10, 11,  9, 10, 11,  9, 10, 11,  9, 10, 11,  9, 10, 11 }
+};
+
+/* rgb_inc2 with the odd pixels, the ones between those of the pass, left out
+ * (an index with the top bit set makes PSHUFB give 0).
+ */
+static const png_byte rgb_pass2[3][16] =
+{
+   {  0,  1,  2,128,128,128,  3,  4,  5,128,128,128,  6,  7,  8,128 },
+   {128,128,  3,  4,  5,128,128,128,  6,  7,  8,128,128,128,  9, 10 },
+   {  9,128,128,128, 10, 11, 12,128,128,128, 13, 14, 15,128,128,128 }
+};
+
+#define MASK(table, j) LOAD(table[j])
+
+static PNG_TARGET_AVX2 png_uint_32
+read_interlace_rgb(png_bytep row, png_uint_32 width, unsigned int inc)
+{
+   png_uint_32 done = 0;
+
+   if (inc == 2)
+   {
+      while (width - done >= 8)
+      {
+         png_uint_32 i = width - done - 8;
+         png_const_bytep sp = row + 3 * (size_t)i;
+         png_bytep dp = row + 6 * (size_t)i;
+         __m128i a = LOAD(sp), b = LOAD(sp + 6), c = LOAD(sp + 8);
+
+         STORE(dp, _mm_shuffle_epi8(a, MASK(rgb_inc2, 0)));
+         STORE(dp + 16, _mm_shuffle_epi8(b, MASK(rgb_inc2, 1)));
+         STORE(dp + 32, _mm_shuffle_epi8(c, MASK(rgb_inc2, 2)));
+         done += 8;
+      }
+   }
+
+   else /* 4 or 8 */
+   {
+      /* The load reads 4 bytes past the 4 pixels, still inside the row */
+      while (width - done >= 4)
+      {
+         png_uint_32 i = width - done - 4;
+         __m128i x = LOAD(row + 3 * (size_t)i);
+         png_bytep dp = row + 3 * (size_t)i * inc;
+
+         if (inc == 4)
+         {
+            STORE(dp, _mm_shuffle_epi8(x, MASK(rgb_inc4, 0)));
+            STORE(dp + 16, _mm_shuffle_epi8(x, MASK(rgb_inc4, 1)));
+            STORE(dp + 32, _mm_shuffle_epi8(x, MASK(rgb_inc4, 2)));
+         }
+
+         else
+         {
+            int j;
+
+            for (j = 0; j < 6; j++)
+               STORE(dp + 16 * j, _mm_shuffle_epi8(x, MASK(rgb_inc8, j)));
+         }
+
+         done += 4;
+      }
+   }
+
+   return done;
+}
+
+static PNG_TARGET_AVX2 png_uint_32
+combine_pass_rgb(png_bytep dp, png_const_bytep sp, png_uint_32 count)
+{
+   png_uint_32 done = 0;
+   const __m128i zero = _mm_setzero_si128();
+   int j;
+
+   /* The last pixel merged lies between two of the pass, so a pass pixel
+    * after the 8 is needed for it to be inside the row.
+    */
+   for (; count - done > 8; done += 8, sp += 24, dp += 48)
+   {
+      __m128i x[3];
+
+      x[0] = LOAD(sp);
+      x[1] = LOAD(sp + 6);
+      x[2] = LOAD(sp + 8);
+
+      for (j = 0; j < 3; j++)
+      {
+         __m128i m = MASK(rgb_pass2, j);
+
+         MERGE(dp + 16 * j, _mm_shuffle_epi8(x[j], m), _mm_cmplt_epi8(m, zero));
+      }
+   }
+
+   return done;
+}
+
+#undef MASK
+#endif /* PNG_INTEL_AVX2_OPT > 0 */
+
+/* Replicate the pixels of x, held as 'size' byte units, to 2, 4 or 8 times
+ * as many bytes and store them at dp.
+ */
+static void
+store_replicated(png_bytep dp, __m128i x, unsigned int size, unsigned int inc)
+{
+   __m128i v[8];
+   unsigned int n = 1, k;
+
+   v[0] = x;
+   for (; inc > 1; inc >>= 1, size <<= 1)
+   {
+      /* Each step doubles every unit in place, from the last vector down */
+      for (k = n; k-- > 0;)
+      {
+         __m128i lo, hi;
+
+         switch (size)
+         {
+            case 1:
+               lo = _mm_unpacklo_epi8(v[k], v[k]);
+               hi = _mm_unpackhi_epi8(v[k], v[k]);
+               break;
+
+            case 2:
+               lo = _mm_unpacklo_epi16(v[k], v[k]);
+               hi = _mm_unpackhi_epi16(v[k], v[k]);
+               break;
+
+            case 4:
+               lo = _mm_unpacklo_epi32(v[k], v[k]);
+               hi = _mm_unpackhi_epi32(v[k], v[k]);
+               break;
+
+            case 8:
+               lo = _mm_unpacklo_epi64(v[k], v[k]);
+               hi = _mm_unpackhi_epi64(v[k], v[k]);
+               break;
+
+            default: /* 16, the whole vector */
+               lo = hi = v[k];
+               break;
+         }
+
+         v[2 * k] = lo;
+         v[2 * k + 1] = hi;
+      }
+
+      n <<= 1;
+   }
+
+   for (k = 0; k < n; k++)
+      STORE(dp + 16 * k, v[k]);
+}
+
+png_uint_32
+png_do_read_interlace_intel(png_bytep row, png_uint_32 width,
+    unsigned int inc, unsigned int pixel_bytes)
+{
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_do_read_interlace_intel");
+
+   switch (pixel_bytes)
+   {
+      case 1:
+      case 2:
+      case 4:
+      {
+         /* 16 bytes of input at a time; all of them are loaded before the
+          * output, which may overlap them, is stored.
+          */
+         png_uint_32 n = 16 / pixel_bytes;
+
+         while (width - done >= n)
+         {
+            png_uint_32 i = width - done - n;
+
+            store_replicated(row + (size_t)i * pixel_bytes * inc,
+                LOAD(row + (size_t)i * pixel_bytes), pixel_bytes, inc);
+            done += n;
+         }
+         break;
+      }
+
+#if PNG_INTEL_AVX2_OPT > 0
+      case 3:
+         if (png_intel_have_avx2() != 0)
+            done = read_interlace_rgb(row, width, inc);
+         break;
+#endif
+
+      default:
+         break;
+   }
+
+   return done;
+}
+
+png_uint_32
+png_combine_row_pass_intel(png_bytep dp, png_const_bytep sp,
+    png_uint_32 count, unsigned int inc, unsigned int pixel_bytes)
+{
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_combine_row_pass_intel");
+
+   if (inc != 2)
+      return 0;
+
+   switch (pixel_bytes)
+   {
+      case 1:
+      case 2:
+      case 4:
+      {
+         /* 16 bytes of the pass fill the even pixels of 32 bytes of the row;
+          * as for RGB another pass pixel must follow them.
+          */
+         png_uint_32 n = 16 / pixel_bytes;
+         const __m128i keep = pixel_bytes == 1 ? _mm_set1_epi16(-256) :
+             pixel_bytes == 2 ? _mm_set1_epi32(-65536) :
+             _mm_set_epi32(-1, 0, -1, 0);
+
+         for (; count - done > n; done += n, sp += 16, dp += 32)
+         {
+            __m128i x = LOAD(sp), lo, hi;
+
+            if (pixel_bytes == 1)
+            {
+               lo = _mm_unpacklo_epi8(x, x);
+               hi = _mm_unpackhi_epi8(x, x);
+            }
+
+            else if (pixel_bytes == 2)
+            {
+               lo = _mm_unpacklo_epi16(x, x);
+               hi = _mm_unpackhi_epi16(x, x);
+            }
+
+            else
+            {
+               lo = _mm_unpacklo_epi32(x, x);
+               hi = _mm_unpackhi_epi32(x, x);
+            }
+
+            MERGE(dp, _mm_andnot_si128(keep, lo), keep);
+            MERGE(dp + 16, _mm_andnot_si128(keep, hi), keep);
+         }
+         break;
+      }
+
+#if PNG_INTEL_AVX2_OPT > 0
+      case 3:
+         if (png_intel_have_avx2() != 0)
+            done = combine_pass_rgb(dp, sp, count);
+         break;
+#endif
+
+      default:
+         break;
+   }
+
+   return done;
+}
+
+#undef MERGE
+#undef STORE
+#undef LOAD
+
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
+#endif /* READ_INTERLACING */
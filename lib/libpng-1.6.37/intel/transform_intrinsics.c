@@ -0,0 +1,559 @@
+/* transform_intrinsics.c - SSE2 and AVX2 optimized row transformations
+ *
+ * Derived from arm/palette_neon_intrinsics.c
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#if defined(PNG_READ_SUPPORTED) || defined(PNG_WRITE_SUPPORTED)
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+
+#if PNG_INTEL_AVX2_OPT > 0
+#  include <immintrin.h>
+#else
+#  include <emmintrin.h>
+#endif
+
+/* Each function here does as much of a row as fits its vectors and returns
+ * how much it did; the C code in pngrtran.c or pngtrans.c does the rest.
+ *
+ * Transformations that make the row longer work from the end of the row back
+ * to the start, as the C code does, and do the last pixels of the row.  They
+ * never do the first pixel, so a vector load of the input never reaches before
+ * the start of the row.  The other transformations do the first pixels.
+ *
+ * The SSE2 code is used on any CPU this is built for.  Moving bytes between
+ * pixels of 3 bytes needs PSHUFB and the palette lookup is fastest with the
+ * AVX2 gather, so those are only done when png_intel_have_avx2() says so.
+ */
+
+#define LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define STORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+
+#if PNG_INTEL_AVX2_OPT > 0
+/* Spread 16 RGB pixels, 48 bytes, to four vectors of four pixels with a
+ * fourth byte of zero, where 'spread' says where the zero goes.
+ */
+static PNG_TARGET_AVX2 void
+load_rgb(png_const_bytep sp, __m128i spread, __m128i x[4])
+{
+   __m128i i0 = LOAD(sp);
+   __m128i i1 = LOAD(sp + 16);
+   __m128i i2 = LOAD(sp + 32);
+
+   x[0] = _mm_shuffle_epi8(i0, spread);
+   x[1] = _mm_shuffle_epi8(_mm_alignr_epi8(i1, i0, 12), spread);
+   x[2] = _mm_shuffle_epi8(_mm_alignr_epi8(i2, i1, 8), spread);
+   x[3] = _mm_shuffle_epi8(_mm_srli_si128(i2, 4), spread);
+}
+
+/* The reverse: 'pack' takes three bytes of each 4 byte pixel to the low 12
+ * bytes of the vector, then the four vectors are stored as 48 bytes.
+ */
+static PNG_TARGET_AVX2 void
+store_rgb(png_bytep dp, __m128i pack, __m128i x0, __m128i x1, __m128i x2,
+    __m128i x3)
+{
+   x0 = _mm_shuffle_epi8(x0, pack);
+   x1 = _mm_shuffle_epi8(x1, pack);
+   x2 = _mm_shuffle_epi8(x2, pack);
+   x3 = _mm_shuffle_epi8(x3, pack);
+
+   STORE(dp, _mm_or_si128(x0, _mm_slli_si128(x1, 12)));
+   STORE(dp + 16, _mm_or_si128(_mm_srli_si128(x1, 4), _mm_slli_si128(x2, 8)));
+   STORE(dp + 32, _mm_or_si128(_mm_srli_si128(x2, 8), _mm_slli_si128(x3, 4)));
+}
+
+#define SPREAD_RGB_X _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, \
+   9, 10, 11, -1)
+#define SPREAD_X_RGB _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, \
+   -1, 9, 10, 11)
+#define PACK_RGB_X _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, \
+   -1, -1, -1, -1)
+#endif /* PNG_INTEL_AVX2_OPT > 0 */
+
+#ifdef PNG_READ_EXPAND_SUPPORTED
+/* Build an RGBA8 palette from the separate RGB and alpha palettes. */
+void
+png_riffle_palette_intel(png_structrp png_ptr)
+{
+   png_const_colorp palette = png_ptr->palette;
+   png_bytep riffled_palette = png_ptr->riffled_palette;
+   png_const_bytep trans_alpha = png_ptr->trans_alpha;
+   int num_trans = png_ptr->num_trans;
+   int i;
+
+   png_debug(1, "in png_riffle_palette_intel");
+
+   for (i = 0; i < 256; i++)
+   {
+      riffled_palette[(i << 2) + 0] = palette[i].red;
+      riffled_palette[(i << 2) + 1] = palette[i].green;
+      riffled_palette[(i << 2) + 2] = palette[i].blue;
+      riffled_palette[(i << 2) + 3] = i < num_trans ? trans_alpha[i] : 0xff;
+   }
+}
+
+#if PNG_INTEL_AVX2_OPT > 0
+static PNG_TARGET_AVX2 png_uint_32
+expand_palette_avx2(const int *palette, png_bytep row, png_uint_32 width,
+    int channels)
+{
+   png_uint_32 done = 0;
+
+   if (channels == 4)
+   {
+      while (width - done > 8)
+      {
+         png_uint_32 i = width - done - 8;
+         __m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+             (const __m128i*)(row + i)));
+
+         x = _mm256_i32gather_epi32(palette, x, 4);
+         _mm256_storeu_si256((__m256i*)(row + 4 * (size_t)i), x);
+         done += 8;
+      }
+   }
+
+   else
+   {
+      while (width - done > 16)
+      {
+         png_uint_32 i = width - done - 16;
+         __m128i index = LOAD(row + i);
+         __m256i lo = _mm256_i32gather_epi32(palette,
+             _mm256_cvtepu8_epi32(index), 4);
+         __m256i hi = _mm256_i32gather_epi32(palette,
+             _mm256_cvtepu8_epi32(_mm_srli_si128(index, 8)), 4);
+
+         store_rgb(row + 3 * (size_t)i, PACK_RGB_X,
+             _mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1),
+             _mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+         done += 16;
+      }
+   }
+
+   return done;
+}
+#endif
+
+/* Expands a row of 8-bit palette indices to RGBA8 (channels 4) or RGB8
+ * (channels 3) with the riffled palette.
+ */
+png_uint_32
+png_do_expand_palette_intel(png_structrp png_ptr, png_bytep row,
+    png_uint_32 width, int channels)
+{
+   const png_uint_32 *palette = (const png_uint_32 *)png_ptr->riffled_palette;
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_do_expand_palette_intel");
+
+#if PNG_INTEL_AVX2_OPT > 0
+   if (png_intel_have_avx2() != 0)
+      return expand_palette_avx2((const int *)palette, row, width, channels);
+#endif
+
+   /* Without a gather the lookups are done one pixel at a time, but the
+    * stores are still whole vectors.
+    */
+   if (channels == 4)
+   {
+      while (width - done > 4)
+      {
+         png_uint_32 i = width - done - 4;
+         png_const_bytep sp = row + i;
+
+         STORE(row + 4 * (size_t)i, _mm_setr_epi32((int)palette[sp[0]],
+             (int)palette[sp[1]], (int)palette[sp[2]], (int)palette[sp[3]]));
+         done += 4;
+      }
+   }
+
+   return done;
+}
+
+/* tRNS to alpha for 8-bit gray, G to GA */
+png_uint_32
+png_do_expand_gray_alpha_intel(png_bytep row, png_uint_32 width,
+    unsigned int gray)
+{
+   const __m128i key = _mm_set1_epi8((char)gray);
+   const __m128i ones = _mm_set1_epi8(-1);
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_do_expand_gray_alpha_intel");
+
+   while (width - done > 16)
+   {
+      png_uint_32 i = width - done - 16;
+      __m128i g = LOAD(row + i);
+      __m128i a = _mm_xor_si128(_mm_cmpeq_epi8(g, key), ones);
+
+      STORE(row + 2 * (size_t)i, _mm_unpacklo_epi8(g, a));
+      STORE(row + 2 * (size_t)i + 16, _mm_unpackhi_epi8(g, a));
+      done += 16;
+   }
+
+   return done;
+}
+
+#if PNG_INTEL_AVX2_OPT > 0
+static PNG_TARGET_AVX2 png_uint_32
+expand_rgb_alpha_avx2(png_bytep row, png_uint_32 width, png_uint_32 rgb)
+{
+   const __m128i key = _mm_set1_epi32((int)rgb);
+   const __m128i opaque = _mm_set1_epi32((int)0xff000000U);
+   png_uint_32 done = 0;
+
+   while (width - done > 16)
+   {
+      png_uint_32 i = width - done - 16;
+      png_bytep dp = row + 4 * (size_t)i;
+      __m128i x[4];
+      int k;
+
+      load_rgb(row + 3 * (size_t)i, SPREAD_RGB_X, x);
+
+      for (k = 0; k < 4; k++)
+         STORE(dp + 16 * k, _mm_or_si128(x[k],
+             _mm_andnot_si128(_mm_cmpeq_epi32(x[k], key), opaque)));
+
+      done += 16;
+   }
+
+   return done;
+}
+#endif
+
+/* tRNS to alpha for RGB8, RGB to RGBA */
+png_uint_32
+png_do_expand_rgb_alpha_intel(png_bytep row, png_uint_32 width,
+    png_const_color_16p trans_color)
+{
+   png_debug(1, "in png_do_expand_rgb_alpha_intel");
+
+#if PNG_INTEL_AVX2_OPT > 0
+   if (png_intel_have_avx2() != 0)
+      return expand_rgb_alpha_avx2(row, width,
+          (png_uint_32)(trans_color->red & 0xff) |
+          (png_uint_32)(trans_color->green & 0xff) << 8 |
+          (png_uint_32)(trans_color->blue & 0xff) << 16);
+#else
+   PNG_UNUSED(row)
+   PNG_UNUSED(width)
+   PNG_UNUSED(trans_color)
+#endif
+
+   return 0;
+}
+#endif /* READ_EXPAND */
+
+#ifdef PNG_READ_GRAY_TO_RGB_SUPPORTED
+#if PNG_INTEL_AVX2_OPT > 0
+static PNG_TARGET_AVX2 png_uint_32
+gray_to_rgb_avx2(png_bytep row, png_uint_32 width)
+{
+   const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4,
+      4, 5);
+   const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,
+      10, 10);
+   const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14,
+      14, 14, 15, 15, 15);
+   png_uint_32 done = 0;
+
+   while (width - done > 16)
+   {
+      png_uint_32 i = width - done - 16;
+      png_bytep dp = row + 3 * (size_t)i;
+      __m128i g = LOAD(row + i);
+
+      STORE(dp, _mm_shuffle_epi8(g, m0));
+      STORE(dp + 16, _mm_shuffle_epi8(g, m1));
+      STORE(dp + 32, _mm_shuffle_epi8(g, m2));
+      done += 16;
+   }
+
+   return done;
+}
+#endif
+
+/* G8 to RGB8 (alpha 0) or GA8 to RGBA8 (alpha 1) */
+png_uint_32
+png_do_gray_to_rgb_intel(png_bytep row, png_uint_32 width, int alpha)
+{
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_do_gray_to_rgb_intel");
+
+   if (alpha != 0)
+   {
+      /* Each GA pair is doubled to GAGA, then the first A is replaced */
+      const __m128i keep = _mm_set1_epi32((int)0xffff00ffU);
+      const __m128i gray = _mm_set1_epi32(0xff);
+
+      while (width - done > 8)
+      {
+         png_uint_32 i = width - done - 8;
+         png_bytep dp = row + 4 * (size_t)i;
+         __m128i ga = LOAD(row + 2 * (size_t)i);
+         __m128i lo = _mm_unpacklo_epi16(ga, ga);
+         __m128i hi = _mm_unpackhi_epi16(ga, ga);
+
+         lo = _mm_or_si128(_mm_and_si128(lo, keep),
+             _mm_slli_epi32(_mm_and_si128(lo, gray), 8));
+         hi = _mm_or_si128(_mm_and_si128(hi, keep),
+             _mm_slli_epi32(_mm_and_si128(hi, gray), 8));
+         STORE(dp, lo);
+         STORE(dp + 16, hi);
+         done += 8;
+      }
+   }
+
+#if PNG_INTEL_AVX2_OPT > 0
+   else if (png_intel_have_avx2() != 0)
+      done = gray_to_rgb_avx2(row, width);
+#endif
+
+   return done;
+}
+#endif /* READ_GRAY_TO_RGB */
+
+#ifdef PNG_READ_FILLER_SUPPORTED
+#if PNG_INTEL_AVX2_OPT > 0
+static PNG_TARGET_AVX2 png_uint_32
+rgb_filler_avx2(png_bytep row, png_uint_32 width, png_byte filler, int after)
+{
+   const __m128i spread = after != 0 ? SPREAD_RGB_X : SPREAD_X_RGB;
+   const __m128i fill = _mm_set1_epi32(after != 0 ?
+       (int)((png_uint_32)filler << 24) : filler);
+   png_uint_32 done = 0;
+
+   while (width - done > 16)
+   {
+      png_uint_32 i = width - done - 16;
+      png_bytep dp = row + 4 * (size_t)i;
+      __m128i x[4];
+      int k;
+
+      load_rgb(row + 3 * (size_t)i, spread, x);
+
+      for (k = 0; k < 4; k++)
+         STORE(dp + 16 * k, _mm_or_si128(x[k], fill));
+
+      done += 16;
+   }
+
+   return done;
+}
+#endif
+
+/* Adds a filler byte to G8 (channels 1) or RGB8 (channels 3) pixels, after
+ * or before the color.
+ */
+png_uint_32
+png_do_read_filler_intel(png_bytep row, png_uint_32 width, int channels,
+    png_byte filler, int after)
+{
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_do_read_filler_intel");
+
+   if (channels == 1)
+   {
+      const __m128i fill = _mm_set1_epi8((char)filler);
+
+      while (width - done > 16)
+      {
+         png_uint_32 i = width - done - 16;
+         png_bytep dp = row + 2 * (size_t)i;
+         __m128i g = LOAD(row + i);
+
+         if (after != 0)
+         {
+            STORE(dp, _mm_unpacklo_epi8(g, fill));
+            STORE(dp + 16, _mm_unpackhi_epi8(g, fill));
+         }
+
+         else
+         {
+            STORE(dp, _mm_unpacklo_epi8(fill, g));
+            STORE(dp + 16, _mm_unpackhi_epi8(fill, g));
+         }
+
+         done += 16;
+      }
+   }
+
+#if PNG_INTEL_AVX2_OPT > 0
+   else if (png_intel_have_avx2() != 0)
+      done = rgb_filler_avx2(row, width, filler, after);
+#endif
+
+   return done;
+}
+#endif /* READ_FILLER */
+
+#ifdef PNG_READ_SWAP_ALPHA_SUPPORTED
+/* RGBA8 to ARGB8 (channels 4) or GA8 to AG8 (channels 2), which is a rotate
+ * of each pixel by one byte.
+ */
+png_uint_32
+png_do_read_swap_alpha_intel(png_bytep row, png_uint_32 width, int channels)
+{
+   png_uint_32 done = 0;
+   png_uint_32 step = 16 / (png_uint_32)channels;
+
+   png_debug(1, "in png_do_read_swap_alpha_intel");
+
+   while (width - done >= step)
+   {
+      png_bytep rp = row + (size_t)done * (size_t)channels;
+      __m128i x = LOAD(rp);
+
+      if (channels == 4)
+         x = _mm_or_si128(_mm_slli_epi32(x, 8), _mm_srli_epi32(x, 24));
+
+      else
+         x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+
+      STORE(rp, x);
+      done += step;
+   }
+
+   return done;
+}
+#endif /* READ_SWAP_ALPHA */
+
+/* Copies the first byte of each two from sp to dp, stopping before sp would
+ * reach ep; returns the number of bytes stored.  This is the 8-bit GA/GX
+ * channel strip and the 16 to 8 bit chop.
+ */
+size_t
+png_copy_1_of_2_intel(png_bytep dp, png_const_bytep sp, png_const_bytep ep)
+{
+   const __m128i low = _mm_set1_epi16(0xff);
+   size_t done = 0;
+
+   png_debug(1, "in png_copy_1_of_2_intel");
+
+   while (ep - sp >= 32)
+   {
+      __m128i a = _mm_and_si128(LOAD(sp), low);
+      __m128i b = _mm_and_si128(LOAD(sp + 16), low);
+
+      STORE(dp, _mm_packus_epi16(a, b));
+      sp += 32;
+      dp += 16;
+      done += 16;
+   }
+
+   return done;
+}
+
+#if PNG_INTEL_AVX2_OPT > 0
+static PNG_TARGET_AVX2 size_t
+copy_3_of_4_avx2(png_bytep dp, png_const_bytep sp, png_const_bytep ep)
+{
+   size_t done = 0;
+
+   while (ep - sp >= 64)
+   {
+      store_rgb(dp, PACK_RGB_X, LOAD(sp), LOAD(sp + 16), LOAD(sp + 32),
+          LOAD(sp + 48));
+      sp += 64;
+      dp += 48;
+      done += 16;
+   }
+
+   return done;
+}
+#endif
+
+/* The same for the first three bytes of each four, the 8-bit RGBA/RGBX
+ * strip; returns the number of pixels done.
+ */
+size_t
+png_copy_3_of_4_intel(png_bytep dp, png_const_bytep sp, png_const_bytep ep)
+{
+   png_debug(1, "in png_copy_3_of_4_intel");
+
+#if PNG_INTEL_AVX2_OPT > 0
+   if (png_intel_have_avx2() != 0)
+      return copy_3_of_4_avx2(dp, sp, ep);
+#else
+   PNG_UNUSED(dp)
+   PNG_UNUSED(sp)
+   PNG_UNUSED(ep)
+#endif
+
+   return 0;
+}
+
+#if PNG_INTEL_AVX2_OPT > 0
+static PNG_TARGET_AVX2 png_uint_32
+bgr_avx2(png_bytep row, png_uint_32 width)
+{
+   const __m128i swap = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1,
+      11, 10, 9, -1);
+   png_uint_32 done = 0;
+
+   while (width - done >= 16)
+   {
+      png_bytep rp = row + 3 * (size_t)done;
+      __m128i x[4];
+
+      load_rgb(rp, swap, x);
+      store_rgb(rp, PACK_RGB_X, x[0], x[1], x[2], x[3]);
+      done += 16;
+   }
+
+   return done;
+}
+#endif
+
+/* Swaps red and blue in RGB8 (channels 3) or RGBA8 (channels 4) pixels */
+png_uint_32
+png_do_bgr_intel(png_bytep row, png_uint_32 width, int channels)
+{
+   png_uint_32 done = 0;
+
+   png_debug(1, "in png_do_bgr_intel");
+
+   if (channels == 4)
+   {
+      /* Red and blue are the two bytes of 0x00ff00ff, a rotate of the 32 bit
+       * pixel by 16 bits swaps them.
+       */
+      const __m128i ga = _mm_set1_epi32((int)0xff00ff00U);
+
+      while (width - done >= 4)
+      {
+         png_bytep rp = row + 4 * (size_t)done;
+         __m128i x = LOAD(rp);
+         __m128i rb = _mm_andnot_si128(ga, x);
+
+         rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+         STORE(rp, _mm_or_si128(_mm_and_si128(x, ga), rb));
+         done += 4;
+      }
+   }
+
+#if PNG_INTEL_AVX2_OPT > 0
+   else if (png_intel_have_avx2() != 0)
+      done = bgr_avx2(row, width);
+#endif
+
+   return done;
+}
+
+#undef STORE
+#undef LOAD
+
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
+#endif /* READ || WRITE */
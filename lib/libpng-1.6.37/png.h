@@ -3234,7 +3234,8 @@ PNG_EXPORT(245, int, png_image_write_to_memory, (png_imagep image, void *memory,
 #ifdef PNG_POWERPC_VSX_API_SUPPORTED
 #  define PNG_POWERPC_VSX   10 /* HARDWARE: PowerPC VSX SIMD instructions supported */
 #endif
-#define PNG_OPTION_NEXT  12 /* Next option - numbers must be even */
+#define PNG_USE_ZLIB_INFLATE 12 /* SOFTWARE: inflate image data with zlib */
+#define PNG_OPTION_NEXT  14 /* Next option - numbers must be even */
 
 /* Return values: NOTE: there are four values and 'off' is *not* zero */
 #define PNG_OPTION_UNSET   0 /* Unset - defaults to off */
@@ -3318,6 +3319,54 @@ PNG_EXPORT(269, void, png_write_frame_tail, (png_structp png_ptr,
 #endif /* PNG_WRITE_APNG_SUPPORTED */
 #endif /* PNG_APNG_SUPPORTED */
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* How png_write_row chooses between the filters enabled with png_set_filter.
+ * The default picks the filter giving the minimum sum of absolute differences.
+ * ENTROPY estimates the number of bits each filtered row would add to the
+ * compressed data, given the bytes in recent rows and the filter used for the
+ * previous row.  It is slower but usually gives smaller files.
+ */
+#define PNG_FILTER_SELECTION_SAD     0 /* Minimum sum of absolute differences */
+#define PNG_FILTER_SELECTION_ENTROPY 1 /* Minimum estimated compressed size */
+#define PNG_FILTER_SELECTION_LAST    2 /* Not a valid value */
+
+PNG_EXPORT(270, void, png_set_filter_selection, (png_structrp png_ptr,
+   int method));
+#endif /* PNG_WRITE_FILTER_SUPPORTED */
+
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+/* Let png_read_image inflate the image data on the calling thread while a
+ * second thread unfilters and transforms the rows.  This only applies to
+ * large non-interlaced images read without a row callback or user transform;
+ * it is ignored where threads are not supported.  Images with an ixDT chunk,
+ * see png_set_IDAT_segments, are instead inflated and unfiltered by several
+ * threads while the calling thread transforms the rows.
+ */
+PNG_EXPORT(271, void, png_set_read_pipeline, (png_structrp png_ptr,
+   int enable));
+
+/* Read the PNG from memory, for example a memory mapped file, instead of
+ * through a read function.  The data must stay valid until the read is
+ * finished.  Image data is inflated without being copied and unused chunks
+ * are skipped; the CRC of a skipped ancillary chunk is only checked when
+ * png_set_crc_action has set PNG_CRC_ERROR_QUIT for ancillary chunks.
+ */
+PNG_EXPORT(272, void, png_set_read_memory, (png_structrp png_ptr,
+   png_const_voidp data, size_t size));
+#endif /* PNG_SEQUENTIAL_READ_SUPPORTED */
+
+#ifdef PNG_WRITE_SUPPORTED
+/* Deflate the image data in independent segments of 'rows' rows and list where
+ * each one starts in a private ixDT chunk ahead of the IDAT chunks.  Other
+ * decoders just skip the chunk; png_read_image, when png_set_read_pipeline is
+ * on, inflates and unfilters the segments in parallel.  The IDAT data is held
+ * in memory until the end of the image so that ixDT can be written first.
+ * Only non-interlaced images are split; 0, the default, turns this off.
+ */
+PNG_EXPORT(273, void, png_set_IDAT_segments, (png_structrp png_ptr,
+   png_uint_32 rows));
+#endif /* PNG_WRITE_SUPPORTED */
+
 /* Maintainer: Put new public prototypes here ^, in libpng.3, in project
  * defs, and in scripts/symbols.def.
  */
@@ -3327,7 +3376,7 @@ PNG_EXPORT(269, void, png_write_frame_tail, (png_structp png_ptr,
  */
 #ifdef PNG_EXPORT_LAST_ORDINAL
 #ifdef PNG_APNG_SUPPORTED
-  PNG_EXPORT_LAST_ORDINAL(269);
+  PNG_EXPORT_LAST_ORDINAL(273);
 #else
   PNG_EXPORT_LAST_ORDINAL(249);
 #endif /* PNG_APNG_SUPPORTED */
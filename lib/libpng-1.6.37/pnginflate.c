@@ -0,0 +1,1177 @@
+/* pnginflate.c - inflate for the image data
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ *
+ * png_inflate_fast decodes the IDAT (and fdAT) zlib stream in place of zlib's
+ * inflate.  It works on png_ptr->zstream exactly the way inflate() does, so
+ * PNG_INFLATE can send the image data to it and everything else (zTXt, iTXt,
+ * iCCP) to zlib.  Where it differs from zlib is in what makes PNG data quick
+ * to decode:
+ *
+ *  - The literal/length table is indexed by 11 bits rather than 9, and an
+ *    entry whose code leaves room for a second literal code in those 11 bits
+ *    decodes both literals at once.  Filtered image data is mostly literals.
+ *
+ *  - The bit buffer has 64 bits, so a single refill is enough for a length
+ *    code, a distance code and the extra bits of both.
+ *
+ *  - A match that lies inside the output buffer is copied 16 (or 8) bytes at
+ *    a time.  Such copies can write up to 15 bytes past the end of the match;
+ *    the fast loop only runs while there is room for that.
+ *
+ *  - When the whole stream is inflated into one buffer (png_inflate_fast_whole)
+ *    every match lies inside it and no sliding window is kept at all.
+ *    Otherwise the last 32K of output is copied to a window at the end of each
+ *    call, as zlib does, for the matches that reach back past next_out.
+ */
+
+#include "pngpriv.h"
+
+#if defined(PNG_READ_SUPPORTED) && PNG_INFLATE_FAST_OPT > 0
+
+#include <stdint.h>
+
+/* Table entries are png_uint_32:
+ *
+ *    bits 0-4   number of bits to drop for the code; for a second level entry
+ *               the bits after the first level ones, for a literal pair both
+ *               codes
+ *    bit 5      LIT: value is a literal
+ *    bit 6      PAIR: value is two literals, the first in the low byte
+ *    bit 7      EXC: end of block, invalid code or a second level table
+ *    bits 8-11  extra bits of a length or distance, the index bits of a
+ *               second level table, or the bits of the first code of a pair
+ *    bit 12     SUB: value is the offset of a second level table
+ *    bit 13     END: end of block
+ *    bit 14     BAD: invalid code
+ *    bits 16-31 value: literal(s), length or distance base, table offset
+ */
+#define E_LIT   0x20U
+#define E_PAIR  0x40U
+#define E_EXC   0x80U
+#define E_SUB   0x1000U
+#define E_END   0x2000U
+#define E_BAD   0x4000U
+#define E_BITS(e)  ((e) & 0x1fU)
+#define E_EXTRA(e) (((e) >> 8) & 0xfU)
+#define E_VALUE(e) ((e) >> 16)
+
+/* The table sizes, first level plus the most second level tables that a
+ * complete code can need (as computed by zlib's examples/enough.c).
+ */
+#define LITLEN_BITS   11
+#define LITLEN_ENOUGH 2340
+#define DIST_BITS     8
+#define DIST_ENOUGH   400
+#define CODES_BITS    7 /* code length codes are at most 7 bits, one level */
+
+#define WSIZE 32768U /* window */
+
+/* The fast loop needs 8 readable input bytes for a refill and room for the
+ * longest match and the copy overrun after it.
+ */
+#define FAST_IN  8
+#define FAST_OUT (258 + 16)
+
+typedef enum
+{
+   HEAD,     /* zlib header */
+   TYPE,     /* block header */
+   STORED,   /* stored block lengths */
+   COPY,     /* stored block data */
+   TABLE,    /* dynamic block code counts */
+   LENLENS,  /* code length code lengths */
+   CODELENS, /* literal/length and distance code lengths */
+   LEN,      /* literal/length code */
+   LENEXT,   /* length extra bits */
+   DIST,     /* distance code */
+   DISTEXT,  /* distance extra bits */
+   MATCH,    /* copying a match */
+   CHECK,    /* adler32 */
+   DONE,
+   BAD
+} inflate_mode;
+
+struct png_inflate_state
+{
+   inflate_mode mode;
+   int last;              /* the current block is the last one */
+   int check;             /* compare the adler32 */
+   png_uint_32 adler;     /* of the output so far */
+
+   uint64_t bitbuf;       /* bits not yet used, from the low end */
+   unsigned int bitcnt;
+
+   unsigned int length;   /* stored bytes or match bytes to copy */
+   unsigned int dist;     /* match distance */
+   unsigned int extra;    /* extra bits for LENEXT or DISTEXT */
+
+   unsigned int nlen, ndist, ncode, have; /* dynamic block header */
+   png_byte lens[320];
+
+   /* Output history.  In 'whole' mode all of the output is at out_origin,
+    * otherwise the last whave bytes of it before this call's next_out are in
+    * window, ending at wnext (circularly).
+    */
+   int whole;
+   png_bytep out_origin;
+   png_bytep out_last;    /* where the last call left next_out */
+   unsigned int wnext, whave;
+
+   png_uint_32 litlen[LITLEN_ENOUGH];
+   png_uint_32 distance[DIST_ENOUGH];
+   png_uint_32 codes[1U << CODES_BITS];
+   png_byte window[WSIZE];
+};
+
+static const png_uint_16 length_base[29] =
+{
+   3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+   67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const png_byte length_extra[29] =
+{
+   0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+   5, 5, 5, 5, 0
+};
+
+static const png_uint_16 dist_base[30] =
+{
+   1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+   769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const png_byte dist_extra[30] =
+{
+   0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+   11, 11, 12, 12, 13, 13
+};
+
+/* The order of the code length code lengths */
+static const png_byte code_order[19] =
+{
+   16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+typedef enum { CODES, LITLEN, DISTANCE } table_kind;
+
+static png_uint_32
+table_entry(table_kind kind, unsigned int sym, unsigned int bits)
+{
+   switch (kind)
+   {
+      case CODES:
+         return (sym << 16) | bits;
+
+      case LITLEN:
+         if (sym < 256)
+            return (sym << 16) | E_LIT | bits;
+
+         if (sym == 256)
+            return E_EXC | E_END | bits;
+
+         if (sym < 286)
+            return ((png_uint_32)length_base[sym - 257] << 16) |
+                ((png_uint_32)length_extra[sym - 257] << 8) | bits;
+
+         return E_EXC | E_BAD | bits;
+
+      default:
+         if (sym < 30)
+            return ((png_uint_32)dist_base[sym] << 16) |
+                ((png_uint_32)dist_extra[sym] << 8) | bits;
+
+         return E_EXC | E_BAD | bits;
+   }
+}
+
+/* Build the decoding table for the n code lengths in lens.  Codes longer than
+ * table_bits go to second level tables after the first level one, which has
+ * 1 << table_bits entries.  Returns 0, or -1 for an over-subscribed or (except
+ * for a single code of one bit, which deflate allows) incomplete set of
+ * lengths.
+ */
+static int
+build_table(png_uint_32 *table, unsigned int table_bits, unsigned int enough,
+    const png_byte *lens, unsigned int n, table_kind kind)
+{
+   unsigned int count[16], offs[16];
+   png_uint_16 sorted[288], rev[288];
+   unsigned int len, sym, max, i, k, code;
+   unsigned int next, size = 1U << table_bits;
+   int left;
+
+   memset(count, 0, sizeof count);
+   for (sym = 0; sym < n; sym++)
+      count[lens[sym]]++;
+
+   for (max = 15; max > 0 && count[max] == 0; max--)
+      ;
+
+   /* With no codes at all every code is invalid, which is only an error once
+    * one is read: a block may have no distance codes.
+    */
+   if (max == 0)
+   {
+      if (kind == CODES)
+         return -1;
+
+      for (i = 0; i < size; i++)
+         table[i] = E_EXC | E_BAD | 1;
+
+      return 0;
+   }
+
+   left = 1;
+   for (len = 1; len <= 15; len++)
+   {
+      left <<= 1;
+      left -= (int)count[len];
+      if (left < 0)
+         return -1;
+   }
+
+   if (left > 0)
+   {
+      if (kind == CODES || max != 1)
+         return -1;
+
+      for (i = 0; i < size; i++)
+         table[i] = E_EXC | E_BAD | 1;
+   }
+
+   /* Sort the symbols by length, then give them their canonical codes, bit
+    * reversed because the codes are read from the low end of the bit buffer.
+    */
+   offs[1] = 0;
+   for (len = 1; len < 15; len++)
+      offs[len + 1] = offs[len] + count[len];
+
+   for (sym = 0; sym < n; sym++)
+      if (lens[sym] != 0)
+         sorted[offs[lens[sym]]++] = (png_uint_16)sym;
+
+   code = 0;
+   k = 0;
+   for (len = 1; len <= max; len++)
+   {
+      for (i = 0; i < count[len]; i++, k++, code++)
+      {
+         unsigned int c = code, r = 0, b;
+
+         for (b = 0; b < len; b++, c >>= 1)
+            r = (r << 1) | (c & 1);
+
+         rev[k] = (png_uint_16)r;
+      }
+
+      code <<= 1;
+   }
+
+   next = size;
+   for (i = 0; i < k;)
+   {
+      len = lens[sorted[i]];
+
+      if (len <= table_bits)
+      {
+         png_uint_32 e = table_entry(kind, sorted[i], len);
+         unsigned int j;
+
+         for (j = rev[i]; j < size; j += 1U << len)
+            table[j] = e;
+
+         i++;
+      }
+
+      else
+      {
+         /* The codes with these first table_bits bits follow each other in
+          * canonical order; the last is the longest and sets the size of the
+          * second level table.
+          */
+         unsigned int prefix = rev[i] & (size - 1);
+         unsigned int end = i, sub_bits;
+
+         while (end < k && (rev[end] & (size - 1)) == prefix)
+            end++;
+
+         sub_bits = lens[sorted[end - 1]] - table_bits;
+         if (next + (1U << sub_bits) > enough)
+            return -1;
+
+         table[prefix] = ((png_uint_32)next << 16) | (sub_bits << 8) |
+             E_EXC | E_SUB | table_bits;
+
+         for (; i < end; i++)
+         {
+            unsigned int sub_len = lens[sorted[i]] - table_bits;
+            png_uint_32 e = table_entry(kind, sorted[i], sub_len);
+            unsigned int j;
+
+            for (j = rev[i] >> table_bits; j < (1U << sub_bits);
+                 j += 1U << sub_len)
+               table[next + j] = e;
+         }
+
+         next += 1U << sub_bits;
+      }
+   }
+
+   /* Pair up literals whose codes fit in the first level bits together.  The
+    * entry for the second literal is at index >> bits of the first; going down
+    * from the top reads it before it is itself paired.
+    */
+   if (kind == LITLEN)
+   {
+      for (i = size; i-- > 0;)
+      {
+         png_uint_32 e1 = table[i], e2;
+         unsigned int len1 = E_BITS(e1);
+
+         if ((e1 & E_LIT) == 0 || len1 >= table_bits)
+            continue;
+
+         e2 = table[i >> len1];
+         if ((e2 & (E_LIT | E_PAIR)) == E_LIT &&
+             len1 + E_BITS(e2) <= table_bits)
+            table[i] = ((E_VALUE(e1) | (E_VALUE(e2) << 8)) << 16) |
+                (len1 << 8) | E_LIT | E_PAIR | (len1 + E_BITS(e2));
+      }
+   }
+
+   return 0;
+}
+
+static void
+build_fixed(png_inflate_statep s)
+{
+   png_byte lens[288];
+   unsigned int i;
+
+   for (i = 0; i < 144; i++) lens[i] = 8;
+   for (; i < 256; i++) lens[i] = 9;
+   for (; i < 280; i++) lens[i] = 7;
+   for (; i < 288; i++) lens[i] = 8;
+   (void)build_table(s->litlen, LITLEN_BITS, LITLEN_ENOUGH, lens, 288,
+       LITLEN);
+
+   for (i = 0; i < 32; i++) lens[i] = 5;
+   (void)build_table(s->distance, DIST_BITS, DIST_ENOUGH, lens, 32, DISTANCE);
+}
+
+/* Look up the next code with the bitcnt bits there are.  Returns 0 if that is
+ * not enough, else the entry with E_BITS counting all the bits of the code;
+ * if a literal pair needs more bits than there are the first literal is
+ * returned alone.
+ */
+static png_uint_32
+lookup(const png_uint_32 *table, unsigned int table_bits, uint64_t bitbuf,
+    unsigned int bitcnt)
+{
+   png_uint_32 e = table[bitbuf & ((1U << table_bits) - 1)];
+
+   if ((e & E_SUB) != 0)
+   {
+      png_uint_32 sub;
+
+      if (bitcnt < table_bits)
+         return 0;
+
+      sub = table[E_VALUE(e) +
+          ((bitbuf >> table_bits) & ((1U << E_EXTRA(e)) - 1))];
+
+      if (table_bits + E_BITS(sub) > bitcnt)
+         return 0;
+
+      return (sub & ~0x1fU) | (table_bits + E_BITS(sub));
+   }
+
+   if (E_BITS(e) <= bitcnt)
+      return e;
+
+   if ((e & E_PAIR) != 0 && E_EXTRA(e) <= bitcnt)
+      return (E_VALUE(e) & 0xff) << 16 | E_LIT | E_EXTRA(e);
+
+   return 0;
+}
+
+/* Copy the n bytes of a match at distance dist to out, one at a time, taking
+ * them from the window where they are before out_start.
+ */
+static png_bytep
+copy_slow(png_inflate_statep s, png_bytep out, png_bytep out_start,
+    unsigned int dist, unsigned int n)
+{
+   while (n > 0)
+   {
+      size_t in_buffer = (size_t)(out - out_start);
+
+      if (dist > in_buffer)
+      {
+         unsigned int back = dist - (unsigned int)in_buffer;
+         unsigned int pos = (s->wnext - back) & (WSIZE - 1);
+         unsigned int c = back;
+
+         if (c > n)
+            c = n;
+
+         if (c > WSIZE - pos)
+            c = WSIZE - pos;
+
+         memcpy(out, s->window + pos, c);
+         out += c;
+         n -= c;
+      }
+
+      else
+      {
+         png_const_bytep from = out - dist;
+
+         do
+            *out++ = *from++;
+         while (--n > 0);
+      }
+   }
+
+   return out;
+}
+
+/* Copy a match that is all inside the output buffer.  This may write up to 15
+ * bytes past out + len.
+ */
+static png_bytep
+copy_fast(png_bytep out, unsigned int dist, unsigned int len)
+{
+   png_const_bytep from = out - dist;
+   png_bytep end = out + len;
+
+   if (dist >= 16)
+   {
+      do
+      {
+         memcpy(out, from, 16);
+         out += 16;
+         from += 16;
+      }
+      while (out < end);
+   }
+
+   else if (dist >= 8)
+   {
+      do
+      {
+         memcpy(out, from, 8);
+         out += 8;
+         from += 8;
+      }
+      while (out < end);
+   }
+
+   else if (dist == 1)
+   {
+      uint64_t v = 0x0101010101010101U * *from;
+
+      do
+      {
+         memcpy(out, &v, 8);
+         memcpy(out + 8, &v, 8);
+         out += 16;
+      }
+      while (out < end);
+   }
+
+   else
+   {
+      do
+         *out++ = *from++;
+      while (out < end);
+   }
+
+   return end;
+}
+
+static uint64_t
+load64(png_const_bytep p)
+{
+   uint64_t v;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   v = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+       (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+       (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+#else
+   memcpy(&v, p, 8);
+#endif
+
+   return v;
+}
+
+int /* PRIVATE */
+png_inflate_fast_reset(png_structrp png_ptr)
+{
+   png_inflate_statep s = png_ptr->inflate_state;
+
+   if (s == NULL)
+   {
+      s = png_voidcast(png_inflate_statep, png_malloc_warn(png_ptr,
+          (sizeof *s)));
+
+      if (s == NULL)
+         return Z_MEM_ERROR;
+
+      png_ptr->inflate_state = s;
+   }
+
+   s->mode = HEAD;
+   s->last = 0;
+   s->check = 1;
+#if defined(PNG_SET_OPTION_SUPPORTED) && defined(PNG_IGNORE_ADLER32)
+   if (((png_ptr->options >> PNG_IGNORE_ADLER32) & 3) == PNG_OPTION_ON)
+      s->check = 0;
+#endif
+   s->adler = 1;
+   s->bitbuf = 0;
+   s->bitcnt = 0;
+   s->whole = 0;
+   s->out_origin = NULL;
+   s->out_last = NULL;
+   s->wnext = 0;
+   s->whave = 0;
+
+   png_ptr->zstream.total_in = 0;
+   png_ptr->zstream.total_out = 0;
+   png_ptr->zstream.msg = NULL;
+
+   return Z_OK;
+}
+
+void /* PRIVATE */
+png_inflate_fast_whole(png_structrp png_ptr)
+{
+   png_ptr->inflate_state->whole = 1;
+}
+
+void /* PRIVATE */
+png_inflate_fast_destroy(png_structrp png_ptr)
+{
+   png_inflate_statep s = png_ptr->inflate_state;
+
+   png_ptr->inflate_state = NULL;
+   png_ptr->zfast = 0;
+   png_free(png_ptr, s);
+}
+
+/* Append the output of this call, [start, end), to the window */
+static void
+update_window(png_inflate_statep s, png_const_bytep start, png_const_bytep end)
+{
+   size_t n = (size_t)(end - start);
+
+   if (n >= WSIZE)
+   {
+      memcpy(s->window, end - WSIZE, WSIZE);
+      s->wnext = 0;
+      s->whave = WSIZE;
+   }
+
+   else if (n > 0)
+   {
+      unsigned int c = WSIZE - s->wnext;
+
+      if (c > n)
+         c = (unsigned int)n;
+
+      memcpy(s->window + s->wnext, start, c);
+      memcpy(s->window, start + c, n - c);
+      s->wnext = (s->wnext + (unsigned int)n) & (WSIZE - 1);
+      s->whave += (unsigned int)n;
+      if (s->whave > WSIZE)
+         s->whave = WSIZE;
+   }
+}
+
+#define PULLBYTE() \
+   do { \
+      if (in == in_end) \
+         goto leave; \
+      bitbuf |= (uint64_t)*in++ << bitcnt; \
+      bitcnt += 8; \
+   } while (0)
+
+#define NEEDBITS(n) \
+   do { \
+      while (bitcnt < (unsigned int)(n)) \
+         PULLBYTE(); \
+   } while (0)
+
+#define BITS(n) ((unsigned int)bitbuf & ((1U << (n)) - 1))
+
+#define DROPBITS(n) \
+   do { \
+      bitbuf >>= (n); \
+      bitcnt -= (unsigned int)(n); \
+   } while (0)
+
+#define FAIL(message) \
+   do { \
+      strm->msg = PNGZ_MSG_CAST(message); \
+      s->mode = BAD; \
+      goto next; \
+   } while (0)
+
+int /* PRIVATE */
+png_inflate_fast(png_structrp png_ptr, int flush)
+{
+   z_streamp strm = &png_ptr->zstream;
+   png_inflate_statep s = png_ptr->inflate_state;
+   png_const_bytep in = strm->next_in;
+   png_const_bytep in_end = in + strm->avail_in;
+   png_bytep out = strm->next_out;
+   png_bytep out_end = out + strm->avail_out;
+   png_bytep out_start = out, out_checked = out;
+   png_bytep history; /* matches can reach back to here in the buffer */
+   uint64_t bitbuf = s->bitbuf;
+   unsigned int bitcnt = s->bitcnt;
+   int ret = Z_OK;
+
+   PNG_UNUSED(flush) /* output is never held back */
+
+   if (s->whole != 0)
+   {
+      if (s->out_origin == NULL)
+         s->out_origin = s->out_last = out;
+
+      /* The caller moved the output elsewhere (png_read_finish_IDAT does
+       * this); carry on with a window made from the end of the old output.
+       */
+      if (out != s->out_last)
+      {
+         size_t n = (size_t)(s->out_last - s->out_origin);
+
+         if (n > WSIZE)
+            n = WSIZE;
+
+         s->wnext = s->whave = 0;
+         update_window(s, s->out_last - n, s->out_last);
+         s->whole = 0;
+      }
+   }
+
+   history = s->whole != 0 ? s->out_origin : out_start;
+
+   for (;;)
+   {
+      png_uint_32 e;
+
+      switch (s->mode)
+      {
+         case HEAD:
+#if ZLIB_VERNUM >= 0x1240
+            /* png_zlib_inflate looks at the window size in the first byte
+             * before zlib sees the header, so it goes first here too.
+             */
+            if (png_ptr->zstream_start != 0)
+            {
+               NEEDBITS(8);
+               if ((BITS(8) >> 4) > 7)
+                  FAIL("invalid window size (libpng)");
+
+               png_ptr->zstream_start = 0;
+            }
+#endif
+
+            NEEDBITS(16);
+            if (((BITS(8) << 8) + (BITS(16) >> 8)) % 31 != 0)
+               FAIL("incorrect header check");
+
+            if (BITS(4) != Z_DEFLATED)
+               FAIL("unknown compression method");
+
+            if ((BITS(8) >> 4) > 7)
+               FAIL("invalid window size");
+
+            if ((BITS(16) & 0x2000) != 0)
+            {
+               s->mode = BAD;
+               ret = Z_NEED_DICT;
+               goto leave;
+            }
+
+            DROPBITS(16);
+            s->mode = TYPE;
+            break;
+
+         case TYPE:
+            if (s->last != 0)
+            {
+               DROPBITS(bitcnt & 7);
+               s->mode = CHECK;
+               break;
+            }
+
+            NEEDBITS(3);
+            s->last = BITS(1);
+            switch (BITS(3) >> 1)
+            {
+               case 0:
+                  s->mode = STORED;
+                  break;
+
+               case 1:
+                  build_fixed(s);
+                  s->mode = LEN;
+                  break;
+
+               case 2:
+                  s->mode = TABLE;
+                  break;
+
+               default:
+                  FAIL("invalid block type");
+            }
+            DROPBITS(3);
+            break;
+
+         case STORED:
+            DROPBITS(bitcnt & 7);
+            NEEDBITS(32);
+            if ((BITS(16) ^ 0xffff) != (unsigned int)(bitbuf >> 16 & 0xffff))
+               FAIL("invalid stored block lengths");
+
+            s->length = BITS(16);
+            DROPBITS(32);
+            s->mode = COPY;
+            /* FALLTHROUGH */
+
+         case COPY:
+            /* Whole bytes left in the bit buffer come first */
+            if (s->length > 0 && bitcnt > 0)
+            {
+               if (out == out_end)
+                  goto leave;
+
+               *out++ = (png_byte)BITS(8);
+               DROPBITS(8);
+               s->length--;
+               break;
+            }
+
+            if (s->length > 0)
+            {
+               size_t n = s->length;
+
+               if (n > (size_t)(in_end - in))
+                  n = (size_t)(in_end - in);
+
+               if (n > (size_t)(out_end - out))
+                  n = (size_t)(out_end - out);
+
+               if (n == 0)
+                  goto leave;
+
+               memcpy(out, in, n);
+               in += n;
+               out += n;
+               s->length -= (unsigned int)n;
+               break;
+            }
+
+            s->mode = TYPE;
+            break;
+
+         case TABLE:
+            NEEDBITS(14);
+            s->nlen = BITS(5) + 257;
+            s->ndist = (BITS(10) >> 5) + 1;
+            s->ncode = (BITS(14) >> 10) + 4;
+            DROPBITS(14);
+            if (s->nlen > 286 || s->ndist > 30)
+               FAIL("too many length or distance symbols");
+
+            s->have = 0;
+            s->mode = LENLENS;
+            /* FALLTHROUGH */
+
+         case LENLENS:
+            while (s->have < s->ncode)
+            {
+               NEEDBITS(3);
+               s->lens[code_order[s->have++]] = (png_byte)BITS(3);
+               DROPBITS(3);
+            }
+
+            while (s->have < 19)
+               s->lens[code_order[s->have++]] = 0;
+
+            if (build_table(s->codes, CODES_BITS, 1U << CODES_BITS, s->lens,
+                19, CODES) != 0)
+               FAIL("invalid code lengths set");
+
+            s->have = 0;
+            s->mode = CODELENS;
+            /* FALLTHROUGH */
+
+         case CODELENS:
+            while (s->have < s->nlen + s->ndist)
+            {
+               unsigned int sym, bits, copy;
+               png_byte len;
+
+               for (;;)
+               {
+                  e = s->codes[BITS(CODES_BITS)];
+                  if (E_BITS(e) <= bitcnt)
+                     break;
+
+                  PULLBYTE();
+               }
+
+               sym = E_VALUE(e);
+               bits = E_BITS(e);
+               if (sym < 16)
+               {
+                  DROPBITS(bits);
+                  s->lens[s->have++] = (png_byte)sym;
+                  continue;
+               }
+
+               if (sym == 16)
+               {
+                  NEEDBITS(bits + 2);
+                  DROPBITS(bits);
+                  if (s->have == 0)
+                     FAIL("invalid bit length repeat");
+
+                  len = s->lens[s->have - 1];
+                  copy = 3 + BITS(2);
+                  DROPBITS(2);
+               }
+
+               else if (sym == 17)
+               {
+                  NEEDBITS(bits + 3);
+                  DROPBITS(bits);
+                  len = 0;
+                  copy = 3 + BITS(3);
+                  DROPBITS(3);
+               }
+
+               else
+               {
+                  NEEDBITS(bits + 7);
+                  DROPBITS(bits);
+                  len = 0;
+                  copy = 11 + BITS(7);
+                  DROPBITS(7);
+               }
+
+               if (s->have + copy > s->nlen + s->ndist)
+                  FAIL("invalid bit length repeat");
+
+               while (copy-- > 0)
+                  s->lens[s->have++] = len;
+            }
+
+            if (s->lens[256] == 0)
+               FAIL("invalid code -- missing end-of-block");
+
+            if (build_table(s->litlen, LITLEN_BITS, LITLEN_ENOUGH, s->lens,
+                s->nlen, LITLEN) != 0)
+               FAIL("invalid literal/lengths set");
+
+            if (build_table(s->distance, DIST_BITS, DIST_ENOUGH,
+                s->lens + s->nlen, s->ndist, DISTANCE) != 0)
+               FAIL("invalid distances set");
+
+            s->mode = LEN;
+            /* FALLTHROUGH */
+
+         case LEN:
+            if (in_end - in >= FAST_IN && out_end - out >= FAST_OUT)
+            {
+               /* The fast loop: whole symbols at a time with no checks on
+                * the input or output until the next one.
+                */
+               const png_uint_32 *litlen = s->litlen;
+               const png_uint_32 *distance = s->distance;
+               png_const_bytep in_fast = in_end - FAST_IN;
+               png_bytep out_fast = out_end - FAST_OUT;
+
+               do
+               {
+                  unsigned int len, dist;
+
+                  bitbuf |= load64(in) << bitcnt;
+                  in += (63 - bitcnt) >> 3;
+                  bitcnt |= 56;
+
+                  e = litlen[bitbuf & ((1U << LITLEN_BITS) - 1)];
+                  if ((e & E_SUB) != 0)
+                  {
+                     bitbuf >>= LITLEN_BITS;
+                     bitcnt -= LITLEN_BITS;
+                     e = litlen[E_VALUE(e) +
+                         ((unsigned int)bitbuf & ((1U << E_EXTRA(e)) - 1))];
+                  }
+
+                  if ((e & E_LIT) != 0)
+                  {
+                     bitbuf >>= E_BITS(e);
+                     bitcnt -= E_BITS(e);
+                     if ((e & E_PAIR) != 0)
+                     {
+                        out[0] = (png_byte)(e >> 16);
+                        out[1] = (png_byte)(e >> 24);
+                        out += 2;
+                     }
+
+                     else
+                        *out++ = (png_byte)(e >> 16);
+
+                     continue;
+                  }
+
+                  if ((e & E_EXC) != 0)
+                  {
+                     bitbuf >>= E_BITS(e);
+                     bitcnt -= E_BITS(e);
+                     if ((e & E_END) != 0)
+                     {
+                        s->mode = TYPE;
+                        break;
+                     }
+
+                     strm->msg = PNGZ_MSG_CAST("invalid literal/length code");
+                     s->mode = BAD;
+                     break;
+                  }
+
+                  bitbuf >>= E_BITS(e);
+                  bitcnt -= E_BITS(e);
+                  len = E_VALUE(e) +
+                      ((unsigned int)bitbuf & ((1U << E_EXTRA(e)) - 1));
+                  bitbuf >>= E_EXTRA(e);
+                  bitcnt -= E_EXTRA(e);
+
+                  e = distance[bitbuf & ((1U << DIST_BITS) - 1)];
+                  if ((e & E_SUB) != 0)
+                  {
+                     bitbuf >>= DIST_BITS;
+                     bitcnt -= DIST_BITS;
+                     e = distance[E_VALUE(e) +
+                         ((unsigned int)bitbuf & ((1U << E_EXTRA(e)) - 1))];
+                  }
+
+                  bitbuf >>= E_BITS(e);
+                  bitcnt -= E_BITS(e);
+                  if ((e & E_EXC) != 0)
+                  {
+                     strm->msg = PNGZ_MSG_CAST("invalid distance code");
+                     s->mode = BAD;
+                     break;
+                  }
+
+                  dist = E_VALUE(e) +
+                      ((unsigned int)bitbuf & ((1U << E_EXTRA(e)) - 1));
+                  bitbuf >>= E_EXTRA(e);
+                  bitcnt -= E_EXTRA(e);
+
+                  if (dist <= (size_t)(out - history))
+                     out = copy_fast(out, dist, len);
+
+                  else if (s->whole == 0 &&
+                      dist <= (size_t)(out - out_start) + s->whave)
+                     out = copy_slow(s, out, out_start, dist, len);
+
+                  else
+                  {
+                     strm->msg = PNGZ_MSG_CAST("invalid distance too far back");
+                     s->mode = BAD;
+                     break;
+                  }
+               }
+               while (in <= in_fast && out <= out_fast);
+
+               /* Give back the whole bytes still in the bit buffer, as many as
+                * came from this call's input; any left over from an earlier
+                * call stay where they are.
+                */
+               {
+                  size_t back = bitcnt >> 3;
+
+                  if (back > (size_t)(in - strm->next_in))
+                     back = (size_t)(in - strm->next_in);
+
+                  in -= back;
+                  bitcnt -= 8 * (unsigned int)back;
+                  bitbuf &= ((uint64_t)1 << bitcnt) - 1;
+               }
+               break;
+            }
+
+            e = lookup(s->litlen, LITLEN_BITS, bitbuf, bitcnt);
+            if (e == 0)
+            {
+               PULLBYTE();
+               break;
+            }
+
+            if ((e & E_LIT) != 0)
+            {
+               if (out == out_end)
+                  goto leave;
+
+               if ((e & E_PAIR) != 0 && out_end - out < 2)
+               {
+                  /* Only room for the first literal */
+                  *out++ = (png_byte)(e >> 16);
+                  DROPBITS(E_EXTRA(e));
+                  break;
+               }
+
+               *out++ = (png_byte)(e >> 16);
+               if ((e & E_PAIR) != 0)
+                  *out++ = (png_byte)(e >> 24);
+
+               DROPBITS(E_BITS(e));
+               break;
+            }
+
+            if ((e & E_EXC) != 0)
+            {
+               if ((e & E_END) == 0)
+                  FAIL("invalid literal/length code");
+
+               DROPBITS(E_BITS(e));
+               s->mode = TYPE;
+               break;
+            }
+
+            DROPBITS(E_BITS(e));
+            s->length = E_VALUE(e);
+            s->extra = E_EXTRA(e);
+            s->mode = LENEXT;
+            /* FALLTHROUGH */
+
+         case LENEXT:
+            NEEDBITS(s->extra);
+            s->length += BITS(s->extra);
+            DROPBITS(s->extra);
+            s->mode = DIST;
+            /* FALLTHROUGH */
+
+         case DIST:
+            while ((e = lookup(s->distance, DIST_BITS, bitbuf, bitcnt)) == 0)
+               PULLBYTE();
+
+            if ((e & E_EXC) != 0)
+               FAIL("invalid distance code");
+
+            DROPBITS(E_BITS(e));
+            s->dist = E_VALUE(e);
+            s->extra = E_EXTRA(e);
+            s->mode = DISTEXT;
+            /* FALLTHROUGH */
+
+         case DISTEXT:
+            NEEDBITS(s->extra);
+            s->dist += BITS(s->extra);
+            DROPBITS(s->extra);
+            s->mode = MATCH;
+            /* FALLTHROUGH */
+
+         case MATCH:
+         {
+            unsigned int n = s->length;
+
+            if (out == out_end)
+               goto leave;
+
+            /* Checked here, with room for the match, as zlib does */
+            if (s->dist > (size_t)(out - history) &&
+                (s->whole != 0 ||
+                 s->dist > (size_t)(out - out_start) + s->whave))
+               FAIL("invalid distance too far back");
+
+            if (n > (size_t)(out_end - out))
+               n = (unsigned int)(out_end - out);
+
+            out = copy_slow(s, out, history, s->dist, n);
+            s->length -= n;
+            if (s->length == 0)
+               s->mode = LEN;
+            break;
+         }
+
+         case CHECK:
+            NEEDBITS(32);
+            if (s->check != 0)
+            {
+               png_uint_32 stored = (png_uint_32)bitbuf;
+
+               stored = (stored >> 24) | ((stored >> 8) & 0xff00) |
+                   ((stored & 0xff00) << 8) | (stored << 24);
+
+               s->adler = (png_uint_32)adler32(s->adler, out_checked,
+                   (uInt)(out - out_checked));
+               out_checked = out;
+
+               if (stored != s->adler)
+                  FAIL("incorrect data check");
+            }
+
+            DROPBITS(32);
+            s->mode = DONE;
+            /* FALLTHROUGH */
+
+         case DONE:
+            ret = Z_STREAM_END;
+            goto leave;
+
+         case BAD:
+         default:
+            ret = Z_DATA_ERROR;
+            goto leave;
+      }
+   next:
+      ;
+   }
+
+leave:
+   if (s->check != 0 && out > out_checked)
+      s->adler = (png_uint_32)adler32(s->adler, out_checked,
+          (uInt)(out - out_checked));
+
+   if (s->whole != 0)
+      s->out_last = out;
+
+   else
+      update_window(s, out_start, out);
+
+   s->bitbuf = bitbuf;
+   s->bitcnt = bitcnt;
+
+   strm->total_in += (uLong)(in - strm->next_in);
+   strm->total_out += (uLong)(out - out_start);
+
+   if (ret == Z_OK && in == strm->next_in && out == out_start)
+      ret = Z_BUF_ERROR;
+
+   strm->next_in = png_constcast(png_bytep, in);
+   strm->avail_in = (uInt)(in_end - in);
+   strm->next_out = out;
+   strm->avail_out = (uInt)(out_end - out);
+
+   return ret;
+}
+
+#undef FAIL
+#undef DROPBITS
+#undef BITS
+#undef NEEDBITS
+#undef PULLBYTE
+#endif /* READ && PNG_INFLATE_FAST_OPT */
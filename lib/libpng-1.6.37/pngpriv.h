@@ -240,11 +240,59 @@
 
 #   if PNG_INTEL_SSE_IMPLEMENTATION > 0
 #      define PNG_FILTER_OPTIMIZATIONS png_init_filter_functions_sse2
+#      define PNG_WRITE_FILTER_OPTIMIZATIONS \
+          png_init_write_filter_functions_sse2
 #   endif
 #else
 #   define PNG_INTEL_SSE_IMPLEMENTATION 0
 #endif
 
+/* AVX2 code is compiled with a per-function target attribute and selected at
+ * run time, so it does not depend on the compiler being told to generate AVX2
+ * code for the whole library.
+ */
+#ifndef PNG_INTEL_AVX2_OPT
+#  if PNG_INTEL_SSE_IMPLEMENTATION > 0 && (defined(__AVX2__) || \
+      defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || \
+      (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+      (defined(_MSC_VER) && _MSC_VER >= 1800))
+#     define PNG_INTEL_AVX2_OPT 1
+#  else
+#     define PNG_INTEL_AVX2_OPT 0
+#  endif
+#endif
+
+#if PNG_INTEL_AVX2_OPT > 0
+#  if defined(__GNUC__) || defined(__clang__)
+#     define PNG_TARGET_AVX2 __attribute__((target("avx2")))
+#  else
+#     define PNG_TARGET_AVX2
+#  endif
+#endif
+
+/* The CRC-32 of chunk data can be folded with PCLMULQDQ.  Like AVX2 this is
+ * compiled with a target attribute and checked for at run time.
+ */
+#ifndef PNG_INTEL_PCLMUL_OPT
+#  if PNG_INTEL_SSE_IMPLEMENTATION > 0 && (defined(__PCLMUL__) || \
+      defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || \
+      (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+      (defined(_MSC_VER) && _MSC_VER >= 1600))
+#     define PNG_INTEL_PCLMUL_OPT 1
+#  else
+#     define PNG_INTEL_PCLMUL_OPT 0
+#  endif
+#endif
+
+#if PNG_INTEL_PCLMUL_OPT > 0
+#  define PNG_CRC32_OPTIMIZATIONS png_crc32_pclmul
+#  if defined(__GNUC__) || defined(__clang__)
+#     define PNG_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+#  else
+#     define PNG_TARGET_PCLMUL
+#  endif
+#endif
+
 #if PNG_MIPS_MSA_OPT > 0
 #  define PNG_FILTER_OPTIMIZATIONS png_init_filter_functions_msa
 #  ifndef PNG_MIPS_MSA_IMPLEMENTATION
@@ -270,6 +318,34 @@
 #  define PNG_POWERPC_VSX_IMPLEMENTATION 1
 #endif
 
+/* png_set_read_pipeline splits png_read_image over two threads.  This needs
+ * POSIX threads and the GCC/clang __atomic builtins; without them, or with
+ * PNG_READ_PIPELINE_OPT defined to 0, the setting is accepted and ignored.
+ */
+#ifndef PNG_READ_PIPELINE_OPT
+#  if defined(PNG_SEQUENTIAL_READ_SUPPORTED) && defined(__ATOMIC_ACQUIRE) && \
+      (defined(__unix__) || defined(__APPLE__))
+#     define PNG_READ_PIPELINE_OPT 1
+#  else
+#     define PNG_READ_PIPELINE_OPT 0
+#  endif
+#endif
+
+/* PNG_INFLATE_FAST_OPT inflates the image data with the decoder in
+ * pnginflate.c instead of zlib.  The build systems that compile pnginflate.c
+ * turn it on; the option PNG_USE_ZLIB_INFLATE turns it off at run time.
+ */
+#ifndef PNG_INFLATE_FAST_OPT
+#  define PNG_INFLATE_FAST_OPT 0
+#endif
+
+/* Up to this many bytes of image data are inflated into a single buffer
+ * rather than row by row, so that matches never have to come from a window.
+ */
+#ifndef PNG_INFLATE_WHOLE_MAX
+#  define PNG_INFLATE_WHOLE_MAX 0x4000000
+#endif
+
 
 /* Is this a build of a DLL where compilation of the object modules requires
  * different preprocessor settings to those required for a simple library?  If
@@ -877,6 +953,9 @@
 #define png_tRNS PNG_U32(116,  82,  78,  83)
 #define png_zTXt PNG_U32(122,  84,  88, 116)
 
+/* Private, unsafe to copy: the restart points of png_set_IDAT_segments */
+#define png_ixDT PNG_U32(105, 120,  68,  84)
+
 #ifdef PNG_APNG_SUPPORTED
 #define png_acTL PNG_U32( 97,  99,  84,  76)
 #define png_fcTL PNG_U32(102,  99,  84,  76)
@@ -1089,6 +1168,15 @@ PNG_INTERNAL_FUNCTION(void PNGCBAPI,png_default_flush,(png_structp png_ptr),
 /* Reset the CRC variable */
 PNG_INTERNAL_FUNCTION(void,png_reset_crc,(png_structrp png_ptr),PNG_EMPTY);
 
+#ifdef PNG_CRC32_OPTIMIZATIONS
+/* Fold as much of the buffer as the optimized code handles into *crc (a zlib
+ * style CRC, not inverted) and return the number of bytes used; the caller
+ * does the rest.  Only called with at least 64 bytes.
+ */
+PNG_INTERNAL_FUNCTION(size_t,PNG_CRC32_OPTIMIZATIONS,(png_uint_32p crc,
+   png_const_bytep ptr, size_t length),PNG_EMPTY);
+#endif
+
 /* Write the "data" buffer to whatever output you are using */
 PNG_INTERNAL_FUNCTION(void,png_write_data,(png_structrp png_ptr,
     png_const_bytep data, size_t length),PNG_EMPTY);
@@ -1101,6 +1189,14 @@ PNG_INTERNAL_FUNCTION(void,png_read_sig,(png_structrp png_ptr,
 PNG_INTERNAL_FUNCTION(png_uint_32,png_read_chunk_header,(png_structrp png_ptr),
    PNG_EMPTY);
 
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+/* The next length bytes of a png_set_read_memory input, which are consumed.
+ * Only call this when png_ptr->read_memory is set.
+ */
+PNG_INTERNAL_FUNCTION(png_const_bytep,png_read_memory_span,
+   (png_structrp png_ptr, size_t length),PNG_EMPTY);
+#endif
+
 /* Read data from whatever input you are using into the "data" buffer */
 PNG_INTERNAL_FUNCTION(void,png_read_data,(png_structrp png_ptr, png_bytep data,
     size_t length),PNG_EMPTY);
@@ -1296,6 +1392,14 @@ PNG_INTERNAL_FUNCTION(void,png_combine_row,(png_const_structrp png_ptr,
  */
 PNG_INTERNAL_FUNCTION(void,png_do_read_interlace,(png_row_infop row_info,
     png_bytep row, int pass, png_uint_32 transformations),PNG_EMPTY);
+
+/* The 'sparkle' png_combine_row for a row that has *not* been through
+ * png_do_read_interlace: the pixels of the pass are copied from the png_struct
+ * row buffer straight to their final places in 'row'.  Only done for whole
+ * byte pixels in passes 0 to 5; returns 0, having done nothing, otherwise.
+ */
+PNG_INTERNAL_FUNCTION(int,png_combine_row_pass,(png_const_structrp png_ptr,
+    png_bytep row),PNG_EMPTY);
 #endif
 
 /* GRR TO DO (2.0 or whenever):  simplify other internal calling interfaces */
@@ -1378,6 +1482,68 @@ PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth4_sse2,(png_row_infop
     row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
 #endif
 
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+PNG_INTERNAL_FUNCTION(int,png_intel_have_avx2,(void),PNG_EMPTY);
+   /* Run-time check for AVX2 support in both the CPU and the OS */
+#endif
+
+#if PNG_INTEL_AVX2_OPT > 0
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_up_avx2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_sub_avx2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_avg_avx2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth_avx2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+   /* Any pixel size up to 8 bytes for up and sub, 5 to 8 bytes for avg and
+    * paeth.
+    */
+#endif
+
+#if PNG_INTEL_PCLMUL_OPT > 0
+PNG_INTERNAL_FUNCTION(int,png_intel_have_pclmul,(void),PNG_EMPTY);
+   /* Run-time check for PCLMULQDQ */
+#endif
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_none_sse2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_sub_sse2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_up_sse2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_avg_sse2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_paeth_sse2,(size_t
+    row_bytes, unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+#endif
+
+#if PNG_INTEL_AVX2_OPT > 0
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_none_avx2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_sub_avx2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_up_avx2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_avg_avx2,(size_t row_bytes,
+    unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_write_filter_row_paeth_avx2,(size_t
+    row_bytes, unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+    png_bytep out, size_t lmins),PNG_EMPTY);
+#endif
+#endif /* WRITE_FILTER */
+
 /* Choose the best filter to use and filter the row data */
 PNG_INTERNAL_FUNCTION(void,png_write_find_filter,(png_structrp png_ptr,
     png_row_infop row_info),PNG_EMPTY);
@@ -1390,6 +1556,13 @@ PNG_INTERNAL_FUNCTION(void,png_read_IDAT_data,(png_structrp png_ptr,
     * case a benign error will be issued if the stream end is not found or if
     * extra data has to be consumed.
     */
+#if PNG_READ_PIPELINE_OPT > 0
+PNG_INTERNAL_FUNCTION(void,png_read_IDAT_stream,(png_structrp png_ptr,
+   png_bytep output, png_alloc_size_t size),PNG_EMPTY);
+   /* Copy the whole IDAT stream, 'size' bytes, to 'output' without inflating
+    * it and end the stream as png_read_IDAT_data does.
+    */
+#endif
 PNG_INTERNAL_FUNCTION(void,png_read_finish_IDAT,(png_structrp png_ptr),
    PNG_EMPTY);
    /* This cleans up when the IDAT LZ stream does not end when the last image
@@ -1407,11 +1580,32 @@ PNG_INTERNAL_FUNCTION(void,png_read_start_row,(png_structrp png_ptr),PNG_EMPTY);
 #if ZLIB_VERNUM >= 0x1240
 PNG_INTERNAL_FUNCTION(int,png_zlib_inflate,(png_structrp png_ptr, int flush),
       PNG_EMPTY);
-#  define PNG_INFLATE(pp, flush) png_zlib_inflate(pp, flush)
+#  define PNG_ZLIB_INFLATE(pp, flush) png_zlib_inflate(pp, flush)
 #else /* Zlib < 1.2.4 */
-#  define PNG_INFLATE(pp, flush) inflate(&(pp)->zstream, flush)
+#  define PNG_ZLIB_INFLATE(pp, flush) inflate(&(pp)->zstream, flush)
 #endif /* Zlib < 1.2.4 */
 
+#if PNG_INFLATE_FAST_OPT > 0
+/* In pnginflate.c.  png_inflate_fast works like inflate on png_ptr->zstream;
+ * png_inflate_fast_reset starts a new stream, allocating the state the first
+ * time, and returns Z_OK or Z_MEM_ERROR.  png_inflate_fast_whole says that all
+ * of the output of the stream goes to one buffer, from the next call on.
+ */
+PNG_INTERNAL_FUNCTION(int,png_inflate_fast_reset,(png_structrp png_ptr),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(int,png_inflate_fast,(png_structrp png_ptr, int flush),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_inflate_fast_whole,(png_structrp png_ptr),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_inflate_fast_destroy,(png_structrp png_ptr),
+   PNG_EMPTY);
+
+#  define PNG_INFLATE(pp, flush) ((pp)->zfast != 0 ? \
+      png_inflate_fast(pp, flush) : PNG_ZLIB_INFLATE(pp, flush))
+#else
+#  define PNG_INFLATE(pp, flush) PNG_ZLIB_INFLATE(pp, flush)
+#endif
+
 #ifdef PNG_READ_TRANSFORMS_SUPPORTED
 /* Optional call to update the users info structure */
 PNG_INTERNAL_FUNCTION(void,png_read_transform_info,(png_structrp png_ptr,
@@ -1550,6 +1744,11 @@ PNG_INTERNAL_FUNCTION(void,png_handle_zTXt,(png_structrp png_ptr,
     png_inforp info_ptr, png_uint_32 length),PNG_EMPTY);
 #endif
 
+#if PNG_READ_PIPELINE_OPT > 0
+PNG_INTERNAL_FUNCTION(void,png_handle_ixDT,(png_structrp png_ptr,
+    png_inforp info_ptr, png_uint_32 length),PNG_EMPTY);
+#endif
+
 PNG_INTERNAL_FUNCTION(void,png_check_chunk_name,(png_const_structrp png_ptr,
     png_uint_32 chunk_name),PNG_EMPTY);
 
@@ -2169,6 +2368,16 @@ PNG_INTERNAL_FUNCTION(void, png_init_filter_functions_sse2,
 #  endif
 #endif
 
+/* The same for the write side filters; these set up png_ptr->write_filter[]
+ * and are selected with PNG_WRITE_FILTER_OPTIMIZATIONS.
+ */
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+#  ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+PNG_INTERNAL_FUNCTION(void, PNG_WRITE_FILTER_OPTIMIZATIONS,
+   (png_structp png_ptr, unsigned int bpp), PNG_EMPTY);
+#  endif
+#endif
+
 PNG_INTERNAL_FUNCTION(png_uint_32, png_check_keyword, (png_structrp png_ptr,
    png_const_charp key, png_bytep new_key), PNG_EMPTY);
 
@@ -2195,6 +2404,53 @@ PNG_INTERNAL_FUNCTION(int,
                       PNG_EMPTY);
 #endif
 
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+/* Vector versions of row transformations.  Each does part of the row and
+ * returns how much; see intel/transform_intrinsics.c.
+ */
+#ifdef PNG_READ_EXPAND_SUPPORTED
+PNG_INTERNAL_FUNCTION(void,png_riffle_palette_intel,(png_structrp png_ptr),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_expand_palette_intel,
+   (png_structrp png_ptr, png_bytep row, png_uint_32 width, int channels),
+   PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_expand_gray_alpha_intel,
+   (png_bytep row, png_uint_32 width, unsigned int gray),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_expand_rgb_alpha_intel,
+   (png_bytep row, png_uint_32 width, png_const_color_16p trans_color),
+   PNG_EMPTY);
+#endif
+#ifdef PNG_READ_GRAY_TO_RGB_SUPPORTED
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_gray_to_rgb_intel,(png_bytep row,
+   png_uint_32 width, int alpha),PNG_EMPTY);
+#endif
+#ifdef PNG_READ_FILLER_SUPPORTED
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_read_filler_intel,(png_bytep row,
+   png_uint_32 width, int channels, png_byte filler, int after),PNG_EMPTY);
+#endif
+#ifdef PNG_READ_SWAP_ALPHA_SUPPORTED
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_read_swap_alpha_intel,(png_bytep row,
+   png_uint_32 width, int channels),PNG_EMPTY);
+#endif
+PNG_INTERNAL_FUNCTION(size_t,png_copy_1_of_2_intel,(png_bytep dp,
+   png_const_bytep sp, png_const_bytep ep),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(size_t,png_copy_3_of_4_intel,(png_bytep dp,
+   png_const_bytep sp, png_const_bytep ep),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_bgr_intel,(png_bytep row,
+   png_uint_32 width, int channels),PNG_EMPTY);
+
+#ifdef PNG_READ_INTERLACING_SUPPORTED
+/* Adam7 pixel replication and placement for 1, 3 and 4 byte pixels; see
+ * intel/interlace_intrinsics.c.
+ */
+PNG_INTERNAL_FUNCTION(png_uint_32,png_do_read_interlace_intel,(png_bytep row,
+   png_uint_32 width, unsigned int inc, unsigned int pixel_bytes),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_combine_row_pass_intel,(png_bytep dp,
+   png_const_bytep sp, png_uint_32 count, unsigned int inc,
+   unsigned int pixel_bytes),PNG_EMPTY);
+#endif
+#endif /* PNG_INTEL_SSE_IMPLEMENTATION > 0 */
+
 /* Maintainer: Put new private prototypes here ^ */
 
 #include "pngdebug.h"
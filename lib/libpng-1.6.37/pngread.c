@@ -15,6 +15,11 @@
  */
 
 #include "pngpriv.h"
+#if PNG_READ_PIPELINE_OPT > 0
+#  include <pthread.h>
+#  include <sched.h>
+#  include <unistd.h>
+#endif
 #if defined(PNG_SIMPLIFIED_READ_SUPPORTED) && defined(PNG_STDIO_SUPPORTED)
 #  include <errno.h>
 #endif
@@ -258,6 +263,11 @@ png_read_info(png_structrp png_ptr, png_inforp info_ptr)
          png_handle_iTXt(png_ptr, info_ptr, length);
 #endif
 
+#if PNG_READ_PIPELINE_OPT > 0
+      else if (chunk_name == png_ixDT)
+         png_handle_ixDT(png_ptr, info_ptr, length);
+#endif
+
 #ifdef PNG_READ_APNG_SUPPORTED
       else if (chunk_name == png_acTL)
          png_handle_acTL(png_ptr, info_ptr, length);
@@ -668,15 +678,22 @@ png_read_row(png_structrp png_ptr, png_bytep row, png_bytep dsp_row)
    if (png_ptr->interlaced != 0 &&
       (png_ptr->transformations & PNG_INTERLACE) != 0)
    {
-      if (png_ptr->pass < 6)
-         png_do_read_interlace(&row_info, png_ptr->row_buf + 1, png_ptr->pass,
-             png_ptr->transformations);
+      /* Only the 'blocky' display needs the row expanded; without it the
+       * pixels of the pass can be put straight where they belong.
+       */
+      if (dsp_row != NULL || row == NULL ||
+          png_combine_row_pass(png_ptr, row) == 0)
+      {
+         if (png_ptr->pass < 6)
+            png_do_read_interlace(&row_info, png_ptr->row_buf + 1,
+                png_ptr->pass, png_ptr->transformations);
 
-      if (dsp_row != NULL)
-         png_combine_row(png_ptr, dsp_row, 1/*display*/);
+         if (dsp_row != NULL)
+            png_combine_row(png_ptr, dsp_row, 1/*display*/);
 
-      if (row != NULL)
-         png_combine_row(png_ptr, row, 0/*row*/);
+         if (row != NULL)
+            png_combine_row(png_ptr, row, 0/*row*/);
+      }
    }
 
    else
@@ -764,6 +781,764 @@ png_read_rows(png_structrp png_ptr, png_bytepp row,
 #endif /* SEQUENTIAL_READ */
 
 #ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+void PNGAPI
+png_set_read_pipeline(png_structrp png_ptr, int enable)
+{
+   png_debug(1, "in png_set_read_pipeline");
+
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->read_pipeline = (png_byte)(enable != 0);
+}
+
+#if PNG_READ_PIPELINE_OPT > 0
+/* The pipelined png_read_image.  The calling thread inflates rows into a ring
+ * of row buffers and a worker thread takes them out to unfilter, transform and
+ * store them just as png_read_row does.  The ring has one producer and one
+ * consumer: 'inflated' is only written by the calling thread and 'taken' only
+ * by the worker, so acquire/release ordering on the two counters is the only
+ * synchronization needed.  The worker owns row_buf and prev_row, the calling
+ * thread the zstream and the input.
+ *
+ * png_error may only be called on the calling thread.  Errors there are
+ * caught to stop the worker before they are passed on; the worker cannot hit
+ * an error other than a bad filter byte, which it records before it stops.
+ */
+#define PNG_PIPELINE_SLOTS 16         /* rows in the ring */
+#define PNG_PIPELINE_MIN_BYTES 262144 /* smaller images are read serially */
+
+typedef struct
+{
+   png_structrp png_ptr;
+   png_bytepp image;      /* rows passed to png_read_image */
+   png_bytep ring;        /* PNG_PIPELINE_SLOTS rows of slot_size bytes */
+   size_t slot_size;      /* filter byte and row */
+   png_uint_32 end;       /* first row not read through the ring */
+   png_uint_32 inflated;  /* rows before this are in the ring */
+   png_uint_32 taken;     /* rows before this are out of the ring */
+   int stop;              /* set by the calling thread to end the worker */
+   int finished;          /* set by the worker when it returns */
+   png_const_charp error; /* why the worker stopped early */
+} png_read_pipeline;
+
+#define PIPE_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PIPE_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* Busy wait briefly, then give up the CPU */
+static void
+png_pipeline_pause(unsigned int *spins)
+{
+   if (++*spins > 64)
+      sched_yield();
+}
+
+static void *
+png_read_pipeline_worker(void *arg)
+{
+   png_read_pipeline *pipe = png_voidcast(png_read_pipeline *, arg);
+   png_structrp png_ptr = pipe->png_ptr;
+   png_uint_32 y;
+
+   for (y = PIPE_LOAD(pipe->taken); y < pipe->end; ++y)
+   {
+      png_row_info row_info;
+      unsigned int spins = 0;
+
+      while (PIPE_LOAD(pipe->inflated) <= y)
+      {
+         if (PIPE_LOAD(pipe->stop) != 0)
+            goto done;
+
+         png_pipeline_pause(&spins);
+      }
+
+      row_info.width = png_ptr->iwidth;
+      row_info.color_type = png_ptr->color_type;
+      row_info.bit_depth = png_ptr->bit_depth;
+      row_info.channels = png_ptr->channels;
+      row_info.pixel_depth = png_ptr->pixel_depth;
+      row_info.rowbytes = PNG_ROWBYTES(row_info.pixel_depth, row_info.width);
+
+      memcpy(png_ptr->row_buf, pipe->ring +
+          (y % PNG_PIPELINE_SLOTS) * pipe->slot_size, row_info.rowbytes + 1);
+      PIPE_STORE(pipe->taken, y + 1);
+
+      /* From here on as png_read_row */
+      if (png_ptr->row_buf[0] > PNG_FILTER_VALUE_NONE)
+      {
+         if (png_ptr->row_buf[0] < PNG_FILTER_VALUE_LAST)
+            png_read_filter_row(png_ptr, &row_info, png_ptr->row_buf + 1,
+                png_ptr->prev_row + 1, png_ptr->row_buf[0]);
+         else
+         {
+            pipe->error = "bad adaptive filter value";
+            break;
+         }
+      }
+
+      memcpy(png_ptr->prev_row, png_ptr->row_buf, row_info.rowbytes + 1);
+
+#ifdef PNG_MNG_FEATURES_SUPPORTED
+      if ((png_ptr->mng_features_permitted & PNG_FLAG_MNG_FILTER_64) != 0 &&
+          (png_ptr->filter_type == PNG_INTRAPIXEL_DIFFERENCING))
+         png_do_read_intrapixel(&row_info, png_ptr->row_buf + 1);
+#endif
+
+#ifdef PNG_READ_TRANSFORMS_SUPPORTED
+      if (png_ptr->transformations)
+         png_do_read_transformations(png_ptr, &row_info);
+#endif
+
+      /* The first row, read by png_read_row, set transformed_pixel_depth */
+      if (png_ptr->transformed_pixel_depth != row_info.pixel_depth)
+      {
+         pipe->error = "internal sequential row size calculation error";
+         break;
+      }
+
+      if (pipe->image[y] != NULL)
+         png_combine_row(png_ptr, pipe->image[y], -1/*ignored*/);
+   }
+
+done:
+   PIPE_STORE(pipe->finished, 1);
+   return NULL;
+}
+
+/* Returns the number of rows read, 0 if the image is not suitable.  The rest
+ * of the image is left to png_read_row.
+ */
+static png_uint_32
+png_read_image_pipelined(png_structrp png_ptr, png_bytepp image)
+{
+   png_read_pipeline pipe;
+   pthread_t worker;
+   png_uint_32 y;
+   size_t slot_size;
+#ifdef PNG_SETJMP_SUPPORTED
+   jmp_buf pipeline_jmpbuf;
+   jmp_buf *saved_jmpbuf;
+#endif
+
+   if (png_ptr->read_pipeline == 0 || png_ptr->interlaced != 0 ||
+       png_ptr->height < 3 || png_ptr->read_row_fn != NULL ||
+       (png_ptr->transformations & (PNG_USER_TRANSFORM | PNG_RGB_TO_GRAY_ERR |
+       PNG_RGB_TO_GRAY_WARN)) != 0)
+      return 0;
+
+   slot_size = PNG_ROWBYTES(png_ptr->pixel_depth, png_ptr->width) + 1;
+
+   if (slot_size * png_ptr->height < PNG_PIPELINE_MIN_BYTES)
+      return 0;
+
+#ifdef _SC_NPROCESSORS_ONLN
+   /* Two threads on one CPU only add switching */
+   if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+      return 0;
+#endif
+
+   /* The first row is read serially; this does all the lazy set up in
+    * png_read_row and png_read_filter_row and checks the row size.  The last
+    * row is too, as inflating it ends the IDAT stream, which changes
+    * png_struct::flags.
+    */
+   png_read_row(png_ptr, image[0], NULL);
+
+   memset(&pipe, 0, (sizeof pipe));
+   pipe.png_ptr = png_ptr;
+   pipe.image = image;
+   pipe.slot_size = slot_size;
+   pipe.end = png_ptr->height - 1;
+   pipe.inflated = 1;
+   pipe.taken = 1;
+   pipe.ring = png_voidcast(png_bytep, png_malloc_warn(png_ptr,
+       PNG_PIPELINE_SLOTS * slot_size));
+
+   if (pipe.ring == NULL)
+      return 1;
+
+   if (pthread_create(&worker, NULL, png_read_pipeline_worker, &pipe) != 0)
+   {
+      png_free(png_ptr, pipe.ring);
+      return 1;
+   }
+
+#ifdef PNG_SETJMP_SUPPORTED
+   saved_jmpbuf = png_ptr->jmp_buf_ptr;
+
+   if (setjmp(pipeline_jmpbuf) != 0)
+   {
+      /* png_error while inflating: stop the worker and pass the error on */
+      PIPE_STORE(pipe.stop, 1);
+      pthread_join(worker, NULL);
+      png_free(png_ptr, pipe.ring);
+      png_ptr->jmp_buf_ptr = saved_jmpbuf;
+      png_longjmp(png_ptr, 1);
+   }
+
+   if (saved_jmpbuf != NULL)
+      png_ptr->jmp_buf_ptr = &pipeline_jmpbuf;
+#endif
+
+   for (y = 1; y < pipe.end; ++y)
+   {
+      png_bytep slot = pipe.ring + (y % PNG_PIPELINE_SLOTS) * slot_size;
+      unsigned int spins = 0;
+
+      while (y - PIPE_LOAD(pipe.taken) >= PNG_PIPELINE_SLOTS &&
+          PIPE_LOAD(pipe.finished) == 0)
+         png_pipeline_pause(&spins);
+
+      if (PIPE_LOAD(pipe.finished) != 0)
+         break;
+
+      slot[0] = 255; /* to force error if no data was found */
+      png_read_IDAT_data(png_ptr, slot, slot_size);
+      PIPE_STORE(pipe.inflated, y + 1);
+   }
+
+   pthread_join(worker, NULL);
+   png_free(png_ptr, pipe.ring);
+
+#ifdef PNG_SETJMP_SUPPORTED
+   png_ptr->jmp_buf_ptr = saved_jmpbuf;
+#endif
+
+   if (pipe.error != NULL)
+      png_error(png_ptr, pipe.error);
+
+   png_ptr->row_number = pipe.end;
+
+   return pipe.end;
+}
+
+/* png_read_image for an image with an ixDT chunk.  The writer restarted
+ * deflate at the first row of each segment and did not filter that row against
+ * the one above, so the segments can be inflated and unfiltered independently.
+ * All the IDAT data is read first.  Worker threads then take the segments in
+ * order while the calling thread transforms and stores the rows of each
+ * segment once it is ready, inflating segments itself while it waits.
+ *
+ * png_error is only called on the calling thread.  A segment whose first row
+ * was filtered against the row above after all is unfiltered there, after the
+ * segment before it.  If a segment does not inflate to exactly its rows the
+ * index does not match the data, and the calling thread inflates the whole
+ * stream again with png_ptr->zstream, which reports any error as usual.
+ */
+#define PNG_SEGMENTS_MAX_THREADS 16
+
+#define PNG_SEGMENT_PENDING  0
+#define PNG_SEGMENT_DONE     1 /* inflated and unfiltered */
+#define PNG_SEGMENT_INFLATED 2 /* the first row needs the segment above */
+#define PNG_SEGMENT_BAD      3 /* does not match the index */
+
+typedef struct
+{
+   int state;             /* PNG_SEGMENT_ value */
+   uLong adler;           /* Adler-32 of the inflated data */
+} png_read_segment;
+
+typedef struct
+{
+   png_structrp png_ptr;
+   png_bytep stream;      /* the zlib stream from the IDAT chunks */
+   png_bytep rows;        /* filter byte and row, for every row */
+   size_t row_size;
+   png_read_segment *segment;
+   png_uint_32 next;      /* next segment to be inflated */
+   int stop;              /* set by the calling thread to end the workers */
+   int threads;           /* workers started */
+   pthread_t thread[PNG_SEGMENTS_MAX_THREADS];
+   z_stream zs;           /* raw inflate for the calling thread */
+   int zs_ready;
+} png_read_segments;
+
+/* Unfilter rows 'first' to 'end' - 1.  'prev_row' is the row above the first
+ * one, without the filter byte.  Returns 0 for a bad filter byte.
+ */
+static int
+png_read_segments_unfilter(png_read_segments *segs, png_uint_32 first,
+    png_uint_32 end, png_const_bytep prev_row)
+{
+   png_structrp png_ptr = segs->png_ptr;
+   png_bytep row = segs->rows + first * segs->row_size;
+   png_row_info row_info;
+
+   row_info.width = png_ptr->iwidth;
+   row_info.color_type = png_ptr->color_type;
+   row_info.bit_depth = png_ptr->bit_depth;
+   row_info.channels = png_ptr->channels;
+   row_info.pixel_depth = png_ptr->pixel_depth;
+   row_info.rowbytes = segs->row_size - 1;
+
+   for (; first < end; ++first, row += segs->row_size)
+   {
+      if (row[0] > PNG_FILTER_VALUE_NONE)
+      {
+         if (row[0] >= PNG_FILTER_VALUE_LAST)
+            return 0;
+
+         png_read_filter_row(png_ptr, &row_info, row + 1, prev_row, row[0]);
+      }
+
+      prev_row = row + 1;
+   }
+
+   return 1;
+}
+
+/* Inflate and unfilter segment 's' with 'zs', a raw inflate stream */
+static int
+png_read_segment_inflate(png_read_segments *segs, z_streamp zs, png_uint_32 s)
+{
+   png_structrp png_ptr = segs->png_ptr;
+   png_const_uint_32p index = png_ptr->idat_segments + 2 * s;
+   int last = s + 1 == png_ptr->idat_segment_count;
+   png_uint_32 first = index[0];
+   png_uint_32 end = last ? png_ptr->height : index[2];
+   png_uint_32 in = s == 0 ? 2 : index[1]; /* after the zlib header */
+   png_uint_32 in_end = last ? png_ptr->idat_stream_size : index[3];
+   png_bytep out = segs->rows + first * segs->row_size;
+   uInt size = (uInt)((end - first) * segs->row_size); /* checked to fit */
+   int ret;
+
+   if (zs == NULL || in >= in_end || inflateReset(zs) != Z_OK)
+      return PNG_SEGMENT_BAD;
+
+   zs->next_in = segs->stream + in;
+   zs->avail_in = in_end - in;
+   zs->next_out = out;
+   zs->avail_out = size;
+
+   if (last != 0)
+   {
+      ret = inflate(zs, Z_FINISH);
+
+      /* Only the Adler-32 of the whole stream may follow */
+      if (ret != Z_STREAM_END || zs->avail_out != 0 || zs->avail_in != 4)
+         return PNG_SEGMENT_BAD;
+   }
+
+   else
+   {
+      /* Stop at each block boundary; the segment must end on one, at a byte
+       * boundary, before the last block, as it does after Z_FULL_FLUSH.
+       */
+      do
+         ret = inflate(zs, Z_BLOCK);
+      while (ret == Z_OK && zs->avail_in > 0);
+
+      if (ret != Z_OK || zs->avail_out != 0 || zs->data_type != 128)
+         return PNG_SEGMENT_BAD;
+   }
+
+   segs->segment[s].adler = adler32(adler32(0, NULL, 0), out, size);
+
+   /* The image starts below a row of zeros, png_ptr->prev_row */
+   if (s > 0 && out[0] > PNG_FILTER_VALUE_SUB)
+      return PNG_SEGMENT_INFLATED;
+
+   if (png_read_segments_unfilter(segs, first, end,
+       png_ptr->prev_row + 1) == 0)
+      return PNG_SEGMENT_BAD;
+
+   return PNG_SEGMENT_DONE;
+}
+
+/* Take the next segment, if there is one.  Returns 0 once all are taken. */
+static int
+png_read_segments_take(png_read_segments *segs, z_streamp zs)
+{
+   png_uint_32 s;
+
+   if (PIPE_LOAD(segs->stop) != 0)
+      return 0;
+
+   s = __atomic_fetch_add(&segs->next, 1, __ATOMIC_ACQ_REL);
+
+   if (s >= segs->png_ptr->idat_segment_count)
+      return 0;
+
+   PIPE_STORE(segs->segment[s].state, png_read_segment_inflate(segs, zs, s));
+   return 1;
+}
+
+static void *
+png_read_segments_worker(void *arg)
+{
+   png_read_segments *segs = png_voidcast(png_read_segments *, arg);
+   z_stream zs;
+
+   /* zlib's own allocator: png_zalloc may call png_warning, which is only safe
+    * on the calling thread.  If this fails the calling thread does the work.
+    */
+   memset(&zs, 0, (sizeof zs));
+
+   if (inflateInit2(&zs, -15) == Z_OK)
+   {
+      while (png_read_segments_take(segs, &zs) != 0)
+         continue;
+
+      inflateEnd(&zs);
+   }
+
+   return NULL;
+}
+
+static void
+png_read_segments_stop(png_read_segments *segs)
+{
+   PIPE_STORE(segs->stop, 1);
+
+   while (segs->threads > 0)
+      pthread_join(segs->thread[--segs->threads], NULL);
+}
+
+static void
+png_read_segments_free(png_read_segments *segs)
+{
+   png_structrp png_ptr = segs->png_ptr;
+
+   png_read_segments_stop(segs);
+
+   if (segs->zs_ready != 0)
+      inflateEnd(&segs->zs);
+
+   png_free(png_ptr, segs->segment);
+   png_free(png_ptr, segs->stream);
+   png_free(png_ptr, segs->rows);
+}
+
+/* Transform and store one unfiltered row, as png_read_row does */
+static void
+png_read_segments_row(png_structrp png_ptr, png_const_bytep row,
+    png_bytep image_row)
+{
+   png_row_info row_info;
+
+   row_info.width = png_ptr->iwidth;
+   row_info.color_type = png_ptr->color_type;
+   row_info.bit_depth = png_ptr->bit_depth;
+   row_info.channels = png_ptr->channels;
+   row_info.pixel_depth = png_ptr->pixel_depth;
+   row_info.rowbytes = PNG_ROWBYTES(row_info.pixel_depth, row_info.width);
+
+   memcpy(png_ptr->row_buf, row, row_info.rowbytes + 1);
+
+#ifdef PNG_MNG_FEATURES_SUPPORTED
+   if ((png_ptr->mng_features_permitted & PNG_FLAG_MNG_FILTER_64) != 0 &&
+       (png_ptr->filter_type == PNG_INTRAPIXEL_DIFFERENCING))
+      png_do_read_intrapixel(&row_info, png_ptr->row_buf + 1);
+#endif
+
+#ifdef PNG_READ_TRANSFORMS_SUPPORTED
+   if (png_ptr->transformations)
+      png_do_read_transformations(png_ptr, &row_info);
+#endif
+
+   if (png_ptr->transformed_pixel_depth == 0)
+   {
+      png_ptr->transformed_pixel_depth = row_info.pixel_depth;
+      if (row_info.pixel_depth > png_ptr->maximum_pixel_depth)
+         png_error(png_ptr, "sequential row overflow");
+   }
+
+   else if (png_ptr->transformed_pixel_depth != row_info.pixel_depth)
+      png_error(png_ptr, "internal sequential row size calculation error");
+
+   if (image_row != NULL)
+      png_combine_row(png_ptr, image_row, -1/*ignored*/);
+}
+
+/* Inflate the whole stream on the calling thread into segs->rows */
+static void
+png_read_segments_serial(png_structrp png_ptr, png_read_segments *segs)
+{
+   png_bytep out = segs->rows;
+   png_alloc_size_t avail_out = segs->row_size * png_ptr->height;
+   int ret;
+
+   png_ptr->zstream.next_in = segs->stream;
+   png_ptr->zstream.avail_in = png_ptr->idat_stream_size;
+
+   do
+   {
+      uInt size = ZLIB_IO_MAX;
+
+      if (size > avail_out)
+         size = (uInt)avail_out;
+
+      png_ptr->zstream.next_out = out;
+      png_ptr->zstream.avail_out = size;
+      ret = PNG_INFLATE(png_ptr, Z_NO_FLUSH);
+      size -= png_ptr->zstream.avail_out;
+      out += size;
+      avail_out -= size;
+   } while (ret == Z_OK && avail_out > 0);
+
+   if (avail_out > 0)
+   {
+      png_ptr->zstream.avail_in = 0;
+
+      if (ret == Z_STREAM_END)
+         png_error(png_ptr, "Not enough image data");
+
+      png_zstream_error(png_ptr, ret);
+      png_chunk_error(png_ptr, png_ptr->zstream.msg);
+   }
+
+   if (png_read_segments_unfilter(segs, 0, png_ptr->height,
+       png_ptr->prev_row + 1) == 0)
+      png_error(png_ptr, "bad adaptive filter value");
+
+   /* As png_read_finish_IDAT, look for the end of the stream */
+   while (ret == Z_OK)
+   {
+      png_byte tmpbuf[PNG_INFLATE_BUF_SIZE];
+
+      png_ptr->zstream.next_out = tmpbuf;
+      png_ptr->zstream.avail_out = (sizeof tmpbuf);
+      ret = PNG_INFLATE(png_ptr, Z_NO_FLUSH);
+
+      if (png_ptr->zstream.avail_out < (sizeof tmpbuf))
+      {
+         png_chunk_benign_error(png_ptr, "Too much image data");
+         ret = Z_STREAM_END;
+      }
+   }
+
+   /* A bad check value, found here rather than with the last row */
+   if (ret != Z_STREAM_END)
+   {
+      png_zstream_error(png_ptr, ret);
+
+      if (ret != Z_BUF_ERROR)
+         png_chunk_error(png_ptr, png_ptr->zstream.msg);
+
+      png_chunk_benign_error(png_ptr, png_ptr->zstream.msg);
+   }
+
+   png_ptr->zstream.next_in = NULL;
+   png_ptr->zstream.avail_in = 0;
+   png_ptr->zstream.next_out = NULL;
+   png_ptr->zstream.avail_out = 0;
+
+}
+
+/* Returns the number of rows read, 0 if the image is not suitable */
+static png_uint_32
+png_read_image_segments(png_structrp png_ptr, png_bytepp image)
+{
+   png_read_segments segs;
+   png_uint_32 count = png_ptr->idat_segment_count;
+   volatile png_uint_32 done = 0; /* rows stored */
+   png_uint_32 s, y;
+   size_t row_size;
+   uLong adler;
+   long cpus = 2;
+   int threads;
+#ifdef PNG_SETJMP_SUPPORTED
+   jmp_buf segments_jmpbuf;
+   jmp_buf *saved_jmpbuf;
+#endif
+
+   if (png_ptr->read_pipeline == 0 || png_ptr->idat_segments == NULL ||
+       count < 2 || png_ptr->interlaced != 0 || png_ptr->row_number != 0 ||
+       png_ptr->zstream.avail_in != 0)
+      return 0;
+
+#ifdef PNG_READ_APNG_SUPPORTED
+   /* ixDT only describes the IDAT stream */
+   if (png_ptr->num_frames_read != 0)
+      return 0;
+#endif
+
+#ifdef _SC_NPROCESSORS_ONLN
+   cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (cpus < 2)
+      return 0;
+#endif
+
+   row_size = PNG_ROWBYTES(png_ptr->pixel_depth, png_ptr->width) + 1;
+
+   if (png_ptr->height > PNG_SIZE_MAX / row_size ||
+       row_size * png_ptr->height < PNG_PIPELINE_MIN_BYTES ||
+       (sizeof (png_read_segment)) > PNG_SIZE_MAX / count)
+      return 0;
+
+   /* Each segment is inflated with one call */
+   for (s = 0; s < count; ++s)
+   {
+      png_uint_32 end = s + 1 < count ? png_ptr->idat_segments[2 * s + 2] :
+          png_ptr->height;
+
+      if ((end - png_ptr->idat_segments[2 * s]) > ZLIB_IO_MAX / row_size)
+         return 0;
+   }
+
+   memset(&segs, 0, (sizeof segs));
+   segs.png_ptr = png_ptr;
+   segs.row_size = row_size;
+   segs.rows = png_voidcast(png_bytep, png_malloc_warn(png_ptr,
+       row_size * png_ptr->height));
+   segs.stream = png_voidcast(png_bytep, png_malloc_warn(png_ptr,
+       png_ptr->idat_stream_size));
+   segs.segment = png_voidcast(png_read_segment *, png_malloc_warn(png_ptr,
+       count * (sizeof (png_read_segment))));
+
+   if (segs.rows == NULL || segs.stream == NULL || segs.segment == NULL)
+   {
+      png_read_segments_free(&segs);
+      return 0;
+   }
+
+   memset(segs.segment, 0, count * (sizeof (png_read_segment)));
+   segs.zs_ready = inflateInit2(&segs.zs, -15) == Z_OK;
+
+#ifdef PNG_SETJMP_SUPPORTED
+   saved_jmpbuf = png_ptr->jmp_buf_ptr;
+
+   if (setjmp(segments_jmpbuf) != 0)
+   {
+      /* Stop the workers and pass the error on */
+      png_read_segments_free(&segs);
+      png_ptr->jmp_buf_ptr = saved_jmpbuf;
+      png_longjmp(png_ptr, 1);
+   }
+
+   if (saved_jmpbuf != NULL)
+      png_ptr->jmp_buf_ptr = &segments_jmpbuf;
+#endif
+
+   png_read_IDAT_stream(png_ptr, segs.stream, png_ptr->idat_stream_size);
+
+   /* The zlib header, which the serial inflate checks if this fails */
+   if (png_ptr->idat_stream_size >= 6 && (segs.stream[0] & 0x8f) == 0x08 &&
+       (segs.stream[1] & 0x20) == 0 &&
+       ((segs.stream[0] << 8) + segs.stream[1]) % 31 == 0)
+   {
+      png_row_info row_info;
+
+      /* Set up png_ptr->read_filter here, the workers only read it */
+      row_info.width = png_ptr->iwidth;
+      row_info.color_type = png_ptr->color_type;
+      row_info.bit_depth = png_ptr->bit_depth;
+      row_info.channels = png_ptr->channels;
+      row_info.pixel_depth = png_ptr->pixel_depth;
+      row_info.rowbytes = row_size - 1;
+      png_read_filter_row(png_ptr, &row_info, png_ptr->row_buf + 1,
+          png_ptr->prev_row + 1, PNG_FILTER_VALUE_UP);
+
+      /* The calling thread inflates too */
+      threads = cpus - 1 < PNG_SEGMENTS_MAX_THREADS ? (int)cpus - 1 :
+          PNG_SEGMENTS_MAX_THREADS;
+
+      if ((png_uint_32)threads > count - 1)
+         threads = (int)count - 1;
+
+      while (segs.threads < threads && pthread_create(
+          &segs.thread[segs.threads], NULL, png_read_segments_worker,
+          &segs) == 0)
+         ++segs.threads;
+
+      adler = adler32(0, NULL, 0);
+
+      for (s = 0; s < count; ++s)
+      {
+         png_uint_32 end = s + 1 < count ? png_ptr->idat_segments[2 * s + 2] :
+             png_ptr->height;
+         unsigned int spins = 0;
+         int state;
+
+         while ((state = PIPE_LOAD(segs.segment[s].state)) ==
+             PNG_SEGMENT_PENDING)
+         {
+            if (png_read_segments_take(&segs,
+                segs.zs_ready != 0 ? &segs.zs : NULL) == 0)
+               png_pipeline_pause(&spins);
+         }
+
+         if (state == PNG_SEGMENT_INFLATED &&
+             png_read_segments_unfilter(&segs, done, end,
+             segs.rows + (done - 1) * row_size + 1) == 0)
+            state = PNG_SEGMENT_BAD;
+
+         if (state == PNG_SEGMENT_BAD)
+            break;
+
+         adler = adler32_combine(adler, segs.segment[s].adler,
+             (z_off_t)((end - done) * row_size));
+
+         for (y = done; y < end; ++y)
+         {
+            png_read_segments_row(png_ptr, segs.rows + y * row_size, image[y]);
+
+            if (y + 1 < png_ptr->height)
+            {
+               png_ptr->row_number = y + 1;
+
+               if (png_ptr->read_row_fn != NULL)
+                  (*(png_ptr->read_row_fn))(png_ptr, y + 1, 0);
+            }
+         }
+
+         done = end;
+      }
+
+      png_read_segments_stop(&segs);
+
+      if (done == png_ptr->height &&
+          png_get_uint_32(segs.stream + png_ptr->idat_stream_size - 4) !=
+          (adler & 0xffffffffU))
+      {
+#if ZLIB_VERNUM >= 0x1290 && \
+   defined(PNG_SET_OPTION_SUPPORTED) && defined(PNG_IGNORE_ADLER32)
+         if (((png_ptr->options >> PNG_IGNORE_ADLER32) & 3) != PNG_OPTION_ON)
+#endif
+            png_chunk_error(png_ptr, "incorrect data check");
+      }
+   }
+
+   if (done < png_ptr->height)
+   {
+      /* Rows already stored are not stored again */
+      png_read_segments_serial(png_ptr, &segs);
+
+      for (y = done; y < png_ptr->height; ++y)
+      {
+         png_read_segments_row(png_ptr, segs.rows + y * row_size, image[y]);
+
+         if (y + 1 < png_ptr->height)
+         {
+            png_ptr->row_number = y + 1;
+
+            if (png_ptr->read_row_fn != NULL)
+               (*(png_ptr->read_row_fn))(png_ptr, y + 1, 0);
+         }
+      }
+   }
+
+   png_read_segments_free(&segs);
+
+#ifdef PNG_SETJMP_SUPPORTED
+   png_ptr->jmp_buf_ptr = saved_jmpbuf;
+#endif
+
+   /* The last row ends the IDAT data as in png_read_row */
+   png_read_finish_row(png_ptr);
+
+   if (png_ptr->read_row_fn != NULL)
+      (*(png_ptr->read_row_fn))(png_ptr, png_ptr->row_number, png_ptr->pass);
+
+   return png_ptr->height;
+}
+
+#undef PIPE_STORE
+#undef PIPE_LOAD
+#endif /* PNG_READ_PIPELINE_OPT */
+
 /* Read the entire image.  If the image has an alpha channel or a tRNS
  * chunk, and you have called png_handle_alpha()[*], you will need to
  * initialize the image to the current image that PNG will be overlaying.
@@ -828,7 +1603,19 @@ png_read_image(png_structrp png_ptr, png_bytepp image)
    for (j = 0; j < pass; j++)
    {
       rp = image;
-      for (i = 0; i < image_height; i++)
+      i = 0;
+#if PNG_READ_PIPELINE_OPT > 0
+      if (pass == 1)
+      {
+         i = png_read_image_segments(png_ptr, image);
+
+         if (i == 0)
+            i = png_read_image_pipelined(png_ptr, image);
+
+         rp += i;
+      }
+#endif
+      for (; i < image_height; i++)
       {
          png_read_row(png_ptr, *rp, NULL);
          rp++;
@@ -1058,6 +1845,17 @@ png_read_destroy(png_structrp png_ptr)
 
    inflateEnd(&png_ptr->zstream);
 
+#if PNG_INFLATE_FAST_OPT > 0
+   png_inflate_fast_destroy(png_ptr);
+#  ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+   png_free(png_ptr, png_ptr->idat_whole);
+   png_ptr->idat_whole = NULL;
+#  endif
+#endif
+
+   png_free(png_ptr, png_ptr->idat_segments);
+   png_ptr->idat_segments = NULL;
+
 #ifdef PNG_PROGRESSIVE_READ_SUPPORTED
    png_free(png_ptr, png_ptr->save_buffer);
    png_ptr->save_buffer = NULL;
@@ -1075,7 +1873,7 @@ png_read_destroy(png_structrp png_ptr)
 #endif
 
 #if defined(PNG_READ_EXPAND_SUPPORTED) && \
-    defined(PNG_ARM_NEON_IMPLEMENTATION)
+    (defined(PNG_ARM_NEON_IMPLEMENTATION) || PNG_INTEL_SSE_IMPLEMENTATION > 0)
    png_free(png_ptr, png_ptr->riffled_palette);
    png_ptr->riffled_palette = NULL;
 #endif
@@ -40,6 +40,29 @@ png_read_data(png_structrp png_ptr, png_bytep data, size_t length)
       png_error(png_ptr, "Call to NULL read function");
 }
 
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+/* The read function installed by png_set_read_memory */
+static void PNGCBAPI
+png_memory_read_data(png_structp png_ptr, png_bytep data, size_t length)
+{
+   memcpy(data, png_read_memory_span(png_ptr, length), length);
+}
+
+png_const_bytep /* PRIVATE */
+png_read_memory_span(png_structrp png_ptr, size_t length)
+{
+   png_const_bytep span;
+
+   if (length > png_ptr->read_memory_size - png_ptr->read_memory_pos)
+      png_error(png_ptr, "Read Error");
+
+   span = png_ptr->read_memory + png_ptr->read_memory_pos;
+   png_ptr->read_memory_pos += length;
+
+   return span;
+}
+#endif
+
 #ifdef PNG_STDIO_SUPPORTED
 /* This is the function that does the actual reading of data.  If you are
  * not reading from a standard C stream, you should create a replacement
@@ -116,5 +139,33 @@ png_set_read_fn(png_structrp png_ptr, png_voidp io_ptr,
 #ifdef PNG_WRITE_FLUSH_SUPPORTED
    png_ptr->output_flush_fn = NULL;
 #endif
+
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+   png_ptr->read_memory = NULL;
+#endif
 }
+
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+/* Read the PNG from size bytes at data, such as a memory mapped file, which
+ * must stay valid until reading is finished.  The image data is inflated
+ * directly from the memory and chunks that are not used are skipped without
+ * being copied; for these the CRC is only checked if an ancillary chunk CRC
+ * error is set to stop the read with png_set_crc_action.
+ */
+void PNGAPI
+png_set_read_memory(png_structrp png_ptr, png_const_voidp data, size_t size)
+{
+   if (png_ptr == NULL)
+      return;
+
+   if (data == NULL)
+      size = 0;
+
+   png_set_read_fn(png_ptr, NULL, png_memory_read_data);
+   png_ptr->read_memory = png_voidcast(png_const_bytep, data);
+   png_ptr->read_memory_size = size;
+   png_ptr->read_memory_pos = 0;
+   png_ptr->read_memory_chunk = 0;
+}
+#endif
 #endif /* READ */
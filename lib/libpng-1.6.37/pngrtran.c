@@ -2457,6 +2457,15 @@ png_do_chop(png_row_infop row_info, png_bytep row)
       png_bytep dp = row; /* destination */
       png_bytep ep = sp + row_info->rowbytes; /* end+1 */
 
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+      {
+         size_t done = png_copy_1_of_2_intel(dp, sp, ep);
+
+         dp += done;
+         sp += done << 1;
+      }
+#endif
+
       while (sp < ep)
       {
          *dp++ = *sp;
@@ -2486,9 +2495,14 @@ png_do_read_swap_alpha(png_row_infop row_info, png_bytep row)
          png_bytep sp = row + row_info->rowbytes;
          png_bytep dp = sp;
          png_byte save;
-         png_uint_32 i;
+         png_uint_32 i = 0;
 
-         for (i = 0; i < row_width; i++)
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+         /* This does the first pixels, the loop the rest from the end */
+         i = png_do_read_swap_alpha_intel(row, row_width, 4);
+#endif
+
+         for (; i < row_width; i++)
          {
             save = *(--sp);
             *(--dp) = *(--sp);
@@ -2532,9 +2546,14 @@ png_do_read_swap_alpha(png_row_infop row_info, png_bytep row)
          png_bytep sp = row + row_info->rowbytes;
          png_bytep dp = sp;
          png_byte save;
-         png_uint_32 i;
+         png_uint_32 i = 0;
 
-         for (i = 0; i < row_width; i++)
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+         /* This does the first pixels, the loop the rest from the end */
+         i = png_do_read_swap_alpha_intel(row, row_width, 2);
+#endif
+
+         for (; i < row_width; i++)
          {
             save = *(--sp);
             *(--dp) = *(--sp);
@@ -2693,7 +2712,20 @@ png_do_read_filler(png_row_infop row_info, png_bytep row,
             /* This changes the data from G to GX */
             png_bytep sp = row + (size_t)row_width;
             png_bytep dp =  sp + (size_t)row_width;
-            for (i = 1; i < row_width; i++)
+
+            i = 1;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            {
+               png_uint_32 done =
+                   png_do_read_filler_intel(row, row_width, 1, lo_filler, 1);
+
+               sp -= done;
+               dp -= (size_t)done << 1;
+               i += done;
+            }
+#endif
+
+            for (; i < row_width; i++)
             {
                *(--dp) = lo_filler;
                *(--dp) = *(--sp);
@@ -2709,7 +2741,15 @@ png_do_read_filler(png_row_infop row_info, png_bytep row,
             /* This changes the data from G to XG */
             png_bytep sp = row + (size_t)row_width;
             png_bytep dp = sp  + (size_t)row_width;
-            for (i = 0; i < row_width; i++)
+
+            i = 0;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_read_filler_intel(row, row_width, 1, lo_filler, 0);
+            sp -= i;
+            dp -= (size_t)i << 1;
+#endif
+
+            for (; i < row_width; i++)
             {
                *(--dp) = *(--sp);
                *(--dp) = lo_filler;
@@ -2770,7 +2810,20 @@ png_do_read_filler(png_row_infop row_info, png_bytep row,
             /* This changes the data from RGB to RGBX */
             png_bytep sp = row + (size_t)row_width * 3;
             png_bytep dp = sp  + (size_t)row_width;
-            for (i = 1; i < row_width; i++)
+
+            i = 1;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            {
+               png_uint_32 done =
+                   png_do_read_filler_intel(row, row_width, 3, lo_filler, 1);
+
+               sp -= (size_t)done * 3;
+               dp -= (size_t)done << 2;
+               i += done;
+            }
+#endif
+
+            for (; i < row_width; i++)
             {
                *(--dp) = lo_filler;
                *(--dp) = *(--sp);
@@ -2788,7 +2841,15 @@ png_do_read_filler(png_row_infop row_info, png_bytep row,
             /* This changes the data from RGB to XRGB */
             png_bytep sp = row + (size_t)row_width * 3;
             png_bytep dp = sp + (size_t)row_width;
-            for (i = 0; i < row_width; i++)
+
+            i = 0;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_read_filler_intel(row, row_width, 3, lo_filler, 0);
+            sp -= (size_t)i * 3;
+            dp -= (size_t)i << 2;
+#endif
+
+            for (; i < row_width; i++)
             {
                *(--dp) = *(--sp);
                *(--dp) = *(--sp);
@@ -2874,7 +2935,15 @@ png_do_gray_to_rgb(png_row_infop row_info, png_bytep row)
             /* This changes G to RGB */
             png_bytep sp = row + (size_t)row_width - 1;
             png_bytep dp = sp  + (size_t)row_width * 2;
-            for (i = 0; i < row_width; i++)
+
+            i = 0;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_gray_to_rgb_intel(row, row_width, 0);
+            sp -= i;
+            dp -= (size_t)i * 3;
+#endif
+
+            for (; i < row_width; i++)
             {
                *(dp--) = *sp;
                *(dp--) = *sp;
@@ -2906,7 +2975,15 @@ png_do_gray_to_rgb(png_row_infop row_info, png_bytep row)
             /* This changes GA to RGBA */
             png_bytep sp = row + (size_t)row_width * 2 - 1;
             png_bytep dp = sp  + (size_t)row_width * 2;
-            for (i = 0; i < row_width; i++)
+
+            i = 0;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_gray_to_rgb_intel(row, row_width, 1);
+            sp -= (size_t)i << 1;
+            dp -= (size_t)i << 2;
+#endif
+
+            for (; i < row_width; i++)
             {
                *(dp--) = *(sp--);
                *(dp--) = *sp;
@@ -4323,6 +4400,10 @@ png_do_expand_palette(png_structrp png_ptr, png_row_infop row_info,
                   i = png_do_expand_palette_rgba8_neon(png_ptr, row_info, row,
                       &sp, &dp);
                }
+#elif PNG_INTEL_SSE_IMPLEMENTATION > 0
+               i = png_do_expand_palette_intel(png_ptr, row, row_width, 4);
+               sp -= i;
+               dp -= (size_t)i << 2;
 #else
                PNG_UNUSED(png_ptr)
 #endif
@@ -4353,6 +4434,10 @@ png_do_expand_palette(png_structrp png_ptr, png_row_infop row_info,
 #ifdef PNG_ARM_NEON_INTRINSICS_AVAILABLE
                i = png_do_expand_palette_rgb8_neon(png_ptr, row_info, row,
                    &sp, &dp);
+#elif PNG_INTEL_SSE_IMPLEMENTATION > 0
+               i = png_do_expand_palette_intel(png_ptr, row, row_width, 3);
+               sp -= i;
+               dp -= (size_t)i * 3;
 #else
                PNG_UNUSED(png_ptr)
 #endif
@@ -4492,7 +4577,14 @@ png_do_expand(png_row_infop row_info, png_bytep row,
             sp = row + (size_t)row_width - 1;
             dp = row + ((size_t)row_width << 1) - 1;
 
-            for (i = 0; i < row_width; i++)
+            i = 0;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_expand_gray_alpha_intel(row, row_width, gray);
+            sp -= i;
+            dp -= (size_t)i << 1;
+#endif
+
+            for (; i < row_width; i++)
             {
                if ((*sp & 0xffU) == gray)
                   *dp-- = 0;
@@ -4547,7 +4639,15 @@ png_do_expand(png_row_infop row_info, png_bytep row,
          png_byte blue = (png_byte)(trans_color->blue & 0xff);
          sp = row + (size_t)row_info->rowbytes - 1;
          dp = row + ((size_t)row_width << 2) - 1;
-         for (i = 0; i < row_width; i++)
+
+         i = 0;
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+         i = png_do_expand_rgb_alpha_intel(row, row_width, trans_color);
+         sp -= (size_t)i * 3;
+         dp -= (size_t)i << 2;
+#endif
+
+         for (; i < row_width; i++)
          {
             if (*(sp - 2) == red && *(sp - 1) == green && *(sp) == blue)
                *dp-- = 0;
@@ -4782,6 +4882,16 @@ png_do_read_transformations(png_structrp png_ptr, png_row_infop row_info)
                png_riffle_palette_neon(png_ptr);
             }
          }
+#elif PNG_INTEL_SSE_IMPLEMENTATION > 0
+         if (png_ptr->riffled_palette == NULL)
+         {
+            /* Both the RGB and the RGBA expansion use this, and it is used
+             * whatever the bit depth, once the indices are unpacked to bytes.
+             */
+            png_ptr->riffled_palette =
+                (png_bytep)png_malloc(png_ptr, 256 * 4);
+            png_riffle_palette_intel(png_ptr);
+         }
 #endif
          png_do_expand_palette(png_ptr, row_info, png_ptr->row_buf + 1,
              png_ptr->palette, png_ptr->trans_alpha, png_ptr->num_trans);
@@ -184,6 +184,10 @@ png_read_chunk_header(png_structrp png_ptr)
    /* Check for too-large chunk length */
    png_check_chunk_length(png_ptr, length);
 
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+   png_ptr->read_memory_chunk = png_ptr->read_memory_pos;
+#endif
+
 #ifdef PNG_IO_STATE_SUPPORTED
    png_ptr->io_state = PNG_IO_READING | PNG_IO_CHUNK_DATA;
 #endif
@@ -210,6 +214,29 @@ png_crc_read(png_structrp png_ptr, png_bytep buf, png_uint_32 length)
 int /* PRIVATE */
 png_crc_finish(png_structrp png_ptr, png_uint_32 skip)
 {
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+   if (png_ptr->read_memory != NULL && skip > 0)
+   {
+      /* From memory the rest of the chunk is skipped, not copied.  If none
+       * of an ancillary chunk was used its CRC only matters when an error in
+       * it would stop the read, otherwise the CRC is not worked out at all.
+       */
+      int unused = png_ptr->read_memory_pos == png_ptr->read_memory_chunk;
+      png_const_bytep data = png_read_memory_span(png_ptr, skip);
+
+      if (unused != 0 && PNG_CHUNK_ANCILLARY(png_ptr->chunk_name) != 0 &&
+          (png_ptr->flags & PNG_FLAG_CRC_ANCILLARY_MASK) !=
+          PNG_FLAG_CRC_ANCILLARY_NOWARN)
+      {
+         (void)png_read_memory_span(png_ptr, 4);
+         return (0);
+      }
+
+      png_calculate_crc(png_ptr, data, skip);
+      skip = 0;
+   }
+#endif
+
    /* The size of the local buffer for inflate is a good guess as to a
     * reasonable size to use for buffering reads from the application.
     */
@@ -333,6 +360,32 @@ png_read_buffer(png_structrp png_ptr, png_alloc_size_t new_size, int warn)
 }
 #endif /* READ_iCCP|iTXt|pCAL|sCAL|sPLT|tEXt|zTXt|SEQUENTIAL_READ */
 
+/* The image data goes to png_inflate_fast unless the application asked for
+ * zlib or the state for it cannot be allocated.  Everything else is inflated
+ * by zlib.
+ */
+static void
+png_inflate_select(png_structrp png_ptr, png_uint_32 owner)
+{
+#if PNG_INFLATE_FAST_OPT > 0
+   png_ptr->zfast = 0;
+
+   if (owner != png_IDAT)
+      return;
+
+#  if defined(PNG_SET_OPTION_SUPPORTED) && defined(PNG_USE_ZLIB_INFLATE)
+   if (((png_ptr->options >> PNG_USE_ZLIB_INFLATE) & 3) == PNG_OPTION_ON)
+      return;
+#  endif
+
+   if (png_inflate_fast_reset(png_ptr) == Z_OK)
+      png_ptr->zfast = 1;
+#else
+   PNG_UNUSED(png_ptr)
+   PNG_UNUSED(owner)
+#endif
+}
+
 /* png_inflate_claim: claim the zstream for some nefarious purpose that involves
  * decompression.  Returns Z_OK on success, else a zlib error code.  It checks
  * the owner but, in final release builds, just issues a warning if some other
@@ -430,7 +483,10 @@ png_inflate_claim(png_structrp png_ptr, png_uint_32 owner)
 #endif
 
       if (ret == Z_OK)
+      {
          png_ptr->zowner = owner;
+         png_inflate_select(png_ptr, owner);
+      }
 
       else
          png_zstream_error(png_ptr, ret);
@@ -2862,6 +2918,96 @@ png_handle_iTXt(png_structrp png_ptr, png_inforp info_ptr, png_uint_32 length)
 }
 #endif
 
+#if PNG_READ_PIPELINE_OPT > 0
+/* ixDT, written by png_set_IDAT_segments, is the length of the zlib stream in
+ * the IDAT chunks followed by the row and the stream offset at which each
+ * segment starts.  The first segment starts at row 0 and offset 0.  The index
+ * is only kept if it is consistent; whether the segments really are
+ * independent is found out when they are inflated.
+ */
+void /* PRIVATE */
+png_handle_ixDT(png_structrp png_ptr, png_inforp info_ptr, png_uint_32 length)
+{
+   png_bytep buffer;
+   png_uint_32p segments;
+   png_uint_32 count, stream_size, i;
+
+   png_debug(1, "in png_handle_ixDT");
+
+   if ((png_ptr->mode & PNG_HAVE_IHDR) == 0)
+      png_chunk_error(png_ptr, "missing IHDR");
+
+   else if ((png_ptr->mode & PNG_HAVE_IDAT) != 0)
+   {
+      png_crc_finish(png_ptr, length);
+      png_chunk_benign_error(png_ptr, "out of place");
+      return;
+   }
+
+   else if (png_ptr->idat_segments != NULL)
+   {
+      png_crc_finish(png_ptr, length);
+      png_chunk_benign_error(png_ptr, "duplicate");
+      return;
+   }
+
+   count = length >= 12 ? (length - 4) / 8 : 0;
+
+   if (count == 0 || 4 + 8 * count != length || count > png_ptr->height)
+   {
+      png_crc_finish(png_ptr, length);
+      png_chunk_benign_error(png_ptr, "invalid");
+      return;
+   }
+
+   buffer = png_read_buffer(png_ptr, length, 2/*silent*/);
+
+   if (buffer == NULL)
+   {
+      png_crc_finish(png_ptr, length);
+      png_chunk_benign_error(png_ptr, "out of memory");
+      return;
+   }
+
+   png_crc_read(png_ptr, buffer, length);
+
+   if (png_crc_finish(png_ptr, 0) != 0)
+      return;
+
+   stream_size = png_get_uint_32(buffer);
+
+   for (i = 0; i < count; ++i)
+   {
+      png_uint_32 row = png_get_uint_32(buffer + 4 + 8 * i);
+      png_uint_32 offset = png_get_uint_32(buffer + 8 + 8 * i);
+
+      if (i == 0 ? row != 0 || offset != 0 :
+          row <= png_get_uint_32(buffer + 8 * i - 4) ||
+          row >= png_ptr->height ||
+          offset <= png_get_uint_32(buffer + 8 * i) || offset >= stream_size)
+      {
+         png_chunk_benign_error(png_ptr, "invalid");
+         return;
+      }
+   }
+
+   /* The array is the same size as the chunk data after the stream size */
+   segments = png_voidcast(png_uint_32p, png_malloc_warn(png_ptr, length - 4));
+
+   if (segments == NULL)
+      return;
+
+   for (i = 0; i < 2 * count; ++i)
+      segments[i] = png_get_uint_32(buffer + 4 + 4 * i);
+
+   png_ptr->idat_segments = segments;
+   png_ptr->idat_segment_count = count;
+   png_ptr->idat_stream_size = stream_size;
+
+   PNG_UNUSED(info_ptr)
+}
+#endif /* READ_PIPELINE_OPT */
+
 #ifdef PNG_READ_APNG_SUPPORTED
 void /* PRIVATE */
 png_handle_acTL(png_structp png_ptr, png_infop info_ptr, png_uint_32 length)
@@ -3858,6 +4004,75 @@ png_combine_row(png_const_structrp png_ptr, png_bytep dp, int display)
 }
 
 #ifdef PNG_READ_INTERLACING_SUPPORTED
+int /* PRIVATE */
+png_combine_row_pass(png_const_structrp png_ptr, png_bytep dp)
+{
+   unsigned int pixel_depth = png_ptr->transformed_pixel_depth;
+   unsigned int pass = png_ptr->pass;
+   png_const_bytep sp = png_ptr->row_buf + 1;
+   png_uint_32 count;
+   unsigned int inc;
+
+   png_debug(1, "in png_combine_row_pass");
+
+   if (pixel_depth < 8 || (pixel_depth & 7) != 0 || pass >= 6 ||
+       png_ptr->interlaced == 0 || (png_ptr->transformations & PNG_INTERLACE) == 0)
+      return 0;
+
+   /* As in png_combine_row */
+   if (png_ptr->info_rowbytes != 0 && png_ptr->info_rowbytes !=
+          PNG_ROWBYTES(pixel_depth, png_ptr->width))
+      png_error(png_ptr, "internal row size calculation error");
+
+   /* The pixels of the pass go to every inc'th pixel from the start column */
+   pixel_depth >>= 3; /* now in bytes */
+   count = PNG_PASS_COLS(png_ptr->width, pass);
+   inc = PNG_PASS_COL_OFFSET(pass);
+   dp += PNG_PASS_START_COL(pass) * pixel_depth;
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+   {
+      png_uint_32 done = png_combine_row_pass_intel(dp, sp, count, inc,
+          pixel_depth);
+
+      sp += (size_t)done * pixel_depth;
+      dp += (size_t)done * inc * pixel_depth;
+      count -= done;
+   }
+#endif
+
+   /* The common sizes are copied with a constant length */
+   switch (pixel_depth)
+   {
+      case 1:
+         for (; count > 0; --count, sp += 1, dp += inc)
+            *dp = *sp;
+         break;
+
+      case 2:
+         for (; count > 0; --count, sp += 2, dp += 2 * inc)
+            memcpy(dp, sp, 2);
+         break;
+
+      case 3:
+         for (; count > 0; --count, sp += 3, dp += 3 * inc)
+            memcpy(dp, sp, 3);
+         break;
+
+      case 4:
+         for (; count > 0; --count, sp += 4, dp += 4 * inc)
+            memcpy(dp, sp, 4);
+         break;
+
+      default:
+         for (; count > 0; --count, sp += pixel_depth, dp += pixel_depth * inc)
+            memcpy(dp, sp, pixel_depth);
+         break;
+   }
+
+   return 1;
+}
+
 void /* PRIVATE */
 png_do_read_interlace(png_row_infop row_info, png_bytep row, int pass,
     png_uint_32 transformations /* Because these may affect the byte layout */)
@@ -4075,9 +4290,17 @@ png_do_read_interlace(png_row_infop row_info, png_bytep row, int pass,
             png_bytep dp = row + (size_t)(final_width - 1) * pixel_bytes;
 
             int jstop = (int)png_pass_inc[pass];
-            png_uint_32 i;
+            png_uint_32 i = 0;
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            /* This does the last pixels, the loop the rest */
+            i = png_do_read_interlace_intel(row, row_info->width,
+                (unsigned int)jstop, (unsigned int)pixel_bytes);
+            sp -= (size_t)i * pixel_bytes;
+            dp -= (size_t)i * (unsigned int)jstop * pixel_bytes;
+#endif
 
-            for (i = 0; i < row_info->width; i++)
+            for (; i < row_info->width; i++)
             {
                png_byte v[8]; /* SAFE; pixel_depth does not exceed 64 */
                int j;
@@ -4323,88 +4546,247 @@ png_read_filter_row(png_structrp pp, png_row_infop row_info, png_bytep row,
 }
 
 #ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+/* Give the zstream the next part of the IDAT (or fdAT) data, reading chunk
+ * headers as required.
+ */
+static void
+png_read_IDAT_input(png_structrp png_ptr)
+{
+   uInt avail_in;
+   png_bytep buffer;
+#ifdef PNG_READ_APNG_SUPPORTED
+   png_uint_32 bytes_to_skip = 0;
+
+   while (png_ptr->idat_size == 0 || bytes_to_skip != 0)
+   {
+      png_crc_finish(png_ptr, bytes_to_skip);
+      bytes_to_skip = 0;
+
+      png_ptr->idat_size = png_read_chunk_header(png_ptr);
+      if (png_ptr->num_frames_read == 0)
+      {
+         if (png_ptr->chunk_name != png_IDAT)
+            png_error(png_ptr, "Not enough image data");
+      }
+      else
+      {
+         if (png_ptr->chunk_name == png_IEND)
+            png_error(png_ptr, "Not enough image data");
+         if (png_ptr->chunk_name != png_fdAT)
+         {
+            png_warning(png_ptr, "Skipped (ignored) a chunk "
+                                 "between APNG chunks");
+            bytes_to_skip = png_ptr->idat_size;
+            continue;
+         }
+
+         png_ensure_sequence_number(png_ptr, png_ptr->idat_size);
+
+         png_ptr->idat_size -= 4;
+      }
+   }
+#else
+   while (png_ptr->idat_size == 0)
+   {
+      png_crc_finish(png_ptr, 0);
+
+      png_ptr->idat_size = png_read_chunk_header(png_ptr);
+      /* This is an error even in the 'check' case because the code just
+       * consumed a non-IDAT header.
+       */
+      if (png_ptr->chunk_name != png_IDAT)
+         png_error(png_ptr, "Not enough image data");
+   }
+#endif /* PNG_READ_APNG_SUPPORTED */
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+   if (png_ptr->read_memory != NULL)
+   {
+      /* Inflate the whole chunk straight from the caller's memory */
+      avail_in = ZLIB_IO_MAX;
+
+      if (avail_in > png_ptr->idat_size)
+         avail_in = (uInt)png_ptr->idat_size;
+
+      buffer = png_constcast(png_bytep,
+          png_read_memory_span(png_ptr, avail_in));
+      png_calculate_crc(png_ptr, buffer, avail_in);
+   }
+
+   else
+#endif
+   {
+      avail_in = png_ptr->IDAT_read_size;
+
+      if (avail_in > png_ptr->idat_size)
+         avail_in = (uInt)png_ptr->idat_size;
+
+      /* A PNG with a gradually increasing IDAT size will defeat this
+       * attempt to minimize memory usage by causing lots of re-allocs,
+       * but realistically doing IDAT_read_size re-allocs is not likely
+       * to be a big problem.
+       */
+      buffer = png_read_buffer(png_ptr, avail_in, 0/*error*/);
+
+      png_crc_read(png_ptr, buffer, avail_in);
+   }
+
+   png_ptr->idat_size -= avail_in;
+
+   png_ptr->zstream.next_in = buffer;
+   png_ptr->zstream.avail_in = avail_in;
+}
+
+#if PNG_READ_PIPELINE_OPT > 0
 void /* PRIVATE */
-png_read_IDAT_data(png_structrp png_ptr, png_bytep output,
+png_read_IDAT_stream(png_structrp png_ptr, png_bytep output,
+    png_alloc_size_t size)
+{
+   while (size > 0)
+   {
+      uInt avail;
+
+      if (png_ptr->zstream.avail_in == 0)
+         png_read_IDAT_input(png_ptr);
+
+      avail = png_ptr->zstream.avail_in;
+
+      if (avail > size)
+         avail = (uInt)size;
+
+      memcpy(output, png_ptr->zstream.next_in, avail);
+      png_ptr->zstream.next_in += avail;
+      png_ptr->zstream.avail_in -= avail;
+      output += avail;
+      size -= avail;
+   }
+
+   png_ptr->mode |= PNG_AFTER_IDAT;
+   png_ptr->flags |= PNG_FLAG_ZSTREAM_ENDED;
+#ifdef PNG_READ_APNG_SUPPORTED
+   png_ptr->num_frames_read++;
+#endif
+
+   if (png_ptr->zstream.avail_in > 0 || png_ptr->idat_size > 0)
+      png_chunk_benign_error(png_ptr, "Extra compressed data");
+}
+#endif /* READ_PIPELINE_OPT */
+
+#if PNG_INFLATE_FAST_OPT > 0
+/* The image data of at most PNG_INFLATE_WHOLE_MAX bytes is inflated into one
+ * buffer, as far as each call needs, so that png_inflate_fast never has to keep
+ * a window.  An error is not reported until a row that needs the bad data is
+ * asked for; the rows before it are returned as usual.
+ */
+static void
+png_read_IDAT_whole(png_structrp png_ptr, png_bytep output,
     png_alloc_size_t avail_out)
 {
-   /* Loop reading IDATs and decompressing the result into output[avail_out] */
-   png_ptr->zstream.next_out = output;
-   png_ptr->zstream.avail_out = 0; /* safety: set below */
+   png_alloc_size_t need = png_ptr->idat_whole_next + avail_out;
 
-   if (output == NULL)
-      avail_out = 0;
+   if (need > png_ptr->idat_whole_size)
+      png_error(png_ptr, "Too much image data requested");
 
-   do
+   for (;;)
    {
+      png_alloc_size_t out;
       int ret;
-      png_byte tmpbuf[PNG_INFLATE_BUF_SIZE];
+
+      /* zlib finds an error just after the data of a row while inflating
+       * that row, so that is when it is reported.
+       */
+      if (png_ptr->idat_whole_ret != Z_OK &&
+          png_ptr->idat_whole_ret != Z_STREAM_END &&
+          png_ptr->idat_whole_have <= need)
+      {
+         png_zstream_error(png_ptr, png_ptr->idat_whole_ret);
+         png_chunk_error(png_ptr, png_ptr->zstream.msg);
+      }
+
+      if (png_ptr->idat_whole_have >= need)
+         break;
+
+      /* Not PNG_FLAG_ZSTREAM_ENDED, which the APNG frames leave set */
+      if (png_ptr->idat_whole_ret == Z_STREAM_END)
+         png_error(png_ptr, "Not enough image data");
 
       if (png_ptr->zstream.avail_in == 0)
+         png_read_IDAT_input(png_ptr);
+
+      out = png_ptr->idat_whole_size - png_ptr->idat_whole_have;
+      if (out > ZLIB_IO_MAX)
+         out = ZLIB_IO_MAX;
+
+      png_ptr->zstream.next_out = png_ptr->idat_whole +
+          png_ptr->idat_whole_have;
+      png_ptr->zstream.avail_out = (uInt)out;
+
+      ret = PNG_INFLATE(png_ptr, Z_NO_FLUSH);
+
+      png_ptr->idat_whole_have += out - png_ptr->zstream.avail_out;
+      png_ptr->zstream.avail_out = 0;
+
+      if (ret == Z_STREAM_END)
       {
-         uInt avail_in;
-         png_bytep buffer;
+         png_ptr->mode |= PNG_AFTER_IDAT;
+         png_ptr->flags |= PNG_FLAG_ZSTREAM_ENDED;
 #ifdef PNG_READ_APNG_SUPPORTED
-         png_uint_32 bytes_to_skip = 0;
-
-         while (png_ptr->idat_size == 0 || bytes_to_skip != 0)
-         {
-            png_crc_finish(png_ptr, bytes_to_skip);
-            bytes_to_skip = 0;
+         png_ptr->num_frames_read++;
+#endif
 
-            png_ptr->idat_size = png_read_chunk_header(png_ptr);
-            if (png_ptr->num_frames_read == 0)
-            {
-               if (png_ptr->chunk_name != png_IDAT)
-                  png_error(png_ptr, "Not enough image data");
-            }
-            else
-            {
-               if (png_ptr->chunk_name == png_IEND)
-                  png_error(png_ptr, "Not enough image data");
-               if (png_ptr->chunk_name != png_fdAT)
-               {
-                  png_warning(png_ptr, "Skipped (ignored) a chunk "
-                                       "between APNG chunks");
-                  bytes_to_skip = png_ptr->idat_size;
-                  continue;
-               }
+         if (png_ptr->zstream.avail_in > 0 || png_ptr->idat_size > 0)
+            png_chunk_benign_error(png_ptr, "Extra compressed data");
+      }
 
-               png_ensure_sequence_number(png_ptr, png_ptr->idat_size);
+      if (ret != Z_OK)
+         png_ptr->idat_whole_ret = ret;
+   }
 
-               png_ptr->idat_size -= 4;
-            }
-         }
-#else
-         while (png_ptr->idat_size == 0)
-         {
-            png_crc_finish(png_ptr, 0);
+   memcpy(output, png_ptr->idat_whole + png_ptr->idat_whole_next, avail_out);
+   png_ptr->idat_whole_next = need;
+}
+#endif /* PNG_INFLATE_FAST_OPT */
 
-            png_ptr->idat_size = png_read_chunk_header(png_ptr);
-            /* This is an error even in the 'check' case because the code just
-             * consumed a non-IDAT header.
-             */
-            if (png_ptr->chunk_name != png_IDAT)
-               png_error(png_ptr, "Not enough image data");
-         }
-#endif /* PNG_READ_APNG_SUPPORTED */
-         avail_in = png_ptr->IDAT_read_size;
+void /* PRIVATE */
+png_read_IDAT_data(png_structrp png_ptr, png_bytep output,
+    png_alloc_size_t avail_out)
+{
+   /* Loop reading IDATs and decompressing the result into output[avail_out] */
+   png_ptr->zstream.next_out = output;
+   png_ptr->zstream.avail_out = 0; /* safety: set below */
 
-         if (avail_in > png_ptr->idat_size)
-            avail_in = (uInt)png_ptr->idat_size;
+#if PNG_INFLATE_FAST_OPT > 0
+   if (output != NULL && png_ptr->idat_whole_size > 0)
+   {
+      if (png_ptr->idat_whole == NULL)
+      {
+         png_ptr->idat_whole = png_voidcast(png_bytep, png_malloc_warn(png_ptr,
+             png_ptr->idat_whole_size));
 
-         /* A PNG with a gradually increasing IDAT size will defeat this attempt
-          * to minimize memory usage by causing lots of re-allocs, but
-          * realistically doing IDAT_read_size re-allocs is not likely to be a
-          * big problem.
-          */
-         buffer = png_read_buffer(png_ptr, avail_in, 0/*error*/);
+         if (png_ptr->idat_whole != NULL)
+            png_inflate_fast_whole(png_ptr);
 
-         png_crc_read(png_ptr, buffer, avail_in);
-         png_ptr->idat_size -= avail_in;
+         else /* inflate row by row */
+            png_ptr->idat_whole_size = 0;
+      }
 
-         png_ptr->zstream.next_in = buffer;
-         png_ptr->zstream.avail_in = avail_in;
+      if (png_ptr->idat_whole != NULL)
+      {
+         png_read_IDAT_whole(png_ptr, output, avail_out);
+         return;
       }
+   }
+#endif
+
+   if (output == NULL)
+      avail_out = 0;
+
+   do
+   {
+      int ret;
+      png_byte tmpbuf[PNG_INFLATE_BUF_SIZE];
+
+      if (png_ptr->zstream.avail_in == 0)
+         png_read_IDAT_input(png_ptr);
 
       /* And set up the output side. */
       if (output != NULL) /* standard read */
@@ -4532,6 +4914,17 @@ png_read_finish_IDAT(png_structrp png_ptr)
        */
       (void)png_crc_finish(png_ptr, png_ptr->idat_size);
    }
+
+#if PNG_INFLATE_FAST_OPT > 0
+   if (png_ptr->idat_whole != NULL)
+   {
+      png_bytep buffer = png_ptr->idat_whole;
+
+      png_ptr->idat_whole = NULL;
+      png_ptr->idat_whole_size = 0;
+      png_free(png_ptr, buffer);
+   }
+#endif
 }
 
 void /* PRIVATE */
@@ -4888,6 +5281,53 @@ defined(PNG_USER_TRANSFORM_PTR_SUPPORTED)
    if (png_inflate_claim(png_ptr, png_IDAT) != Z_OK)
       png_error(png_ptr, png_ptr->zstream.msg);
 
+#if PNG_INFLATE_FAST_OPT > 0 && defined(PNG_SEQUENTIAL_READ_SUPPORTED)
+   /* The size of all the image data, filter bytes included, for
+    * png_read_IDAT_data to inflate in one go.
+    */
+   png_ptr->idat_whole_size = 0;
+   png_ptr->idat_whole_have = 0;
+   png_ptr->idat_whole_next = 0;
+   png_ptr->idat_whole_ret = Z_OK;
+
+   if (png_ptr->zfast != 0)
+   {
+      png_alloc_size_t size = 0;
+      int pass;
+
+      for (pass = 0; pass <= 6; pass++)
+      {
+         png_uint_32 rows = png_ptr->height;
+         png_uint_32 cols = png_ptr->width;
+
+         if (png_ptr->interlaced != 0)
+         {
+            rows = PNG_PASS_ROWS(rows, pass);
+            cols = PNG_PASS_COLS(cols, pass);
+         }
+
+         else if (pass > 0)
+            break;
+
+         if (rows > 0 && cols > 0)
+         {
+            png_alloc_size_t row_size =
+                PNG_ROWBYTES(png_ptr->pixel_depth, cols) + 1;
+
+            if (row_size > (PNG_INFLATE_WHOLE_MAX - size) / rows)
+            {
+               size = 0; /* too big */
+               break;
+            }
+
+            size += rows * row_size;
+         }
+      }
+
+      png_ptr->idat_whole_size = size;
+   }
+#endif
+
    png_ptr->flags |= PNG_FLAG_ROW_INIT;
 }
 
@@ -4958,6 +5398,7 @@ png_progressive_read_reset(png_structp png_ptr)
     png_ptr->flags &= ~PNG_FLAG_ZSTREAM_ENDED;
     if (inflateReset(&(png_ptr->zstream)) != Z_OK)
         png_error(png_ptr, "inflateReset failed");
+    png_inflate_select(png_ptr, png_IDAT);
     png_ptr->zstream.avail_in = 0;
     png_ptr->zstream.next_in = 0;
     png_ptr->zstream.next_out = png_ptr->row_buf;
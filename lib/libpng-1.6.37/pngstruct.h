@@ -68,6 +68,11 @@ typedef struct png_compression_buffer
    (offsetof(png_compression_buffer, output) + (pp)->zbuffer_size)
 #endif
 
+#if PNG_INFLATE_FAST_OPT > 0
+/* The state of png_inflate_fast, defined in pnginflate.c */
+typedef struct png_inflate_state *png_inflate_statep;
+#endif
+
 /* Colorspace support; structures used in png_struct, png_info and in internal
  * functions to hold and communicate information about the color space.
  *
@@ -181,6 +186,10 @@ struct png_struct_def
 
    png_uint_32 zowner;        /* ID (chunk type) of zstream owner, 0 if none */
    z_stream    zstream;       /* decompression structure */
+#if PNG_INFLATE_FAST_OPT > 0
+   png_byte    zfast;         /* zstream is inflated by png_inflate_fast */
+   png_inflate_statep inflate_state; /* allocated on first use */
+#endif
 
 #ifdef PNG_WRITE_SUPPORTED
    png_compression_bufferp zbuffer_list; /* Created on demand during write */
@@ -394,7 +403,7 @@ struct png_struct_def
 
 /* New member added in libpng-1.6.36 */
 #if defined(PNG_READ_EXPAND_SUPPORTED) && \
-    defined(PNG_ARM_NEON_IMPLEMENTATION)
+    (defined(PNG_ARM_NEON_IMPLEMENTATION) || PNG_INTEL_SSE_IMPLEMENTATION > 0)
    png_bytep riffled_palette; /* buffer for accelerated palette expansion */
 #endif
 
@@ -501,6 +510,56 @@ struct png_struct_def
    void (*read_filter[PNG_FILTER_VALUE_LAST-1])(png_row_infop row_info,
       png_bytep row, png_const_bytep prev_row);
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+   /* Write side counterpart of read_filter, indexed by PNG_FILTER_VALUE_; a
+    * NULL entry selects the generic code in pngwutil.c.  Each function filters
+    * 'row' against 'prev_row' into 'out' and returns the sum of absolute
+    * differences, it may return early once that exceeds 'lmins'.  The NONE
+    * entry only computes the sum and does not write 'out'.
+    */
+   size_t (*write_filter[PNG_FILTER_VALUE_LAST])(size_t row_bytes,
+      unsigned int bpp, png_const_bytep row, png_const_bytep prev_row,
+      png_bytep out, size_t lmins);
+   png_byte write_filter_bpp; /* bpp write_filter[] was set up for, or 0 */
+
+   /* State for png_set_filter_selection(PNG_FILTER_SELECTION_ENTROPY) */
+   png_uint_32p filter_hist;      /* byte counts of recently written rows */
+   png_uint_32 filter_hist_total; /* sum of filter_hist[] */
+   png_byte filter_selection;     /* PNG_FILTER_SELECTION_ value */
+   png_byte filter_prev;          /* filter value chosen for the last row */
+#endif
+
+#ifdef PNG_SEQUENTIAL_READ_SUPPORTED
+   png_byte read_pipeline; /* set by png_set_read_pipeline */
+
+   /* Input from png_set_read_memory */
+   png_const_bytep read_memory;  /* NULL unless reading from memory */
+   size_t read_memory_size;
+   size_t read_memory_pos;       /* next byte to read */
+   size_t read_memory_chunk;     /* start of the current chunk's data */
+
+#if PNG_INFLATE_FAST_OPT > 0
+   /* The image data inflated in one go, see png_read_IDAT_data */
+   png_bytep idat_whole;
+   png_alloc_size_t idat_whole_size; /* 0 if rows are inflated one by one */
+   png_alloc_size_t idat_whole_have; /* bytes inflated */
+   png_alloc_size_t idat_whole_next; /* bytes returned */
+   int idat_whole_ret;               /* deferred inflate error */
+#endif
+#endif
+
+   /* The IDAT restart points: the row and the offset in the zlib stream at
+    * which each segment starts, as read from or to be written to ixDT.
+    */
+   png_uint_32p idat_segments;     /* two entries per segment */
+   png_uint_32 idat_segment_count;
+   png_uint_32 idat_stream_size;   /* length of the zlib stream, from ixDT */
+#ifdef PNG_WRITE_SUPPORTED
+   png_uint_32 idat_segment_rows;  /* set by png_set_IDAT_segments */
+   png_compression_bufferp idat_hold; /* the IDAT data being held back ends
+                                       * in this buffer */
+#endif
+
 #ifdef PNG_READ_SUPPORTED
 #if defined(PNG_COLORSPACE_SUPPORTED) || defined(PNG_GAMMA_SUPPORTED)
    png_colorspace   colorspace;
@@ -518,6 +518,15 @@ png_do_strip_channel(png_row_infop row_info, png_bytep row, int at_start)
             sp += 2; ++dp;
          }
 
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+         {
+            size_t done = png_copy_1_of_2_intel(dp, sp, ep);
+
+            dp += done;
+            sp += done << 1;
+         }
+#endif
+
          /* For a 1 pixel wide image there is nothing to do */
          while (sp < ep)
          {
@@ -566,6 +575,15 @@ png_do_strip_channel(png_row_infop row_info, png_bytep row, int at_start)
             sp += 4; dp += 3;
          }
 
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+         {
+            size_t done = png_copy_3_of_4_intel(dp, sp, ep);
+
+            dp += done * 3;
+            sp += done << 2;
+         }
+#endif
+
          /* Note that the loop adds 3 to dp and 4 to sp each time. */
          while (sp < ep)
          {
@@ -628,9 +646,13 @@ png_do_bgr(png_row_infop row_info, png_bytep row)
          if (row_info->color_type == PNG_COLOR_TYPE_RGB)
          {
             png_bytep rp;
-            png_uint_32 i;
+            png_uint_32 i = 0;
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_bgr_intel(row, row_width, 3);
+#endif
 
-            for (i = 0, rp = row; i < row_width; i++, rp += 3)
+            for (rp = row + (size_t)i * 3; i < row_width; i++, rp += 3)
             {
                png_byte save = *rp;
                *rp = *(rp + 2);
@@ -641,9 +663,13 @@ png_do_bgr(png_row_infop row_info, png_bytep row)
          else if (row_info->color_type == PNG_COLOR_TYPE_RGB_ALPHA)
          {
             png_bytep rp;
-            png_uint_32 i;
+            png_uint_32 i = 0;
+
+#if PNG_INTEL_SSE_IMPLEMENTATION > 0
+            i = png_do_bgr_intel(row, row_width, 4);
+#endif
 
-            for (i = 0, rp = row; i < row_width; i++, rp += 4)
+            for (rp = row + ((size_t)i << 2); i < row_width; i++, rp += 4)
             {
                png_byte save = *rp;
                *rp = *(rp + 2);
@@ -961,11 +961,16 @@ png_write_destroy(png_structrp png_ptr)
    png_free(png_ptr, png_ptr->prev_row);
    png_free(png_ptr, png_ptr->try_row);
    png_free(png_ptr, png_ptr->tst_row);
+   png_free(png_ptr, png_ptr->filter_hist);
    png_ptr->prev_row = NULL;
    png_ptr->try_row = NULL;
    png_ptr->tst_row = NULL;
+   png_ptr->filter_hist = NULL;
 #endif
 
+   png_free(png_ptr, png_ptr->idat_segments);
+   png_ptr->idat_segments = NULL;
+
 #ifdef PNG_SET_UNKNOWN_CHUNKS_SUPPORTED
    png_free(png_ptr, png_ptr->chunk_list);
    png_ptr->chunk_list = NULL;
@@ -1131,6 +1136,36 @@ png_set_filter(png_structrp png_ptr, int method, int filters)
       png_error(png_ptr, "Unknown custom filter method");
 }
 
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+void PNGAPI
+png_set_filter_selection(png_structrp png_ptr, int method)
+{
+   png_debug(1, "in png_set_filter_selection");
+
+   if (png_ptr == NULL)
+      return;
+
+   if (method < 0 || method >= PNG_FILTER_SELECTION_LAST)
+   {
+      png_app_error(png_ptr, "Unknown filter selection method");
+      return;
+   }
+
+   png_ptr->filter_selection = (png_byte)method;
+}
+#endif /* WRITE_FILTER */
+
+void PNGAPI
+png_set_IDAT_segments(png_structrp png_ptr, png_uint_32 rows)
+{
+   png_debug(1, "in png_set_IDAT_segments");
+
+   if (png_ptr == NULL)
+      return;
+
+   png_ptr->idat_segment_rows = rows;
+}
+
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED /* DEPRECATED */
 /* Provide floating and fixed point APIs */
 #ifdef PNG_FLOATING_POINT_SUPPORTED
@@ -915,6 +915,82 @@ png_write_PLTE(png_structrp png_ptr, png_const_colorp palette,
    png_ptr->mode |= PNG_HAVE_PLTE;
 }
 
+/* With png_set_IDAT_segments the IDAT data is held in png_ptr->zbuffer_list,
+ * up to and including png_ptr->idat_hold, until the image is finished, so that
+ * ixDT can be written before it.  This returns the next buffer to fill.
+ */
+static png_bytep
+png_write_IDAT_hold(png_structrp png_ptr)
+{
+   png_compression_bufferp next = png_ptr->idat_hold->next;
+
+   if (next == NULL)
+   {
+      next = png_voidcast(png_compression_bufferp,
+          png_malloc(png_ptr, PNG_COMPRESSION_BUFFER_SIZE(png_ptr)));
+      next->next = NULL;
+      png_ptr->idat_hold->next = next;
+   }
+
+   png_ptr->idat_hold = next;
+   return next->output;
+}
+
+/* Write ixDT and then the held IDAT data.  ixDT is the length of the zlib
+ * stream followed by the first row and the stream offset of each segment.
+ */
+static void
+png_write_IDAT_segments(png_structrp png_ptr)
+{
+   png_compression_bufferp next = png_ptr->zbuffer_list;
+   png_uint_32 count = png_ptr->idat_segment_count;
+
+   if (count > 1 && png_ptr->zstream.total_out <= PNG_UINT_31_MAX)
+   {
+      png_byte buf[8];
+      png_uint_32 i;
+
+      png_write_chunk_header(png_ptr, png_ixDT, 4 + 8 * count);
+      png_save_uint_32(buf, (png_uint_32)png_ptr->zstream.total_out);
+      png_write_chunk_data(png_ptr, buf, 4);
+
+      for (i = 0; i < count; ++i)
+      {
+         png_save_uint_32(buf, png_ptr->idat_segments[2 * i]);
+         png_save_uint_32(buf + 4, png_ptr->idat_segments[2 * i + 1]);
+         png_write_chunk_data(png_ptr, buf, 8);
+      }
+
+      png_write_chunk_end(png_ptr);
+   }
+
+#ifdef PNG_WRITE_OPTIMIZE_CMF_SUPPORTED
+   if (png_ptr->compression_type == PNG_COMPRESSION_TYPE_BASE)
+      optimize_cmf(next->output, png_image_size(png_ptr));
+#endif
+
+   for (;;)
+   {
+      uInt size = png_ptr->zbuffer_size;
+
+      if (next == png_ptr->idat_hold)
+         size -= png_ptr->zstream.avail_out;
+
+      if (size > 0)
+         png_write_complete_chunk(png_ptr, png_IDAT, next->output, size);
+
+      if (next == png_ptr->idat_hold)
+         break;
+
+      next = next->next;
+   }
+
+   png_free_buffer_list(png_ptr, &png_ptr->zbuffer_list->next);
+   png_free(png_ptr, png_ptr->idat_segments);
+   png_ptr->idat_segments = NULL;
+   png_ptr->idat_hold = NULL;
+}
+
 /* This is similar to png_text_compress, above, except that it does not require
  * all of the data at once and, instead of buffering the compressed result,
  * writes it as IDAT chunks.  Unlike png_text_compress it *can* png_error out
@@ -926,6 +1002,8 @@ png_write_PLTE(png_structrp png_ptr, png_const_colorp palette,
  *
  * Z_NO_FLUSH: normal incremental output of compressed data
  * Z_SYNC_FLUSH: do a SYNC_FLUSH, used by png_write_flush
+ * Z_FULL_FLUSH: as SYNC_FLUSH but also reset the dictionary, used to start
+ *               a segment for png_set_IDAT_segments
  * Z_FINISH: this is the end of the input, do a Z_FINISH and clean up
  *
  * The routine manages the acquire and release of the png_ptr->zstream by
@@ -962,6 +1040,7 @@ png_compress_IDAT(png_structrp png_ptr, png_const_bytep input,
        */
       png_ptr->zstream.next_out = png_ptr->zbuffer_list->output;
       png_ptr->zstream.avail_out = png_ptr->zbuffer_size;
+      png_ptr->idat_hold = png_ptr->zbuffer_list;
    }
 
    /* Now loop reading and writing until all the input is consumed or an error
@@ -998,9 +1077,14 @@ png_compress_IDAT(png_structrp png_ptr, png_const_bytep input,
          png_bytep data = png_ptr->zbuffer_list->output;
          uInt size = png_ptr->zbuffer_size;
 
-         /* Write an IDAT containing the data then reset the buffer.  The
-          * first IDAT may need deflate header optimization.
-          */
+         if (png_ptr->idat_segments != NULL)
+            data = png_write_IDAT_hold(png_ptr);
+
+         else
+         {
+            /* Write an IDAT containing the data then reset the buffer.  The
+             * first IDAT may need deflate header optimization.
+             */
 #ifdef PNG_WRITE_OPTIMIZE_CMF_SUPPORTED
             if ((png_ptr->mode & PNG_HAVE_IDAT) == 0 &&
                 png_ptr->compression_type == PNG_COMPRESSION_TYPE_BASE)
@@ -1018,7 +1102,8 @@ png_compress_IDAT(png_structrp png_ptr, png_const_bytep input,
                   png_write_fdAT(png_ptr, data, size);
             }
 #endif /* PNG_WRITE_APNG_SUPPORTED */
-         png_ptr->mode |= PNG_HAVE_IDAT;
+            png_ptr->mode |= PNG_HAVE_IDAT;
+         }
 
          png_ptr->zstream.next_out = data;
          png_ptr->zstream.avail_out = size;
@@ -1054,26 +1139,32 @@ png_compress_IDAT(png_structrp png_ptr, png_const_bytep input,
          /* This is the end of the IDAT data; any pending output must be
           * flushed.  For small PNG files we may still be at the beginning.
           */
-         png_bytep data = png_ptr->zbuffer_list->output;
-         uInt size = png_ptr->zbuffer_size - png_ptr->zstream.avail_out;
+         if (png_ptr->idat_segments != NULL)
+            png_write_IDAT_segments(png_ptr);
+
+         else
+         {
+            png_bytep data = png_ptr->zbuffer_list->output;
+            uInt size = png_ptr->zbuffer_size - png_ptr->zstream.avail_out;
 
 #ifdef PNG_WRITE_OPTIMIZE_CMF_SUPPORTED
-         if ((png_ptr->mode & PNG_HAVE_IDAT) == 0 &&
-             png_ptr->compression_type == PNG_COMPRESSION_TYPE_BASE)
-            optimize_cmf(data, png_image_size(png_ptr));
+            if ((png_ptr->mode & PNG_HAVE_IDAT) == 0 &&
+                png_ptr->compression_type == PNG_COMPRESSION_TYPE_BASE)
+               optimize_cmf(data, png_image_size(png_ptr));
 #endif
 
-         if (size > 0)
+            if (size > 0)
 #ifdef PNG_WRITE_APNG_SUPPORTED
-         {
-            if (png_ptr->num_frames_written == 0)
+            {
+               if (png_ptr->num_frames_written == 0)
 #endif
-            png_write_complete_chunk(png_ptr, png_IDAT, data, size);
+               png_write_complete_chunk(png_ptr, png_IDAT, data, size);
 #ifdef PNG_WRITE_APNG_SUPPORTED
-            else
-               png_write_fdAT(png_ptr, data, size);
-         }
+               else
+                  png_write_fdAT(png_ptr, data, size);
+            }
 #endif /* PNG_WRITE_APNG_SUPPORTED */
+         }
 
          png_ptr->zstream.avail_out = 0;
          png_ptr->zstream.next_out = NULL;
@@ -2098,6 +2189,23 @@ png_write_start_row(png_structrp png_ptr)
       png_ptr->num_rows = png_ptr->height;
       png_ptr->usr_width = png_ptr->width;
    }
+
+   /* Independent segments for png_set_IDAT_segments, as many as fit in ixDT */
+   png_free(png_ptr, png_ptr->idat_segments);
+   png_ptr->idat_segments = NULL;
+   png_ptr->idat_segment_count = 0;
+
+   if (png_ptr->idat_segment_rows > 0 && png_ptr->interlaced == 0 &&
+       png_ptr->height > png_ptr->idat_segment_rows &&
+       (png_ptr->height - 1) / png_ptr->idat_segment_rows <
+       (PNG_UINT_31_MAX - 4) / 8
+#ifdef PNG_WRITE_APNG_SUPPORTED
+       && png_ptr->num_frames_written == 0
+#endif
+       )
+      png_ptr->idat_segments = png_voidcast(png_uint_32p, png_malloc(png_ptr,
+          ((png_ptr->height - 1) / png_ptr->idat_segment_rows + 1) *
+          2 * (sizeof (png_uint_32))));
 }
 
 /* Internal use only.  Called when finished processing a row of data. */
@@ -2375,6 +2483,37 @@ png_write_filtered_row(png_structrp png_ptr, png_bytep filtered_row,
     size_t row_bytes);
 
 #ifdef PNG_WRITE_FILTER_SUPPORTED
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+static void
+png_init_write_filter_functions(png_structrp png_ptr, png_uint_32 bpp)
+   /* Like png_init_filter_functions in pngrutil.c, the function named by
+    * PNG_WRITE_FILTER_OPTIMIZATIONS replaces entries of png_ptr->write_filter[]
+    * with hardware specific versions.  Those left NULL use the code below.
+    * This is repeated if the pixel size changes.
+    */
+{
+   int i;
+
+   for (i = 0; i < PNG_FILTER_VALUE_LAST; i++)
+      png_ptr->write_filter[i] = NULL;
+
+   png_ptr->write_filter_bpp = (png_byte)bpp;
+
+   PNG_WRITE_FILTER_OPTIMIZATIONS(png_ptr, bpp);
+}
+
+static size_t
+png_write_filter_opt(png_structrp png_ptr, int filter, size_t row_bytes,
+    size_t lmins)
+{
+   /* prev_row is only allocated when a filter that needs it is enabled */
+   return png_ptr->write_filter[filter](row_bytes, png_ptr->write_filter_bpp,
+       png_ptr->row_buf + 1,
+       png_ptr->prev_row != NULL ? png_ptr->prev_row + 1 : NULL,
+       png_ptr->try_row + 1, lmins);
+}
+#endif /* WRITE_FILTER_OPTIMIZATIONS */
+
 static size_t /* PRIVATE */
 png_setup_sub_row(png_structrp png_ptr, png_uint_32 bpp,
     size_t row_bytes, size_t lmins)
@@ -2386,6 +2525,12 @@ png_setup_sub_row(png_structrp png_ptr, png_uint_32 bpp,
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_SUB;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_SUB] != NULL)
+      return png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_SUB, row_bytes,
+          lmins);
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1; i < bpp;
         i++, rp++, dp++)
    {
@@ -2423,6 +2568,15 @@ png_setup_sub_row_only(png_structrp png_ptr, png_uint_32 bpp,
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_SUB;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_SUB] != NULL)
+   {
+      png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_SUB, row_bytes,
+          PNG_SIZE_MAX);
+      return;
+   }
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1; i < bpp;
         i++, rp++, dp++)
    {
@@ -2446,6 +2600,12 @@ png_setup_up_row(png_structrp png_ptr, size_t row_bytes, size_t lmins)
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_UP;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_UP] != NULL)
+      return png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_UP, row_bytes,
+          lmins);
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
        pp = png_ptr->prev_row + 1; i < row_bytes;
        i++, rp++, pp++, dp++)
@@ -2471,6 +2631,15 @@ png_setup_up_row_only(png_structrp png_ptr, size_t row_bytes)
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_UP;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_UP] != NULL)
+   {
+      png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_UP, row_bytes,
+          PNG_SIZE_MAX);
+      return;
+   }
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
        pp = png_ptr->prev_row + 1; i < row_bytes;
        i++, rp++, pp++, dp++)
@@ -2490,6 +2659,12 @@ png_setup_avg_row(png_structrp png_ptr, png_uint_32 bpp,
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_AVG;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_AVG] != NULL)
+      return png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_AVG, row_bytes,
+          lmins);
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
        pp = png_ptr->prev_row + 1; i < bpp; i++)
    {
@@ -2528,6 +2703,15 @@ png_setup_avg_row_only(png_structrp png_ptr, png_uint_32 bpp,
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_AVG;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_AVG] != NULL)
+   {
+      png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_AVG, row_bytes,
+          PNG_SIZE_MAX);
+      return;
+   }
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
        pp = png_ptr->prev_row + 1; i < bpp; i++)
    {
@@ -2552,6 +2736,12 @@ png_setup_paeth_row(png_structrp png_ptr, png_uint_32 bpp,
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_PAETH;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_PAETH] != NULL)
+      return png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_PAETH, row_bytes,
+          lmins);
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
        pp = png_ptr->prev_row + 1; i < bpp; i++)
    {
@@ -2611,6 +2801,15 @@ png_setup_paeth_row_only(png_structrp png_ptr, png_uint_32 bpp,
 
    png_ptr->try_row[0] = PNG_FILTER_VALUE_PAETH;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter[PNG_FILTER_VALUE_PAETH] != NULL)
+   {
+      png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_PAETH, row_bytes,
+          PNG_SIZE_MAX);
+      return;
+   }
+#endif
+
    for (i = 0, rp = png_ptr->row_buf + 1, dp = png_ptr->try_row + 1,
        pp = png_ptr->prev_row + 1; i < bpp; i++)
    {
@@ -2644,12 +2843,186 @@ png_setup_paeth_row_only(png_structrp png_ptr, png_uint_32 bpp,
       *dp++ = (png_byte)(((int)*rp++ - p) & 0xff);
    }
 }
+
+/* Entropy based filter selection (PNG_FILTER_SELECTION_ENTROPY).  Each
+ * candidate row is costed as the number of bits an order-0 entropy coder would
+ * add to the output if the row were appended to the bytes recently written.
+ * Those are kept as a byte histogram that is halved whenever it grows past
+ * PNG_FILTER_HIST_MAX, so older rows count for less, roughly following the
+ * adaptive Huffman blocks deflate emits.  The cost is:
+ *
+ *    f(N+n) - f(N) - sum over bytes b in the row of (f(h[b]+c[b]) - f(h[b]))
+ *
+ * where f(x) = x*log2(x), h[] is the history with total N and c[] the counts
+ * for the row, with total n.  Bits are measured in 1/64ths.
+ */
+#define PNG_FILTER_HIST_MAX 0x10000U /* histogram total before halving */
+#define PNG_FILTER_ROW_MAX  0x40000U /* larger rows have their counts scaled */
+
+/* 64*log2(1+m/256), for the fractional part of the logarithm */
+static const png_byte png_log2_frac[256] =
+{
+    0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  4,  4,  4,  5,  5,  5,
+    6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 10, 11,
+   11, 11, 12, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15, 16,
+   16, 16, 16, 17, 17, 17, 18, 18, 18, 19, 19, 19, 19, 20, 20, 20,
+   21, 21, 21, 21, 22, 22, 22, 23, 23, 23, 23, 24, 24, 24, 25, 25,
+   25, 25, 26, 26, 26, 26, 27, 27, 27, 28, 28, 28, 28, 29, 29, 29,
+   29, 30, 30, 30, 30, 31, 31, 31, 31, 32, 32, 32, 32, 33, 33, 33,
+   34, 34, 34, 34, 35, 35, 35, 35, 35, 36, 36, 36, 36, 37, 37, 37,
+   37, 38, 38, 38, 38, 39, 39, 39, 39, 40, 40, 40, 40, 41, 41, 41,
+   41, 41, 42, 42, 42, 42, 43, 43, 43, 43, 43, 44, 44, 44, 44, 45,
+   45, 45, 45, 45, 46, 46, 46, 46, 47, 47, 47, 47, 47, 48, 48, 48,
+   48, 49, 49, 49, 49, 49, 50, 50, 50, 50, 50, 51, 51, 51, 51, 51,
+   52, 52, 52, 52, 52, 53, 53, 53, 53, 54, 54, 54, 54, 54, 55, 55,
+   55, 55, 55, 56, 56, 56, 56, 56, 56, 57, 57, 57, 57, 57, 58, 58,
+   58, 58, 58, 59, 59, 59, 59, 59, 60, 60, 60, 60, 60, 61, 61, 61,
+   61, 61, 61, 62, 62, 62, 62, 62, 63, 63, 63, 63, 63, 63, 64, 64
+};
+
+static png_uint_32
+png_xlog2x(png_uint_32 x)
+{
+   /* x*log2(x) in 1/64 bits; x < 2^21 here so the result fits 32 bits. */
+   unsigned int k = 0;
+   png_uint_32 m;
+
+   if (x < 2)
+      return 0;
+
+   if (x >= 0x10000U) k += 16;
+   if ((x >> k) >= 0x100U) k += 8;
+   if ((x >> k) >= 0x10U) k += 4;
+   if ((x >> k) >= 0x4U) k += 2;
+   if ((x >> k) >= 0x2U) k += 1;
+
+   m = k >= 8 ? x >> (k - 8) : x << (8 - k);
+
+   return x * ((k << 6) + png_log2_frac[m & 0xff]);
+}
+
+static unsigned int
+png_filter_count_row(png_const_bytep row, size_t row_bytes,
+    png_uint_32 count[256])
+{
+   /* Returns the shift to apply to the counts to keep them in range */
+   unsigned int shift = 0;
+   size_t i;
+
+   memset(count, 0, 256 * (sizeof count[0]));
+
+   for (i = 0; i < row_bytes; i++)
+      count[row[i]]++;
+
+   while ((row_bytes >> shift) > PNG_FILTER_ROW_MAX)
+      shift++;
+
+   return shift;
+}
+
+static size_t
+png_filter_entropy_cost(png_structrp png_ptr, png_const_bytep row,
+    size_t row_bytes, int filter)
+{
+   png_const_uint_32p hist = png_ptr->filter_hist;
+   png_uint_32 count[256];
+   png_uint_32 n = 0, gain = 0, added;
+   unsigned int shift, i;
+   size_t cost;
+
+   shift = png_filter_count_row(row, row_bytes, count);
+
+   for (i = 0; i < 256; i++)
+   {
+      if (count[i] != 0)
+      {
+         png_uint_32 c = ((count[i] - 1) >> shift) + 1;
+
+         n += c;
+         gain += png_xlog2x(hist[i] + c) - png_xlog2x(hist[i]);
+      }
+   }
+
+   added = png_xlog2x(png_ptr->filter_hist_total + n) -
+       png_xlog2x(png_ptr->filter_hist_total);
+
+   /* The rounding in png_xlog2x can make this very slightly negative. */
+   cost = added > gain ? added - gain : 0;
+
+   /* Prefer the filter used for the previous row a little; rows filtered the
+    * same way give deflate longer matches against the row above.
+    */
+   if (filter == png_ptr->filter_prev)
+      cost -= cost >> 5;
+
+   return cost;
+}
+
+static void
+png_filter_entropy_update(png_structrp png_ptr, png_const_bytep row,
+    size_t row_bytes)
+{
+   png_uint_32p hist = png_ptr->filter_hist;
+   png_uint_32 count[256];
+   unsigned int shift, i;
+
+   shift = png_filter_count_row(row, row_bytes, count);
+
+   for (i = 0; i < 256; i++)
+   {
+      if (count[i] != 0)
+      {
+         png_uint_32 c = ((count[i] - 1) >> shift) + 1;
+
+         hist[i] += c;
+         png_ptr->filter_hist_total += c;
+      }
+   }
+
+   while (png_ptr->filter_hist_total > PNG_FILTER_HIST_MAX)
+   {
+      png_ptr->filter_hist_total = 0;
+
+      for (i = 0; i < 256; i++)
+      {
+         hist[i] >>= 1;
+         png_ptr->filter_hist_total += hist[i];
+      }
+   }
+}
 #endif /* WRITE_FILTER */
 
+/* Start a segment at this row if png_set_IDAT_segments asked for one.
+ * Z_FULL_FLUSH makes deflate forget the rows before.  Returns 1 if the row must
+ * not be filtered against the row above.
+ */
+static int
+png_write_segment_start(png_structrp png_ptr)
+{
+   png_uint_32p entry;
+
+   if (png_ptr->idat_segments == NULL ||
+       png_ptr->row_number % png_ptr->idat_segment_rows != 0)
+      return 0;
+
+   entry = png_ptr->idat_segments + 2 * png_ptr->idat_segment_count++;
+   entry[0] = png_ptr->row_number;
+   entry[1] = 0;
+
+   if (png_ptr->row_number == 0)
+      return 0;
+
+   png_compress_IDAT(png_ptr, NULL, 0, Z_FULL_FLUSH);
+   entry[1] = (png_uint_32)png_ptr->zstream.total_out;
+
+   return 1;
+}
+
 void /* PRIVATE */
 png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
 {
 #ifndef PNG_WRITE_FILTER_SUPPORTED
+   png_write_segment_start(png_ptr);
    png_write_filtered_row(png_ptr, png_ptr->row_buf, row_info->rowbytes+1);
 #else
    unsigned int filter_to_do = png_ptr->do_filter;
@@ -2658,6 +3031,7 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
    png_uint_32 bpp;
    size_t mins;
    size_t row_bytes = row_info->rowbytes;
+   int entropy;
 
    png_debug(1, "in png_write_find_filter");
 
@@ -2668,6 +3042,19 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
    mins = PNG_SIZE_MAX - 256/* so we can detect potential overflow of the
                                running sum */;
 
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+   if (png_ptr->write_filter_bpp != bpp)
+      png_init_write_filter_functions(png_ptr, bpp);
+#endif
+
+   if (png_write_segment_start(png_ptr) != 0)
+   {
+      filter_to_do &= PNG_FILTER_NONE | PNG_FILTER_SUB;
+
+      if (filter_to_do == 0)
+         filter_to_do = PNG_FILTER_NONE;
+   }
+
    /* The prediction method we use is to find which method provides the
     * smallest value when summing the absolute values of the distances
     * from zero, using anything >= 128 as negative numbers.  This is known
@@ -2698,6 +3085,29 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
     */
    best_row = png_ptr->row_buf;
 
+   /* The alternative entropy selector needs every candidate filtered in full,
+    * so no limit is passed to the png_setup functions and the sums they return
+    * are replaced by the estimated cost.
+    */
+   entropy = png_ptr->filter_selection == PNG_FILTER_SELECTION_ENTROPY &&
+       (filter_to_do & (filter_to_do - 1)) != 0 &&
+       PNG_SIZE_MAX/128 > row_bytes;
+
+   if (entropy != 0)
+   {
+      if (png_ptr->filter_hist == NULL)
+         png_ptr->filter_hist = png_voidcast(png_uint_32p,
+             png_malloc(png_ptr, 256 * (sizeof (png_uint_32))));
+
+      /* Start again with each image (and each APNG frame) */
+      if (png_ptr->row_number == 0 && png_ptr->pass == 0)
+      {
+         memset(png_ptr->filter_hist, 0, 256 * (sizeof (png_uint_32)));
+         png_ptr->filter_hist_total = 0;
+         png_ptr->filter_prev = PNG_FILTER_VALUE_NONE;
+      }
+   }
+
    if (PNG_SIZE_MAX/128 <= row_bytes)
    {
       /* Overflow can occur in the calculation, just select the lowest set
@@ -2716,6 +3126,18 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       size_t i;
       unsigned int v;
 
+      if (entropy != 0)
+         sum = png_filter_entropy_cost(png_ptr, row_buf + 1, row_bytes,
+             PNG_FILTER_VALUE_NONE);
+
+      else
+#ifdef PNG_WRITE_FILTER_OPTIMIZATIONS
+      if (png_ptr->write_filter[PNG_FILTER_VALUE_NONE] != NULL)
+         sum = png_write_filter_opt(png_ptr, PNG_FILTER_VALUE_NONE, row_bytes,
+             PNG_SIZE_MAX);
+
+      else
+#endif
       {
          for (i = 0, rp = row_buf + 1; i < row_bytes; i++, rp++)
          {
@@ -2742,10 +3164,14 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
    else if ((filter_to_do & PNG_FILTER_SUB) != 0)
    {
       size_t sum;
-      size_t lmins = mins;
+      size_t lmins = entropy != 0 ? PNG_SIZE_MAX - 256 : mins;
 
       sum = png_setup_sub_row(png_ptr, bpp, row_bytes, lmins);
 
+      if (entropy != 0)
+         sum = png_filter_entropy_cost(png_ptr, png_ptr->try_row + 1,
+             row_bytes, PNG_FILTER_VALUE_SUB);
+
       if (sum < mins)
       {
          mins = sum;
@@ -2768,10 +3194,14 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
    else if ((filter_to_do & PNG_FILTER_UP) != 0)
    {
       size_t sum;
-      size_t lmins = mins;
+      size_t lmins = entropy != 0 ? PNG_SIZE_MAX - 256 : mins;
 
       sum = png_setup_up_row(png_ptr, row_bytes, lmins);
 
+      if (entropy != 0)
+         sum = png_filter_entropy_cost(png_ptr, png_ptr->try_row + 1,
+             row_bytes, PNG_FILTER_VALUE_UP);
+
       if (sum < mins)
       {
          mins = sum;
@@ -2794,10 +3224,14 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
    else if ((filter_to_do & PNG_FILTER_AVG) != 0)
    {
       size_t sum;
-      size_t lmins = mins;
+      size_t lmins = entropy != 0 ? PNG_SIZE_MAX - 256 : mins;
 
       sum= png_setup_avg_row(png_ptr, bpp, row_bytes, lmins);
 
+      if (entropy != 0)
+         sum = png_filter_entropy_cost(png_ptr, png_ptr->try_row + 1,
+             row_bytes, PNG_FILTER_VALUE_AVG);
+
       if (sum < mins)
       {
          mins = sum;
@@ -2820,10 +3254,14 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
    else if ((filter_to_do & PNG_FILTER_PAETH) != 0)
    {
       size_t sum;
-      size_t lmins = mins;
+      size_t lmins = entropy != 0 ? PNG_SIZE_MAX - 256 : mins;
 
       sum = png_setup_paeth_row(png_ptr, bpp, row_bytes, lmins);
 
+      if (entropy != 0)
+         sum = png_filter_entropy_cost(png_ptr, png_ptr->try_row + 1,
+             row_bytes, PNG_FILTER_VALUE_PAETH);
+
       if (sum < mins)
       {
          best_row = png_ptr->try_row;
@@ -2835,6 +3273,12 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       }
    }
 
+   if (entropy != 0)
+   {
+      png_filter_entropy_update(png_ptr, best_row + 1, row_bytes);
+      png_ptr->filter_prev = best_row[0];
+   }
+
    /* Do the actual writing of the filtered row data from the chosen filter. */
    png_write_filtered_row(png_ptr, best_row, row_info->rowbytes+1);
 
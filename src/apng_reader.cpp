@@ -0,0 +1,306 @@
+//
+//  apng_reader.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "apng_reader.h"
+#include "mapped_file.h"
+#include "../lib/libpng-1.6.37/png.h"
+#include <stdio.h>
+#include <memory>
+#include <vector>
+
+static FrameDispose apng_getDispose(png_byte dispose_op) {
+    switch (dispose_op) {
+        case PNG_DISPOSE_OP_BACKGROUND:
+            return FrameDispose::Background;
+        case PNG_DISPOSE_OP_PREVIOUS:
+            return FrameDispose::Previous;
+        default:
+            return FrameDispose::None;
+    }
+}
+
+static int apng_getDelayMs(png_uint_16 delay_num, png_uint_16 delay_den) {
+    // a zero denominator means 1/100 second units
+    if (delay_den == 0) {
+        delay_den = 100;
+    }
+    return (int)((delay_num * 1000 + delay_den / 2) / delay_den);
+}
+
+// Every frame as 8 bit RGBA; the caller updates the info afterwards.
+static void apng_setTransforms(png_structp png_ptr) {
+    png_set_expand(png_ptr);
+    png_set_strip_16(png_ptr);
+    png_set_gray_to_rgb(png_ptr);
+    png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+    png_set_interlace_handling(png_ptr);
+}
+
+// The rectangle and timing of the next frame, the whole canvas when there is no fcTL.
+static FrameInfo apng_getFrameInfo(png_structp png_ptr, png_infop info_ptr, bool animated, int width, int height) {
+    FrameInfo info;
+    info.x = 0;
+    info.y = 0;
+    info.width = width;
+    info.height = height;
+    info.dispose = FrameDispose::None;
+    info.blend = FrameBlend::Source;
+    info.delayMs = 0;
+    if (animated && png_get_valid(png_ptr, info_ptr, PNG_INFO_fcTL)) {
+        png_uint_32 w, h, x, y;
+        png_uint_16 delay_num, delay_den;
+        png_byte dispose_op, blend_op;
+        png_get_next_frame_fcTL(png_ptr, info_ptr, &w, &h, &x, &y, &delay_num, &delay_den, &dispose_op, &blend_op);
+        info.x = (int)x;
+        info.y = (int)y;
+        info.width = (int)w;
+        info.height = (int)h;
+        info.dispose = apng_getDispose(dispose_op);
+        info.blend = blend_op == PNG_BLEND_OP_OVER ? FrameBlend::Over : FrameBlend::Source;
+        info.delayMs = apng_getDelayMs(delay_num, delay_den);
+    }
+    return info;
+}
+
+bool readAPNG(const char* name, const FrameHandler& onFrame) {
+    printf("%s\n", name);
+    MappedFile file;
+    if (!file.open(name)) {
+        return false;
+    }
+    return readAPNG(file.data(), file.size(), onFrame);
+}
+
+bool readAPNG(const void* data, size_t size, const FrameHandler& onFrame) {
+    // everything that owns memory lives outside the setjmp
+    std::unique_ptr<FrameCompositor> compositor;
+    std::vector<RGBA> frameBuffer;
+    std::vector<png_bytep> rows;
+    // set after setjmp and read after a longjmp out of it
+    volatile bool success = false;
+
+    png_structp png_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+    while (1) {
+        png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (nullptr == png_ptr) {
+            break;
+        }
+
+        info_ptr = png_create_info_struct(png_ptr);
+        if (nullptr == info_ptr) {
+            break;
+        }
+        if (setjmp(png_jmpbuf(png_ptr))) {
+            break;
+        }
+        // chunks are walked in place, IDAT and fdAT are inflated from the memory
+        png_set_read_memory(png_ptr, data, size);
+        png_read_info(png_ptr, info_ptr);
+        // inflate on this thread, unfilter and convert on another
+        png_set_read_pipeline(png_ptr, 1);
+
+        apng_setTransforms(png_ptr);
+        png_read_update_info(png_ptr, info_ptr);
+
+        const int width = (int)png_get_image_width(png_ptr, info_ptr);
+        const int height = (int)png_get_image_height(png_ptr, info_ptr);
+        printf("w: %d, h: %d\n", width, height);
+
+        // the APNG canvas starts, and is cleared to, transparent black
+        compositor.reset(new FrameCompositor(width, height, k_rgba_transparent));
+        frameBuffer.resize((size_t)width * height);
+        rows.resize(height);
+
+        const bool animated = png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL) != 0;
+        const bool firstHidden = animated && png_get_first_frame_is_hidden(png_ptr, info_ptr) != 0;
+        // includes the hidden default image
+        const png_uint_32 numFrames = animated ? png_get_num_frames(png_ptr, info_ptr) : 1;
+        printf("frames: %u%s\n", numFrames, firstHidden ? " (first hidden)" : "");
+
+        bool stopped = false;
+        for (png_uint_32 i = 0; i < numFrames && !stopped; ++i) {
+            if (animated) {
+                png_read_frame_head(png_ptr, info_ptr);
+            }
+
+            const FrameInfo info = apng_getFrameInfo(png_ptr, info_ptr, animated, width, height);
+
+            // fcTL keeps frames inside the canvas, so the frame buffer is big enough
+            for (int y = 0; y < info.height; ++y) {
+                rows[y] = (png_bytep)(frameBuffer.data() + (size_t)y * info.width);
+            }
+            png_read_image(png_ptr, rows.data());
+
+            if (i == 0 && firstHidden) {
+                continue;
+            }
+
+            compositor->beginFrame(info);
+            for (int y = 0; y < info.height; ++y) {
+                compositor->drawRow(y, (const RGBA*)rows[y]);
+            }
+            const Frame frame = compositor->endFrame();
+            if (onFrame && !onFrame(frame)) {
+                stopped = true;
+            }
+        }
+        if (!stopped) {
+            png_read_end(png_ptr, nullptr);
+        }
+        success = true;
+        break;
+    }
+
+    if (png_ptr) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    }
+    return success;
+}
+
+APNGPushDecoder::APNGPushDecoder(const FrameHandler& onFrame, const PreviewHandler& onPreview)
+: _onFrame(onFrame)
+, _onPreview(onPreview)
+, _png(nullptr)
+, _info(nullptr)
+, _animated(false)
+, _firstHidden(false)
+, _interlaced(false)
+, _frame(0)
+, _stopped(false)
+, _failed(false)
+, _finished(false) {
+    while (1) {
+        _png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if (nullptr == _png) {
+            break;
+        }
+        _info = png_create_info_struct(_png);
+        if (nullptr == _info) {
+            break;
+        }
+        png_set_progressive_read_fn(_png, this, infoCallback, rowCallback, endCallback);
+        // also makes libpng decode the frames after the first
+        png_set_progressive_frame_fn(_png, frameInfoCallback, frameEndCallback);
+        return;
+    }
+    _failed = true;
+}
+
+APNGPushDecoder::~APNGPushDecoder() {
+    if (_png) {
+        png_destroy_read_struct(&_png, &_info, nullptr);
+    }
+}
+
+bool APNGPushDecoder::push(const void* data, size_t size) {
+    if (_failed || _stopped) {
+        return false;
+    }
+    if (setjmp(png_jmpbuf(_png))) {
+        _failed = true;
+        return false;
+    }
+    png_process_data(_png, _info, (png_bytep)data, size);
+    return !_stopped;
+}
+
+void APNGPushDecoder::infoCallback(png_structp png_ptr, png_infop info_ptr) {
+    APNGPushDecoder* self = (APNGPushDecoder*)png_get_progressive_ptr(png_ptr);
+
+    apng_setTransforms(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    const int width = (int)png_get_image_width(png_ptr, info_ptr);
+    const int height = (int)png_get_image_height(png_ptr, info_ptr);
+    printf("w: %d, h: %d\n", width, height);
+
+    // the APNG canvas starts, and is cleared to, transparent black
+    self->_compositor.reset(new FrameCompositor(width, height, k_rgba_transparent));
+    self->_animated = png_get_valid(png_ptr, info_ptr, PNG_INFO_acTL) != 0;
+    self->_firstHidden = self->_animated && png_get_first_frame_is_hidden(png_ptr, info_ptr) != 0;
+    self->_interlaced = png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
+    if (self->_interlaced) {
+        // frames are never bigger than the canvas
+        self->_frameBuffer.resize((size_t)width * height);
+    }
+    printf("frames: %u%s\n", self->_animated ? png_get_num_frames(png_ptr, info_ptr) : 1, self->_firstHidden ? " (first hidden)" : "");
+
+    // the fcTL of the first frame, if any, comes before IDAT
+    self->_frame = 0;
+    self->beginFrame();
+}
+
+void APNGPushDecoder::frameInfoCallback(png_structp png_ptr, png_uint_32 frame) {
+    APNGPushDecoder* self = (APNGPushDecoder*)png_get_progressive_ptr(png_ptr);
+    self->_frame = frame;
+    self->beginFrame();
+}
+
+void APNGPushDecoder::beginFrame() {
+    _frameInfo = apng_getFrameInfo(_png, _info, _animated, _compositor->width(), _compositor->height());
+    if (_frame == 0 && _firstHidden) {
+        return;
+    }
+    _compositor->beginFrame(_frameInfo);
+}
+
+void APNGPushDecoder::rowCallback(png_structp png_ptr, png_bytep row, png_uint_32 y, int pass) {
+    APNGPushDecoder* self = (APNGPushDecoder*)png_get_progressive_ptr(png_ptr);
+    if (self->_stopped || (self->_frame == 0 && self->_firstHidden)) {
+        return;
+    }
+    if (self->_interlaced) {
+        const int width = self->_frameInfo.width;
+        const int height = self->_frameInfo.height;
+        // row is null for the rows a pass leaves as they are
+        png_progressive_combine_row(png_ptr, (png_bytep)(self->_frameBuffer.data() + (size_t)y * width), row);
+        // every pass goes over all the rows; the last pass makes the frame
+        if (self->_onPreview && (int)y == height - 1 && pass < 6) {
+            FrameCompositor* compositor = self->_compositor.get();
+            compositor->beginPreview();
+            for (int i = 0; i < height; ++i) {
+                compositor->drawRow(i, self->_frameBuffer.data() + (size_t)i * width);
+            }
+            if (!self->_onPreview(compositor->endPreview(), pass + 1, 7)) {
+                self->stop();
+            }
+        }
+    } else {
+        self->_compositor->drawRow((int)y, (const RGBA*)row);
+    }
+}
+
+void APNGPushDecoder::frameEndCallback(png_structp png_ptr, png_uint_32 frame) {
+    APNGPushDecoder* self = (APNGPushDecoder*)png_get_progressive_ptr(png_ptr);
+    (void)frame;
+    if (self->_frame == 0 && self->_firstHidden) {
+        return;
+    }
+    if (self->_interlaced) {
+        const RGBA* pixels = self->_frameBuffer.data();
+        for (int y = 0; y < self->_frameInfo.height; ++y) {
+            self->_compositor->drawRow(y, pixels + (size_t)y * self->_frameInfo.width);
+        }
+    }
+    const Frame out = self->_compositor->endFrame();
+    if (self->_onFrame && !self->_onFrame(out)) {
+        self->stop();
+    }
+}
+
+void APNGPushDecoder::stop() {
+    _stopped = true;
+    // drop the rest of the data given to png_process_data
+    png_process_data_pause(_png, 0);
+}
+
+void APNGPushDecoder::endCallback(png_structp png_ptr, png_infop info_ptr) {
+    APNGPushDecoder* self = (APNGPushDecoder*)png_get_progressive_ptr(png_ptr);
+    (void)info_ptr;
+    self->_finished = true;
+}
@@ -0,0 +1,79 @@
+//
+//  apng_reader.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef apng_reader_h
+#define apng_reader_h
+
+#include "frame_compositor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+// Decodes every frame of an APNG and passes the composited canvas to onFrame;
+// a PNG without acTL is a single frame. A hidden default image is decoded but
+// not passed on. The file is memory mapped.
+bool readAPNG(const char* name, const FrameHandler& onFrame = FrameHandler());
+// The same for a PNG already in memory.
+bool readAPNG(const void* data, size_t size, const FrameHandler& onFrame = FrameHandler());
+
+struct png_struct_def;
+struct png_info_def;
+
+// Decodes an APNG that arrives in pieces, as from a network upload. Bytes are
+// pushed in slices of any size and each frame is passed to onFrame as soon as
+// its last row is decoded. Rows of a non-interlaced frame go straight onto the
+// canvas, so apart from the canvas only an interlaced frame is held, plus the
+// zlib state and whatever part of a chunk libpng has to keep between pushes.
+// Interlaced frames are previewed after each of the first 6 of their 7 passes.
+class APNGPushDecoder {
+public:
+    explicit APNGPushDecoder(const FrameHandler& onFrame = FrameHandler(), const PreviewHandler& onPreview = PreviewHandler());
+    ~APNGPushDecoder();
+
+    APNGPushDecoder(const APNGPushDecoder&) = delete;
+    APNGPushDecoder& operator=(const APNGPushDecoder&) = delete;
+
+    // Decodes as far as the data allows; false on an error or once onFrame
+    // has stopped decoding, after which further data is ignored.
+    bool push(const void* data, size_t size);
+    // Whether IEND has been reached.
+    bool finished() const { return _finished; }
+
+private:
+    static void infoCallback(png_struct_def* png_ptr, png_info_def* info_ptr);
+    static void frameInfoCallback(png_struct_def* png_ptr, uint32_t frame);
+    static void rowCallback(png_struct_def* png_ptr, uint8_t* row, uint32_t y, int pass);
+    static void frameEndCallback(png_struct_def* png_ptr, uint32_t frame);
+    static void endCallback(png_struct_def* png_ptr, png_info_def* info_ptr);
+
+    void beginFrame();
+    void stop();
+
+private:
+    FrameHandler _onFrame;
+    PreviewHandler _onPreview;
+    png_struct_def* _png;
+    png_info_def* _info;
+    std::unique_ptr<FrameCompositor> _compositor;
+    // only used for interlaced frames, whose rows come in over 7 passes; libpng
+    // replicates the rows of each pass, so it is a preview between passes
+    std::vector<RGBA> _frameBuffer;
+
+    bool _animated;
+    bool _firstHidden;
+    bool _interlaced;
+    // the frame being decoded, counting the hidden default image
+    uint32_t _frame;
+    FrameInfo _frameInfo;
+    bool _stopped;
+    bool _failed;
+    bool _finished;
+};
+
+#endif /* apng_reader_h */
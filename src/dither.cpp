@@ -0,0 +1,459 @@
+//
+//  dither.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "dither.h"
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <system_error>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const int k_cells = 1 << 15;
+
+// Pixels a thread diffuses at least, and the most threads used.
+static const size_t k_diffuse_part = 1 << 18;
+static const unsigned k_diffuse_threads = 8;
+// A row tells the row below how far it got every this many pixels.
+static const int k_diffuse_chunk = 64;
+
+static inline int cellOf(int r, int g, int b) {
+    return (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+}
+
+static inline int clampByte(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Bayer matrix of size n, a power of 2: each doubling puts 4 copies of the
+// smaller one side by side, scaled and offset as 0 2 / 3 1.
+static std::vector<uint16_t> makeBayer(int n) {
+    std::vector<uint16_t> matrix(1, 0);
+    for (int size = 1; size < n; size *= 2) {
+        std::vector<uint16_t> next(size * 2 * size * 2);
+        static const int offsets[4] = { 0, 2, 3, 1 };
+        for (int y = 0; y < size * 2; ++y) {
+            for (int x = 0; x < size * 2; ++x) {
+                const int quadrant = (y / size) * 2 + x / size;
+                next[y * size * 2 + x] = (uint16_t)(matrix[(y % size) * size + x % size] * 4 + offsets[quadrant]);
+            }
+        }
+        matrix.swap(next);
+    }
+    return matrix;
+}
+
+// Blue noise threshold matrix of size n, a power of 2, by Ulichney's
+// void-and-cluster method: a random pattern is relaxed by moving the pixel
+// in the tightest cluster to the largest void until it is the same pixel,
+// then pixels are ranked by taking them out of the tightest clusters and
+// putting them into the largest voids.
+static std::vector<uint16_t> makeBlueNoise(int n) {
+    const int size = n * n;
+    // gaussian of sigma 1.5 over the torus
+    std::vector<float> kernel(size);
+    for (int y = 0; y < n; ++y) {
+        for (int x = 0; x < n; ++x) {
+            const int dx = std::min(x, n - x), dy = std::min(y, n - y);
+            kernel[y * n + x] = expf(-(dx * dx + dy * dy) / (2 * 1.5f * 1.5f));
+        }
+    }
+    std::vector<float> energy(size, 0.0f);
+    std::vector<uint8_t> bits(size, 0);
+    auto toggle = [&](int p) {
+        const float sign = bits[p] ? -1.0f : 1.0f;
+        bits[p] ^= 1;
+        const int px = p % n, py = p / n;
+        for (int y = 0; y < n; ++y) {
+            const float* row = kernel.data() + ((y - py) & (n - 1)) * n;
+            for (int x = 0; x < n; ++x) {
+                energy[y * n + x] += sign * row[(x - px) & (n - 1)];
+            }
+        }
+    };
+    auto tightestCluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < size; ++p) {
+            if (bits[p] && (best < 0 || energy[p] > energy[best])) {
+                best = p;
+            }
+        }
+        return best;
+    };
+    auto largestVoid = [&]() {
+        int best = -1;
+        for (int p = 0; p < size; ++p) {
+            if (!bits[p] && (best < 0 || energy[p] < energy[best])) {
+                best = p;
+            }
+        }
+        return best;
+    };
+
+    // a tenth of the pixels, at fixed pseudo random places
+    const int ones = size / 10;
+    uint32_t seed = 0x2545F491u;
+    for (int placed = 0; placed < ones;) {
+        seed = seed * 1664525u + 1013904223u;
+        const int p = (int)((seed >> 8) % (uint32_t)size);
+        if (!bits[p]) {
+            toggle(p);
+            ++placed;
+        }
+    }
+    for (;;) {
+        const int cluster = tightestCluster();
+        toggle(cluster);
+        const int hole = largestVoid();
+        toggle(hole);
+        if (hole == cluster) {
+            break;
+        }
+    }
+
+    std::vector<uint16_t> rank(size);
+    const std::vector<float> initialEnergy = energy;
+    const std::vector<uint8_t> initialBits = bits;
+    for (int r = ones - 1; r >= 0; --r) {
+        const int cluster = tightestCluster();
+        rank[cluster] = (uint16_t)r;
+        toggle(cluster);
+    }
+    energy = initialEnergy;
+    bits = initialBits;
+    // past half the pixels the largest void is the tightest cluster of the
+    // zeros, so the same step ranks the rest
+    for (int r = ones; r < size; ++r) {
+        const int hole = largestVoid();
+        rank[hole] = (uint16_t)r;
+        toggle(hole);
+    }
+    return rank;
+}
+
+static const int k_bayer_size = 8;
+static const int k_blue_noise_size = 32;
+
+// made on first use, once
+static const std::vector<uint16_t>& bayerMatrix() {
+    static const std::vector<uint16_t> matrix = makeBayer(k_bayer_size);
+    return matrix;
+}
+
+static const std::vector<uint16_t>& blueNoiseMatrix() {
+    static const std::vector<uint16_t> matrix = makeBlueNoise(k_blue_noise_size);
+    return matrix;
+}
+
+const char* DitherModeString(DitherMode mode) {
+    switch (mode) {
+        case DitherMode::None:
+            return "none";
+        case DitherMode::FloydSteinberg:
+            return "floyd-steinberg";
+        case DitherMode::SierraLite:
+            return "sierra lite";
+        case DitherMode::Bayer:
+            return "bayer 8x8";
+        case DitherMode::BlueNoise:
+            return "blue noise";
+    }
+    return "unknown";
+}
+
+PaletteMapper::PaletteMapper()
+: _mode(DitherMode::None)
+, _transparent(-1)
+, _orderedMode(DitherMode::None)
+, _orderedSize(0) {
+}
+
+void PaletteMapper::setPalette(const RGBA* colors, int count, int transparentIndex) {
+    _palette.assign(colors, colors + std::max(0, std::min(count, 256)));
+    _transparent = transparentIndex >= 0 ? transparentIndex : 0;
+    if (!_nearest) {
+        _nearest.reset(new std::atomic<uint16_t>[k_cells]);
+    }
+    for (int i = 0; i < k_cells; ++i) {
+        _nearest[i].store(0, std::memory_order_relaxed);
+    }
+    // the offsets depend on how far apart the colors are
+    _orderedMode = DitherMode::None;
+}
+
+// The palette entry nearest to the middle of the cell.
+uint8_t PaletteMapper::nearest(int cell) {
+    const uint16_t cached = _nearest[cell].load(std::memory_order_relaxed);
+    if (cached) {
+        return (uint8_t)(cached - 1);
+    }
+    const int r = (cell >> 10) << 3 | 4;
+    const int g = ((cell >> 5) & 0x1f) << 3 | 4;
+    const int b = (cell & 0x1f) << 3 | 4;
+    int best = 0;
+    int bestDistance = INT_MAX;
+    for (int i = 0; i < (int)_palette.size(); ++i) {
+        const int dr = _palette[i].r - r;
+        const int dg = _palette[i].g - g;
+        const int db = _palette[i].b - b;
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = i;
+        }
+    }
+    // another thread may store the same value
+    _nearest[cell].store((uint16_t)(best + 1), std::memory_order_relaxed);
+    return (uint8_t)best;
+}
+
+bool PaletteMapper::map(const RGBA* pixels, int width, int height, size_t stride, uint8_t* indices) {
+    if (!_nearest) {
+        return false;
+    }
+    if (width <= 0 || height <= 0) {
+        return true;
+    }
+    try {
+        switch (_mode) {
+            case DitherMode::None:
+                for (int y = 0; y < height; ++y) {
+                    const RGBA* row = (const RGBA*)((const uint8_t*)pixels + y * stride);
+                    uint8_t* out = indices + (size_t)y * width;
+                    for (int x = 0; x < width; ++x) {
+                        const RGBA c = row[x];
+                        out[x] = c.a < 128 ? (uint8_t)_transparent : nearest(cellOf(c.r, c.g, c.b));
+                    }
+                }
+                break;
+            case DitherMode::FloydSteinberg:
+            case DitherMode::SierraLite:
+                mapDiffused(pixels, width, height, stride, indices);
+                break;
+            case DitherMode::Bayer:
+            case DitherMode::BlueNoise:
+                mapOrdered(pixels, width, height, stride, indices);
+                break;
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+// Offsets for the matrix of the mode. They span the median distance from
+// a palette color to the one nearest it, so a pixel halfway between two
+// colors is spread evenly over both.
+void PaletteMapper::makeOrdered() {
+    if (_orderedMode == _mode) {
+        return;
+    }
+    const auto& matrix = _mode == DitherMode::Bayer ? bayerMatrix() : blueNoiseMatrix();
+    const int size = _mode == DitherMode::Bayer ? k_bayer_size : k_blue_noise_size;
+
+    std::vector<int> distances;
+    for (size_t i = 0; i < _palette.size(); ++i) {
+        int bestDistance = INT_MAX;
+        for (size_t j = 0; j < _palette.size(); ++j) {
+            const int dr = _palette[i].r - _palette[j].r;
+            const int dg = _palette[i].g - _palette[j].g;
+            const int db = _palette[i].b - _palette[j].b;
+            const int distance = dr * dr + dg * dg + db * db;
+            if (j != i && distance < bestDistance) {
+                bestDistance = distance;
+            }
+        }
+        if (bestDistance != INT_MAX) {
+            distances.push_back(bestDistance);
+        }
+    }
+    float spread = 16.0f;
+    if (!distances.empty()) {
+        std::nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+        spread = std::min(std::max(sqrtf((float)distances[distances.size() / 2]), 2.0f), 96.0f);
+    }
+
+    const int entries = size * size;
+    _orderedAdd.assign(entries * 4, 0);
+    _orderedSub.assign(entries * 4, 0);
+    for (int i = 0; i < entries; ++i) {
+        const float threshold = (matrix[i] + 0.5f) / entries - 0.5f;
+        const int offset = (int)lrintf(threshold * spread);
+        auto* add = &_orderedAdd[i * 4];
+        auto* sub = &_orderedSub[i * 4];
+        // the alpha byte stays 0
+        add[0] = add[1] = add[2] = (uint8_t)std::max(offset, 0);
+        sub[0] = sub[1] = sub[2] = (uint8_t)std::max(-offset, 0);
+    }
+    _orderedSize = size;
+    _orderedMode = _mode;
+}
+
+void PaletteMapper::mapOrdered(const RGBA* pixels, int width, int height, size_t stride, uint8_t* indices) {
+    makeOrdered();
+    const int size = _orderedSize;
+    for (int y = 0; y < height; ++y) {
+        const RGBA* row = (const RGBA*)((const uint8_t*)pixels + y * stride);
+        uint8_t* out = indices + (size_t)y * width;
+        const uint8_t* add = _orderedAdd.data() + (y & (size - 1)) * size * 4;
+        const uint8_t* sub = _orderedSub.data() + (y & (size - 1)) * size * 4;
+        int x = 0;
+#if defined(__SSE2__)
+        // 4 pixels at a time; the matrix is a multiple of 4 wide so they
+        // take 4 entries of one matrix row
+        const __m128i maskR = _mm_set1_epi32(0xf8);
+        const __m128i maskG = _mm_set1_epi32(0xf800);
+        const __m128i maskB = _mm_set1_epi32(0x1f);
+        alignas(16) int32_t cells[4];
+        for (; x + 4 <= width; x += 4) {
+            const int entry = (x & (size - 1)) * 4;
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+            v = _mm_adds_epu8(v, _mm_loadu_si128((const __m128i*)(add + entry)));
+            v = _mm_subs_epu8(v, _mm_loadu_si128((const __m128i*)(sub + entry)));
+            const __m128i r = _mm_slli_epi32(_mm_and_si128(v, maskR), 7);
+            const __m128i g = _mm_srli_epi32(_mm_and_si128(v, maskG), 6);
+            const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 19), maskB);
+            _mm_store_si128((__m128i*)cells, _mm_or_si128(_mm_or_si128(r, g), b));
+            // sign bit of each pixel is the top bit of its alpha
+            const int opaque = _mm_movemask_ps(_mm_castsi128_ps(v));
+            for (int k = 0; k < 4; ++k) {
+                out[x + k] = (opaque >> k) & 1 ? nearest(cells[k]) : (uint8_t)_transparent;
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            const RGBA c = row[x];
+            if (c.a < 128) {
+                out[x] = (uint8_t)_transparent;
+                continue;
+            }
+            const int entry = (x & (size - 1)) * 4;
+            const int r = clampByte(c.r + add[entry] - sub[entry]);
+            const int g = clampByte(c.g + add[entry + 1] - sub[entry + 1]);
+            const int b = clampByte(c.b + add[entry + 2] - sub[entry + 2]);
+            out[x] = nearest(cellOf(r, g, b));
+        }
+    }
+}
+
+namespace {
+
+// Weights of the error going right, down left, down and down right, out of
+// 1 << shift.
+struct DiffusionKernel {
+    int right, downLeft, down, downRight;
+    int shift;
+};
+
+const DiffusionKernel k_floyd_steinberg = { 7, 3, 5, 1, 4 };
+const DiffusionKernel k_sierra_lite = { 2, 1, 1, 0, 2 };
+
+}
+
+// Error diffusion, left to right on every row. The error of a row goes to
+// the row below through a ring of error rows, 3 ints per pixel with one
+// pixel of margin on each side. Pixel x of a row takes its error from the
+// row above once that row is past x + 1, so big images run a row on each
+// of several threads with each row a little behind the one above it. The
+// ring has 2 rows more than the threads, so a row is finished before its
+// error row is written again.
+void PaletteMapper::mapDiffused(const RGBA* pixels, int width, int height, size_t stride, uint8_t* indices) {
+    const DiffusionKernel kernel = _mode == DitherMode::FloydSteinberg ? k_floyd_steinberg : k_sierra_lite;
+    const size_t count = (size_t)width * height;
+    const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    const int threads = (int)std::max<size_t>(1, std::min<size_t>(std::min<size_t>(count / k_diffuse_part, height), std::min(cpus, k_diffuse_threads)));
+    const int ringRows = threads + 2;
+    const size_t errorStride = ((size_t)width + 2) * 3;
+    std::vector<int> ring(errorStride * ringRows, 0);
+    std::unique_ptr<std::atomic<int>[]> progress(new std::atomic<int>[height]);
+    for (int y = 0; y < height; ++y) {
+        progress[y].store(0, std::memory_order_relaxed);
+    }
+    std::atomic<int> nextRow(0);
+
+    const int round = 1 << (kernel.shift - 1);
+    auto diffuse = [&]() {
+        for (;;) {
+            // rows are taken in order, so the row above is always being
+            // worked on or done
+            const int y = nextRow.fetch_add(1);
+            if (y >= height) {
+                return;
+            }
+            const RGBA* row = (const RGBA*)((const uint8_t*)pixels + y * stride);
+            uint8_t* out = indices + (size_t)y * width;
+            const int* above = ring.data() + (y % ringRows) * errorStride + 3;
+            int* below = ring.data() + ((y + 1) % ringRows) * errorStride + 3;
+            // down right assigns, so only what is before it needs clearing
+            below[-3] = below[-2] = below[-1] = 0;
+            below[0] = below[1] = below[2] = 0;
+            int carryR = 0, carryG = 0, carryB = 0;
+            int ready = y == 0 ? width : 0;
+            for (int x = 0; x < width; ++x) {
+                if (x + 1 >= ready && ready < width) {
+                    const int need = std::min(x + 2, width);
+                    while ((ready = progress[y - 1].load(std::memory_order_acquire)) < need) {
+                        std::this_thread::yield();
+                    }
+                }
+                if (x % k_diffuse_chunk == 0 && x > 0) {
+                    progress[y].store(x, std::memory_order_release);
+                }
+
+                const RGBA c = row[x];
+                const int* in = above + x * 3;
+                int* next = below + x * 3;
+                int er = 0, eg = 0, eb = 0;
+                if (c.a < 128) {
+                    out[x] = (uint8_t)_transparent;
+                } else {
+                    const int r = clampByte(c.r + ((in[0] + carryR * kernel.right + round) >> kernel.shift));
+                    const int g = clampByte(c.g + ((in[1] + carryG * kernel.right + round) >> kernel.shift));
+                    const int b = clampByte(c.b + ((in[2] + carryB * kernel.right + round) >> kernel.shift));
+                    const uint8_t index = nearest(cellOf(r, g, b));
+                    out[x] = index;
+                    const RGBA q = _palette.empty() ? RGBA{(uint8_t)r, (uint8_t)g, (uint8_t)b, 255} : _palette[index];
+                    er = r - q.r;
+                    eg = g - q.g;
+                    eb = b - q.b;
+                }
+                next[-3] += er * kernel.downLeft;
+                next[-2] += eg * kernel.downLeft;
+                next[-1] += eb * kernel.downLeft;
+                next[0] += er * kernel.down;
+                next[1] += eg * kernel.down;
+                next[2] += eb * kernel.down;
+                next[3] = er * kernel.downRight;
+                next[4] = eg * kernel.downRight;
+                next[5] = eb * kernel.downRight;
+                carryR = er;
+                carryG = eg;
+                carryB = eb;
+            }
+            progress[y].store(width, std::memory_order_release);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; ++i) {
+        try {
+            workers.emplace_back(diffuse);
+        } catch (const std::system_error&) {
+            // the rows go to the threads there are
+            break;
+        }
+    }
+    diffuse();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
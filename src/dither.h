@@ -0,0 +1,66 @@
+//
+//  dither.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef dither_h
+#define dither_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "rgba.h"
+
+enum class DitherMode {
+    None,           // nearest color
+    FloydSteinberg, // error diffusion to 4 neighbours
+    SierraLite,     // error diffusion to 3 neighbours, a little faster
+    Bayer,          // ordered, 8x8 Bayer matrix
+    BlueNoise,      // ordered, 32x32 void-and-cluster blue noise
+};
+
+const char* DitherModeString(DitherMode mode);
+
+// Maps RGBA pixels to the indices of a palette, dithered or not. Pixels with
+// alpha below 128 get the transparent index. The nearest color of each 5 bit
+// per channel cell is cached, so reuse a mapper for the frames that share a
+// palette. Ordered dithering uses SSE2; error diffusion of big images runs
+// rows on several threads, each row following the one above it.
+class PaletteMapper {
+public:
+    PaletteMapper();
+
+    void setDither(DitherMode mode) { _mode = mode; }
+    DitherMode dither() const { return _mode; }
+
+    // At most 256 opaque colors; transparentIndex is -1 if there is none.
+    void setPalette(const RGBA* colors, int count, int transparentIndex);
+    // Rows are stride bytes apart, indices are width * height.
+    bool map(const RGBA* pixels, int width, int height, size_t stride, uint8_t* indices);
+
+private:
+    uint8_t nearest(int cell);
+    void makeOrdered();
+    void mapOrdered(const RGBA* pixels, int width, int height, size_t stride, uint8_t* indices);
+    void mapDiffused(const RGBA* pixels, int width, int height, size_t stride, uint8_t* indices);
+
+private:
+    DitherMode _mode;
+    std::vector<RGBA> _palette;
+    int _transparent;
+    // cell -> nearest palette index + 1, 0 until looked up; rows on other
+    // threads share it
+    std::unique_ptr<std::atomic<uint16_t>[]> _nearest;
+    // ordered dithering: the matrix and the offsets of each of its entries,
+    // as RGBA bytes added then subtracted with saturation
+    DitherMode _orderedMode;
+    int _orderedSize;
+    std::vector<uint8_t> _orderedAdd;
+    std::vector<uint8_t> _orderedSub;
+};
+
+#endif /* dither_h */
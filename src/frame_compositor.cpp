@@ -0,0 +1,222 @@
+//
+//  frame_compositor.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "frame_compositor.h"
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The blend is done in float with both the numerator and the denominator
+// scaled by 255 so every intermediate is an integer below 2^24, which float
+// holds exactly; scalar and SIMD code then round to the same result:
+//   wd = ad * (255 - as)
+//   ao = as * 255 + wd
+//   c  = (cs * as * 255 + cd * wd) / ao
+//   a  = ao / 255
+static inline void blendPixel(RGBA& d, const RGBA& s) {
+    if (s.a == 255) {
+        d = s;
+        return;
+    }
+    if (s.a == 0) {
+        return;
+    }
+    const float as = s.a, ad = d.a;
+    const float wd = ad * (255.0f - as);
+    const float ws = as * 255.0f;
+    const float ao = ws + wd;
+    d.r = (uint8_t)((s.r * ws + d.r * wd) / ao + 0.5f);
+    d.g = (uint8_t)((s.g * ws + d.g * wd) / ao + 0.5f);
+    d.b = (uint8_t)((s.b * ws + d.b * wd) / ao + 0.5f);
+    d.a = (uint8_t)(ao / 255.0f + 0.5f);
+}
+
+#if defined(__SSE2__)
+// One pixel, channels in the four lanes.
+static inline __m128 blendPixelSSE2(__m128 s, __m128 d) {
+    const __m128 k255 = _mm_set1_ps(255.0f);
+    const __m128 as = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128 ad = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128 wd = _mm_mul_ps(ad, _mm_sub_ps(k255, as));
+    const __m128 ws = _mm_mul_ps(as, k255);
+    const __m128 ao = _mm_add_ps(ws, wd);
+    const __m128 c = _mm_div_ps(_mm_add_ps(_mm_mul_ps(s, ws), _mm_mul_ps(d, wd)), ao);
+    const __m128 a = _mm_div_ps(ao, k255);
+    const __m128 alphaLane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+    const __m128 half = _mm_set1_ps(0.5f);
+    return _mm_add_ps(_mm_or_ps(_mm_andnot_ps(alphaLane, c), _mm_and_ps(alphaLane, a)), half);
+}
+
+static void blendOverSSE2(RGBA* dst, const RGBA* src, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32((int)0xff000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i sa = _mm_and_si128(s, alphaMask);
+        const __m128i opaque = _mm_cmpeq_epi32(sa, alphaMask);
+        const __m128i clear = _mm_cmpeq_epi32(sa, zero);
+        const int opaqueBits = _mm_movemask_epi8(opaque);
+        const int clearBits = _mm_movemask_epi8(clear);
+        if (clearBits == 0xffff) {
+            continue;
+        }
+        if (opaqueBits == 0xffff) {
+            _mm_storeu_si128((__m128i*)(dst + i), s);
+            continue;
+        }
+        const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+
+        const __m128i s01 = _mm_unpacklo_epi8(s, zero), s23 = _mm_unpackhi_epi8(s, zero);
+        const __m128i d01 = _mm_unpacklo_epi8(d, zero), d23 = _mm_unpackhi_epi8(d, zero);
+        const __m128 r0 = blendPixelSSE2(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s01, zero)), _mm_cvtepi32_ps(_mm_unpacklo_epi16(d01, zero)));
+        const __m128 r1 = blendPixelSSE2(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s01, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(d01, zero)));
+        const __m128 r2 = blendPixelSSE2(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s23, zero)), _mm_cvtepi32_ps(_mm_unpacklo_epi16(d23, zero)));
+        const __m128 r3 = blendPixelSSE2(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s23, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(d23, zero)));
+        const __m128i r01 = _mm_packs_epi32(_mm_cvttps_epi32(r0), _mm_cvttps_epi32(r1));
+        const __m128i r23 = _mm_packs_epi32(_mm_cvttps_epi32(r2), _mm_cvttps_epi32(r3));
+        __m128i r = _mm_packus_epi16(r01, r23);
+
+        // source alpha 255 takes the source, 0 keeps the destination
+        r = _mm_or_si128(_mm_andnot_si128(opaque, r), _mm_and_si128(opaque, s));
+        r = _mm_or_si128(_mm_andnot_si128(clear, r), _mm_and_si128(clear, d));
+        _mm_storeu_si128((__m128i*)(dst + i), r);
+    }
+    for (; i < count; ++i) {
+        blendPixel(dst[i], src[i]);
+    }
+}
+#endif
+
+void blendOver(RGBA* dst, const RGBA* src, int count) {
+#if defined(__SSE2__)
+    blendOverSSE2(dst, src, count);
+#else
+    for (int i = 0; i < count; ++i) {
+        blendPixel(dst[i], src[i]);
+    }
+#endif
+}
+
+FrameCompositor::FrameCompositor(int width, int height, RGBA background)
+: _width(width), _height(height), _background(background)
+, _canvas((size_t)width * height, background)
+, _target(_canvas.data())
+, _index(0), _frame(), _x0(0), _y0(0), _x1(0), _y1(0), _pendingDispose(false) {
+}
+
+void FrameCompositor::fillRect(RGBA color) {
+    for (int y = _y0; y < _y1; ++y) {
+        RGBA* line = _canvas.data() + (size_t)y * _width;
+        std::fill(line + _x0, line + _x1, color);
+    }
+}
+
+void FrameCompositor::applyDisposal() {
+    if (!_pendingDispose) {
+        return;
+    }
+    _pendingDispose = false;
+    switch (_frame.dispose) {
+        case FrameDispose::None:
+            break;
+        case FrameDispose::Background:
+            fillRect(_background);
+            break;
+        case FrameDispose::Previous: {
+            const int rectWidth = _x1 - _x0;
+            const RGBA* saved = _saved.data();
+            for (int y = _y0; y < _y1; ++y, saved += rectWidth) {
+                memcpy(_canvas.data() + (size_t)y * _width + _x0, saved, rectWidth * sizeof(RGBA));
+            }
+            break;
+        }
+    }
+}
+
+void FrameCompositor::beginFrame(const FrameInfo& info) {
+    applyDisposal();
+
+    _frame = info;
+    // there is nothing to go back to before the first frame
+    if (_index == 0 && _frame.dispose == FrameDispose::Previous) {
+        _frame.dispose = FrameDispose::Background;
+    }
+    _x0 = std::min(std::max(info.x, 0), _width);
+    _y0 = std::min(std::max(info.y, 0), _height);
+    _x1 = std::max(std::min(info.x + info.width, _width), _x0);
+    _y1 = std::max(std::min(info.y + info.height, _height), _y0);
+
+    if (_frame.dispose == FrameDispose::Previous) {
+        const int rectWidth = _x1 - _x0;
+        _saved.resize((size_t)rectWidth * (_y1 - _y0));
+        RGBA* saved = _saved.data();
+        for (int y = _y0; y < _y1; ++y, saved += rectWidth) {
+            memcpy(saved, _canvas.data() + (size_t)y * _width + _x0, rectWidth * sizeof(RGBA));
+        }
+    }
+}
+
+void FrameCompositor::drawRow(int y, const RGBA* pixels) {
+    y += _frame.y;
+    if (y < _y0 || y >= _y1) {
+        return;
+    }
+    pixels += _x0 - _frame.x;
+    RGBA* line = _target + (size_t)y * _width + _x0;
+    if (_frame.blend == FrameBlend::Over) {
+        blendOver(line, pixels, _x1 - _x0);
+    } else {
+        memcpy(line, pixels, (_x1 - _x0) * sizeof(RGBA));
+    }
+}
+
+void FrameCompositor::drawIndexedRow(int y, const uint8_t* indices, const RGBA* palette) {
+    y += _frame.y;
+    if (y < _y0 || y >= _y1) {
+        return;
+    }
+    indices += _x0 - _frame.x;
+    RGBA* line = _target + (size_t)y * _width + _x0;
+    const bool over = _frame.blend == FrameBlend::Over;
+    for (int x = 0, count = _x1 - _x0; x < count; ++x) {
+        const RGBA& color = palette[indices[x]];
+        if (color.a != 0 || !over) {
+            line[x] = color;
+        }
+    }
+}
+
+Frame FrameCompositor::endFrame() {
+    _pendingDispose = true;
+    Frame frame;
+    frame.index = _index++;
+    frame.width = _width;
+    frame.height = _height;
+    frame.pixels = _canvas.data();
+    frame.delayMs = _frame.delayMs;
+    return frame;
+}
+
+void FrameCompositor::beginPreview() {
+    _preview = _canvas;
+    _target = _preview.data();
+}
+
+Frame FrameCompositor::endPreview() {
+    _target = _canvas.data();
+    Frame frame;
+    frame.index = _index;
+    frame.width = _width;
+    frame.height = _height;
+    frame.pixels = _preview.data();
+    frame.delayMs = _frame.delayMs;
+    return frame;
+}
@@ -0,0 +1,100 @@
+//
+//  frame_compositor.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef frame_compositor_h
+#define frame_compositor_h
+
+#include <functional>
+#include <vector>
+#include "rgba.h"
+
+enum class FrameDispose {
+    None,       // leave the frame on the canvas
+    Background, // clear the frame area to the background
+    Previous,   // restore the frame area to what it was before the frame
+};
+
+enum class FrameBlend {
+    Source, // replace the canvas pixels, alpha included
+    Over,   // alpha-composite the frame over the canvas
+};
+
+struct FrameInfo {
+    int x, y, width, height;
+    FrameDispose dispose;
+    FrameBlend blend;
+    int delayMs;
+};
+
+// A composited frame as handed to the output stage.
+struct Frame {
+    int index;
+    int width, height;
+    const RGBA* pixels;
+    int delayMs;
+};
+
+// Return false to stop decoding.
+typedef std::function<bool(const Frame& frame)> FrameHandler;
+
+// Called as the passes of an interlaced frame are decoded, with the canvas as
+// it would be if every row still to come were a copy of the nearest decoded
+// row above it. pass counts from 1; the last of the passes is not previewed,
+// it completes the frame, which goes to the FrameHandler as usual. Return
+// false to stop decoding.
+typedef std::function<bool(const Frame& preview, int pass, int passes)> PreviewHandler;
+
+// Builds the full canvas of each frame of an animation from the frame
+// rectangles, with GIF/APNG disposal and blending. The disposal of a frame is
+// applied when the next frame begins, so the canvas holds the finished frame
+// between endFrame and the next beginFrame.
+class FrameCompositor {
+public:
+    FrameCompositor(int width, int height, RGBA background);
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    const RGBA* pixels() const { return _canvas.data(); }
+
+    // The frame rectangle is clipped to the canvas.
+    void beginFrame(const FrameInfo& info);
+    // Row y of the frame, info.width pixels.
+    void drawRow(int y, const RGBA* pixels);
+    // Row y of the frame as palette indices; palette has 256 entries and
+    // entries with alpha 0 leave the canvas as it is.
+    void drawIndexedRow(int y, const uint8_t* indices, const RGBA* palette);
+    Frame endFrame();
+
+    // Rows drawn between beginPreview and endPreview go onto a copy of the
+    // canvas, which endPreview returns; the canvas itself is left as it was.
+    void beginPreview();
+    Frame endPreview();
+
+private:
+    void applyDisposal();
+    void fillRect(RGBA color);
+
+private:
+    int _width, _height;
+    RGBA _background;
+    std::vector<RGBA> _canvas;
+    std::vector<RGBA> _saved;
+    std::vector<RGBA> _preview;
+    // where drawRow and drawIndexedRow draw, the canvas or the preview
+    RGBA* _target;
+
+    int _index;
+    FrameInfo _frame;
+    // clipped frame rectangle
+    int _x0, _y0, _x1, _y1;
+    bool _pendingDispose;
+};
+
+// dst = src over dst, straight (not premultiplied) alpha as in APNG.
+void blendOver(RGBA* dst, const RGBA* src, int count);
+
+#endif /* frame_compositor_h */
@@ -0,0 +1,244 @@
+//
+//  gif_reader.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "gif_reader.h"
+#include "../lib/giflib-5.2.1/gif_lib.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+
+static void printGIFError(const char* name, int err) {
+    printf("gif: %s: error: %d(%s)", name, err, GifErrorString(err));
+}
+
+// from https://android.googlesource.com/platform/frameworks/ex/+/refs/heads/master/framesequence/jni/FrameSequence_gif.cpp
+static RGBA gif_getBGColor(GifFileType* GifFile) {
+    RGBA color = k_rgba_transparent;
+    const ColorMapObject* cmap = GifFile->SColorMap;
+    if (cmap) {
+        // calculate bg color
+        GraphicsControlBlock gcb;
+        DGifSavedExtensionToGCB(GifFile, 0, &gcb);
+        if (gcb.TransparentColor == NO_TRANSPARENT_COLOR && GifFile->SBackGroundColor < cmap->ColorCount) {
+            auto gifColor = cmap->Colors[GifFile->SBackGroundColor];
+            color.r = gifColor.Red;
+            color.g = gifColor.Green;
+            color.b = gifColor.Blue;
+            color.a = 255;
+        }
+    }
+    return color;
+}
+
+static FrameDispose gif_getDispose(int srcI, int disposalMode) {
+    switch (disposalMode) {
+        case DISPOSE_DO_NOT:
+            printf("%d: DISPOSE_DO_NOT\n", srcI);
+            return FrameDispose::None;
+        case DISPOSE_BACKGROUND:
+            printf("%d: DISPOSE_BACKGROUND\n", srcI);
+            return FrameDispose::Background;
+        case DISPOSE_PREVIOUS:
+            printf("%d: DISPOSE_PREVIOUS\n", srcI);
+            return FrameDispose::Previous;
+        case DISPOSAL_UNSPECIFIED:
+            printf("%d: DISPOSAL_UNSPECIFIED\n", srcI);
+            return FrameDispose::None;
+        default:
+            printf("%d: DISPOSAL_UNKNOWN\n", srcI);
+            return FrameDispose::None;
+    }
+}
+
+static void gif_getPalette(const ColorMapObject* ColorMap, int transparentColor, RGBA palette[256]) {
+    // indices outside the color map are drawn as transparent
+    for (int i = 0; i < 256; ++i) {
+        if (i != transparentColor && i < ColorMap->ColorCount) {
+            const auto* color = ColorMap->Colors + i;
+            palette[i].r = color->Red;
+            palette[i].g = color->Green;
+            palette[i].b = color->Blue;
+            palette[i].a = 255;
+        } else {
+            palette[i] = k_rgba_transparent;
+        }
+    }
+}
+
+// The record loop of DGifSlurp, with each image composited as soon as its
+// lines are read and its raster freed after, and interlaced images previewed
+// between their passes.
+// https://docstore.mik.ua/orelly/web2/wdesign/ch23_05.htm
+static int decodeGIFFrames(GifFileType* GifFile, const FrameHandler& onFrame, const PreviewHandler& onPreview) {
+    // the order the rows of an interlaced image come in
+    static const int InterlacedOffset[] = { 0, 4, 2, 1 };
+    static const int InterlacedJumps[] = { 8, 8, 4, 2 };
+
+    std::unique_ptr<FrameCompositor> compositor;
+    RGBA palette[256];
+    GifRecordType RecordType;
+    GifByteType* ExtData;
+    int ExtFunction;
+
+    GifFile->ExtensionBlocks = NULL;
+    GifFile->ExtensionBlockCount = 0;
+
+    do {
+        if (DGifGetRecordType(GifFile, &RecordType) == GIF_ERROR) {
+            return GifFile->Error;
+        }
+        if (RecordType == EXTENSION_RECORD_TYPE) {
+            if (DGifGetExtension(GifFile, &ExtFunction, &ExtData) == GIF_ERROR) {
+                return GifFile->Error;
+            }
+            if (ExtData != NULL && GifAddExtensionBlock(&GifFile->ExtensionBlockCount, &GifFile->ExtensionBlocks, ExtFunction, ExtData[0], &ExtData[1]) == GIF_ERROR) {
+                return D_GIF_ERR_NOT_ENOUGH_MEM;
+            }
+            while (1) {
+                if (DGifGetExtensionNext(GifFile, &ExtData) == GIF_ERROR) {
+                    return GifFile->Error;
+                }
+                if (ExtData == NULL) {
+                    break;
+                }
+                if (GifAddExtensionBlock(&GifFile->ExtensionBlockCount, &GifFile->ExtensionBlocks, CONTINUE_EXT_FUNC_CODE, ExtData[0], &ExtData[1]) == GIF_ERROR) {
+                    return D_GIF_ERR_NOT_ENOUGH_MEM;
+                }
+            }
+            continue;
+        }
+        if (RecordType != IMAGE_DESC_RECORD_TYPE) {
+            continue;
+        }
+
+        if (DGifGetImageDesc(GifFile) == GIF_ERROR) {
+            return GifFile->Error;
+        }
+        const int srcI = GifFile->ImageCount - 1;
+        auto& src = GifFile->SavedImages[srcI];
+        const int width = src.ImageDesc.Width;
+        const int height = src.ImageDesc.Height;
+        if (width <= 0 || height <= 0 || width > INT_MAX / height) {
+            return D_GIF_ERR_DATA_TOO_BIG;
+        }
+        src.RasterBits = (GifPixelType*)malloc((size_t)width * height);
+        if (src.RasterBits == NULL) {
+            return D_GIF_ERR_NOT_ENOUGH_MEM;
+        }
+        // the extensions read since the last image are this image's
+        if (GifFile->ExtensionBlocks) {
+            src.ExtensionBlocks = GifFile->ExtensionBlocks;
+            src.ExtensionBlockCount = GifFile->ExtensionBlockCount;
+            GifFile->ExtensionBlocks = NULL;
+            GifFile->ExtensionBlockCount = 0;
+        }
+
+        GraphicsControlBlock gcb;
+        DGifSavedExtensionToGCB(GifFile, srcI, &gcb);
+        if (!compositor) {
+            // the background color depends on the first image's extensions
+            compositor.reset(new FrameCompositor(GifFile->SWidth, GifFile->SHeight, gif_getBGColor(GifFile)));
+        }
+
+        /* Lets dump it - set the global variables required and do it: */
+        const auto ColorMap = (src.ImageDesc.ColorMap ? src.ImageDesc.ColorMap : GifFile->SColorMap);
+        if (ColorMap == NULL) {
+            fprintf(stderr, "Gif Image does not have a colormap\n");
+        } else {
+            gif_getPalette(ColorMap, gcb.TransparentColor, palette);
+        }
+
+        printf("%d, %d, %d, %d\n", src.ImageDesc.Left, src.ImageDesc.Top, width, height);
+
+        FrameInfo info;
+        info.x = src.ImageDesc.Left;
+        info.y = src.ImageDesc.Top;
+        info.width = width;
+        info.height = height;
+        info.dispose = gif_getDispose(srcI, gcb.DisposalMode);
+        info.blend = FrameBlend::Over;
+        info.delayMs = gcb.DelayTime * 10;
+        if (ColorMap) {
+            compositor->beginFrame(info);
+        }
+
+        bool stopped = false;
+        if (src.ImageDesc.Interlace) {
+            for (int pass = 0; pass < 4; ++pass) {
+                for (int y = InterlacedOffset[pass]; y < height; y += InterlacedJumps[pass]) {
+                    if (DGifGetLine(GifFile, src.RasterBits + (size_t)y * width, width) == GIF_ERROR) {
+                        return GifFile->Error;
+                    }
+                }
+                if (onPreview && ColorMap && pass < 3) {
+                    // the rows read so far are those at multiples of step
+                    const int step = InterlacedJumps[pass + 1];
+                    compositor->beginPreview();
+                    for (int y = 0; y < height; ++y) {
+                        compositor->drawIndexedRow(y, src.RasterBits + (size_t)(y & ~(step - 1)) * width, palette);
+                    }
+                    if (!onPreview(compositor->endPreview(), pass + 1, 4)) {
+                        stopped = true;
+                        break;
+                    }
+                }
+            }
+        } else {
+            if (DGifGetLine(GifFile, src.RasterBits, width * height) == GIF_ERROR) {
+                return GifFile->Error;
+            }
+        }
+        if (stopped) {
+            break;
+        }
+
+        if (ColorMap) {
+            for (int y = 0; y < height; ++y) {
+                compositor->drawIndexedRow(y, src.RasterBits + (size_t)y * width, palette);
+            }
+            const Frame frame = compositor->endFrame();
+            if (onFrame && !onFrame(frame)) {
+                break;
+            }
+        }
+        // the frame is on the canvas, its indices aren't needed anymore
+        free(src.RasterBits);
+        src.RasterBits = NULL;
+    } while (RecordType != TERMINATE_RECORD_TYPE);
+
+    /* Sanity check for corrupted file */
+    if (GifFile->ImageCount == 0) {
+        return D_GIF_ERR_NO_IMAG_DSCR;
+    }
+    printf("done.");
+    return D_GIF_SUCCEEDED;
+}
+
+bool readGIF(const char* name, const FrameHandler& onFrame, const PreviewHandler& onPreview) {
+    printf("%s\n", name);
+    int Error;
+    GifFileType* GifFile = DGifOpenFileName(name, &Error);
+    if (!GifFile) {
+        printGIFError("open", Error);
+        return false;
+    }
+    printf("w: %d, h: %d\n", GifFile->SWidth, GifFile->SHeight);
+    if (GifFile->SHeight == 0 || GifFile->SWidth == 0) {
+        fprintf(stderr, "Image of width or height 0\n");
+        DGifCloseFile(GifFile, &Error);
+        return false;
+    }
+    Error = decodeGIFFrames(GifFile, onFrame, onPreview);
+    if (Error != D_GIF_SUCCEEDED) {
+        printGIFError("decode", Error);
+    }
+    if (DGifCloseFile(GifFile, &Error) == GIF_ERROR) {
+        printGIFError("close", Error);
+    }
+    return true;
+}
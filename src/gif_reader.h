@@ -0,0 +1,18 @@
+//
+//  gif_reader.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef gif_reader_h
+#define gif_reader_h
+
+#include "frame_compositor.h"
+
+// Decodes every frame of a GIF and passes the composited canvas to onFrame.
+// Frames are decoded one at a time as the file is read; interlaced frames are
+// previewed after each of the first 3 of their 4 passes.
+bool readGIF(const char* name, const FrameHandler& onFrame = FrameHandler(), const PreviewHandler& onPreview = PreviewHandler());
+
+#endif /* gif_reader_h */
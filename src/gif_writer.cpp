@@ -0,0 +1,1178 @@
+//
+//  gif_writer.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "gif_writer.h"
+// GifQuantizeBuffer is declared with the giflib utilities
+extern "C" {
+#include "../lib/giflib-5.2.1/getarg.h"
+}
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <system_error>
+#include <thread>
+
+// Slots of the exact color table, 4 times the most colors a palette has.
+static const int k_exact_slots = 1024;
+
+static inline uint32_t exactKey(RGBA c) {
+    return 0x1000000u | (uint32_t)c.r << 16 | (uint32_t)c.g << 8 | c.b;
+}
+
+static inline uint32_t exactSlot(uint32_t key) {
+    return (key * 0x9E3779B1u) >> 22;
+}
+
+// Pixels a thread quantizes at least, and the most threads used.
+static const size_t k_quantize_part = 1 << 18;
+static const unsigned k_quantize_threads = 8;
+
+static int quantizeParts(size_t count) {
+    const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    return (int)std::max<size_t>(1, std::min<size_t>(count / k_quantize_part, std::min(cpus, k_quantize_threads)));
+}
+
+// Runs fn(part, begin, end) on parts equal pieces of count pixels, the
+// first on this thread.
+template <typename Fn>
+static void forEachPart(size_t count, int parts, const Fn& fn) {
+    std::vector<std::thread> threads;
+    for (int part = 1; part < parts; ++part) {
+        const size_t begin = count * part / parts;
+        const size_t end = count * (part + 1) / parts;
+        try {
+            threads.emplace_back(fn, part, begin, end);
+        } catch (const std::system_error&) {
+            fn(part, begin, end);
+        }
+    }
+    fn(0, 0, count / parts);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Pixels of each frame that go into the histogram of Shared mode, about.
+static const size_t k_sample_pixels = 1 << 16;
+
+// Ways the optimizer tries a frame: each disposal of the frame before it,
+// with and without the unchanged pixels made transparent.
+static const int k_candidates = 6;
+// Canvas pixels from which the candidates are encoded on several threads.
+static const size_t k_optimize_part = 1 << 16;
+
+// Canvas pixels from which frames are encoded on threads of their own, and
+// the most frames encoded at once.
+static const size_t k_encode_part = 1 << 16;
+static const unsigned k_encode_threads = 8;
+
+static int gif_getDisposalMode(FrameDispose dispose) {
+    switch (dispose) {
+        case FrameDispose::None:
+            return DISPOSE_DO_NOT;
+        case FrameDispose::Background:
+            return DISPOSE_BACKGROUND;
+        case FrameDispose::Previous:
+            return DISPOSE_PREVIOUS;
+    }
+    return DISPOSAL_UNSPECIFIED;
+}
+
+// A color map object over colors, which giflib only copies from.
+static ColorMapObject gif_colorMap(const std::vector<GifColorType>& colors) {
+    ColorMapObject map;
+    map.ColorCount = (int)colors.size();
+    map.BitsPerPixel = GifBitSize(map.ColorCount);
+    map.SortFlag = false;
+    map.Colors = const_cast<GifColorType*>(colors.data());
+    return map;
+}
+
+GifWriter::GifWriter()
+: _gif(nullptr)
+, _file(nullptr)
+, _sinkFailed(false)
+, _width(0)
+, _height(0)
+, _loopCount(0)
+, _paletteMode(GifPaletteMode::PerFrame)
+, _frames(0)
+, _error(E_GIF_SUCCEEDED)
+, _lossy(0)
+, _colorCount(0)
+, _transparent(-1)
+, _encodeThreads(1)
+, _optimize(false)
+, _hasPending(false)
+, _pending()
+, _pendingDelayMs(0)
+, _pendingColorCount(0)
+, _pendingTransparent(-1) {
+    _quantize.kind = QuantizerKind::MedianCut;
+}
+
+GifWriter::~GifWriter() {
+    closeEncoders();
+    closeCandidates();
+    if (_gif) {
+        EGifCloseFile(_gif, nullptr);
+    }
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+int GifWriter::writeSink(GifFileType* gif, const GifByteType* data, int size) {
+    auto* writer = (GifWriter*)gif->UserData;
+    if (writer->_sinkFailed || (size > 0 && !writer->_sink(data, size))) {
+        writer->_sinkFailed = true;
+        return 0;
+    }
+    return size;
+}
+
+bool GifWriter::fail(int error) {
+    if (_error == E_GIF_SUCCEEDED) {
+        _error = error;
+    }
+    return false;
+}
+
+bool GifWriter::open(const char* name, int width, int height) {
+    if (_gif || _file) {
+        return fail(E_GIF_ERR_OPEN_FAILED);
+    }
+    _file = fopen(name, "wb");
+    if (!_file) {
+        return fail(E_GIF_ERR_OPEN_FAILED);
+    }
+    FILE* file = _file;
+    return open([file](const uint8_t* data, size_t size) {
+        return fwrite(data, 1, size, file) == size;
+    }, width, height);
+}
+
+bool GifWriter::open(const GifSink& sink, int width, int height) {
+    if (_gif) {
+        return fail(E_GIF_ERR_OPEN_FAILED);
+    }
+    if (width <= 0 || height <= 0 || width > 0xffff || height > 0xffff) {
+        return fail(E_GIF_ERR_DATA_TOO_BIG);
+    }
+    _sink = sink;
+    _sinkFailed = false;
+    _width = width;
+    _height = height;
+    _frames = 0;
+    _error = E_GIF_SUCCEEDED;
+    _shared.clear();
+    if (_sampled) {
+        _sampled->clear();
+    }
+    closeEncoders();
+    _globalColors.clear();
+    const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    _encodeThreads = (size_t)width * height >= k_encode_part ? std::min(cpus, k_encode_threads) : 1;
+
+    int error = E_GIF_SUCCEEDED;
+    _gif = EGifOpen(this, writeSink, &error);
+    if (!_gif) {
+        return fail(error);
+    }
+    // GCB and application extensions need GIF89a
+    EGifSetGifVersion(_gif, true);
+    return !_optimize || openCandidates();
+}
+
+int GifWriter::paletteLimit() const {
+    return std::max(1, std::min(_quantize.maxColors, 256));
+}
+
+// The distinct opaque colors of the frame, in order, go to _colors and
+// their indices to _indices, with 0xff for transparent pixels. Gives up
+// when there are more than limit colors, but still tells if any pixel is
+// transparent.
+bool GifWriter::exactPalette(const RGBA* pixels, size_t count, size_t limit, bool& transparent) {
+    _exactKeys.assign(k_exact_slots, 0);
+    _exactIndices.resize(k_exact_slots);
+    _colors.clear();
+
+    bool exact = true;
+    transparent = false;
+    uint32_t lastKey = 0;
+    uint8_t lastIndex = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const RGBA c = pixels[i];
+        if (c.a < 128) {
+            transparent = true;
+            _indices[i] = 0xff;
+            continue;
+        }
+        if (!exact) {
+            continue;
+        }
+        const uint32_t key = exactKey(c);
+        if (key != lastKey) {
+            uint32_t slot = exactSlot(key);
+            while (_exactKeys[slot] && _exactKeys[slot] != key) {
+                slot = (slot + 1) & (k_exact_slots - 1);
+            }
+            if (!_exactKeys[slot]) {
+                if (_colors.size() == limit) {
+                    exact = false;
+                    continue;
+                }
+                _exactKeys[slot] = key;
+                _exactIndices[slot] = (uint16_t)_colors.size();
+                _colors.push_back({c.r, c.g, c.b});
+            }
+            lastKey = key;
+            lastIndex = (uint8_t)_exactIndices[slot];
+        }
+        _indices[i] = lastIndex;
+    }
+    // a transparent index needs a free entry
+    return exact && !(transparent && _colors.size() == 256);
+}
+
+// Opaque pixels of the frame, in order, go to the palette; up to 256
+// distinct colors, or 255 with a transparent index, are kept exactly and
+// more are quantized. _indices gets the frame.
+bool GifWriter::buildPalette(const RGBA* pixels, size_t count, bool reserveTransparent) {
+    const size_t limit = (size_t)paletteLimit();
+    bool transparent = false;
+    bool exact = exactPalette(pixels, count, limit, transparent);
+    _transparent = -1;
+    reserveTransparent = reserveTransparent || transparent;
+    if (exact && reserveTransparent && _colors.size() == 256) {
+        exact = false;
+    }
+
+    if (exact) {
+        if (reserveTransparent) {
+            _transparent = (int)_colors.size();
+        }
+        // transparent pixels were marked 0xff, which is right only if the
+        // transparent index is 255
+        if (transparent && _transparent != 0xff) {
+            for (size_t i = 0; i < count; ++i) {
+                if (pixels[i].a < 128) {
+                    _indices[i] = (uint8_t)_transparent;
+                }
+            }
+        }
+        _colorCount = (int)_colors.size();
+    } else if (_quantize.kind != QuantizerKind::MedianCut || _quantize.refineIterations > 0) {
+        if (!quantize(pixels, count, _quantize, reserveTransparent, _quantized)) {
+            return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+        }
+        _colors.clear();
+        for (const auto& c : _quantized.palette) {
+            _colors.push_back({c.r, c.g, c.b});
+        }
+        _colorCount = (int)_colors.size();
+        _transparent = _quantized.transparentIndex;
+        _indices.swap(_quantized.indices);
+    } else if (!quantizeMedianCut(pixels, count, (int)std::min(limit, reserveTransparent ? (size_t)255 : (size_t)256), reserveTransparent)) {
+        return false;
+    }
+
+    if (_mapper.dither() != DitherMode::None) {
+        // quantized frames are remapped dithered, later frames of Global
+        // mode are mapped the same way
+        if (!exact || _paletteMode == GifPaletteMode::Global) {
+            setDitherPalette();
+        }
+        if (!exact && !ditherToPalette(pixels)) {
+            return false;
+        }
+    }
+    if (_paletteMode == GifPaletteMode::Global) {
+        indexPalette();
+    }
+    return true;
+}
+
+// giflib's median cut, with the histogram and the mapping of big frames
+// split across threads.
+bool GifWriter::quantizeMedianCut(const RGBA* pixels, size_t count, int colors, bool reserveTransparent) {
+    const int parts = quantizeParts(count);
+    try {
+        _histograms.resize(parts);
+        for (auto& histogram : _histograms) {
+            histogram.assign(GIF_QUANTIZE_HISTOGRAM_SIZE, 0);
+        }
+        _colorTable.resize(GIF_QUANTIZE_HISTOGRAM_SIZE);
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    forEachPart(count, parts, [this, pixels](int part, size_t begin, size_t end) {
+        GifQuantizeHistogramRGBA((const GifByteType*)(pixels + begin), end - begin, _histograms[part].data());
+    });
+    auto& histogram = _histograms[0];
+    for (int part = 1; part < parts; ++part) {
+        for (int i = 0; i < GIF_QUANTIZE_HISTOGRAM_SIZE; ++i) {
+            histogram[i] += _histograms[part][i];
+        }
+    }
+    _colors.resize(256);
+    if (GifQuantizeHistogram(histogram.data(), &colors, _colors.data(), _colorTable.data()) == GIF_ERROR) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    _colors.resize(colors);
+    _colorCount = colors;
+    if (reserveTransparent) {
+        _transparent = colors;
+    }
+    forEachPart(count, parts, [this, pixels](int /*part*/, size_t begin, size_t end) {
+        GifQuantizeMapRGBA((const GifByteType*)(pixels + begin), end - begin, _colorTable.data(), _transparent, _indices.data() + begin);
+    });
+    return true;
+}
+
+// Makes the global palette ready for paletteIndex: its colors go to the
+// exact table and the nearest color cache starts empty.
+void GifWriter::indexPalette() {
+    _exactKeys.assign(k_exact_slots, 0);
+    _exactIndices.resize(k_exact_slots);
+    for (int i = 0; i < _colorCount; ++i) {
+        const auto& color = _colors[i];
+        const uint32_t key = exactKey({color.Red, color.Green, color.Blue, 255});
+        uint32_t slot = exactSlot(key);
+        while (_exactKeys[slot] && _exactKeys[slot] != key) {
+            slot = (slot + 1) & (k_exact_slots - 1);
+        }
+        if (!_exactKeys[slot]) {
+            _exactKeys[slot] = key;
+            _exactIndices[slot] = (uint16_t)i;
+        }
+    }
+    _nearest.assign(1 << 15, 0);
+}
+
+// The global palette index of an opaque color: the color itself if it is in
+// the palette, else the nearest entry, cached per 5 bit per channel cell.
+uint8_t GifWriter::paletteIndex(RGBA c) {
+    const uint32_t key = exactKey(c);
+    uint32_t slot = exactSlot(key);
+    while (_exactKeys[slot] && _exactKeys[slot] != key) {
+        slot = (slot + 1) & (k_exact_slots - 1);
+    }
+    if (_exactKeys[slot]) {
+        return (uint8_t)_exactIndices[slot];
+    }
+    const int cell = ColorHistogram::cellOf(c);
+    if (!_nearest[cell]) {
+        int best = 0;
+        int bestDistance = INT_MAX;
+        for (int j = 0; j < _colorCount; ++j) {
+            const int dr = _colors[j].Red - c.r;
+            const int dg = _colors[j].Green - c.g;
+            const int db = _colors[j].Blue - c.b;
+            const int distance = dr * dr + dg * dg + db * db;
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = j;
+            }
+        }
+        _nearest[cell] = (uint16_t)(best + 1);
+    }
+    return (uint8_t)(_nearest[cell] - 1);
+}
+
+// Maps a frame to the global palette.
+void GifWriter::mapToPalette(const RGBA* pixels, size_t count) {
+    uint32_t lastKey = 0;
+    uint8_t lastIndex = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const RGBA c = pixels[i];
+        if (c.a < 128) {
+            _indices[i] = (uint8_t)_transparent;
+            continue;
+        }
+        const uint32_t key = exactKey(c);
+        if (key != lastKey) {
+            lastIndex = paletteIndex(c);
+            lastKey = key;
+        }
+        _indices[i] = lastIndex;
+    }
+}
+
+void GifWriter::setDitherPalette() {
+    std::vector<RGBA> palette(_colorCount);
+    for (int i = 0; i < _colorCount; ++i) {
+        palette[i] = { _colors[i].Red, _colors[i].Green, _colors[i].Blue, 255 };
+    }
+    _mapper.setPalette(palette.data(), _colorCount, _transparent);
+}
+
+// The frame, _width by _height, to _indices with the dithering of _mapper.
+bool GifWriter::ditherToPalette(const RGBA* pixels) {
+    _indices.resize((size_t)_width * _height);
+    return _mapper.map(pixels, _width, _height, (size_t)_width * 4, _indices.data()) || fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+}
+
+// Color tables have a power of 2 entries, 2 at least.
+void GifWriter::padPalette() {
+    const size_t entries = _colorCount + (_transparent >= 0 ? 1 : 0);
+    _colors.resize(std::max<size_t>(2, (size_t)1 << GifBitSize((int)entries)), {0, 0, 0});
+}
+
+// Shared mode: the frame is kept for close, as its exact palette and
+// indices if it has few enough colors, and some of its rows go to the
+// histogram the palette is quantized from if all the colors do not fit.
+bool GifWriter::keepFrame(const Frame& frame, FrameDispose dispose) {
+    const size_t count = (size_t)_width * _height;
+    try {
+        if (!_sampled) {
+            _sampled.reset(new ColorHistogram());
+        }
+        _indices.resize(count);
+        _shared.emplace_back();
+        auto& kept = _shared.back();
+        kept.delayMs = frame.delayMs;
+        kept.dispose = dispose;
+        if (exactPalette(frame.pixels, count, (size_t)paletteLimit(), kept.transparent)) {
+            kept.indices.swap(_indices);
+            kept.colors = _colors;
+        } else {
+            kept.pixels.assign(frame.pixels, frame.pixels + count);
+        }
+        // every step-th row, starting at a different row for each frame:
+        // about k_sample_pixels / _width rows
+        const int step = (int)std::max<size_t>(1, count / k_sample_pixels);
+        const uint64_t sampled = _sampled->pixels();
+        for (int y = _frames % step; y < _height; y += step) {
+            _sampled->add(frame.pixels + (size_t)y * _width, _width);
+        }
+        // step is at least half of count / k_sample_pixels
+        assert(step == 1 || _sampled->pixels() - sampled <= 2 * k_sample_pixels + _width);
+        (void)sampled;
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    return true;
+}
+
+// Shared mode: builds the global palette and writes the kept frames with
+// it. Like GifUnionColorMap, the palette is the colors of the first frame
+// followed by those of each later frame that are not in it yet; each frame
+// is then remapped with a translation table, as GifApplyTranslation does.
+// Frames with too many colors, or too many colors together, make the
+// palette quantized from the sampled histogram instead.
+bool GifWriter::writeShared() {
+    _colors.clear();
+    _colorCount = 0;
+    _transparent = -1;
+    if (_shared.empty()) {
+        return writeHeader();
+    }
+    // the optimizer makes the unchanged pixels transparent
+    bool transparent = _optimize;
+    for (const auto& kept : _shared) {
+        transparent = transparent || kept.transparent;
+    }
+    const size_t limit = std::min<size_t>(paletteLimit(), transparent ? 255 : 256);
+
+    _exactKeys.assign(k_exact_slots, 0);
+    _exactIndices.resize(k_exact_slots);
+    bool exact = true;
+    for (size_t f = 0; f < _shared.size() && exact; ++f) {
+        const auto& kept = _shared[f];
+        exact = !kept.indices.empty();
+        for (size_t i = 0; i < kept.colors.size() && exact; ++i) {
+            const auto& color = kept.colors[i];
+            const uint32_t key = exactKey({color.Red, color.Green, color.Blue, 255});
+            uint32_t slot = exactSlot(key);
+            while (_exactKeys[slot] && _exactKeys[slot] != key) {
+                slot = (slot + 1) & (k_exact_slots - 1);
+            }
+            if (!_exactKeys[slot]) {
+                if (_colors.size() == limit) {
+                    exact = false;
+                    break;
+                }
+                _exactKeys[slot] = key;
+                _colors.push_back(color);
+            }
+        }
+    }
+    if (!exact) {
+        std::vector<RGBA> palette;
+        try {
+            if (_sampled->pixels() > 0) {
+                makeQuantizer(_quantize.kind)->makePalette(*_sampled, (int)limit, palette);
+                refinePalette(*_sampled, _quantize.refineIterations, palette);
+            }
+        } catch (const std::bad_alloc&) {
+            return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+        }
+        _colors.clear();
+        for (const auto& c : palette) {
+            _colors.push_back({c.r, c.g, c.b});
+        }
+    }
+    _colorCount = (int)_colors.size();
+    if (transparent) {
+        _transparent = _colorCount;
+    }
+    indexPalette();
+    padPalette();
+    if (!writeHeader()) {
+        return false;
+    }
+
+    const size_t count = (size_t)_width * _height;
+    // a quantized palette is dithered to, the union of the colors is exact
+    const bool dither = !exact && _mapper.dither() != DitherMode::None;
+    if (dither) {
+        setDitherPalette();
+    }
+    GifPixelType translation[256];
+    for (auto& kept : _shared) {
+        if (dither) {
+            if (kept.pixels.empty()) {
+                try {
+                    kept.pixels.resize(count);
+                } catch (const std::bad_alloc&) {
+                    return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    const uint8_t index = kept.indices[i];
+                    if (kept.transparent && index == 0xff) {
+                        kept.pixels[i] = k_rgba_transparent;
+                    } else {
+                        const auto& color = kept.colors[index];
+                        kept.pixels[i] = { color.Red, color.Green, color.Blue, 255 };
+                    }
+                }
+            }
+            if (!ditherToPalette(kept.pixels.data())) {
+                return false;
+            }
+        } else if (kept.indices.empty()) {
+            _indices.resize(count);
+            mapToPalette(kept.pixels.data(), count);
+        } else {
+            for (size_t i = 0; i < kept.colors.size(); ++i) {
+                const auto& color = kept.colors[i];
+                translation[i] = paletteIndex({color.Red, color.Green, color.Blue, 255});
+            }
+            if (kept.transparent) {
+                translation[0xff] = (GifPixelType)_transparent;
+            }
+            SavedImage image;
+            memset(&image, 0, sizeof(image));
+            image.ImageDesc.Width = _width;
+            image.ImageDesc.Height = _height;
+            image.RasterBits = kept.indices.data();
+            GifApplyTranslation(&image, translation);
+            _indices.swap(kept.indices);
+        }
+        // the frames are let go of as they are written
+        std::vector<RGBA>().swap(kept.pixels);
+        std::vector<uint8_t>().swap(kept.indices);
+        if (!(_optimize ? optimizeFrame(kept.delayMs, false) : queueFrame(kept.delayMs, kept.dispose, false))) {
+            return false;
+        }
+    }
+    _shared.clear();
+    return true;
+}
+
+// Screen descriptor, with the global color table in Global mode, and the
+// loop extension.
+bool GifWriter::writeHeader() {
+    try {
+        if (_paletteMode != GifPaletteMode::PerFrame) {
+            _globalColors = _colors;
+        }
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    ColorMapObject map = gif_colorMap(_globalColors);
+    if (EGifPutScreenDesc(_gif, _width, _height, 8, 0, _globalColors.empty() ? nullptr : &map) == GIF_ERROR) {
+        return fail(_gif->Error);
+    }
+    for (int i = 0; _candidates && i < k_candidates; ++i) {
+        if (!openEncoder(_candidates[i])) {
+            return false;
+        }
+    }
+    if (_loopCount >= 0) {
+        const GifByteType loop[3] = { 1, (GifByteType)(_loopCount & 0xff), (GifByteType)((_loopCount >> 8) & 0xff) };
+        if (EGifPutExtensionLeader(_gif, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR
+            || EGifPutExtensionBlock(_gif, 11, "NETSCAPE2.0") == GIF_ERROR
+            || EGifPutExtensionBlock(_gif, sizeof(loop), loop) == GIF_ERROR
+            || EGifPutExtensionTrailer(_gif) == GIF_ERROR) {
+            return fail(_gif->Error);
+        }
+    }
+    return !_sinkFailed || fail(E_GIF_ERR_WRITE_FAILED);
+}
+
+bool GifWriter::addFrame(const Frame& frame, FrameDispose dispose) {
+    if (!_gif || _error != E_GIF_SUCCEEDED) {
+        return fail(E_GIF_ERR_NOT_WRITEABLE);
+    }
+    if (frame.width != _width || frame.height != _height || !frame.pixels) {
+        return fail(E_GIF_ERR_DATA_TOO_BIG);
+    }
+    if (_paletteMode == GifPaletteMode::Shared) {
+        if (!keepFrame(frame, dispose)) {
+            return false;
+        }
+        ++_frames;
+        return true;
+    }
+    const size_t count = (size_t)_width * _height;
+    try {
+        _indices.resize(count);
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+
+    const bool global = _paletteMode == GifPaletteMode::Global;
+    if (global && _frames > 0) {
+        if (_mapper.dither() == DitherMode::None) {
+            mapToPalette(frame.pixels, count);
+        } else if (!ditherToPalette(frame.pixels)) {
+            return false;
+        }
+    } else {
+        // the global palette keeps a transparent index for later frames
+        if (!buildPalette(frame.pixels, count, global)) {
+            return false;
+        }
+        padPalette();
+    }
+    if (_frames == 0 && !writeHeader()) {
+        return false;
+    }
+    if (!(_optimize ? optimizeFrame(frame.delayMs, !global) : queueFrame(frame.delayMs, dispose, !global))) {
+        return false;
+    }
+    ++_frames;
+    return true;
+}
+
+bool GifWriter::writeControl(int delayMs, FrameDispose dispose, int transparent) {
+    GraphicsControlBlock gcb;
+    gcb.DisposalMode = gif_getDisposalMode(dispose);
+    gcb.UserInputFlag = false;
+    gcb.DelayTime = std::min(std::max((delayMs + 5) / 10, 0), 0xffff);
+    gcb.TransparentColor = transparent >= 0 ? transparent : NO_TRANSPARENT_COLOR;
+    GifByteType extension[4];
+    EGifGCBToExtension(&gcb, extension);
+    if (EGifPutExtension(_gif, GRAPHICS_EXT_FUNC_CODE, sizeof(extension), extension) == GIF_ERROR) {
+        return fail(_gif->Error);
+    }
+    return true;
+}
+
+int GifWriter::bufferSink(GifFileType* gif, const GifByteType* data, int size) {
+    auto* buffer = (std::vector<uint8_t>*)gif->UserData;
+    try {
+        buffer->insert(buffer->end(), data, data + size);
+    } catch (const std::bad_alloc&) {
+        return 0;
+    }
+    return size;
+}
+
+// An encoder that writes to image.data, unbuffered so the image is all
+// there once encoded. It gets the screen descriptor, so it can encode
+// images with the global color table; what it writes for that is thrown
+// away.
+bool GifWriter::openEncoder(Encoded& image) {
+    int error = E_GIF_SUCCEEDED;
+    image.gif = EGifOpen(&image.data, bufferSink, &error);
+    if (!image.gif) {
+        return fail(error);
+    }
+    if (EGifSetOutputBuffer(image.gif, 0) == GIF_ERROR) {
+        return fail(image.gif->Error);
+    }
+    ColorMapObject map = gif_colorMap(_globalColors);
+    if (EGifPutScreenDesc(image.gif, _width, _height, 8, 0, _globalColors.empty() ? nullptr : &map) == GIF_ERROR) {
+        return fail(image.gif->Error);
+    }
+    image.data.clear();
+    return true;
+}
+
+// Encodes image.indices, with image.colors as the local color table if
+// there are any, to image.data. Runs on any thread, it only writes image.
+bool GifWriter::encodeImage(Encoded& image) const {
+    image.ok = false;
+    image.data.clear();
+    ColorMapObject map = gif_colorMap(image.colors);
+    EGifSetLossy(image.gif, _lossy, image.transparent);
+    if (EGifPutImageDesc(image.gif, image.left, image.top, image.width, image.height, false, image.colors.empty() ? nullptr : &map) == GIF_ERROR) {
+        return false;
+    }
+    // the descriptor, the color table and the LZW code size are out, the
+    // data blocks follow
+    image.codeOffset = image.data.size();
+    // as many rows at a time as an int counts
+    const int rows = std::max(1, INT_MAX / image.width);
+    for (int y = 0; y < image.height; y += rows) {
+        const int n = std::min(rows, image.height - y);
+        if (EGifPutLine(image.gif, image.indices.data() + (size_t)y * image.width, n * image.width) == GIF_ERROR) {
+            return false;
+        }
+    }
+    image.ok = true;
+    return true;
+}
+
+// Writes an image encodeImage made: the image descriptor again, then its
+// LZW data as it is, block by block with EGifPutCode, the way giflib copies
+// a decoded image.
+bool GifWriter::putEncoded(const Encoded& image) {
+    ColorMapObject map = gif_colorMap(image.colors);
+    if (EGifPutImageDesc(_gif, image.left, image.top, image.width, image.height, false, image.colors.empty() ? nullptr : &map) == GIF_ERROR) {
+        return fail(_gif->Error);
+    }
+    const GifByteType* block = image.data.data() + image.codeOffset;
+    const GifByteType* end = image.data.data() + image.data.size();
+    if (EGifPutCode(_gif, 0, block) == GIF_ERROR) {
+        return fail(_gif->Error);
+    }
+    for (block += block[0] + 1; block < end && block[0] != 0; block += block[0] + 1) {
+        if (EGifPutCodeNext(_gif, block) == GIF_ERROR) {
+            return fail(_gif->Error);
+        }
+    }
+    if (EGifPutCodeNext(_gif, nullptr) == GIF_ERROR) {
+        return fail(_gif->Error);
+    }
+    return !_sinkFailed || fail(E_GIF_ERR_WRITE_FAILED);
+}
+
+// Hands _indices, with _colors as the local color table if localMap is set,
+// to an encoder of its own, on a thread of its own if frames are big. The
+// frames are written in order as they are done, so the file lags behind by
+// up to _encodeThreads frames until close.
+bool GifWriter::queueFrame(int delayMs, FrameDispose dispose, bool localMap) {
+    try {
+        if (_idle.empty()) {
+            _jobs.emplace_back(new FrameJob());
+            if (!openEncoder(*_jobs.back())) {
+                _jobs.pop_back();
+                return false;
+            }
+        } else {
+            _jobs.push_back(std::move(_idle.back()));
+            _idle.pop_back();
+        }
+        auto& job = *_jobs.back();
+        job.left = job.top = 0;
+        job.width = _width;
+        job.height = _height;
+        job.indices.swap(_indices);
+        if (localMap) {
+            job.colors = _colors;
+        } else {
+            job.colors.clear();
+        }
+        job.transparent = _transparent;
+        job.delayMs = delayMs;
+        job.dispose = dispose;
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+
+    auto& job = *_jobs.back();
+    if (_encodeThreads > 1) {
+        try {
+            job.thread = std::thread([this, &job] {
+                encodeImage(job);
+            });
+        } catch (const std::system_error&) {
+            encodeImage(job);
+        }
+    } else {
+        encodeImage(job);
+    }
+    return flushFrames(_encodeThreads - 1);
+}
+
+// Writes the oldest frames being encoded, waiting for them if need be,
+// until at most keep are left. After a failure they are only waited for.
+bool GifWriter::flushFrames(size_t keep) {
+    while (_jobs.size() > keep) {
+        std::unique_ptr<FrameJob> job = std::move(_jobs.front());
+        _jobs.pop_front();
+        if (job->thread.joinable()) {
+            job->thread.join();
+        }
+        if (_error == E_GIF_SUCCEEDED) {
+            if (!job->ok) {
+                fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+            } else if (writeControl(job->delayMs, job->dispose, job->transparent)) {
+                putEncoded(*job);
+            }
+        }
+        try {
+            _idle.push_back(std::move(job));
+        } catch (const std::bad_alloc&) {
+            EGifCloseFile(job->gif, nullptr);
+        }
+    }
+    return _error == E_GIF_SUCCEEDED;
+}
+
+void GifWriter::closeEncoders() {
+    for (auto& job : _jobs) {
+        if (job->thread.joinable()) {
+            job->thread.join();
+        }
+        _idle.push_back(std::move(job));
+    }
+    _jobs.clear();
+    for (auto& job : _idle) {
+        EGifCloseFile(job->gif, nullptr);
+    }
+    _idle.clear();
+}
+
+// Optimizer: the candidates and an empty canvas. writeHeader gives the
+// candidates their encoders.
+bool GifWriter::openCandidates() {
+    closeCandidates();
+    const size_t count = (size_t)_width * _height;
+    try {
+        _candidates.reset(new Candidate[k_candidates]());
+        for (int i = 0; i < k_candidates; ++i) {
+            _candidates[i].row.resize(_width);
+        }
+        _shown.assign(count, 0);
+        _under.assign(count, 0);
+        _target.resize(count);
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    return true;
+}
+
+void GifWriter::closeCandidates() {
+    if (_candidates) {
+        for (int i = 0; i < k_candidates; ++i) {
+            if (_candidates[i].gif) {
+                EGifCloseFile(_candidates[i].gif, nullptr);
+            }
+        }
+        _candidates.reset();
+    }
+    _hasPending = false;
+}
+
+// Row y of the canvas the frame being added is drawn on, once the pending
+// frame is disposed with previous.
+const uint32_t* GifWriter::beforeRow(FrameDispose previous, int y, std::vector<uint32_t>& row) const {
+    const size_t offset = (size_t)y * _width;
+    if (previous == FrameDispose::Previous) {
+        return _under.data() + offset;
+    }
+    if (previous == FrameDispose::None || y < _pending.top || y >= _pending.top + _pending.height) {
+        return _shown.data() + offset;
+    }
+    std::copy(_shown.begin() + offset, _shown.begin() + offset + _width, row.begin());
+    std::fill(row.begin() + _pending.left, row.begin() + _pending.left + _pending.width, 0);
+    return row.data();
+}
+
+// The bounding box of the pixels _target changes on the canvas left by
+// candidate.previous, 1 by 1 if there are none. False if the frame has a
+// transparent pixel where that canvas has not, drawing cannot clear it.
+bool GifWriter::changedRect(Candidate& candidate) const {
+    int left = _width, right = -1, top = -1, bottom = -1;
+    for (int y = 0; y < _height; ++y) {
+        const uint32_t* before = beforeRow(candidate.previous, y, candidate.row);
+        const uint32_t* target = _target.data() + (size_t)y * _width;
+        int x0 = 0;
+        while (x0 < _width && target[x0] == before[x0]) {
+            ++x0;
+        }
+        if (x0 == _width) {
+            continue;
+        }
+        int x1 = _width - 1;
+        while (target[x1] == before[x1]) {
+            --x1;
+        }
+        for (int x = x0; x <= x1; ++x) {
+            if (!target[x] && before[x]) {
+                return false;
+            }
+        }
+        left = std::min(left, x0);
+        right = std::max(right, x1);
+        if (top < 0) {
+            top = y;
+        }
+        bottom = y;
+    }
+    if (right < 0) {
+        left = right = top = bottom = 0;
+    }
+    candidate.left = left;
+    candidate.top = top;
+    candidate.width = right - left + 1;
+    candidate.height = bottom - top + 1;
+    return true;
+}
+
+// Encodes the rectangle of a frame, given by the indices of the whole canvas
+// and their palette, to candidate.data. A local color table keeps only the
+// colors the rectangle uses. Runs on any thread, it only writes candidate.
+bool GifWriter::encodeCandidate(Candidate& candidate, const uint8_t* indices, const std::vector<GifColorType>& colors, int colorCount, int transparent, bool localMap) const {
+    candidate.ok = false;
+    // what transparent pixels are gathered as: a free entry if the palette
+    // has no transparent index
+    const int clear = transparent >= 0 ? transparent : colorCount;
+    if (candidate.fill && (clear > 0xff || (!localMap && transparent < 0))) {
+        return false;
+    }
+    const int width = candidate.width;
+    const int height = candidate.height;
+    try {
+        candidate.indices.resize((size_t)width * height);
+        candidate.data.clear();
+        bool used[256] = {};
+        uint8_t* out = candidate.indices.data();
+        for (int y = candidate.top; y < candidate.top + height; ++y) {
+            const size_t offset = (size_t)y * _width + candidate.left;
+            const uint8_t* in = indices + offset;
+            if (candidate.fill) {
+                const uint32_t* before = beforeRow(candidate.previous, y, candidate.row) + candidate.left;
+                const uint32_t* target = _target.data() + offset;
+                for (int x = 0; x < width; ++x) {
+                    out[x] = target[x] == before[x] ? (uint8_t)clear : in[x];
+                }
+            } else {
+                memcpy(out, in, width);
+            }
+            for (int x = 0; x < width; ++x) {
+                used[out[x]] = true;
+            }
+            out += width;
+        }
+
+        candidate.transparent = transparent;
+        if (localMap) {
+            GifPixelType translation[256];
+            candidate.colors.clear();
+            for (int i = 0; i < colorCount; ++i) {
+                if (used[i] && i != clear) {
+                    translation[i] = (GifPixelType)candidate.colors.size();
+                    candidate.colors.push_back(colors[i]);
+                }
+            }
+            candidate.transparent = -1;
+            // clear is 256 for a full palette with no transparent index
+            if (clear <= 0xff && used[clear]) {
+                candidate.transparent = (int)candidate.colors.size();
+                translation[clear] = (GifPixelType)candidate.transparent;
+            }
+            const size_t entries = candidate.colors.size() + (candidate.transparent >= 0 ? 1 : 0);
+            candidate.colors.resize(std::max<size_t>(2, (size_t)1 << GifBitSize((int)entries)), {0, 0, 0});
+            for (auto& index : candidate.indices) {
+                index = translation[index];
+            }
+        } else {
+            candidate.colors.clear();
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return encodeImage(candidate);
+}
+
+// Optimizer: _indices, with _colors and _transparent, is the frame. It is
+// compared with the canvas each disposal of the pending frame leaves; the
+// valid ways to draw it on them are encoded at once and the smallest is
+// kept. The pending frame is written with the disposal that needs, and this
+// frame takes its place. The first frame is written whole.
+bool GifWriter::optimizeFrame(int delayMs, bool localMap) {
+    const size_t count = (size_t)_width * _height;
+    memset(_packed, 0, sizeof(_packed));
+    for (int i = 0; i < _colorCount; ++i) {
+        _packed[i] = 0xff000000u | (uint32_t)_colors[i].Red << 16 | (uint32_t)_colors[i].Green << 8 | _colors[i].Blue;
+    }
+    if (_transparent >= 0) {
+        _packed[_transparent] = 0;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        _target[i] = _packed[_indices[i]];
+    }
+
+    const FrameDispose disposals[] = { FrameDispose::None, FrameDispose::Background, FrameDispose::Previous };
+    int n = 0;
+    for (int d = 0; d < (_hasPending ? 3 : 1); ++d) {
+        auto& opaque = _candidates[n];
+        opaque.previous = disposals[d];
+        opaque.fill = false;
+        if (!_hasPending) {
+            opaque.left = opaque.top = 0;
+            opaque.width = _width;
+            opaque.height = _height;
+            ++n;
+            break;
+        }
+        if (!changedRect(opaque)) {
+            continue;
+        }
+        auto& fill = _candidates[n + 1];
+        fill.previous = opaque.previous;
+        fill.fill = true;
+        fill.left = opaque.left;
+        fill.top = opaque.top;
+        fill.width = opaque.width;
+        fill.height = opaque.height;
+        n += 2;
+    }
+    if (n == 0) {
+        // no disposal clears the pixels that turn transparent, so the
+        // pending frame is written whole and disposed to the background
+        auto& whole = _candidates[0];
+        whole.fill = false;
+        whole.left = whole.top = 0;
+        whole.width = _width;
+        whole.height = _height;
+        if (!encodeCandidate(whole, _pendingIndices.data(), _pendingColors, _pendingColorCount, _pendingTransparent, localMap)) {
+            return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+        }
+        _pending.left = _pending.top = 0;
+        _pending.width = _width;
+        _pending.height = _height;
+        _pending.transparent = whole.transparent;
+        _pending.colors.swap(whole.colors);
+        _pending.data.swap(whole.data);
+        _pending.codeOffset = whole.codeOffset;
+        for (; n < 2; ++n) {
+            _candidates[n].previous = FrameDispose::Background;
+            _candidates[n].fill = n == 1;
+            changedRect(_candidates[n]);
+        }
+    }
+
+    const uint8_t* indices = _indices.data();
+    auto encode = [this, indices, localMap](int i) {
+        encodeCandidate(_candidates[i], indices, _colors, _colorCount, _transparent, localMap);
+    };
+    const bool threaded = count >= k_optimize_part && std::thread::hardware_concurrency() > 1;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n; ++i) {
+        if (threaded) {
+            try {
+                threads.emplace_back(encode, i);
+                continue;
+            } catch (const std::system_error&) {
+            }
+        }
+        encode(i);
+    }
+    encode(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    int best = -1;
+    for (int i = 0; i < n; ++i) {
+        if (_candidates[i].ok && (best < 0 || _candidates[i].data.size() < _candidates[best].data.size())) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    auto& chosen = _candidates[best];
+    if (_hasPending && !writePending(chosen.previous)) {
+        return false;
+    }
+
+    // the canvas under this frame, then with it
+    if (chosen.previous == FrameDispose::Background) {
+        for (int y = _pending.top; y < _pending.top + _pending.height; ++y) {
+            auto row = _shown.begin() + (size_t)y * _width + _pending.left;
+            std::fill(row, row + _pending.width, 0);
+        }
+    }
+    if (chosen.previous != FrameDispose::Previous) {
+        _under.swap(_shown);
+    }
+    _shown.swap(_target);
+
+    try {
+        _pendingColors = _colors;
+    } catch (const std::bad_alloc&) {
+        return fail(E_GIF_ERR_NOT_ENOUGH_MEM);
+    }
+    _pending.left = chosen.left;
+    _pending.top = chosen.top;
+    _pending.width = chosen.width;
+    _pending.height = chosen.height;
+    _pending.transparent = chosen.transparent;
+    _pending.colors.swap(chosen.colors);
+    _pending.data.swap(chosen.data);
+    _pending.codeOffset = chosen.codeOffset;
+    _pendingDelayMs = delayMs;
+    _pendingIndices.swap(_indices);
+    _pendingColorCount = _colorCount;
+    _pendingTransparent = _transparent;
+    _hasPending = true;
+    return true;
+}
+
+// Optimizer: the pending frame, disposed with dispose.
+bool GifWriter::writePending(FrameDispose dispose) {
+    _hasPending = false;
+    return writeControl(_pendingDelayMs, dispose, _pending.transparent) && putEncoded(_pending);
+}
+
+bool GifWriter::close() {
+    if (!_gif) {
+        return fail(E_GIF_ERR_NOT_WRITEABLE);
+    }
+    if (_paletteMode == GifPaletteMode::Shared) {
+        if (_error == E_GIF_SUCCEEDED) {
+            writeShared();
+        }
+        _shared.clear();
+    } else if (_frames == 0 && _error == E_GIF_SUCCEEDED) {
+        writeHeader();
+    }
+    flushFrames(0);
+    closeEncoders();
+    // the first frame is written whole, the last one is cleared so the
+    // transparent pixels of the first show nothing when the animation loops
+    if (_hasPending && _error == E_GIF_SUCCEEDED) {
+        writePending(FrameDispose::Background);
+    }
+    closeCandidates();
+    int error = E_GIF_SUCCEEDED;
+    if (EGifCloseFile(_gif, &error) == GIF_ERROR) {
+        fail(error);
+    }
+    _gif = nullptr;
+    if (_sinkFailed) {
+        fail(E_GIF_ERR_WRITE_FAILED);
+    }
+    if (_file) {
+        if (fclose(_file) != 0) {
+            fail(E_GIF_ERR_CLOSE_FAILED);
+        }
+        _file = nullptr;
+    }
+    _sink = GifSink();
+    return _error == E_GIF_SUCCEEDED;
+}
@@ -0,0 +1,235 @@
+//
+//  gif_writer.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef gif_writer_h
+#define gif_writer_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "dither.h"
+#include "frame_compositor.h"
+#include "quantizer.h"
+#include "../lib/giflib-5.2.1/gif_lib.h"
+
+enum class GifPaletteMode {
+    // each frame is quantized on its own and gets a local color table
+    PerFrame,
+    // the palette of the first frame is the global color table and the
+    // frames after it are mapped to it, no local color tables
+    Global,
+    // one global color table for all the frames, the union of their colors
+    // if it fits, else quantized once from a sampled histogram of them all.
+    // Frames are kept until close, as indices if they have few colors.
+    Shared,
+};
+
+// Receives the file as it is written, in chunks of up to 64KB as giflib
+// buffers its output; return false to fail the write.
+typedef std::function<bool(const uint8_t* data, size_t size)> GifSink;
+
+// Encodes composited RGBA frames, such as FrameCompositor makes, into an
+// animated GIF. Each frame is written as soon as it is added, except in
+// Shared mode, which writes them all on close, and when optimizing, which
+// holds each frame back until the next. Big frames are LZW-encoded on
+// threads of their own, a few at a time, and written in order as they are
+// done. Pixels with alpha below 128 become the transparent index, the
+// others are opaque.
+// Frames with at most 255 colors keep their exact colors, others are
+// quantized, by default with giflib's median cut on several threads if they
+// are big.
+class GifWriter {
+public:
+    GifWriter();
+    ~GifWriter();
+
+    // 0 loops forever, a negative count writes no NETSCAPE2.0 extension so
+    // the animation plays once. Set both before the first frame.
+    void setLoopCount(int count) { _loopCount = count; }
+    void setPaletteMode(GifPaletteMode mode) { _paletteMode = mode; }
+    // The backend, k-means passes and most colors of the palettes; frames
+    // with no more colors than that keep them exactly.
+    void setQuantizer(const QuantizeOptions& options) { _quantize = options; }
+    // How quantized frames, and frames mapped to a global palette, are
+    // dithered; frames that keep their exact colors are not.
+    void setDither(DitherMode mode) { _mapper.setDither(mode); }
+    // Writes each frame as what changed from the canvas the frame before it
+    // leaves: cropped to the changed rectangle, with the pixels that did not
+    // change made transparent when that encodes smaller, and the disposal of
+    // the frame before picked to suit. The dispose of addFrame is then not
+    // used. Each frame is written when the next one is added.
+    void setOptimize(bool optimize) { _optimize = optimize; }
+    // Lossy LZW: a pixel may be encoded as a color at most error away, in
+    // RGB distance, when that extends the string before it; 0 is lossless.
+    void setLossy(int error) { _lossy = error; }
+
+    bool open(const char* name, int width, int height);
+    bool open(const GifSink& sink, int width, int height);
+    // The frame covers the whole canvas. It is disposed to the background
+    // by default, so its transparent pixels do not show the frame before
+    // it; FrameDispose::None or Previous suit frames that cover the canvas.
+    bool addFrame(const Frame& frame, FrameDispose dispose = FrameDispose::Background);
+    // Writes the trailer and closes the file.
+    bool close();
+
+    // giflib error code of the last failure
+    int error() const { return _error; }
+
+private:
+    static int writeSink(GifFileType* gif, const GifByteType* data, int size);
+    bool writeHeader();
+    int paletteLimit() const;
+    bool exactPalette(const RGBA* pixels, size_t count, size_t limit, bool& transparent);
+    bool buildPalette(const RGBA* pixels, size_t count, bool reserveTransparent);
+    bool quantizeMedianCut(const RGBA* pixels, size_t count, int colors, bool reserveTransparent);
+    void indexPalette();
+    uint8_t paletteIndex(RGBA c);
+    void mapToPalette(const RGBA* pixels, size_t count);
+    void setDitherPalette();
+    bool ditherToPalette(const RGBA* pixels);
+    void padPalette();
+    bool keepFrame(const Frame& frame, FrameDispose dispose);
+    bool writeShared();
+    bool writeControl(int delayMs, FrameDispose dispose, int transparent);
+    bool fail(int error);
+
+    struct Encoded;
+    static int bufferSink(GifFileType* gif, const GifByteType* data, int size);
+    bool openEncoder(Encoded& image);
+    bool encodeImage(Encoded& image) const;
+    bool putEncoded(const Encoded& image);
+    bool queueFrame(int delayMs, FrameDispose dispose, bool localMap);
+    bool flushFrames(size_t keep);
+    void closeEncoders();
+
+    struct Candidate;
+    bool openCandidates();
+    void closeCandidates();
+    const uint32_t* beforeRow(FrameDispose previous, int y, std::vector<uint32_t>& row) const;
+    bool changedRect(Candidate& candidate) const;
+    bool encodeCandidate(Candidate& candidate, const uint8_t* indices, const std::vector<GifColorType>& colors, int colorCount, int transparent, bool localMap) const;
+    bool optimizeFrame(int delayMs, bool localMap);
+    bool writePending(FrameDispose dispose);
+
+    // a frame kept for Shared mode
+    struct SharedFrame {
+        // indices into colors, which is the exact palette of the frame and
+        // is followed by the transparent index if transparent is set
+        std::vector<uint8_t> indices;
+        std::vector<GifColorType> colors;
+        // the frame itself if it has too many colors, indices are empty
+        std::vector<RGBA> pixels;
+        bool transparent;
+        int delayMs;
+        FrameDispose dispose;
+    };
+
+    // An image LZW-encoded to memory by an encoder of its own, which can
+    // run on any thread; putEncoded then writes it to the file.
+    struct Encoded {
+        int left, top, width, height;
+        // the image, and its color table if it has one
+        std::vector<uint8_t> indices;
+        std::vector<GifColorType> colors;
+        int transparent;
+        // image descriptor, color table and LZW data; the data blocks start
+        // at codeOffset
+        std::vector<uint8_t> data;
+        size_t codeOffset;
+        GifFileType* gif;
+        bool ok;
+    };
+
+    // a frame being encoded, on its own thread if frames are big
+    struct FrameJob : Encoded {
+        int delayMs;
+        FrameDispose dispose;
+        std::thread thread;
+    };
+
+    // Optimizer: one way to write the frame, encoded to compare its size
+    // with the others
+    struct Candidate : Encoded {
+        // disposal of the frame before, which sets what this one is drawn on
+        FrameDispose previous;
+        // pixels that are already on the canvas are transparent
+        bool fill;
+        // a row of the canvas before the frame
+        std::vector<uint32_t> row;
+    };
+
+private:
+    GifFileType* _gif;
+    GifSink _sink;
+    // the file open(name) writes to
+    FILE* _file;
+    bool _sinkFailed;
+    int _width, _height;
+    int _loopCount;
+    GifPaletteMode _paletteMode;
+    int _frames;
+    int _error;
+    int _lossy;
+
+    // color table of the frame being written: _colorCount colors, then the
+    // transparent index if there is one, padded to a power of 2
+    std::vector<GifColorType> _colors;
+    int _colorCount;
+    int _transparent;
+    std::vector<uint8_t> _indices;
+    QuantizeOptions _quantize;
+    QuantizeResult _quantized;
+    PaletteMapper _mapper;
+    // median cut: a histogram per thread, and the color index of each
+    // histogram entry
+    std::vector<std::vector<unsigned long>> _histograms;
+    std::vector<GifByteType> _colorTable;
+    // exact color -> index + 1, open addressing on 0xRRGGBB
+    std::vector<uint32_t> _exactKeys;
+    std::vector<uint16_t> _exactIndices;
+    // 5 bit per channel color -> nearest palette index + 1, Global and
+    // Shared modes
+    std::vector<uint16_t> _nearest;
+    // Shared mode: the frames so far, and a histogram of some of their rows
+    std::vector<SharedFrame> _shared;
+    std::unique_ptr<ColorHistogram> _sampled;
+
+    // the global color table the encoders are given
+    std::vector<GifColorType> _globalColors;
+    // frames being encoded, oldest first, at most _encodeThreads; and the
+    // jobs done with, which keep their encoders
+    std::deque<std::unique_ptr<FrameJob>> _jobs;
+    std::vector<std::unique_ptr<FrameJob>> _idle;
+    size_t _encodeThreads;
+
+    // Optimizer. The canvas as 0xAARRGGBB, 0 where transparent: _shown once
+    // the pending frame is drawn and _under before it; _target is the frame
+    // being added, _packed the colors of its palette.
+    bool _optimize;
+    std::vector<uint32_t> _shown;
+    std::vector<uint32_t> _under;
+    std::vector<uint32_t> _target;
+    uint32_t _packed[256];
+    std::unique_ptr<Candidate[]> _candidates;
+    // the last frame, written once the disposal that suits the next is
+    // known; its full indices and palette are kept in case it has to be
+    // written whole after all
+    bool _hasPending;
+    Encoded _pending;
+    int _pendingDelayMs;
+    std::vector<uint8_t> _pendingIndices;
+    std::vector<GifColorType> _pendingColors;
+    int _pendingColorCount;
+    int _pendingTransparent;
+};
+
+#endif /* gif_writer_h */
@@ -0,0 +1,92 @@
+//
+//  gif_writer_check.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "gif_writer_check.h"
+#include "gif_writer.h"
+#include "gif_reader.h"
+#include <stdio.h>
+#include <vector>
+
+struct CheckCase {
+    const char* title;
+    GifPaletteMode mode;
+    bool optimize;
+};
+
+// Every frame uses all 256 colors and is opaque, so a palette of its own
+// is full and has no transparent index: the optimizer has no free entry to
+// gather unchanged pixels in. Global and Shared modes keep an entry for
+// transparency, so they would quantize these frames.
+static std::vector<std::vector<RGBA>> fullPaletteFrames(int width, int height) {
+    std::vector<std::vector<RGBA>> frames(4, std::vector<RGBA>((size_t)width * height));
+    for (size_t f = 0; f < frames.size(); ++f) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                // frame 1 changes a rectangle, frame 2 repeats frame 1 and
+                // frame 3 changes everything
+                const bool changed = (f == 1 || f == 2) ? (x >= 8 && x < 40 && y >= 16 && y < 32) : f == 3;
+                const int i = (y * width + x + (changed ? 85 : 0)) & 0xff;
+                frames[f][(size_t)y * width + x] = { (uint8_t)i, (uint8_t)(255 - i), (uint8_t)(i * 7), 255 };
+            }
+        }
+    }
+    return frames;
+}
+
+static bool checkCase(const char* name, const CheckCase& check, int width, int height, const std::vector<std::vector<RGBA>>& frames) {
+    GifWriter writer;
+    writer.setPaletteMode(check.mode);
+    writer.setOptimize(check.optimize);
+    bool ok = writer.open(name, width, height);
+    for (size_t i = 0; ok && i < frames.size(); ++i) {
+        const Frame frame = { (int)i, width, height, frames[i].data(), 100 };
+        ok = writer.addFrame(frame);
+    }
+    ok = writer.close() && ok;
+    if (!ok) {
+        printf("%s: write failed, error %d\n", check.title, writer.error());
+        return false;
+    }
+
+    size_t decoded = 0;
+    bool same = true;
+    ok = readGIF(name, [&](const Frame& frame) {
+        if (decoded >= frames.size() || frame.width != width || frame.height != height) {
+            same = false;
+            return false;
+        }
+        const auto& expected = frames[decoded++];
+        for (size_t i = 0; i < expected.size(); ++i) {
+            const RGBA a = frame.pixels[i], b = expected[i];
+            if (a.r != b.r || a.g != b.g || a.b != b.b || a.a != b.a) {
+                same = false;
+                break;
+            }
+        }
+        return same;
+    });
+    if (!ok || !same || decoded != frames.size()) {
+        printf("%s: frame %zu differs\n", check.title, decoded == 0 ? 0 : decoded - 1);
+        return false;
+    }
+    return true;
+}
+
+bool checkGifWriter(const char* name) {
+    const int width = 64, height = 48;
+    const auto frames = fullPaletteFrames(width, height);
+    const CheckCase cases[] = {
+        { "256 opaque colors", GifPaletteMode::PerFrame, false },
+        { "256 opaque colors, optimized", GifPaletteMode::PerFrame, true },
+    };
+    bool passed = true;
+    for (const auto& check : cases) {
+        passed = checkCase(name, check, width, height, frames) && passed;
+    }
+    printf("GifWriter check %s\n", passed ? "passed" : "failed");
+    return passed;
+}
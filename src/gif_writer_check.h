@@ -0,0 +1,16 @@
+//
+//  gif_writer_check.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef gif_writer_check_h
+#define gif_writer_check_h
+
+// Writes animations that have given GifWriter trouble to the named file,
+// reads them back and compares each frame with what was added. Prints the
+// cases that fail and returns false if any did.
+bool checkGifWriter(const char* name);
+
+#endif /* gif_writer_check_h */
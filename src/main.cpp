@@ -7,278 +7,44 @@
 
 #include <iostream>
 #include "../lib/libpng-1.6.37/png.h"
-#include "../lib/giflib-5.2.1/gif_lib.h"
+#include "png_writer.h"
+#include "gif_reader.h"
+#include "gif_writer.h"
+#include "quantizer_bench.h"
+#include "gif_writer_check.h"
+#include "apng_reader.h"
 #include <unistd.h>
+#include <string.h>
 #include <memory>
 #include <string>
 #include <vector>
 
-bool writePng(const char* name, int w, int h, const void* data) {
-    FILE *fp = fopen(name, "wb");
-    if (!fp) {
-        return false;
-    }
-    png_structp png_ptr = nullptr;
-    png_infop info_ptr = nullptr;
-    bool success = false;
-    while (1) {
-        png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-
-        if (nullptr == png_ptr) {
-            break;
-        }
-
-        info_ptr = png_create_info_struct(png_ptr);
-        if (nullptr == info_ptr) {
-            break;
-        }
-        if (setjmp(png_jmpbuf(png_ptr))) {
-            break;
-        }
-        png_init_io(png_ptr, fp);
-        png_set_IHDR(png_ptr, info_ptr, w, h, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-        png_set_compression_level(png_ptr, 9);
-        png_write_info(png_ptr, info_ptr);
-        png_set_packing(png_ptr);
-
-        png_const_bytep ptr = (png_const_bytep)data;
-        for (int i = 0; i < h; ++i) {
-            png_write_row(png_ptr, ptr + i * w * 4);
-        }
-
-        png_write_end(png_ptr, info_ptr);
-
-        break;
-    }
-
-    if (png_ptr) {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-    }
-
-    fclose(fp);
-    
-    return success;
-}
-
-void printGIFError(const char* name, int err) {
-    printf("gif: %s: error: %d(%s)", name, err, GifErrorString(err));
-}
-
-void saveSubImage(const char* name, int i, int width, int height, const void* image) {
+void saveSubImage(PngFrameWriter& writer, const char* name, int i, int width, int height, const void* image) {
     std::string newName = name;
     char buf[32];
     sprintf(buf, "%d", i);
     newName.append(buf);
     newName.append(".png");
     
-    writePng(newName.c_str(), width, height, image);
-}
-
-struct RGBA {
-    uint8_t r,g,b,a;
-};
-
-static const RGBA k_rgba_transparent = {0};
-
-// from https://android.googlesource.com/platform/frameworks/ex/+/refs/heads/master/framesequence/jni/FrameSequence_gif.cpp
-static RGBA gif_getBGColor(GifFileType* GifFile) {
-    RGBA color = k_rgba_transparent;
-    const ColorMapObject* cmap = GifFile->SColorMap;
-    if (cmap) {
-        // calculate bg color
-        GraphicsControlBlock gcb;
-        DGifSavedExtensionToGCB(GifFile, 0, &gcb);
-        if (gcb.TransparentColor == NO_TRANSPARENT_COLOR && GifFile->SBackGroundColor < cmap->ColorCount) {
-            auto gifColor = cmap->Colors[GifFile->SBackGroundColor];
-            color.r = gifColor.Red;
-            color.g = gifColor.Green;
-            color.b = gifColor.Blue;
-            color.a = 255;
-        }
-    }
-    return color;
+    writer.write(newName.c_str(), ImageView(image, width, height));
 }
 
-// https://docstore.mik.ua/orelly/web2/wdesign/ch23_05.htm
-void saveGIFFrames(GifFileType* GifFile, const char* name) {
-    //std::vector<std::shared_ptr<RGBA[]>> images;
-    const int width = GifFile->SWidth, height = GifFile->SHeight;
-    int doNotDispose = -1;
-    const RGBA bgRGBA = gif_getBGColor(GifFile);
-    std::shared_ptr<RGBA[]> doNotDisposeImageRef;
-    std::shared_ptr<RGBA[]> nextImageRef;
-    for (int srcI = 0, dstI = 0; srcI < GifFile->ImageCount; ++srcI) {
-        const auto& src = GifFile->SavedImages[srcI];
-        
-        /* Lets dump it - set the global variables required and do it: */
-        const auto ColorMap = (src.ImageDesc.ColorMap ? src.ImageDesc.ColorMap : GifFile->SColorMap);
-        if (ColorMap == NULL) {
-            fprintf(stderr, "Gif Image does not have a colormap\n");
-            continue;
-        }
-        
-        std::shared_ptr<RGBA[]> imageRef;
-        RGBA* image;
-        bool imgPrepared = false;
-        if (/*dstI < images.size()*/nextImageRef.get()) {
-            imageRef = nextImageRef;
-            //image = images[dstI].get();
-            //saveSubImage(name, dstI + 100, width, height, image);
-            imgPrepared = true;
-        } else {
-            imageRef = std::shared_ptr<RGBA[]>(new RGBA[width * height]);
-            //images.push_back(imageRef);
-        }
-        image = imageRef.get();
-        ++dstI;
-        
-        GraphicsControlBlock gcb;
-        DGifSavedExtensionToGCB(GifFile, srcI, &gcb);
-        const int transparentColor = gcb.TransparentColor;
-
-        const int startX = std::min(src.ImageDesc.Left, width);
-        const int endX = std::min(startX + src.ImageDesc.Width, width);
-        const int startY = std::min(src.ImageDesc.Top, height);
-        const int endY = std::min(startY + src.ImageDesc.Height, height);
-        
-        printf("%d, %d, %d, %d\n", src.ImageDesc.Left, src.ImageDesc.Top, src.ImageDesc.Width, src.ImageDesc.Height);
- 
-        if (!imgPrepared) {
-            for (int y = 0; y < startY; ++y) {
-                auto line = image + y * width;
-                const auto end = line + width;
-                while (line < end) {
-                    *line++ = bgRGBA;
-                }
-            }
-        }
-        for (int y = 0, subheight = endY - startY; y < subheight; ++y) {
-            auto line = image + (y + startY) * width;
-            const auto lineEnd = line + width;
-            auto end = line + startX;
-            if (!imgPrepared) {
-                while (line < end) {
-                    *line++ = bgRGBA;
-                }
-            }
-            line = end;
-            auto gifLine = src.RasterBits + y * src.ImageDesc.Width;
-            end = line + src.ImageDesc.Width;
-            while (line < end) {
-                const auto colorIndex = *gifLine++;
-                if (colorIndex != transparentColor && colorIndex < ColorMap->ColorCount) {
-                    const auto* color = ColorMap->Colors + colorIndex;
-                    line->r = color->Red;
-                    line->g = color->Green;
-                    line->b = color->Blue;
-                    line->a = 255;
-                } else {
-                    if (!imgPrepared) {
-                        *line = k_rgba_transparent;
-                    }
-                }
-                ++line;
-            }
-            if (!imgPrepared) {
-                while (line < lineEnd) {
-                    *line++ = bgRGBA;
-                }
-            }
-        }
-        if (!imgPrepared) {
-            for (int y = endY; y < height; ++y) {
-                auto line = image + y * width;
-                const auto end = line + width;
-                while (line < end) {
-                    *line++ = bgRGBA;
-                }
-            }
-        }
-        
-        //saveSubImage(name, srcI, width, height, image);
-                
-        if (srcI >= GifFile->ImageCount) {
-            break;
-        }
-
-        RGBA* fromImage = image;
-        bool needCopy = false;
-        switch (gcb.DisposalMode) {
-            case DISPOSE_DO_NOT:
-                printf("%d: DISPOSE_DO_NOT\n", srcI);
-                doNotDisposeImageRef = imageRef;
-                doNotDispose = (int)dstI - 1;
-                needCopy = true;
-                break;
-            case DISPOSE_BACKGROUND:
-                printf("%d: DISPOSE_BACKGROUND\n", srcI);
-                needCopy = true;
-                break;
-            case DISPOSE_PREVIOUS:
-                printf("%d: DISPOSE_PREVIOUS\n", srcI);
-                needCopy = true;
-                if (doNotDispose >= 0) {
-                    fromImage = doNotDisposeImageRef.get();
-                }
-                break;
-            case DISPOSAL_UNSPECIFIED:
-                printf("%d: DISPOSAL_UNSPECIFIED\n", srcI);
-                break;
-            default:
-                printf("%d: DISPOSAL_UNKNOWN\n", srcI);
-                break;
-        }
-
-        if (needCopy) {
-            // copy to next image
-            RGBA* nextImage = new RGBA[width * height];
-            nextImageRef = std::shared_ptr<RGBA[]>(nextImage);
-            //images.push_back(nextImageRef);
-            memcpy(nextImage, fromImage, width * height * sizeof(RGBA));
-            if (gcb.DisposalMode == DISPOSE_BACKGROUND) {
-                for (int y = 0, subheight = endY - startY; y < subheight; ++y) {
-                    auto line = nextImage + (y + startY) * width;
-                    auto subLine = line + startX;
-                    for (int x = 0, subWidth = endX - startX; x < subWidth; ++x) {
-                        subLine[x] = bgRGBA;
-                    }
-                }
-            }
-        } else {
-            nextImageRef.reset();
-        }
-    }
-    if (true) {
-        printf("done.");
-    }
+// Writes every frame as <name><index>.png.
+FrameHandler frameSaver(PngFrameWriter& writer, const char* name) {
+    return [&writer, name](const Frame& frame) {
+        saveSubImage(writer, name, frame.index, frame.width, frame.height, frame.pixels);
+        return true;
+    };
 }
 
-bool readGIF(const char* name) {
-    printf("%s\n", name);
-    int Error;
-    GifFileType* GifFile = DGifOpenFileName(name, &Error);
-    if (!GifFile) {
-        printGIFError("open", Error);
-        return false;
-    }
-    printf("w: %d, h: %d\n", GifFile->SWidth, GifFile->SHeight);
-    if (GifFile->SHeight == 0 || GifFile->SWidth == 0) {
-        fprintf(stderr, "Image of width or height 0\n");
-        return false;
-    }
-    Error = DGifSlurp(GifFile);
-    if (Error == GIF_OK) {
-        saveGIFFrames(GifFile, name);
-        for (int i = 0; i < GifFile->ImageCount; ++i) {
-            
+// Appends every frame to an animated GIF, opened at the first frame.
+FrameHandler gifEncoder(GifWriter& writer, const char* name) {
+    return [&writer, name](const Frame& frame) {
+        if (frame.index == 0 && !writer.open(name, frame.width, frame.height)) {
+            return false;
         }
-    } else {
-        printGIFError("slurp", Error);
-    }
-    if (DGifCloseFile(GifFile, &Error) == GIF_ERROR) {
-        printGIFError("close", Error);
-    }
-    return true;
+        return writer.addFrame(frame);
+    };
 }
 
 int main(int argc, const char * argv[]) {
@@ -294,6 +60,7 @@ int main(int argc, const char * argv[]) {
     char cwd[1024];
     printf("cwd: %s\n", getcwd(cwd, 1024));
     //writePng("test.png", 4, 4, data);
+    PngFrameWriter writer;
     
     //readGIF("img/1.gif");
     //readGIF("2.gif");
@@ -308,5 +75,24 @@ int main(int argc, const char * argv[]) {
     //readGIF("img/canvas_none.gif");
     //readGIF("img/canvas_prev.gif");
 
+    // https://wiki.mozilla.org/APNG_Specification
+    //readAPNG("img/1.png", frameSaver(writer, "img/1.png"));
+
+    // back to GIF, e.g. after editing the frames
+    //GifWriter gifWriter;
+    //gifWriter.setPaletteMode(GifPaletteMode::Shared);
+    //gifWriter.setOptimize(true);
+    //gifWriter.setLossy(40);
+    //readAPNG("img/1.png", gifEncoder(gifWriter, "img/1.png.gif"));
+    //gifWriter.close();
+
+    // speed against quality of the palette quantizers
+    //const char* corpus[] = { "img/1.gif", "img/2.gif", "img/3.gif", "img/4.gif", "img/1.png" };
+    //benchmarkQuantizers(corpus, sizeof(corpus) / sizeof(corpus[0]));
+    //benchmarkDithering(corpus, sizeof(corpus) / sizeof(corpus[0]), 64);
+
+    // round trips of animations that have given GifWriter trouble
+    //checkGifWriter("img/check.gif");
+
     return 0;
 }
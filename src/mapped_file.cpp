@@ -0,0 +1,61 @@
+//
+//  mapped_file.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+: _data(nullptr)
+, _size(0) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char* name) {
+    close();
+    const int fd = ::open(name, O_RDONLY);
+    if (fd < 0) {
+        printf("mmap: open: failed: %s\n", name);
+        return false;
+    }
+    bool success = false;
+    struct stat st;
+    while (1) {
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            printf("mmap: empty: %s\n", name);
+            break;
+        }
+        void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            printf("mmap: map: failed: %s\n", name);
+            break;
+        }
+        // the file is read front to back once
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+        _data = (const uint8_t*)data;
+        _size = (size_t)st.st_size;
+        success = true;
+        break;
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return success;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        munmap((void*)_data, _size);
+        _data = nullptr;
+        _size = 0;
+    }
+}
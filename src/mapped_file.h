@@ -0,0 +1,34 @@
+//
+//  mapped_file.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef mapped_file_h
+#define mapped_file_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A read only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* name);
+    void close();
+
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const uint8_t* _data;
+    size_t _size;
+};
+
+#endif /* mapped_file_h */
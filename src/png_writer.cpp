@@ -0,0 +1,241 @@
+//
+//  png_writer.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "png_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+// Largest IDAT we ask libpng to produce, bigger frames are split.
+static const size_t k_max_idat_size = 4 * 1024 * 1024;
+// signature, IHDR, one IDAT header and IEND
+static const size_t k_png_overhead = 8 + 25 + 12 + 12;
+
+// Upper bound for the zlib stream of a frame, about what deflateBound gives
+// for stored blocks.
+static size_t expectedIDATSize(const ImageView& image, int bytesPerPixel) {
+    const size_t raw = ((size_t)image.width * bytesPerPixel + 1) * image.height;
+    return raw + (raw >> 12) + (raw >> 14) + 64;
+}
+
+const char* PngErrorString(PngError error) {
+    switch (error) {
+        case PngError::None:
+            return "no error";
+        case PngError::InvalidImage:
+            return "invalid image";
+        case PngError::OutOfMemory:
+            return "out of memory";
+        case PngError::Encode:
+            return "encode failed";
+    }
+    return "unknown error";
+}
+
+// The smallest bit depth that holds entries palette indices.
+static int paletteBitDepth(size_t entries) {
+    return entries <= 2 ? 1 : entries <= 4 ? 2 : entries <= 16 ? 4 : 8;
+}
+
+PngEncoder::PngEncoder()
+: _compressionLevel(9)
+, _segmentRows(0)
+, _indexed(false)
+, _transparent(-1)
+, _ratio(0)
+, _output(nullptr) {
+}
+
+void PngEncoder::writeData(png_structp png_ptr, png_bytep data, size_t length) {
+    auto* encoder = (PngEncoder*)png_get_io_ptr(png_ptr);
+    auto* output = encoder->_output;
+    bool failed = false;
+    try {
+        output->insert(output->end(), data, data + length);
+    } catch (const std::bad_alloc&) {
+        failed = true;
+    }
+    // not from inside the handler, the longjmp would leak the exception
+    if (failed) {
+        png_error(png_ptr, "out of memory");
+    }
+}
+
+void PngEncoder::flushData(png_structp png_ptr) {
+    (void)png_ptr;
+}
+
+void PngEncoder::errorHandler(png_structp png_ptr, png_const_charp message) {
+    auto* encoder = (PngEncoder*)png_get_error_ptr(png_ptr);
+    // nothing may throw through libpng, the message is dropped instead
+    try {
+        encoder->_message = message;
+    } catch (const std::bad_alloc&) {
+        encoder->_message.clear();
+    }
+    png_longjmp(png_ptr, 1);
+}
+
+size_t PngEncoder::estimateSize(const ImageView& image) const {
+    const size_t bound = expectedIDATSize(image, _indexed ? 1 : 4);
+    if (_ratio == 0) {
+        return bound + k_png_overhead;
+    }
+    // an eighth of slack over the history so a slightly worse frame still
+    // fits, each extra IDAT costs 12 bytes
+    size_t estimate = (size_t)(((uint64_t)bound * _ratio) >> 16);
+    estimate += estimate >> 3;
+    estimate += (estimate / k_max_idat_size + 1) * 12;
+    return std::min(estimate, bound) + k_png_overhead;
+}
+
+// Quantizes the image to _palette and maps it to _indices.
+bool PngEncoder::quantizeImage(const ImageView& image) {
+    try {
+        if (!_histogram) {
+            _histogram.reset(new ColorHistogram());
+        }
+        _histogram->clear();
+        for (int y = 0; y < image.height; ++y) {
+            _histogram->add((const RGBA*)((const uint8_t*)image.pixels + y * image.stride), image.width);
+        }
+        const size_t count = (size_t)image.width * image.height;
+        const bool transparent = _histogram->pixels() < count;
+        std::vector<RGBA> palette;
+        makeQuantizer(_quantize.kind)->makePalette(*_histogram, std::max(1, std::min(_quantize.maxColors, transparent ? 255 : 256)), palette);
+        refinePalette(*_histogram, _quantize.refineIterations, palette);
+        _transparent = transparent ? (int)palette.size() : -1;
+        _palette.clear();
+        for (const auto& c : palette) {
+            _palette.push_back({ c.r, c.g, c.b });
+        }
+        if (transparent) {
+            _palette.push_back({ 0, 0, 0 });
+        }
+        _indices.resize(count);
+        _mapper.setPalette(palette.data(), (int)palette.size(), _transparent);
+        return _mapper.map((const RGBA*)image.pixels, image.width, image.height, image.stride, _indices.data());
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+}
+
+PngEncodeResult PngEncoder::encode(const ImageView& image) {
+    PngEncodeResult result;
+    result.error = PngError::None;
+    if (image.width <= 0 || image.height <= 0 || !image.pixels || image.stride < (size_t)image.width * 4) {
+        result.error = PngError::InvalidImage;
+        return result;
+    }
+
+    try {
+        result.data.reserve(estimateSize(image));
+        _rows.resize(image.height);
+    } catch (const std::bad_alloc&) {
+        result.error = PngError::OutOfMemory;
+        return result;
+    }
+    if (_indexed && !quantizeImage(image)) {
+        result.error = PngError::OutOfMemory;
+        return result;
+    }
+    auto ptr = (png_bytep)image.pixels;
+    for (int i = 0; i < image.height; ++i) {
+        _rows[i] = _indexed ? _indices.data() + (size_t)i * image.width : ptr + i * image.stride;
+    }
+    _output = &result.data;
+    _message.clear();
+
+    png_structp png_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+    while (1) {
+        png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, this, errorHandler, nullptr);
+        if (nullptr == png_ptr) {
+            result.error = PngError::OutOfMemory;
+            break;
+        }
+
+        info_ptr = png_create_info_struct(png_ptr);
+        if (nullptr == info_ptr) {
+            result.error = PngError::OutOfMemory;
+            break;
+        }
+        if (setjmp(png_jmpbuf(png_ptr))) {
+            result.error = PngError::Encode;
+            break;
+        }
+        png_set_write_fn(png_ptr, this, writeData, flushData);
+        png_set_compression_buffer_size(png_ptr, std::min(expectedIDATSize(image, _indexed ? 1 : 4), k_max_idat_size));
+        const int bitDepth = _indexed ? paletteBitDepth(_palette.size()) : 8;
+        if (_indexed) {
+            png_set_IHDR(png_ptr, info_ptr, image.width, image.height, bitDepth, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+            png_set_PLTE(png_ptr, info_ptr, _palette.data(), (int)_palette.size());
+            if (_transparent >= 0) {
+                // opaque up to the transparent entry, which is last
+                png_byte alpha[256];
+                memset(alpha, 255, sizeof(alpha));
+                alpha[_transparent] = 0;
+                png_set_tRNS(png_ptr, info_ptr, alpha, _transparent + 1, nullptr);
+            }
+        } else {
+            png_set_IHDR(png_ptr, info_ptr, image.width, image.height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+        }
+        png_set_compression_level(png_ptr, _compressionLevel);
+        png_set_IDAT_segments(png_ptr, _segmentRows);
+        png_write_info(png_ptr, info_ptr);
+        if (bitDepth < 8) {
+            // the indices are a byte each
+            png_set_packing(png_ptr);
+        }
+        png_write_image(png_ptr, _rows.data());
+        png_write_end(png_ptr, info_ptr);
+        break;
+    }
+
+    if (png_ptr) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+    }
+    _output = nullptr;
+
+    if (!result.ok()) {
+        result.data.clear();
+        result.message.swap(_message);
+        return result;
+    }
+
+    // running average of the last few frames
+    const size_t bound = expectedIDATSize(image, _indexed ? 1 : 4);
+    const size_t idat = result.data.size() > k_png_overhead ? result.data.size() - k_png_overhead : 0;
+    const uint32_t ratio = (uint32_t)std::min<uint64_t>(((uint64_t)idat << 16) / bound + 1, 1 << 16);
+    _ratio = _ratio == 0 ? ratio : (_ratio * 3 + ratio) / 4;
+
+    return result;
+}
+
+bool PngFrameWriter::write(const char* name, const ImageView& image) {
+    const auto result = _encoder.encode(image);
+    if (!result.ok()) {
+        return false;
+    }
+
+    FILE *fp = fopen(name, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool success = fwrite(result.data.data(), 1, result.data.size(), fp) == result.data.size();
+    if (fclose(fp) != 0) {
+        success = false;
+    }
+
+    return success;
+}
+
+bool writePng(const char* name, int w, int h, const void* data) {
+    PngFrameWriter writer;
+    return writer.write(name, ImageView(data, w, h));
+}
@@ -0,0 +1,114 @@
+//
+//  png_writer.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef png_writer_h
+#define png_writer_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <vector>
+#include "dither.h"
+#include "quantizer.h"
+#include "../lib/libpng-1.6.37/png.h"
+
+// 8 bit RGBA pixels, rows are stride bytes apart.
+struct ImageView {
+    const void* pixels;
+    int width;
+    int height;
+    size_t stride;
+
+    ImageView(const void* pixels, int width, int height)
+    : pixels(pixels), width(width), height(height), stride((size_t)width * 4) {}
+    ImageView(const void* pixels, int width, int height, size_t stride)
+    : pixels(pixels), width(width), height(height), stride(stride) {}
+};
+
+enum class PngError {
+    None,
+    InvalidImage,
+    OutOfMemory,
+    Encode,
+};
+
+const char* PngErrorString(PngError error);
+
+struct PngEncodeResult {
+    std::vector<uint8_t> data;
+    PngError error;
+    std::string message;
+
+    bool ok() const { return error == PngError::None; }
+};
+
+// Encodes frames to memory with png_write_image. The output buffer is
+// reserved up front from the compressed size of the previous frames and the
+// compression buffer is sized so a frame normally fits in one IDAT. Errors,
+// including libpng ones, are returned in the result. Reuse one encoder for
+// many frames to keep the size history and the row pointers.
+class PngEncoder {
+public:
+    PngEncoder();
+
+    void setCompressionLevel(int level) { _compressionLevel = level; }
+    // Deflate every `rows` rows as an independent segment indexed by an
+    // ixDT chunk, so our reader can inflate them in parallel. 0 is off.
+    void setSegmentRows(int rows) { _segmentRows = rows; }
+    // Write palette images: each frame is quantized to its own palette,
+    // with a transparent entry for pixels with alpha below 128, and mapped
+    // to it with the dithering asked for.
+    void setIndexed(bool indexed) { _indexed = indexed; }
+    void setQuantizer(const QuantizeOptions& options) { _quantize = options; }
+    void setDither(DitherMode mode) { _mapper.setDither(mode); }
+
+    PngEncodeResult encode(const ImageView& image);
+
+private:
+    static void writeData(png_structp png_ptr, png_bytep data, size_t length);
+    static void flushData(png_structp png_ptr);
+    static void errorHandler(png_structp png_ptr, png_const_charp message);
+    size_t estimateSize(const ImageView& image) const;
+    bool quantizeImage(const ImageView& image);
+
+private:
+    int _compressionLevel;
+    int _segmentRows;
+    bool _indexed;
+    QuantizeOptions _quantize;
+    PaletteMapper _mapper;
+    std::unique_ptr<ColorHistogram> _histogram;
+    // the palette with the transparent entry last, and the indices
+    std::vector<png_color> _palette;
+    int _transparent;
+    std::vector<uint8_t> _indices;
+    // compressed / raw size of the recent frames, 16.16 fixed point
+    uint32_t _ratio;
+    std::vector<png_bytep> _rows;
+    std::vector<uint8_t>* _output;
+    std::string _message;
+};
+
+// Writes frames to files, each file with a single fwrite.
+class PngFrameWriter {
+public:
+    void setCompressionLevel(int level) { _encoder.setCompressionLevel(level); }
+    void setSegmentRows(int rows) { _encoder.setSegmentRows(rows); }
+    void setIndexed(bool indexed) { _encoder.setIndexed(indexed); }
+    void setQuantizer(const QuantizeOptions& options) { _encoder.setQuantizer(options); }
+    void setDither(DitherMode mode) { _encoder.setDither(mode); }
+
+    bool write(const char* name, const ImageView& image);
+
+private:
+    PngEncoder _encoder;
+};
+
+bool writePng(const char* name, int w, int h, const void* data);
+
+#endif /* png_writer_h */
@@ -0,0 +1,500 @@
+//
+//  quantizer.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "quantizer.h"
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include "../lib/giflib-5.2.1/gif_lib.h"
+// GifQuantizeHistogram is declared with the giflib utilities
+extern "C" {
+#include "../lib/giflib-5.2.1/getarg.h"
+}
+
+static RGBA cellMean(const ColorHistogram::Cell& cell) {
+    const uint64_t half = cell.count / 2;
+    RGBA c;
+    c.r = (uint8_t)((cell.r + half) / cell.count);
+    c.g = (uint8_t)((cell.g + half) / cell.count);
+    c.b = (uint8_t)((cell.b + half) / cell.count);
+    c.a = 255;
+    return c;
+}
+
+static int nearestColor(const std::vector<RGBA>& palette, RGBA c) {
+    int best = 0;
+    int bestDistance = INT_MAX;
+    for (int i = 0; i < (int)palette.size(); ++i) {
+        const int dr = palette[i].r - c.r;
+        const int dg = palette[i].g - c.g;
+        const int db = palette[i].b - c.b;
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+ColorHistogram::ColorHistogram()
+: _cells(k_cells)
+, _pixels(0) {
+    _used.reserve(k_cells);
+}
+
+void ColorHistogram::clear() {
+    for (auto index : _used) {
+        _cells[index] = Cell();
+    }
+    _used.clear();
+    _pixels = 0;
+}
+
+void ColorHistogram::add(const RGBA* pixels, size_t count) {
+    uint64_t added = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const RGBA c = pixels[i];
+        if (c.a < 128) {
+            continue;
+        }
+        ++added;
+        const int index = cellOf(c);
+        auto& cell = _cells[index];
+        if (cell.count == 0) {
+            _used.push_back((uint16_t)index);
+        }
+        ++cell.count;
+        cell.r += c.r;
+        cell.g += c.g;
+        cell.b += c.b;
+        cell.squares += c.r * c.r + c.g * c.g + c.b * c.b;
+    }
+    _pixels += added;
+}
+
+// giflib's median cut over the cells, with each color the mean of the
+// exact colors of its cells rather than of the cell corners.
+class MedianCutQuantizer : public Quantizer {
+public:
+    const char* name() const override { return "median cut"; }
+
+    void makePalette(const ColorHistogram& histogram, int maxColors, std::vector<RGBA>& palette) const override {
+        std::vector<unsigned long> counts(ColorHistogram::k_cells, 0);
+        std::vector<GifByteType> table(ColorHistogram::k_cells);
+        for (auto index : histogram.used()) {
+            counts[index] = (unsigned long)histogram.cell(index).count;
+        }
+        GifColorType colors[256];
+        int size = std::min(maxColors, 256);
+        if (GifQuantizeHistogram(counts.data(), &size, colors, table.data()) == GIF_ERROR) {
+            throw std::bad_alloc();
+        }
+        std::vector<ColorHistogram::Cell> sums(size, ColorHistogram::Cell());
+        for (auto index : histogram.used()) {
+            const auto& cell = histogram.cell(index);
+            auto& sum = sums[table[index]];
+            sum.count += cell.count;
+            sum.r += cell.r;
+            sum.g += cell.g;
+            sum.b += cell.b;
+        }
+        palette.clear();
+        for (const auto& sum : sums) {
+            if (sum.count) {
+                palette.push_back(cellMean(sum));
+            }
+        }
+    }
+};
+
+// Every cell is a leaf of an octree 5 levels deep; the inner nodes at the
+// deepest level with the fewest pixels are merged into leaves until there
+// are few enough.
+class OctreeQuantizer : public Quantizer {
+public:
+    const char* name() const override { return "octree"; }
+
+    void makePalette(const ColorHistogram& histogram, int maxColors, std::vector<RGBA>& palette) const override {
+        static const int k_depth = 5;
+        struct Node {
+            ColorHistogram::Cell sum;
+            int child[8];
+            int level;
+            bool leaf;
+        };
+        std::vector<Node> nodes;
+        std::vector<int> levels[k_depth];
+        auto newNode = [&nodes, &levels](int level) {
+            Node node;
+            memset(&node, 0, sizeof(node));
+            node.level = level;
+            node.leaf = level == k_depth;
+            nodes.push_back(node);
+            if (level < k_depth) {
+                levels[level].push_back((int)nodes.size() - 1);
+            }
+            return (int)nodes.size() - 1;
+        };
+        nodes.reserve(histogram.used().size() * 2 + 1);
+        newNode(0);
+        for (auto index : histogram.used()) {
+            const auto& cell = histogram.cell(index);
+            int node = 0;
+            for (int level = 0; ; ++level) {
+                auto& sum = nodes[node].sum;
+                sum.count += cell.count;
+                sum.r += cell.r;
+                sum.g += cell.g;
+                sum.b += cell.b;
+                if (level == k_depth) {
+                    break;
+                }
+                // bit 4 - level of each 5 bit channel picks the child
+                const int shift = 4 - level;
+                const int child = ((index >> (10 + shift)) & 1) << 2 | ((index >> (5 + shift)) & 1) << 1 | ((index >> shift) & 1);
+                if (!nodes[node].child[child]) {
+                    const int created = newNode(level + 1);
+                    nodes[node].child[child] = created;
+                }
+                node = nodes[node].child[child];
+            }
+        }
+
+        int leaves = (int)histogram.used().size();
+        for (int level = k_depth - 1; level >= 0 && leaves > maxColors; --level) {
+            auto& reducible = levels[level];
+            std::sort(reducible.begin(), reducible.end(), [&nodes](int a, int b) {
+                return nodes[a].sum.count < nodes[b].sum.count;
+            });
+            for (auto node : reducible) {
+                int children = 0;
+                for (int i = 0; i < 8; ++i) {
+                    children += nodes[node].child[i] != 0;
+                }
+                nodes[node].leaf = true;
+                leaves -= children - 1;
+                if (leaves <= maxColors) {
+                    break;
+                }
+            }
+        }
+
+        palette.clear();
+        std::vector<int> stack(1, 0);
+        while (!stack.empty()) {
+            const auto& node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.leaf) {
+                palette.push_back(cellMean(node.sum));
+                continue;
+            }
+            for (int i = 0; i < 8; ++i) {
+                if (node.child[i]) {
+                    stack.push_back(node.child[i]);
+                }
+            }
+        }
+    }
+};
+
+// Xiaolin Wu, "Efficient Statistical Computations for Optimal Color
+// Quantization", Graphics Gems II. Boxes of cells are cut where the sum of
+// the variances of the two halves is smallest, always cutting the box with
+// the largest variance.
+class WuQuantizer : public Quantizer {
+public:
+    const char* name() const override { return "wu"; }
+
+    void makePalette(const ColorHistogram& histogram, int maxColors, std::vector<RGBA>& palette) const override {
+        Moments m;
+        for (auto index : histogram.used()) {
+            const auto& cell = histogram.cell(index);
+            const int i = at((index >> 10) + 1, ((index >> 5) & 31) + 1, (index & 31) + 1);
+            m.wt[i] = (int64_t)cell.count;
+            m.mr[i] = (int64_t)cell.r;
+            m.mg[i] = (int64_t)cell.g;
+            m.mb[i] = (int64_t)cell.b;
+            m.m2[i] = (double)cell.squares;
+        }
+        m.accumulate();
+
+        std::vector<Box> boxes(std::max(maxColors, 1));
+        std::vector<double> variance(boxes.size(), 0.0);
+        boxes[0].r0 = boxes[0].g0 = boxes[0].b0 = 0;
+        boxes[0].r1 = boxes[0].g1 = boxes[0].b1 = 32;
+        int count = (int)boxes.size();
+        int next = 0;
+        for (int i = 1; i < count; ++i) {
+            if (cut(m, boxes[next], boxes[i])) {
+                variance[next] = boxes[next].volume() > 1 ? m.variance(boxes[next]) : 0.0;
+                variance[i] = boxes[i].volume() > 1 ? m.variance(boxes[i]) : 0.0;
+            } else {
+                // this box cannot be split
+                variance[next] = 0.0;
+                --i;
+            }
+            next = 0;
+            double largest = variance[0];
+            for (int k = 1; k <= i; ++k) {
+                if (variance[k] > largest) {
+                    largest = variance[k];
+                    next = k;
+                }
+            }
+            if (largest <= 0.0) {
+                count = i + 1;
+                break;
+            }
+        }
+
+        palette.clear();
+        for (int i = 0; i < count; ++i) {
+            const int64_t weight = volume(boxes[i], m.wt);
+            if (weight > 0) {
+                RGBA c;
+                c.r = (uint8_t)((volume(boxes[i], m.mr) + weight / 2) / weight);
+                c.g = (uint8_t)((volume(boxes[i], m.mg) + weight / 2) / weight);
+                c.b = (uint8_t)((volume(boxes[i], m.mb) + weight / 2) / weight);
+                c.a = 255;
+                palette.push_back(c);
+            }
+        }
+    }
+
+private:
+    static const int k_side = 33;
+
+    static int at(int r, int g, int b) { return (r * k_side + g) * k_side + b; }
+
+    // boxes are (r0, r1] x (g0, g1] x (b0, b1] in cell coordinates + 1
+    struct Box {
+        int r0, r1, g0, g1, b0, b1;
+        int volume() const { return (r1 - r0) * (g1 - g0) * (b1 - b0); }
+    };
+
+    enum Axis { Red, Green, Blue };
+
+    template <typename T>
+    static T volume(const Box& b, const std::vector<T>& m) {
+        return m[at(b.r1, b.g1, b.b1)] - m[at(b.r1, b.g1, b.b0)] - m[at(b.r1, b.g0, b.b1)] + m[at(b.r1, b.g0, b.b0)]
+            - m[at(b.r0, b.g1, b.b1)] + m[at(b.r0, b.g1, b.b0)] + m[at(b.r0, b.g0, b.b1)] - m[at(b.r0, b.g0, b.b0)];
+    }
+
+    // the part of volume() on the low side of the box along axis
+    static int64_t bottom(const Box& b, Axis axis, const std::vector<int64_t>& m) {
+        switch (axis) {
+            case Red:
+                return -m[at(b.r0, b.g1, b.b1)] + m[at(b.r0, b.g1, b.b0)] + m[at(b.r0, b.g0, b.b1)] - m[at(b.r0, b.g0, b.b0)];
+            case Green:
+                return -m[at(b.r1, b.g0, b.b1)] + m[at(b.r1, b.g0, b.b0)] + m[at(b.r0, b.g0, b.b1)] - m[at(b.r0, b.g0, b.b0)];
+            case Blue:
+                return -m[at(b.r1, b.g1, b.b0)] + m[at(b.r1, b.g0, b.b0)] + m[at(b.r0, b.g1, b.b0)] - m[at(b.r0, b.g0, b.b0)];
+        }
+        return 0;
+    }
+
+    // and the part with the box cut at position along axis
+    static int64_t top(const Box& b, Axis axis, int position, const std::vector<int64_t>& m) {
+        switch (axis) {
+            case Red:
+                return m[at(position, b.g1, b.b1)] - m[at(position, b.g1, b.b0)] - m[at(position, b.g0, b.b1)] + m[at(position, b.g0, b.b0)];
+            case Green:
+                return m[at(b.r1, position, b.b1)] - m[at(b.r1, position, b.b0)] - m[at(b.r0, position, b.b1)] + m[at(b.r0, position, b.b0)];
+            case Blue:
+                return m[at(b.r1, b.g1, position)] - m[at(b.r1, b.g0, position)] - m[at(b.r0, b.g1, position)] + m[at(b.r0, b.g0, position)];
+        }
+        return 0;
+    }
+
+    // cumulative moments of the cells: pixels, sums of the channels and of
+    // their squares
+    struct Moments {
+        std::vector<int64_t> wt, mr, mg, mb;
+        std::vector<double> m2;
+
+        Moments()
+        : wt(k_side * k_side * k_side, 0), mr(wt), mg(wt), mb(wt), m2(wt.size(), 0.0) {}
+
+        void accumulate() {
+            int64_t area[k_side], areaR[k_side], areaG[k_side], areaB[k_side];
+            double area2[k_side];
+            for (int r = 1; r < k_side; ++r) {
+                for (int i = 0; i < k_side; ++i) {
+                    area[i] = areaR[i] = areaG[i] = areaB[i] = 0;
+                    area2[i] = 0.0;
+                }
+                for (int g = 1; g < k_side; ++g) {
+                    int64_t line = 0, lineR = 0, lineG = 0, lineB = 0;
+                    double line2 = 0.0;
+                    for (int b = 1; b < k_side; ++b) {
+                        const int i = at(r, g, b);
+                        line += wt[i];
+                        lineR += mr[i];
+                        lineG += mg[i];
+                        lineB += mb[i];
+                        line2 += m2[i];
+                        area[b] += line;
+                        areaR[b] += lineR;
+                        areaG[b] += lineG;
+                        areaB[b] += lineB;
+                        area2[b] += line2;
+                        const int below = i - k_side * k_side;
+                        wt[i] = wt[below] + area[b];
+                        mr[i] = mr[below] + areaR[b];
+                        mg[i] = mg[below] + areaG[b];
+                        mb[i] = mb[below] + areaB[b];
+                        m2[i] = m2[below] + area2[b];
+                    }
+                }
+            }
+        }
+
+        double variance(const Box& b) const {
+            const double dr = (double)volume(b, mr);
+            const double dg = (double)volume(b, mg);
+            const double db = (double)volume(b, mb);
+            return volume(b, m2) - (dr * dr + dg * dg + db * db) / (double)volume(b, wt);
+        }
+    };
+
+    // Best cut of box along axis between first and last, in *cutAt, -1 if
+    // there is none; returns how much it leaves of the sum of squares.
+    static double maximize(const Moments& m, const Box& box, Axis axis, int first, int last, int* cutAt,
+                           int64_t wholeR, int64_t wholeG, int64_t wholeB, int64_t wholeW) {
+        const int64_t baseR = bottom(box, axis, m.mr);
+        const int64_t baseG = bottom(box, axis, m.mg);
+        const int64_t baseB = bottom(box, axis, m.mb);
+        const int64_t baseW = bottom(box, axis, m.wt);
+        double best = 0.0;
+        *cutAt = -1;
+        for (int i = first; i < last; ++i) {
+            int64_t halfR = baseR + top(box, axis, i, m.mr);
+            int64_t halfG = baseG + top(box, axis, i, m.mg);
+            int64_t halfB = baseB + top(box, axis, i, m.mb);
+            int64_t halfW = baseW + top(box, axis, i, m.wt);
+            if (halfW == 0) {
+                continue;
+            }
+            double value = ((double)halfR * halfR + (double)halfG * halfG + (double)halfB * halfB) / halfW;
+            halfR = wholeR - halfR;
+            halfG = wholeG - halfG;
+            halfB = wholeB - halfB;
+            halfW = wholeW - halfW;
+            if (halfW == 0) {
+                continue;
+            }
+            value += ((double)halfR * halfR + (double)halfG * halfG + (double)halfB * halfB) / halfW;
+            if (value > best) {
+                best = value;
+                *cutAt = i;
+            }
+        }
+        return best;
+    }
+
+    // Splits a into a and b; false if a cannot be split.
+    static bool cut(const Moments& m, Box& a, Box& b) {
+        const int64_t wholeR = volume(a, m.mr);
+        const int64_t wholeG = volume(a, m.mg);
+        const int64_t wholeB = volume(a, m.mb);
+        const int64_t wholeW = volume(a, m.wt);
+        int cutR, cutG, cutB;
+        const double maxR = maximize(m, a, Red, a.r0 + 1, a.r1, &cutR, wholeR, wholeG, wholeB, wholeW);
+        const double maxG = maximize(m, a, Green, a.g0 + 1, a.g1, &cutG, wholeR, wholeG, wholeB, wholeW);
+        const double maxB = maximize(m, a, Blue, a.b0 + 1, a.b1, &cutB, wholeR, wholeG, wholeB, wholeW);
+
+        b.r1 = a.r1;
+        b.g1 = a.g1;
+        b.b1 = a.b1;
+        if (maxR >= maxG && maxR >= maxB) {
+            if (cutR < 0) {
+                return false;
+            }
+            b.r0 = a.r1 = cutR;
+            b.g0 = a.g0;
+            b.b0 = a.b0;
+        } else if (maxG >= maxR && maxG >= maxB) {
+            b.g0 = a.g1 = cutG;
+            b.r0 = a.r0;
+            b.b0 = a.b0;
+        } else {
+            b.b0 = a.b1 = cutB;
+            b.r0 = a.r0;
+            b.g0 = a.g0;
+        }
+        return true;
+    }
+};
+
+std::unique_ptr<Quantizer> makeQuantizer(QuantizerKind kind) {
+    switch (kind) {
+        case QuantizerKind::MedianCut:
+            return std::unique_ptr<Quantizer>(new MedianCutQuantizer());
+        case QuantizerKind::Octree:
+            return std::unique_ptr<Quantizer>(new OctreeQuantizer());
+        case QuantizerKind::Wu:
+            return std::unique_ptr<Quantizer>(new WuQuantizer());
+    }
+    return nullptr;
+}
+
+void refinePalette(const ColorHistogram& histogram, int iterations, std::vector<RGBA>& palette) {
+    std::vector<ColorHistogram::Cell> sums;
+    for (int iteration = 0; iteration < iterations && !palette.empty(); ++iteration) {
+        sums.assign(palette.size(), ColorHistogram::Cell());
+        for (auto index : histogram.used()) {
+            const auto& cell = histogram.cell(index);
+            auto& sum = sums[nearestColor(palette, cellMean(cell))];
+            sum.count += cell.count;
+            sum.r += cell.r;
+            sum.g += cell.g;
+            sum.b += cell.b;
+        }
+        bool moved = false;
+        for (size_t i = 0; i < palette.size(); ++i) {
+            // a color no cell is nearest to stays where it is
+            if (sums[i].count) {
+                const RGBA c = cellMean(sums[i]);
+                moved = moved || c.r != palette[i].r || c.g != palette[i].g || c.b != palette[i].b;
+                palette[i] = c;
+            }
+        }
+        if (!moved) {
+            break;
+        }
+    }
+}
+
+bool quantize(const RGBA* pixels, size_t count, const QuantizeOptions& options, bool reserveTransparent, QuantizeResult& result) {
+    try {
+        ColorHistogram histogram;
+        histogram.add(pixels, count);
+        const bool transparent = reserveTransparent || histogram.pixels() < count;
+        const int maxColors = std::max(1, std::min(options.maxColors, transparent ? 255 : 256));
+
+        auto quantizer = makeQuantizer(options.kind);
+        quantizer->makePalette(histogram, maxColors, result.palette);
+        refinePalette(histogram, options.refineIterations, result.palette);
+        result.transparentIndex = transparent ? (int)result.palette.size() : -1;
+
+        // each cell maps to the color nearest to its mean
+        std::vector<uint8_t> table(ColorHistogram::k_cells);
+        for (auto index : histogram.used()) {
+            table[index] = (uint8_t)nearestColor(result.palette, cellMean(histogram.cell(index)));
+        }
+        result.indices.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const RGBA c = pixels[i];
+            result.indices[i] = c.a < 128 ? (uint8_t)result.transparentIndex : table[ColorHistogram::cellOf(c)];
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
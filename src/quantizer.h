@@ -0,0 +1,93 @@
+//
+//  quantizer.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef quantizer_h
+#define quantizer_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "rgba.h"
+
+enum class QuantizerKind {
+    MedianCut, // giflib's median cut, the fastest
+    Octree,    // merges the smallest branches of an octree of the colors
+    Wu,        // Wu's variance minimization, the best palettes for the time
+};
+
+// The opaque colors of an image in cells of 5 bits per channel, with the
+// pixel count and the sums of the exact colors of each cell. Pixels with
+// alpha below 128 are left out.
+class ColorHistogram {
+public:
+    static const int k_cells = 1 << 15;
+
+    struct Cell {
+        uint64_t count;
+        uint64_t r, g, b;
+        // sum of r*r + g*g + b*b
+        uint64_t squares;
+    };
+
+    ColorHistogram();
+
+    void clear();
+    void add(const RGBA* pixels, size_t count);
+
+    static int cellOf(RGBA c) { return (c.r >> 3) << 10 | (c.g >> 3) << 5 | c.b >> 3; }
+    const Cell& cell(int index) const { return _cells[index]; }
+    // the cells with pixels, in no particular order
+    const std::vector<uint16_t>& used() const { return _used; }
+    uint64_t pixels() const { return _pixels; }
+
+private:
+    std::vector<Cell> _cells;
+    std::vector<uint16_t> _used;
+    uint64_t _pixels;
+};
+
+// A palette building backend.
+class Quantizer {
+public:
+    virtual ~Quantizer() {}
+
+    virtual const char* name() const = 0;
+    // At most maxColors colors for the histogram, fewer if it has fewer.
+    virtual void makePalette(const ColorHistogram& histogram, int maxColors, std::vector<RGBA>& palette) const = 0;
+};
+
+std::unique_ptr<Quantizer> makeQuantizer(QuantizerKind kind);
+
+// Moves each color of the palette to the mean of the cells nearest to it,
+// iterations times: k-means, seeded by the palette.
+void refinePalette(const ColorHistogram& histogram, int iterations, std::vector<RGBA>& palette);
+
+struct QuantizeOptions {
+    QuantizerKind kind;
+    int maxColors;
+    // k-means passes over the palette of the backend, 0 for none
+    int refineIterations;
+
+    QuantizeOptions()
+    : kind(QuantizerKind::Wu), maxColors(256), refineIterations(0) {}
+};
+
+// A palette and the index of each pixel in it. Pixels with alpha below 128
+// get transparentIndex, which follows the palette; it is -1 if there are
+// none, unless the transparent index was asked for.
+struct QuantizeResult {
+    std::vector<RGBA> palette;
+    std::vector<uint8_t> indices;
+    int transparentIndex;
+};
+
+// Quantizes count pixels. With reserveTransparent the palette has room for
+// a transparent index even when no pixel is transparent.
+bool quantize(const RGBA* pixels, size_t count, const QuantizeOptions& options, bool reserveTransparent, QuantizeResult& result);
+
+#endif /* quantizer_h */
@@ -0,0 +1,229 @@
+//
+//  quantizer_bench.cpp
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#include "quantizer_bench.h"
+#include "quantizer.h"
+#include "dither.h"
+#include "gif_reader.h"
+#include "apng_reader.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+struct BenchImage {
+    int width, height;
+    std::vector<RGBA> pixels;
+};
+
+struct Lab {
+    float l, a, b;
+};
+
+static bool loadFrames(const char* name, std::vector<BenchImage>& images) {
+    auto onFrame = [&images](const Frame& frame) {
+        BenchImage image;
+        image.width = frame.width;
+        image.height = frame.height;
+        image.pixels.assign(frame.pixels, frame.pixels + (size_t)frame.width * frame.height);
+        images.push_back(std::move(image));
+        return true;
+    };
+    const size_t length = strlen(name);
+    if (length > 4 && strcasecmp(name + length - 4, ".gif") == 0) {
+        return readGIF(name, onFrame);
+    }
+    return readAPNG(name, onFrame);
+}
+
+// sRGB to CIE L*a*b* under D65
+static Lab toLab(RGBA c) {
+    static float linear[256];
+    static bool ready = false;
+    if (!ready) {
+        for (int i = 0; i < 256; ++i) {
+            const float v = i / 255.0f;
+            linear[i] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+        }
+        ready = true;
+    }
+    const float r = linear[c.r], g = linear[c.g], b = linear[c.b];
+    const float x = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f;
+    const float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    const float z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f;
+    auto f = [](float t) {
+        return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+    };
+    const float fx = f(x), fy = f(y), fz = f(z);
+    Lab lab;
+    lab.l = 116.0f * fy - 16.0f;
+    lab.a = 500.0f * (fx - fy);
+    lab.b = 200.0f * (fy - fz);
+    return lab;
+}
+
+static void loadCorpus(const char* const* names, int count, std::vector<BenchImage>& images) {
+    for (int i = 0; i < count; ++i) {
+        if (!loadFrames(names[i], images)) {
+            printf("bench: %s: cannot read\n", names[i]);
+        }
+    }
+}
+
+void benchmarkQuantizers(const char* const* names, int count, int colors) {
+    std::vector<BenchImage> images;
+    loadCorpus(names, count, images);
+    if (images.empty()) {
+        return;
+    }
+
+    struct Config {
+        QuantizerKind kind;
+        int refineIterations;
+    };
+    static const Config configs[] = {
+        { QuantizerKind::MedianCut, 0 },
+        { QuantizerKind::MedianCut, 4 },
+        { QuantizerKind::Octree, 0 },
+        { QuantizerKind::Octree, 4 },
+        { QuantizerKind::Wu, 0 },
+        { QuantizerKind::Wu, 4 },
+    };
+    printf("%zu images, %d colors\n", images.size(), colors);
+    printf("%-20s %10s %9s %8s\n", "quantizer", "ms", "PSNR dB", "mean dE");
+    for (const auto& config : configs) {
+        QuantizeOptions options;
+        options.kind = config.kind;
+        options.maxColors = colors;
+        options.refineIterations = config.refineIterations;
+
+        double ms = 0;
+        double squares = 0;
+        double deltaE = 0;
+        uint64_t pixels = 0;
+        QuantizeResult result;
+        for (const auto& image : images) {
+            const size_t size = image.pixels.size();
+            // the fastest of 3 runs
+            double best = 1e30;
+            for (int run = 0; run < 3; ++run) {
+                const auto start = std::chrono::steady_clock::now();
+                quantize(image.pixels.data(), size, options, false, result);
+                const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            ms += best;
+
+            std::vector<Lab> paletteLab;
+            for (const auto& c : result.palette) {
+                paletteLab.push_back(toLab(c));
+            }
+            for (size_t i = 0; i < size; ++i) {
+                const RGBA c = image.pixels[i];
+                if (c.a < 128) {
+                    continue;
+                }
+                const RGBA q = result.palette[result.indices[i]];
+                const int dr = c.r - q.r, dg = c.g - q.g, db = c.b - q.b;
+                squares += dr * dr + dg * dg + db * db;
+                const Lab a = toLab(c);
+                const Lab& b = paletteLab[result.indices[i]];
+                deltaE += sqrt((a.l - b.l) * (a.l - b.l) + (a.a - b.a) * (a.a - b.a) + (a.b - b.b) * (a.b - b.b));
+                ++pixels;
+            }
+        }
+        const double mse = pixels ? squares / (pixels * 3.0) : 0;
+        const double psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s", makeQuantizer(config.kind)->name(), config.refineIterations ? " + k-means" : "");
+        printf("%-20s %10.1f %9.2f %8.2f\n", name, ms, psnr, pixels ? deltaE / pixels : 0);
+    }
+}
+
+void benchmarkDithering(const char* const* names, int count, int colors) {
+    std::vector<BenchImage> images;
+    loadCorpus(names, count, images);
+    if (images.empty()) {
+        return;
+    }
+
+    QuantizeOptions options;
+    options.maxColors = colors;
+    std::vector<QuantizeResult> palettes(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        quantize(images[i].pixels.data(), images[i].pixels.size(), options, false, palettes[i]);
+    }
+
+    static const DitherMode modes[] = {
+        DitherMode::None,
+        DitherMode::FloydSteinberg,
+        DitherMode::SierraLite,
+        DitherMode::Bayer,
+        DitherMode::BlueNoise,
+    };
+    printf("%zu images, %d colors\n", images.size(), colors);
+    printf("%-20s %10s %9s %14s\n", "dither", "ms", "Mpixel/s", "blurred PSNR");
+    for (auto mode : modes) {
+        double ms = 0;
+        double squares = 0;
+        uint64_t pixels = 0;
+        uint64_t samples = 0;
+        PaletteMapper mapper;
+        mapper.setDither(mode);
+        std::vector<uint8_t> indices;
+        for (size_t n = 0; n < images.size(); ++n) {
+            const auto& image = images[n];
+            const auto& palette = palettes[n];
+            indices.resize(image.pixels.size());
+            mapper.setPalette(palette.palette.data(), (int)palette.palette.size(), palette.transparentIndex);
+            // the fastest of 3 runs
+            double best = 1e30;
+            for (int run = 0; run < 3; ++run) {
+                const auto start = std::chrono::steady_clock::now();
+                mapper.map(image.pixels.data(), image.width, image.height, (size_t)image.width * 4, indices.data());
+                const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            ms += best;
+            pixels += image.pixels.size();
+
+            // 3x3 neighbourhoods that are all opaque
+            const int w = image.width;
+            for (int y = 1; y + 1 < image.height; ++y) {
+                for (int x = 1; x + 1 < w; ++x) {
+                    int sums[2][3] = {};
+                    bool opaque = true;
+                    for (int dy = -1; dy <= 1 && opaque; ++dy) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            const size_t i = (size_t)(y + dy) * w + x + dx;
+                            const RGBA c = image.pixels[i];
+                            if (c.a < 128) {
+                                opaque = false;
+                                break;
+                            }
+                            const RGBA q = palette.palette[indices[i]];
+                            sums[0][0] += c.r, sums[0][1] += c.g, sums[0][2] += c.b;
+                            sums[1][0] += q.r, sums[1][1] += q.g, sums[1][2] += q.b;
+                        }
+                    }
+                    if (!opaque) {
+                        continue;
+                    }
+                    for (int k = 0; k < 3; ++k) {
+                        const double d = (sums[0][k] - sums[1][k]) / 9.0;
+                        squares += d * d;
+                    }
+                    samples += 3;
+                }
+            }
+        }
+        const double mse = samples ? squares / samples : 0;
+        const double psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+        printf("%-20s %10.1f %9.1f %14.2f\n", DitherModeString(mode), ms, ms > 0 ? pixels / ms / 1000 : 0, psnr);
+    }
+}
@@ -0,0 +1,23 @@
+//
+//  quantizer_bench.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef quantizer_bench_h
+#define quantizer_bench_h
+
+// Quantizes every frame of the named GIF and PNG files with each backend,
+// with and without k-means passes, and prints for each the time taken and
+// the quality of the opaque pixels: PSNR over RGB and the mean CIE76 color
+// difference. The Kodak set (http://r0k.us/graphics/kodak/) is the usual
+// corpus.
+void benchmarkQuantizers(const char* const* names, int count, int colors = 256);
+
+// Maps the frames to a Wu palette with each dithering mode and prints the
+// time taken and the PSNR of the opaque pixels after a 3x3 box blur, which
+// is about how the eye averages the dither pattern.
+void benchmarkDithering(const char* const* names, int count, int colors = 256);
+
+#endif /* quantizer_bench_h */
@@ -0,0 +1,19 @@
+//
+//  rgba.h
+//  images_op
+//
+//  Created by bianchui on 2026/10/19.
+//
+
+#ifndef rgba_h
+#define rgba_h
+
+#include <stdint.h>
+
+struct RGBA {
+    uint8_t r,g,b,a;
+};
+
+static const RGBA k_rgba_transparent = {0, 0, 0, 0};
+
+#endif /* rgba_h */